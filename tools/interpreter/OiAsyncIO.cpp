@@ -0,0 +1,292 @@
+//===-- OiAsyncIO.cpp - Asynchronous guest file I/O ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// One mutex guards the descriptor state and the worker queue. Workers drop
+// it while they wait on the disk. A descriptor is either reading, with a
+// ring of read-ahead chunks starting at the guest offset, or writing, with
+// the chunks still being written behind. Switching between the two finishes
+// the pending writes first.
+//
+//===----------------------------------------------------------------------===//
+
+#include "OiAsyncIO.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace llvm;
+
+OiAsyncIO::OiAsyncIO(unsigned NumThreads, size_t ChunkSize, unsigned Depth)
+  : ChunkSize(std::max<size_t>(ChunkSize, 4096)),
+    Depth(std::max(Depth, 1U)), Stopping(false) {
+  for (unsigned i = 0; i < std::max(NumThreads, 1U); ++i)
+    Workers.push_back(std::thread([this] { work(); }));
+}
+
+OiAsyncIO::~OiAsyncIO() {
+  syncAll();
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Stopping = true;
+  }
+  QueueCond.notify_all();
+  for (std::thread &T : Workers)
+    T.join();
+}
+
+void OiAsyncIO::work() {
+  std::unique_lock<std::mutex> Guard(Lock);
+  for (;;) {
+    QueueCond.wait(Guard, [this] { return Stopping || !Queue.empty(); });
+    if (Queue.empty())
+      return;
+    std::function<void()> Task = std::move(Queue.front());
+    Queue.pop_front();
+    Guard.unlock();
+    Task();
+    Guard.lock();
+  }
+}
+
+// Lock must be held
+void OiAsyncIO::enqueue(std::function<void()> Task) {
+  Queue.push_back(std::move(Task));
+  QueueCond.notify_one();
+}
+
+// Lock must be held. Returns null if the host should service the call.
+OiAsyncIO::Stream *OiAsyncIO::getStream(int Fd, bool ForWrite) {
+  std::map<int, Stream>::iterator I = Streams.find(Fd);
+  if (I == Streams.end()) {
+    struct stat St;
+    int Flags = fcntl(Fd, F_GETFL);
+    // Let the host report descriptors that are not open
+    if (Flags == -1 || fstat(Fd, &St) != 0)
+      return nullptr;
+    Stream &S = Streams[Fd];
+    S.Mode = Stream::Unused;
+    S.Offset = 0;
+    S.AccessMode = Flags & O_ACCMODE;
+    S.WriteError = 0;
+    // Appends go wherever the end of the file is at the time
+    if (!S_ISREG(St.st_mode) || (Flags & O_APPEND))
+      S.Mode = Stream::Bypass;
+    I = Streams.find(Fd);
+  }
+  Stream &S = I->second;
+  if (S.Mode == Stream::Bypass ||
+      S.AccessMode == (ForWrite ? O_RDONLY : O_WRONLY))
+    return nullptr;
+  return &S;
+}
+
+// Wait for the writes pending on S and drop its chunks. Lock must be held.
+void OiAsyncIO::finish(int Fd, Stream &S,
+                       std::unique_lock<std::mutex> &Guard) {
+  if (S.Mode == Stream::Writing) {
+    Done.wait(Guard, [&S] {
+      for (const std::shared_ptr<Chunk> &C : S.Chunks)
+        if (!C->Ready)
+          return false;
+      return true;
+    });
+    if (S.WriteError) {
+      errs() << "oii: warning: write-behind on descriptor " << Fd
+             << " failed: " << strerror(S.WriteError) << "\n";
+      S.WriteError = 0;
+    }
+  }
+  // Reads still in flight own their chunk and only touch it
+  S.Chunks.clear();
+}
+
+// Lock must be held. Returns false if Fd should be left to the host.
+bool OiAsyncIO::switchMode(int Fd, Stream &S, bool Writing,
+                           std::unique_lock<std::mutex> &Guard) {
+  Stream::ModeKind Mode = Writing ? Stream::Writing : Stream::Reading;
+  if (S.Mode == Mode)
+    return true;
+  if (S.Mode == Stream::Unused) {
+    S.Offset = lseek(Fd, 0, SEEK_CUR);
+    if (S.Offset == (off_t) -1) {
+      S.Mode = Stream::Bypass;
+      return false;
+    }
+  } else {
+    finish(Fd, S, Guard);
+  }
+  S.Mode = Mode;
+  return true;
+}
+
+// Keep Depth chunks in flight after the guest offset. Lock must be held.
+void OiAsyncIO::fillReadAhead(int Fd, Stream &S) {
+  off_t Next = S.Chunks.empty() ? S.Offset : S.Chunks.back()->Offset +
+                                                 (off_t) ChunkSize;
+  while (S.Chunks.size() < Depth) {
+    std::shared_ptr<Chunk> C = std::make_shared<Chunk>();
+    C->Offset = Next;
+    C->Data.resize(ChunkSize);
+    C->Len = 0;
+    C->Error = 0;
+    C->Ready = false;
+    S.Chunks.push_back(C);
+    enqueue([this, Fd, C] {
+      ssize_t Len = pread(Fd, &C->Data[0], C->Data.size(), C->Offset);
+      int Error = errno;
+      std::lock_guard<std::mutex> Guard(Lock);
+      C->Len = Len;
+      C->Error = Error;
+      C->Ready = true;
+      Done.notify_all();
+    });
+    Next += ChunkSize;
+  }
+}
+
+bool OiAsyncIO::read(int Fd, void *Buf, size_t Count, ssize_t &Result) {
+  std::unique_lock<std::mutex> Guard(Lock);
+  Stream *S = getStream(Fd, false);
+  if (!S || !switchMode(Fd, *S, false, Guard))
+    return false;
+
+  char *Out = static_cast<char *>(Buf);
+  size_t Copied = 0;
+  Result = 0;
+  while (Copied < Count) {
+    fillReadAhead(Fd, *S);
+    std::shared_ptr<Chunk> C = S->Chunks.front();
+    Done.wait(Guard, [&C] { return C->Ready; });
+    if (C->Len < 0) {
+      // Fail like the host read would, unless data came before the error
+      S->Chunks.clear();
+      if (Copied == 0) {
+        errno = C->Error;
+        Result = -1;
+      }
+      break;
+    }
+    size_t Skip = S->Offset - C->Offset;
+    size_t N = std::min<size_t>(C->Len - Skip, Count - Copied);
+    memcpy(Out + Copied, &C->Data[Skip], N);
+    Copied += N;
+    S->Offset += N;
+    if (Skip + N < (size_t) C->Len)
+      continue;
+    S->Chunks.pop_front();
+    // A short chunk is the end of the file; look again on the next read
+    if ((size_t) C->Len < ChunkSize) {
+      S->Chunks.clear();
+      break;
+    }
+  }
+  if (Result == 0)
+    Result = Copied;
+  lseek(Fd, S->Offset, SEEK_SET);
+  return true;
+}
+
+bool OiAsyncIO::write(int Fd, const void *Buf, size_t Count,
+                      ssize_t &Result) {
+  std::unique_lock<std::mutex> Guard(Lock);
+  Stream *S = getStream(Fd, true);
+  if (!S || !switchMode(Fd, *S, true, Guard))
+    return false;
+
+  // Retire finished writes and keep at most Depth in flight
+  for (;;) {
+    while (!S->Chunks.empty() && S->Chunks.front()->Ready)
+      S->Chunks.pop_front();
+    if (S->Chunks.size() < Depth)
+      break;
+    Done.wait(Guard);
+  }
+  if (S->WriteError) {
+    errno = S->WriteError;
+    S->WriteError = 0;
+    Result = -1;
+    return true;
+  }
+  Result = Count;
+  if (Count == 0)
+    return true;
+
+  const char *In = static_cast<const char *>(Buf);
+  std::shared_ptr<Chunk> C = std::make_shared<Chunk>();
+  C->Offset = S->Offset;
+  C->Data.assign(In, In + Count);
+  C->Len = Count;
+  C->Error = 0;
+  C->Ready = false;
+  S->Chunks.push_back(C);
+  S->Offset += Count;
+  // S outlives the write: finish() waits for it before S goes away
+  enqueue([this, Fd, C, S] {
+    size_t Written = 0;
+    int Error = 0;
+    while (Written < C->Data.size()) {
+      ssize_t N = pwrite(Fd, &C->Data[Written], C->Data.size() - Written,
+                         C->Offset + Written);
+      if (N < 0 && errno == EINTR)
+        continue;
+      if (N <= 0) {
+        Error = N < 0 ? errno : EIO;
+        break;
+      }
+      Written += N;
+    }
+    std::lock_guard<std::mutex> Guard(Lock);
+    if (Error)
+      S->WriteError = Error;
+    C->Ready = true;
+    Done.notify_all();
+  });
+  lseek(Fd, S->Offset, SEEK_SET);
+  return true;
+}
+
+void OiAsyncIO::sync(int Fd) {
+  std::unique_lock<std::mutex> Guard(Lock);
+  std::map<int, Stream>::iterator I = Streams.find(Fd);
+  if (I == Streams.end() || I->second.Mode == Stream::Bypass)
+    return;
+  finish(Fd, I->second, Guard);
+  Streams.erase(I);
+}
+
+void OiAsyncIO::exclude(int Fd) {
+  std::unique_lock<std::mutex> Guard(Lock);
+  Stream &S = Streams[Fd];
+  if (S.Mode != Stream::Bypass)
+    finish(Fd, S, Guard);
+  S.Mode = Stream::Bypass;
+}
+
+void OiAsyncIO::close(int Fd) {
+  std::unique_lock<std::mutex> Guard(Lock);
+  std::map<int, Stream>::iterator I = Streams.find(Fd);
+  if (I == Streams.end())
+    return;
+  finish(Fd, I->second, Guard);
+  Streams.erase(I);
+}
+
+void OiAsyncIO::syncAll() {
+  std::unique_lock<std::mutex> Guard(Lock);
+  // finish() may drop the lock, so look the next descriptor up each time
+  while (!Streams.empty()) {
+    int Fd = Streams.begin()->first;
+    finish(Fd, Streams.begin()->second, Guard);
+    Streams.erase(Fd);
+  }
+}
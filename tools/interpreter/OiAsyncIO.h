@@ -0,0 +1,101 @@
+//=== OiAsyncIO.h - Asynchronous guest file I/O -*- C++ -*-==//
+//
+// Services guest read and write syscalls on regular files with a pool of
+// host I/O threads, so the interpreter keeps running guest code while the
+// disk works. Reads are served from a ring of read-ahead chunks fetched
+// with pread; writes are copied and written behind with pwrite. The host
+// file offset is kept where the guest expects it after every call.
+//
+// Pending I/O on a descriptor completes before any other syscall uses it
+// (see sync()). Files are assumed not to change behind the guest's back
+// while it streams them, and a failed write-behind is reported on the
+// descriptor's next write.
+//
+//===------------------------------------------------------------===//
+
+#ifndef OIASYNCIO_H
+#define OIASYNCIO_H
+
+#include "llvm/Support/DataTypes.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+namespace llvm {
+
+class OiAsyncIO {
+public:
+  // ChunkSize bytes are read ahead or written behind per host request, with
+  // up to Depth requests in flight per descriptor.
+  OiAsyncIO(unsigned NumThreads, size_t ChunkSize, unsigned Depth);
+  ~OiAsyncIO();
+
+  // Emulate read/write on Fd. Return false, doing nothing, if Fd is not a
+  // regular file this class handles; Result is the syscall result
+  // otherwise.
+  bool read(int Fd, void *Buf, size_t Count, ssize_t &Result);
+  bool write(int Fd, const void *Buf, size_t Count, ssize_t &Result);
+
+  // Finish the pending writes on Fd and drop its read-ahead, before
+  // another syscall uses it.
+  void sync(int Fd);
+
+  // Stop handling Fd until it is closed, for descriptors that share their
+  // offset with another one (dup).
+  void exclude(int Fd);
+
+  // Forget Fd, after finishing its pending writes, when the guest closes
+  // it.
+  void close(int Fd);
+
+  // sync() every descriptor, before the guest exits or forks
+  void syncAll();
+
+private:
+  struct Chunk {
+    off_t Offset;
+    std::vector<char> Data;
+    ssize_t Len;
+    int Error;
+    bool Ready;
+  };
+
+  struct Stream {
+    enum ModeKind { Unused, Reading, Writing, Bypass } Mode;
+    // Where the guest believes the descriptor offset is
+    off_t Offset;
+    // Read-ahead chunks in file order, or pending writes
+    std::deque<std::shared_ptr<Chunk> > Chunks;
+    int AccessMode;
+    int WriteError;
+  };
+
+  size_t ChunkSize;
+  unsigned Depth;
+  std::mutex Lock;
+  std::condition_variable Done;
+  std::map<int, Stream> Streams;
+
+  std::vector<std::thread> Workers;
+  std::deque<std::function<void()> > Queue;
+  std::condition_variable QueueCond;
+  bool Stopping;
+
+  Stream *getStream(int Fd, bool ForWrite);
+  bool switchMode(int Fd, Stream &S, bool Writing,
+                  std::unique_lock<std::mutex> &Guard);
+  void finish(int Fd, Stream &S, std::unique_lock<std::mutex> &Guard);
+  void fillReadAhead(int Fd, Stream &S);
+  void enqueue(std::function<void()> Task);
+  void work();
+};
+
+} // end namespace llvm
+
+#endif
@@ -0,0 +1,176 @@
+//===-- OiCacheModel.cpp - Guest data cache and TLB model ------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Accesses that straddle a line or page boundary are looked up once per
+// line or page they touch, and count as one miss if any lookup misses.
+// Accesses are attributed to the closest symbol at or below their PC.
+//
+//===----------------------------------------------------------------------===//
+
+#include "OiCacheModel.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+
+using namespace llvm;
+
+OiSetAssocArray::OiSetAssocArray(uint64_t Size, unsigned Assoc,
+                                 unsigned BlockSize)
+  : Assoc(Assoc), BlockBits(Log2_32(BlockSize)),
+    SetMask(Size / BlockSize / Assoc - 1), Clock(0),
+    Ways(Size / BlockSize) {
+  for (Way &W : Ways) {
+    W.Tag = 0;
+    W.Valid = false;
+    W.LastUse = 0;
+  }
+}
+
+bool OiSetAssocArray::access(uint32_t Addr) {
+  uint32_t Block = Addr >> BlockBits;
+  Way *Set = &Ways[(Block & SetMask) * Assoc];
+  Way *Victim = Set;
+  ++Clock;
+  for (unsigned i = 0; i < Assoc; ++i) {
+    if (Set[i].Valid && Set[i].Tag == Block) {
+      Set[i].LastUse = Clock;
+      return true;
+    }
+    // Invalid ways have LastUse 0 and are filled first
+    if (Set[i].LastUse < Victim->LastUse)
+      Victim = &Set[i];
+  }
+  Victim->Tag = Block;
+  Victim->Valid = true;
+  Victim->LastUse = Clock;
+  return false;
+}
+
+std::string OiCacheModel::validate(const Config &C) {
+  if (!isPowerOf2_64(C.CacheSize) || !isPowerOf2_32(C.CacheAssoc) ||
+      !isPowerOf2_32(C.LineSize))
+    return "cache size, associativity and line size must be powers of two";
+  if ((uint64_t) C.CacheAssoc * C.LineSize > C.CacheSize)
+    return "cache is smaller than one set";
+  if (!isPowerOf2_32(C.TLBEntries) || !isPowerOf2_32(C.TLBAssoc) ||
+      !isPowerOf2_32(C.PageSize))
+    return "TLB entries, associativity and page size must be powers of two";
+  if (C.TLBAssoc > C.TLBEntries)
+    return "TLB associativity exceeds its number of entries";
+  return "";
+}
+
+OiCacheModel::OiCacheModel(
+    const Config &C,
+    const std::vector<std::pair<uint64_t, StringRef> > &Syms)
+  : Conf(C), Cache(C.CacheSize, C.CacheAssoc, C.LineSize),
+    TLB((uint64_t) C.TLBEntries * C.PageSize, C.TLBAssoc, C.PageSize),
+    LastStart(1), LastEnd(0), LastStats(nullptr) {
+  for (const auto &S : Syms)
+    Symbols.push_back(std::make_pair(S.first, S.second.str()));
+  FuncStats.resize(Symbols.size());
+}
+
+OiCacheModel::Stats &OiCacheModel::statsFor(uint32_t PC) {
+  if (PC >= LastStart && PC < LastEnd)
+    return *LastStats;
+  auto It = std::upper_bound(
+      Symbols.begin(), Symbols.end(), (uint64_t) PC,
+      [](uint64_t A, const std::pair<uint64_t, std::string> &S) {
+        return A < S.first;
+      });
+  LastEnd = It == Symbols.end() ? ~0ULL : It->first;
+  if (It == Symbols.begin()) {
+    LastStart = 0;
+    LastStats = &Unknown;
+  } else {
+    LastStart = (It - 1)->first;
+    LastStats = &FuncStats[(It - Symbols.begin()) - 1];
+  }
+  return *LastStats;
+}
+
+void OiCacheModel::memAccess(uint32_t PC, uint32_t Addr, unsigned Size,
+                             bool IsStore) {
+  Stats &S = statsFor(PC);
+  if (IsStore)
+    ++S.Stores;
+  else
+    ++S.Loads;
+
+  // Accesses that run past the 4 GiB guest address space stop at its end
+  uint64_t Last = std::min<uint64_t>((uint64_t)Addr + Size - 1, UINT32_MAX);
+  bool CacheHit = true, TLBHit = true;
+  unsigned LineBits = Cache.blockBits(), PageBits = TLB.blockBits();
+  for (uint64_t L = Addr >> LineBits; L <= Last >> LineBits; ++L)
+    CacheHit &= Cache.access(L << LineBits);
+  for (uint64_t P = Addr >> PageBits; P <= Last >> PageBits; ++P)
+    TLBHit &= TLB.access(P << PageBits);
+  S.CacheMisses += !CacheHit;
+  S.TLBMisses += !TLBHit;
+}
+
+static void PrintStats(raw_ostream &OS, StringRef Name, uint64_t Loads,
+                       uint64_t Stores, uint64_t CacheMisses,
+                       uint64_t TLBMisses) {
+  uint64_t Accesses = Loads + Stores;
+  double Scale = Accesses ? 100.0 / Accesses : 0.0;
+  OS << format("%-32s %12" PRIu64 " %12" PRIu64, Name.str().c_str(), Loads,
+               Stores)
+     << format(" %12" PRIu64 " %7.2f%%", CacheMisses, CacheMisses * Scale)
+     << format(" %12" PRIu64 " %7.2f%%\n", TLBMisses, TLBMisses * Scale);
+}
+
+bool OiCacheModel::write(StringRef Filename, StringRef Binary) {
+  std::error_code EC;
+  raw_fd_ostream OS(Filename, EC, sys::fs::F_Text);
+  if (EC) {
+    errs() << "oii: cannot write cache report '" << Filename << "': "
+           << EC.message() << "\n";
+    return false;
+  }
+
+  OS << "binary: " << Binary << "\n"
+     << "cache: " << Conf.CacheSize << " bytes, " << Conf.CacheAssoc
+     << "-way, " << Conf.LineSize << "-byte lines\n"
+     << "tlb: " << Conf.TLBEntries << " entries, " << Conf.TLBAssoc
+     << "-way, " << Conf.PageSize << "-byte pages\n\n";
+  OS << "function                                "
+        "loads       stores   cache-miss     rate     tlb-miss     rate\n";
+
+  // Busiest functions first
+  std::vector<unsigned> Order;
+  for (unsigned i = 0, e = FuncStats.size(); i != e; ++i)
+    if (FuncStats[i].Loads + FuncStats[i].Stores != 0)
+      Order.push_back(i);
+  std::stable_sort(Order.begin(), Order.end(), [this](unsigned A,
+                                                      unsigned B) {
+    return FuncStats[A].Loads + FuncStats[A].Stores >
+           FuncStats[B].Loads + FuncStats[B].Stores;
+  });
+
+  Stats Total = Unknown;
+  for (unsigned i : Order) {
+    const Stats &S = FuncStats[i];
+    PrintStats(OS, Symbols[i].second, S.Loads, S.Stores, S.CacheMisses,
+               S.TLBMisses);
+    Total.Loads += S.Loads;
+    Total.Stores += S.Stores;
+    Total.CacheMisses += S.CacheMisses;
+    Total.TLBMisses += S.TLBMisses;
+  }
+  if (Unknown.Loads + Unknown.Stores != 0)
+    PrintStats(OS, "<unknown>", Unknown.Loads, Unknown.Stores,
+               Unknown.CacheMisses, Unknown.TLBMisses);
+  PrintStats(OS, "<total>", Total.Loads, Total.Stores, Total.CacheMisses,
+             Total.TLBMisses);
+  return !OS.has_error();
+}
@@ -0,0 +1,91 @@
+//=== OiCacheModel.h - Guest data cache and TLB model -*- C++ -*-==//
+//
+// A memory listener that runs every guest data access through a
+// set-associative data cache and TLB with LRU replacement, and counts hits
+// and misses per guest function. Stores allocate lines like loads. The
+// model only counts; it does not change how the guest runs.
+//
+//===------------------------------------------------------------===//
+
+#ifndef OICACHEMODEL_H
+#define OICACHEMODEL_H
+
+#include "OiMemListener.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+
+// Tags of a set-associative array with LRU replacement, indexed by
+// Addr >> BlockBits
+class OiSetAssocArray {
+public:
+  // Size and BlockSize in bytes; both and Assoc must be powers of two
+  OiSetAssocArray(uint64_t Size, unsigned Assoc, unsigned BlockSize);
+
+  // Look up the block holding Addr, filling it on a miss. Returns true on
+  // a hit.
+  bool access(uint32_t Addr);
+
+  unsigned blockBits() const { return BlockBits; }
+
+private:
+  struct Way {
+    uint32_t Tag;
+    bool Valid;
+    uint64_t LastUse;
+  };
+
+  unsigned Assoc;
+  unsigned BlockBits;
+  uint32_t SetMask;
+  uint64_t Clock;
+  std::vector<Way> Ways;
+};
+
+class OiCacheModel : public OiMemListener {
+public:
+  struct Config {
+    uint64_t CacheSize;
+    unsigned CacheAssoc, LineSize;
+    unsigned TLBEntries, TLBAssoc, PageSize;
+  };
+
+  // Returns an error message if C does not describe valid geometries
+  static std::string validate(const Config &C);
+
+  OiCacheModel(const Config &C,
+               const std::vector<std::pair<uint64_t, StringRef> > &Symbols);
+
+  void memAccess(uint32_t PC, uint32_t Addr, unsigned Size,
+                 bool IsStore) override;
+
+  // Write a per-function report. Returns false on I/O errors.
+  bool write(StringRef Filename, StringRef Binary);
+
+private:
+  struct Stats {
+    Stats() : Loads(0), Stores(0), CacheMisses(0), TLBMisses(0) {}
+    uint64_t Loads, Stores;
+    uint64_t CacheMisses, TLBMisses;
+  };
+
+  Stats &statsFor(uint32_t PC);
+
+  Config Conf;
+  OiSetAssocArray Cache, TLB;
+  // Sorted by address; PCs below the first symbol go to Unknown
+  std::vector<std::pair<uint64_t, std::string> > Symbols;
+  std::vector<Stats> FuncStats;
+  Stats Unknown;
+  // Range of the function the last access came from
+  uint64_t LastStart, LastEnd;
+  Stats *LastStats;
+};
+
+} // end namespace llvm
+
+#endif
@@ -0,0 +1,148 @@
+//===-- OiCoSim.cpp - Co-simulation against static-bt output ---===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The stream is written by tools/static-bt/runtime/oi-cosim.c: the magic
+// "OICOSIM\0", a u32 version, u32 count and count x (u32 length, name),
+// then one record per translated function entry. Everything is in host
+// byte order, as both sides are expected to run on the same host.
+//
+//===----------------------------------------------------------------------===//
+
+#include "OiCoSim.h"
+#include "OiMachineModel.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <errno.h>
+#include <string.h>
+
+using namespace llvm;
+
+namespace {
+
+const char CoSimMagic[8] = { 'O', 'I', 'C', 'O', 'S', 'I', 'M', 0 };
+const uint32_t CoSimVersion = 1;
+
+} // end anonymous namespace
+
+OiCoSim::OiCoSim(StringRef Filename, uint32_t IgnoreMask)
+  : In(nullptr), Filename(Filename), IgnoreMask(IgnoreMask), NumRecords(0),
+    LastAgreed(0), LastIndex(~0U) {
+  FILE *F = fopen(this->Filename.c_str(), "rb");
+  if (!F) {
+    errs() << "oii: cannot open co-simulation stream '" << Filename << "': "
+           << strerror(errno) << "\n";
+    return;
+  }
+  char Magic[sizeof(CoSimMagic)];
+  uint32_t Version, Count;
+  if (fread(Magic, sizeof(Magic), 1, F) != 1 ||
+      memcmp(Magic, CoSimMagic, sizeof(Magic)) != 0 ||
+      fread(&Version, sizeof(Version), 1, F) != 1 ||
+      Version != CoSimVersion || fread(&Count, sizeof(Count), 1, F) != 1) {
+    errs() << "oii: '" << Filename
+           << "' is not a co-simulation stream of this version\n";
+    fclose(F);
+    return;
+  }
+  for (uint32_t i = 0; i < Count; ++i) {
+    uint32_t Len;
+    std::string Name;
+    if (fread(&Len, sizeof(Len), 1, F) == 1) {
+      Name.resize(Len);
+      if (Len == 0 || fread(&Name[0], Len, 1, F) == 1) {
+        Indexes.insert(std::make_pair(Name, i));
+        Names.push_back(Name);
+        continue;
+      }
+    }
+    errs() << "oii: co-simulation stream '" << Filename << "' is truncated\n";
+    fclose(F);
+    return;
+  }
+  In = F;
+}
+
+OiCoSim::~OiCoSim() {
+  if (In)
+    fclose(In);
+}
+
+int OiCoSim::lookup(StringRef Name) const {
+  StringMap<uint32_t>::const_iterator I = Indexes.find(Name);
+  return I == Indexes.end() ? -1 : (int) I->second;
+}
+
+bool OiCoSim::check(uint32_t Index, const OiMachineModel &MM,
+                    uint64_t NumInsts) {
+  raw_ostream &OS = errs();
+  Record R;
+  if (fread(&R, sizeof(R), 1, In) != 1) {
+    OS << "oii: co-simulation: translated program ended before "
+       << Names[Index] << " was entered, after " << NumInsts
+       << " interpreted instructions\n";
+    return false;
+  }
+  ++NumRecords;
+
+  bool Diverged = false;
+  if (R.Index != Index) {
+    OS << "oii: co-simulation: control flow diverged: interpreter entered "
+       << Names[Index] << ", translated program entered "
+       << (R.Index < Names.size() ? StringRef(Names[R.Index])
+                                  : StringRef("<invalid>"))
+       << "\n";
+    Diverged = true;
+  } else {
+    for (unsigned i = 1; i < 32; ++i) {
+      if ((IgnoreMask >> i) & 1 || MM.Bank[i] == R.Bank[i])
+        continue;
+      OS << "oii: co-simulation: r" << i << " diverged entering "
+         << Names[Index] << ": interpreter "
+         << format("0x%08" PRIx32, MM.Bank[i]) << ", translated "
+         << format("0x%08" PRIx32, R.Bank[i]) << "\n";
+      Diverged = true;
+      break;
+    }
+    if (!Diverged && (MM.Hi != R.Hi || MM.Lo != R.Lo)) {
+      OS << "oii: co-simulation: hi/lo diverged entering " << Names[Index]
+         << ": interpreter " << format("0x%08" PRIx32 "/0x%08" PRIx32,
+                                       MM.Hi, MM.Lo)
+         << ", translated " << format("0x%08" PRIx32 "/0x%08" PRIx32,
+                                      R.Hi, R.Lo)
+         << "\n";
+      Diverged = true;
+    }
+  }
+  if (!Diverged) {
+    LastAgreed = NumRecords;
+    LastIndex = Index;
+    return true;
+  }
+
+  OS << "  at function entry " << NumRecords << ", after " << NumInsts
+     << " interpreted instructions\n";
+  if (LastIndex != ~0U)
+    OS << "  last agreement: entry " << LastAgreed << " ("
+       << Names[LastIndex] << ")\n";
+  else
+    OS << "  no earlier function entry agreed\n";
+  return false;
+}
+
+bool OiCoSim::finish(uint64_t NumInsts) {
+  Record R;
+  if (fread(&R, sizeof(R), 1, In) != 1)
+    return true;
+  errs() << "oii: co-simulation: interpreted program ended after " << NumInsts
+         << " instructions, but the translated program went on to enter "
+         << (R.Index < Names.size() ? StringRef(Names[R.Index])
+                                    : StringRef("<invalid>"))
+         << "\n";
+  return false;
+}
@@ -0,0 +1,70 @@
+//=== OiCoSim.h - Co-simulation against static-bt output -*- C++ -*-==//
+//
+// Checks the interpreter against a program translated by static-bt
+// -cosim. The translated program, linked with
+// tools/static-bt/runtime/oi-cosim.c, reports the guest registers at every
+// function entry. The interpreter reads those records in lockstep (a FIFO
+// works) and compares them with its own state when it enters the same
+// functions, stopping at the first control flow or register divergence.
+//
+// Memory is not compared: static-bt lays out the relocatable object in a
+// shadow image while oii runs the linked executable, so addresses, and
+// registers holding them, legitimately differ. Such registers can be
+// excluded with a mask.
+//
+//===------------------------------------------------------------===//
+
+#ifndef OICOSIM_H
+#define OICOSIM_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+class OiMachineModel;
+
+class OiCoSim {
+public:
+  // Open the stream and read its symbol table. Bit N of IgnoreMask excludes
+  // Bank[N] from comparisons. Check valid() for errors.
+  OiCoSim(StringRef Filename, uint32_t IgnoreMask);
+  ~OiCoSim();
+
+  bool valid() const { return In != nullptr; }
+
+  // Index of the function called Name in the translated program, or -1
+  int lookup(StringRef Name) const;
+
+  // Compare MM, entering function Index, against the next record. Prints
+  // the divergence and returns false on mismatch.
+  bool check(uint32_t Index, const OiMachineModel &MM, uint64_t NumInsts);
+
+  // Called when the interpreted program ends. Returns false, after
+  // reporting it, if the translated program entered more functions.
+  bool finish(uint64_t NumInsts);
+
+private:
+  struct Record {
+    uint32_t Index;
+    uint32_t Bank[32];
+    uint32_t Hi, Lo;
+  };
+
+  FILE *In;
+  std::string Filename;
+  uint32_t IgnoreMask;
+  std::vector<std::string> Names;
+  StringMap<uint32_t> Indexes;
+  uint64_t NumRecords;
+  uint64_t LastAgreed;
+  uint32_t LastIndex;
+};
+
+} // end namespace llvm
+
+#endif
@@ -0,0 +1,387 @@
+//===-- OiDecodeCache.cpp - Predecoded instruction cache -------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Decodes OpenISA instructions once and binds them to specialized handlers.
+// Opcodes without a specialized handler (or instructions with unusual
+// operands) fall back to OiMachineModel::executeInstruction.
+//
+//===----------------------------------------------------------------------===//
+
+#include "OiDecodeCache.h"
+#include "OiMachineModel.h"
+#include "InterpUtils.h"
+#include "../lib/Target/Mips/MipsInstrInfo.h"
+#include "llvm/MC/MCDisassembler.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+extern cl::opt<int32_t> Verbosity;
+
+namespace {
+
+inline uint32_t Src(OiMachineModel *MM, const OiDecodedInst *DI, unsigned i) {
+  return DI->isReg(i) ? MM->Bank[DI->Ops[i]] : DI->Ops[i];
+}
+
+inline uint8_t *Addr(OiMachineModel *MM, const OiDecodedInst *DI) {
+  return &MM->Mem->memory[MM->Bank[DI->Ops[1]] + DI->Ops[2]];
+}
+
+uint64_t HandleGeneric(OiMachineModel *MM, const OiDecodedInst *DI,
+                       uint64_t CurPC) {
+  return MM->executeInstruction(&DI->Inst, CurPC);
+}
+
+#define ALU_HANDLER(name, type, expr)                                    \
+  uint64_t name(OiMachineModel *MM, const OiDecodedInst *DI,             \
+                uint64_t CurPC) {                                        \
+    type o1 = Src(MM, DI, 1);                                            \
+    type o2 = Src(MM, DI, 2);                                            \
+    MM->Bank[DI->Ops[0]] = (expr);                                       \
+    return CurPC + 8;                                                    \
+  }
+
+ALU_HANDLER(HandleADD, uint32_t, o1 + o2)
+ALU_HANDLER(HandleSUB, uint32_t, o1 - o2)
+ALU_HANDLER(HandleOR, uint32_t, o1 | o2)
+ALU_HANDLER(HandleNOR, uint32_t, ~(o1 | o2))
+ALU_HANDLER(HandleAND, uint32_t, o1 & o2)
+ALU_HANDLER(HandleXOR, uint32_t, o1 ^ o2)
+ALU_HANDLER(HandleSLTu, uint32_t, o1 < o2)
+ALU_HANDLER(HandleSLT, int32_t, o1 < o2)
+ALU_HANDLER(HandleSLL, uint32_t, o1 << o2)
+ALU_HANDLER(HandleSRL, uint32_t, o1 >> o2)
+//XXX: SRLV is decoded with operands inverted!
+ALU_HANDLER(HandleSRLV, uint32_t, o2 >> o1)
+ALU_HANDLER(HandleSRA, int32_t, o1 / (1 << o2))
+#undef ALU_HANDLER
+
+uint64_t HandleMOVN(OiMachineModel *MM, const OiDecodedInst *DI,
+                    uint64_t CurPC) {
+  if (Src(MM, DI, 2))
+    MM->Bank[DI->Ops[0]] = Src(MM, DI, 1);
+  return CurPC + 8;
+}
+
+uint64_t HandleMOVZ(OiMachineModel *MM, const OiDecodedInst *DI,
+                    uint64_t CurPC) {
+  if (!Src(MM, DI, 2))
+    MM->Bank[DI->Ops[0]] = Src(MM, DI, 1);
+  return CurPC + 8;
+}
+
+#define LOAD_HANDLER(name, type)                                         \
+  uint64_t name(OiMachineModel *MM, const OiDecodedInst *DI,             \
+                uint64_t CurPC) {                                        \
+    MM->Bank[DI->Ops[0]] = *reinterpret_cast<type *>(Addr(MM, DI));      \
+    return CurPC + 8;                                                    \
+  }
+
+LOAD_HANDLER(HandleLW, uint32_t)
+LOAD_HANDLER(HandleLHu, uint16_t)
+LOAD_HANDLER(HandleLH, int16_t)
+LOAD_HANDLER(HandleLBu, uint8_t)
+LOAD_HANDLER(HandleLB, int8_t)
+#undef LOAD_HANDLER
+
+#define STORE_HANDLER(name, type)                                        \
+  uint64_t name(OiMachineModel *MM, const OiDecodedInst *DI,             \
+                uint64_t CurPC) {                                        \
+    *reinterpret_cast<type *>(Addr(MM, DI)) = Src(MM, DI, 0);            \
+    return CurPC + 8;                                                    \
+  }
+
+STORE_HANDLER(HandleSW, uint32_t)
+STORE_HANDLER(HandleSH, uint16_t)
+STORE_HANDLER(HandleSB, uint8_t)
+#undef STORE_HANDLER
+
+uint64_t HandleBEQ(OiMachineModel *MM, const OiDecodedInst *DI,
+                   uint64_t CurPC) {
+  if (Src(MM, DI, 0) == Src(MM, DI, 1))
+    return (CurPC + DI->Ops[2]) & 0xFFFFFFFFULL;
+  return CurPC + 8;
+}
+
+uint64_t HandleBNE(OiMachineModel *MM, const OiDecodedInst *DI,
+                   uint64_t CurPC) {
+  if (Src(MM, DI, 0) != Src(MM, DI, 1))
+    return (CurPC + DI->Ops[2]) & 0xFFFFFFFFULL;
+  return CurPC + 8;
+}
+
+#define BRANCH_ZERO_HANDLER(name, cmp)                                   \
+  uint64_t name(OiMachineModel *MM, const OiDecodedInst *DI,             \
+                uint64_t CurPC) {                                        \
+    int32_t o0 = Src(MM, DI, 0);                                         \
+    if (o0 cmp 0)                                                        \
+      return (CurPC + DI->Ops[1]) & 0xFFFFFFFFULL;                       \
+    return CurPC + 8;                                                    \
+  }
+
+BRANCH_ZERO_HANDLER(HandleBLTZ, <)
+BRANCH_ZERO_HANDLER(HandleBGTZ, >)
+BRANCH_ZERO_HANDLER(HandleBGEZ, >=)
+BRANCH_ZERO_HANDLER(HandleBLEZ, <=)
+#undef BRANCH_ZERO_HANDLER
+
+uint64_t HandleJ(OiMachineModel *MM, const OiDecodedInst *DI,
+                 uint64_t CurPC) {
+  return DI->Ops[0];
+}
+
+uint64_t HandleJAL(OiMachineModel *MM, const OiDecodedInst *DI,
+                   uint64_t CurPC) {
+  MM->Bank[31] = CurPC + 8;
+  return DI->Ops[0];
+}
+
+uint64_t HandleJR(OiMachineModel *MM, const OiDecodedInst *DI,
+                  uint64_t CurPC) {
+  return MM->Bank[DI->Ops[0]];
+}
+
+uint64_t HandleJALR(OiMachineModel *MM, const OiDecodedInst *DI,
+                    uint64_t CurPC) {
+  MM->Bank[31] = CurPC + 8;
+  return MM->Bank[DI->Ops[1]]; // Not operand 0!
+}
+
+// Pick the specialized handler for Opcode, or NULL if the generic path must
+// be used.
+OiInstHandler SelectHandler(unsigned Opcode) {
+  // Keep the verbose trace of executeInstruction when debugging
+  if (Verbosity != 0)
+    return nullptr;
+
+  switch (Opcode) {
+  case Mips::ADDiu:
+  case Mips::ADDu:     return HandleADD;
+  case Mips::SUBu:     return HandleSUB;
+  case Mips::ORi:
+  case Mips::OR:       return HandleOR;
+  case Mips::NOR:      return HandleNOR;
+  case Mips::ANDi:
+  case Mips::AND:      return HandleAND;
+  case Mips::XORi:
+  case Mips::XOR:      return HandleXOR;
+  case Mips::SLTiu:
+  case Mips::SLTu:     return HandleSLTu;
+  case Mips::SLTi:
+  case Mips::SLT:      return HandleSLT;
+  case Mips::SLL:
+  case Mips::SLLV:     return HandleSLL;
+  case Mips::SRL:      return HandleSRL;
+  case Mips::SRLV:     return HandleSRLV;
+  case Mips::SRA:      return HandleSRA;
+  case Mips::MOVN_I_I: return HandleMOVN;
+  case Mips::MOVZ_I_I: return HandleMOVZ;
+  case Mips::LW:       return HandleLW;
+  case Mips::LHu:      return HandleLHu;
+  case Mips::LH:       return HandleLH;
+  case Mips::LBu:      return HandleLBu;
+  case Mips::LB:       return HandleLB;
+  case Mips::SW:       return HandleSW;
+  case Mips::SH:       return HandleSH;
+  case Mips::SB:       return HandleSB;
+  case Mips::BEQ:      return HandleBEQ;
+  case Mips::BNE:      return HandleBNE;
+  case Mips::BLTZ:     return HandleBLTZ;
+  case Mips::BGTZ:     return HandleBGTZ;
+  case Mips::BGEZ:     return HandleBGEZ;
+  case Mips::BLEZ:     return HandleBLEZ;
+  case Mips::J:        return HandleJ;
+  case Mips::JAL:      return HandleJAL;
+  case Mips::JR:       return HandleJR;
+  case Mips::JALR:     return HandleJALR;
+  }
+  return nullptr;
+}
+
+// Check that the resolved operands have the kinds the specialized handler
+// expects, so handlers do not have to.
+bool HasExpectedOperands(const OiDecodedInst &DI) {
+  bool DstIsReg = DI.NumOps > 0 && DI.isReg(0) && DI.Ops[0] != 0;
+  switch (DI.Opcode) {
+  case Mips::ADDiu:
+  case Mips::ADDu:
+  case Mips::SUBu:
+  case Mips::ORi:
+  case Mips::OR:
+  case Mips::NOR:
+  case Mips::ANDi:
+  case Mips::AND:
+  case Mips::XORi:
+  case Mips::XOR:
+  case Mips::SLTiu:
+  case Mips::SLTu:
+  case Mips::SLTi:
+  case Mips::SLT:
+  case Mips::SLL:
+  case Mips::SLLV:
+  case Mips::SRL:
+  case Mips::SRLV:
+  case Mips::SRA:
+  case Mips::MOVN_I_I:
+  case Mips::MOVZ_I_I:
+    // Writes to $zero (e.g. the SLL NOP) go through the generic path
+    if (DI.NumOps < 3 || !DstIsReg)
+      return false;
+    break;
+  case Mips::LW:
+  case Mips::LHu:
+  case Mips::LH:
+  case Mips::LBu:
+  case Mips::LB:
+    if (DI.NumOps < 3 || !DstIsReg || !DI.isReg(1) || DI.isReg(2))
+      return false;
+    break;
+  case Mips::SW:
+  case Mips::SH:
+  case Mips::SB:
+    if (DI.NumOps < 3 || !DI.isReg(1) || DI.isReg(2))
+      return false;
+    break;
+  case Mips::BEQ:
+  case Mips::BNE:
+    if (DI.NumOps < 3 || DI.isReg(2))
+      return false;
+    break;
+  case Mips::BLTZ:
+  case Mips::BGTZ:
+  case Mips::BGEZ:
+  case Mips::BLEZ:
+    if (DI.NumOps < 2 || DI.isReg(1))
+      return false;
+    break;
+  case Mips::J:
+  case Mips::JAL:
+    if (DI.NumOps < 1 || DI.isReg(0))
+      return false;
+    break;
+  case Mips::JR:
+    if (DI.NumOps < 1 || !DI.isReg(0))
+      return false;
+    break;
+  case Mips::JALR:
+    if (DI.NumOps < 2 || !DI.isReg(1))
+      return false;
+    break;
+  default:
+    return false;
+  }
+
+  return true;
+}
+
+bool EndsBlock(unsigned Opcode) {
+  switch (Opcode) {
+  case Mips::BEQ:
+  case Mips::BNE:
+  case Mips::BLTZ:
+  case Mips::BGTZ:
+  case Mips::BGEZ:
+  case Mips::BLEZ:
+  case Mips::BC1T:
+  case Mips::BC1F:
+  case Mips::J:
+  case Mips::JAL:
+  case Mips::JR:
+  case Mips::JALR:
+  case Mips::SYSCALL:
+    return true;
+  }
+  return false;
+}
+
+} // end anonymous namespace
+
+void OiDecodeCache::invalidate() {
+  for (auto &P : Pages)
+    P.reset();
+  Blocks.clear();
+}
+
+const OiBasicBlock *OiDecodeCache::formBlock(uint64_t PC) {
+  // Blocks point into the pages, which misaligned entries do not live in
+  if (PC & 7)
+    return nullptr;
+
+  OiDecodedInst *Head = const_cast<OiDecodedInst *>(lookup(PC));
+  if (!Head)
+    return nullptr;
+
+  std::unique_ptr<OiBasicBlock> BB(new OiBasicBlock);
+  const OiDecodedInst *DI = Head;
+  while (DI) {
+    BB->Insts.push_back(DI);
+    if (EndsBlock(DI->Opcode) || BB->size() == MaxBlockSize)
+      break;
+    PC += 8;
+    DI = lookup(PC);
+  }
+
+  Head->Block = BB.get();
+  Blocks.push_back(std::move(BB));
+  return Head->Block;
+}
+
+const OiDecodedInst *OiDecodeCache::decode(uint64_t PC) {
+  if (PC >= Mem->TOTALSIZE)
+    return nullptr;
+
+  // Instructions are 8 bytes wide; a misaligned PC cannot share a slot
+  OiDecodedInst *DI = &Misaligned;
+  if ((PC & 7) == 0) {
+    std::unique_ptr<OiDecodedInst[]> &Page = Pages[PC >> PageBits];
+    if (!Page)
+      Page.reset(new OiDecodedInst[(PageMask + 1) >> 3]());
+    DI = &Page[(PC & PageMask) >> 3];
+  }
+
+  uint64_t Size;
+  ArrayRef<uint8_t> Bytes(Mem->memory, Mem->TOTALSIZE);
+  DI->Inst.clear();
+  if (!DisAsm.getInstruction(DI->Inst, Size, Bytes.slice(PC), PC, nulls(),
+                             nulls())) {
+    DI->Handler = nullptr;
+    return nullptr;
+  }
+
+  DI->Opcode = DI->Inst.getOpcode();
+  DI->NumOps = DI->Inst.getNumOperands();
+  DI->RegMask = 0;
+  DI->Handler = HandleGeneric;
+  DI->Specialized = false;
+  DI->Block = nullptr;
+
+  // Operands are only resolved for opcodes with a specialized handler, as
+  // ConvToDirective does not know every register class (e.g. FCC).
+  OiInstHandler H = GenericOnly ? nullptr : SelectHandler(DI->Opcode);
+  if (!H || DI->NumOps > 4)
+    return DI;
+  for (unsigned i = 0; i < DI->NumOps; ++i) {
+    const MCOperand &o = DI->Inst.getOperand(i);
+    if (o.isReg()) {
+      DI->Ops[i] = ConvToDirective(conv32(o.getReg()));
+      DI->RegMask |= 1 << i;
+    } else if (o.isImm()) {
+      DI->Ops[i] = o.getImm();
+    } else {
+      return DI;
+    }
+  }
+  if (HasExpectedOperands(*DI)) {
+    DI->Handler = H;
+    DI->Specialized = true;
+  }
+  return DI;
+}
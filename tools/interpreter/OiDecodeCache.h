@@ -0,0 +1,124 @@
+//=== OiDecodeCache.h - Predecoded instruction cache -*- C++ -*-==//
+//
+// Caches decoded OpenISA instructions keyed by guest PC, so that each
+// instruction is disassembled only once. Every entry keeps a compact
+// record with a handler and its register indices/immediates already
+// resolved, avoiding MCOperand inspection on the hot path.
+//
+// Guest stores are not watched, so code written by the guest after it was
+// first run keeps executing its old decoding: self-modifying code is not
+// supported unless the cache is disabled with -no-decode-cache.
+//
+//===------------------------------------------------------------===//
+
+#ifndef OIDECODECACHE_H
+#define OIDECODECACHE_H
+
+#include "OiMemoryModel.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/Support/DataTypes.h"
+#include <memory>
+#include <vector>
+
+namespace llvm {
+
+class MCDisassembler;
+class OiMachineModel;
+struct OiBasicBlock;
+struct OiDecodedInst;
+
+// Executes a predecoded instruction and returns the next guest PC.
+typedef uint64_t (*OiInstHandler)(OiMachineModel *MM, const OiDecodedInst *DI,
+                                  uint64_t CurPC);
+
+struct OiDecodedInst {
+  OiInstHandler Handler;
+  // Operands resolved to Bank indices (when the matching bit of RegMask
+  // is set) or to raw immediates.
+  uint32_t Ops[4];
+  uint8_t RegMask;
+  uint8_t NumOps;
+  // Set when Handler is a specialized one and Ops are resolved
+  bool Specialized;
+  unsigned Opcode;
+  // Kept for handlers that fall back to OiMachineModel::executeInstruction
+  MCInst Inst;
+  // Guest basic block starting at this instruction, if already formed
+  OiBasicBlock *Block;
+
+  bool isReg(unsigned i) const { return RegMask & (1 << i); }
+};
+
+// A guest basic block, ending at the first branch, jump or syscall. It runs
+// as a loop of indirect calls over its handlers, paying the lookup once per
+// block. Handlers are separate functions, so computed-goto threading does
+// not apply, and C++ does not guarantee the tail calls that would let each
+// handler jump to the next without growing the host stack.
+struct OiBasicBlock {
+  std::vector<const OiDecodedInst *> Insts;
+
+  uint64_t execute(OiMachineModel *MM, uint64_t CurPC) const {
+    for (const OiDecodedInst *DI : Insts)
+      CurPC = DI->Handler(MM, DI, CurPC);
+    return CurPC;
+  }
+
+  size_t size() const { return Insts.size(); }
+};
+
+class OiDecodeCache {
+public:
+  OiDecodeCache(const MCDisassembler &DisAsm, OiMemoryModel *Mem)
+    : DisAsm(DisAsm), Mem(Mem), Pages(Mem->TOTALSIZE >> PageBits),
+      Misaligned(), GenericOnly(false) {}
+
+  // Return the decoded instruction at PC, decoding it on a miss. Returns
+  // NULL if the bytes at PC are not a valid instruction.
+  const OiDecodedInst *lookup(uint64_t PC) {
+    uint64_t Page = PC >> PageBits;
+    if ((PC & 7) == 0 && Page < Pages.size() && Pages[Page]) {
+      OiDecodedInst *DI = &Pages[Page][(PC & PageMask) >> 3];
+      if (DI->Handler)
+        return DI;
+    }
+    return decode(PC);
+  }
+
+  // Return the basic block starting at PC, forming it on a miss. Returns
+  // NULL if no block can start at PC.
+  const OiBasicBlock *lookupBlock(uint64_t PC) {
+    const OiDecodedInst *DI = lookup(PC);
+    if (DI && DI->Block)
+      return DI->Block;
+    return formBlock(PC);
+  }
+
+  // Drop every cached entry, e.g. when execution switches to the generic
+  // handlers. Guest stores to code do not call this.
+  void invalidate();
+
+  // Send every instruction decoded from now on through
+  // OiMachineModel::executeInstruction, e.g. to trace it. Entries already
+  // cached keep their handlers until invalidate().
+  void setGenericOnly(bool G) { GenericOnly = G; }
+
+private:
+  static const unsigned PageBits = 12;
+  static const uint64_t PageMask = (1ULL << PageBits) - 1;
+  static const unsigned MaxBlockSize = 256;
+
+  const OiDecodedInst *decode(uint64_t PC);
+  const OiBasicBlock *formBlock(uint64_t PC);
+
+  const MCDisassembler &DisAsm;
+  OiMemoryModel *Mem;
+  std::vector<std::unique_ptr<OiDecodedInst[]>> Pages;
+  std::vector<std::unique_ptr<OiBasicBlock>> Blocks;
+  // Scratch entry for decoding misaligned PCs
+  OiDecodedInst Misaligned;
+  bool GenericOnly;
+};
+
+} // end namespace llvm
+
+#endif
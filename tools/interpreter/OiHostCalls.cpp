@@ -0,0 +1,88 @@
+//===-- OiHostCalls.cpp - Host versions of guest libc routines -===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Guest functions take their arguments in a0-a3 (Bank[4] to Bank[7]),
+// return in v0 (Bank[2]) and come back to ra (Bank[31]).
+//
+//===----------------------------------------------------------------------===//
+
+#include "OiHostCalls.h"
+#include "OiMachineModel.h"
+#include <string.h>
+
+using namespace llvm;
+
+OiHostCalls::OiHostCalls(
+    const std::vector<std::pair<uint64_t, StringRef> > &Symbols) {
+  for (const auto &S : Symbols) {
+    Routine R;
+    if (S.second == "memcpy")
+      R = Memcpy;
+    else if (S.second == "memset")
+      R = Memset;
+    else if (S.second == "strlen")
+      R = Strlen;
+    else if (S.second == "strcmp")
+      R = Strcmp;
+    else
+      continue;
+    Routines[(uint32_t) S.first] = R;
+  }
+}
+
+// Length of the guest string at Addr, or -1 if it is not terminated inside
+// guest memory
+static int64_t GuestStrlen(const OiMemoryModel *Mem, uint32_t Addr) {
+  if (Addr >= Mem->TOTALSIZE)
+    return -1;
+  const void *End = memchr(&Mem->memory[Addr], 0, Mem->TOTALSIZE - Addr);
+  if (!End)
+    return -1;
+  return static_cast<const uint8_t *>(End) - &Mem->memory[Addr];
+}
+
+bool OiHostCalls::call(Routine R, OiMachineModel *MM, uint64_t &PC) const {
+  OiMemoryModel *Mem = MM->Mem;
+  uint32_t *Bank = MM->Bank;
+  uint32_t A0 = Bank[4], A1 = Bank[5], A2 = Bank[6];
+
+  switch (R) {
+  case Memcpy:
+    if ((uint64_t) A0 + A2 > Mem->TOTALSIZE ||
+        (uint64_t) A1 + A2 > Mem->TOTALSIZE)
+      return false;
+    // Guests get away with overlapping copies that run forward; so do we
+    memmove(&Mem->memory[A0], &Mem->memory[A1], A2);
+    Bank[2] = A0;
+    break;
+  case Memset:
+    if ((uint64_t) A0 + A2 > Mem->TOTALSIZE)
+      return false;
+    memset(&Mem->memory[A0], (int) A1, A2);
+    Bank[2] = A0;
+    break;
+  case Strlen: {
+    int64_t Len = GuestStrlen(Mem, A0);
+    if (Len < 0)
+      return false;
+    Bank[2] = Len;
+    break;
+  }
+  case Strcmp: {
+    if (GuestStrlen(Mem, A0) < 0 || GuestStrlen(Mem, A1) < 0)
+      return false;
+    int Cmp = strcmp(reinterpret_cast<const char *>(&Mem->memory[A0]),
+                     reinterpret_cast<const char *>(&Mem->memory[A1]));
+    Bank[2] = Cmp < 0 ? -1 : Cmp > 0;
+    break;
+  }
+  }
+  PC = Bank[31];
+  return true;
+}
@@ -0,0 +1,52 @@
+//=== OiHostCalls.h - Host versions of guest libc routines -*- C++ -*-==//
+//
+// Recognises calls to guest memcpy, memset, strlen and strcmp by the
+// address of their symbols, and runs the host C library versions over the
+// guest memory instead of interpreting the guest code byte by byte. The
+// guest routine is still interpreted when its arguments reach outside
+// guest memory, so that faults look the same as without this.
+//
+//===------------------------------------------------------------===//
+
+#ifndef OIHOSTCALLS_H
+#define OIHOSTCALLS_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+#include <utility>
+#include <vector>
+
+namespace llvm {
+
+class OiMachineModel;
+
+class OiHostCalls {
+public:
+  explicit OiHostCalls(
+      const std::vector<std::pair<uint64_t, StringRef> > &Symbols);
+
+  // Whether any routine was found in the guest program
+  bool empty() const { return Routines.empty(); }
+
+  // If PC is the entry of a known routine, run it for MM as if the guest
+  // had, set PC to its return address and return true.
+  bool tryCall(OiMachineModel *MM, uint64_t &PC) const {
+    if (Routines.empty())
+      return false;
+    DenseMap<uint32_t, Routine>::const_iterator I =
+      Routines.find((uint32_t) PC);
+    return I != Routines.end() && call(I->second, MM, PC);
+  }
+
+private:
+  enum Routine { Memcpy, Memset, Strlen, Strcmp };
+
+  bool call(Routine R, OiMachineModel *MM, uint64_t &PC) const;
+
+  DenseMap<uint32_t, Routine> Routines;
+};
+
+} // end namespace llvm
+
+#endif
@@ -0,0 +1,484 @@
+//===-- OiJIT.cpp - Hot region JIT tier for the interpreter ----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Translates hot regions of predecoded guest code into LLVM IR and compiles
+// them with MCJIT. Only instructions with a specialized handler in the decode
+// cache are translated; anything else makes native code return to the
+// interpreter at that instruction.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "oii-jit"
+#include "OiJIT.h"
+#include "OiDecodeCache.h"
+#include "../lib/Target/Mips/MipsInstrInfo.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/PassManager.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Scalar.h"
+#include <set>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<unsigned>
+MaxRegionBlocks("jit-region-blocks", cl::desc("Maximum number of guest basic "
+                                              "blocks in a JIT region"),
+                cl::init(128));
+
+namespace {
+
+typedef std::pair<uint32_t, const OiBasicBlock *> RegionBlock;
+
+bool IsBranch(unsigned Opcode) {
+  switch (Opcode) {
+  case Mips::BEQ:
+  case Mips::BNE:
+  case Mips::BLTZ:
+  case Mips::BGTZ:
+  case Mips::BGEZ:
+  case Mips::BLEZ:
+  case Mips::J:
+  case Mips::JAL:
+  case Mips::JR:
+  case Mips::JALR:
+    return true;
+  }
+  return false;
+}
+
+// Builds one LLVM function out of a region. Guest registers live in allocas
+// while inside the region and only the written ones are stored back to Bank
+// on the way out.
+class RegionTranslator {
+public:
+  RegionTranslator(LLVMContext &Ctx, Module &M, StringRef Name)
+    : Ctx(Ctx), Builder(Ctx), EntryBuilder(Ctx), I8(Type::getInt8Ty(Ctx)),
+      I16(Type::getInt16Ty(Ctx)), I32(Type::getInt32Ty(Ctx)),
+      I64(Type::getInt64Ty(Ctx)), Regs(32), Dirty(32) {
+    Type *Args[] = { PointerType::getUnqual(I32), PointerType::getUnqual(I8),
+                     PointerType::getUnqual(I64), I32 };
+    FunctionType *FT = FunctionType::get(I32, Args, false);
+    F = Function::Create(FT, Function::ExternalLinkage, Name, &M);
+    Function::arg_iterator AI = F->arg_begin();
+    Bank = AI++;
+    Mem = AI++;
+    Count = AI++;
+    EntryPC = AI++;
+
+    Entry = BasicBlock::Create(Ctx, "entry", F);
+    Exit = BasicBlock::Create(Ctx, "exit", F);
+    EntryBuilder.SetInsertPoint(Entry);
+    NextPC = EntryBuilder.CreateAlloca(I32, nullptr, "nextpc");
+    Retired = EntryBuilder.CreateAlloca(I64, nullptr, "retired");
+    EntryBuilder.CreateStore(ConstantInt::get(I64, 0), Retired);
+  }
+
+  Function *translate(ArrayRef<RegionBlock> Region, bool *Enterable);
+
+private:
+  Value *getReg(unsigned R);
+  void setReg(unsigned R, Value *V);
+  Value *getSrc(const OiDecodedInst *DI, unsigned i);
+  Value *getAddress(const OiDecodedInst *DI, Type *Ty);
+  BasicBlock *getTarget(uint32_t PC);
+  void retire(unsigned N);
+  void exitTo(Value *PC);
+  void translateInst(const OiDecodedInst *DI, uint32_t PC);
+  void translateBranch(const OiDecodedInst *DI, uint32_t PC);
+
+  LLVMContext &Ctx;
+  IRBuilder<> Builder, EntryBuilder;
+  Type *I8, *I16, *I32, *I64;
+  Function *F;
+  Value *Bank, *Mem, *Count, *EntryPC, *NextPC, *Retired;
+  BasicBlock *Entry, *Exit;
+  std::vector<Value *> Regs;
+  std::vector<bool> Dirty;
+  DenseMap<uint32_t, BasicBlock *> BlockMap, StubMap;
+};
+
+Value *RegionTranslator::getReg(unsigned R) {
+  if (R == 0)
+    return ConstantInt::get(I32, 0);
+  if (!Regs[R]) {
+    Regs[R] = EntryBuilder.CreateAlloca(I32, nullptr, "r" + utostr(R));
+    Value *Ptr = EntryBuilder.CreateConstGEP1_32(Bank, R);
+    EntryBuilder.CreateStore(EntryBuilder.CreateLoad(Ptr), Regs[R]);
+  }
+  return Builder.CreateLoad(Regs[R]);
+}
+
+void RegionTranslator::setReg(unsigned R, Value *V) {
+  assert (R != 0 && "Cannot write to register 0");
+  getReg(R);
+  Builder.CreateStore(V, Regs[R]);
+  Dirty[R] = true;
+}
+
+Value *RegionTranslator::getSrc(const OiDecodedInst *DI, unsigned i) {
+  if (DI->isReg(i))
+    return getReg(DI->Ops[i]);
+  return ConstantInt::get(I32, DI->Ops[i]);
+}
+
+Value *RegionTranslator::getAddress(const OiDecodedInst *DI, Type *Ty) {
+  Value *Addr = Builder.CreateAdd(getReg(DI->Ops[1]),
+                                  ConstantInt::get(I32, DI->Ops[2]));
+  Value *Ptr = Builder.CreateGEP(Mem, Builder.CreateZExt(Addr, I64));
+  return Builder.CreateBitCast(Ptr, PointerType::getUnqual(Ty));
+}
+
+BasicBlock *RegionTranslator::getTarget(uint32_t PC) {
+  if (BasicBlock *BB = BlockMap.lookup(PC))
+    return BB;
+  BasicBlock *&Stub = StubMap[PC];
+  if (!Stub) {
+    Stub = BasicBlock::Create(Ctx, "exit" + utohexstr(PC), F);
+    IRBuilder<> StubBuilder(Stub);
+    StubBuilder.CreateStore(ConstantInt::get(I32, PC), NextPC);
+    StubBuilder.CreateBr(Exit);
+  }
+  return Stub;
+}
+
+void RegionTranslator::retire(unsigned N) {
+  if (N == 0)
+    return;
+  Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(Retired),
+                                        ConstantInt::get(I64, N)), Retired);
+}
+
+void RegionTranslator::exitTo(Value *PC) {
+  Builder.CreateStore(PC, NextPC);
+  Builder.CreateBr(Exit);
+}
+
+void RegionTranslator::translateInst(const OiDecodedInst *DI, uint32_t PC) {
+  unsigned Dst = DI->Ops[0];
+  switch (DI->Opcode) {
+  case Mips::ADDiu:
+  case Mips::ADDu:
+    setReg(Dst, Builder.CreateAdd(getSrc(DI, 1), getSrc(DI, 2)));
+    return;
+  case Mips::SUBu:
+    setReg(Dst, Builder.CreateSub(getSrc(DI, 1), getSrc(DI, 2)));
+    return;
+  case Mips::ORi:
+  case Mips::OR:
+    setReg(Dst, Builder.CreateOr(getSrc(DI, 1), getSrc(DI, 2)));
+    return;
+  case Mips::NOR:
+    setReg(Dst, Builder.CreateNot(Builder.CreateOr(getSrc(DI, 1),
+                                                   getSrc(DI, 2))));
+    return;
+  case Mips::ANDi:
+  case Mips::AND:
+    setReg(Dst, Builder.CreateAnd(getSrc(DI, 1), getSrc(DI, 2)));
+    return;
+  case Mips::XORi:
+  case Mips::XOR:
+    setReg(Dst, Builder.CreateXor(getSrc(DI, 1), getSrc(DI, 2)));
+    return;
+  case Mips::SLTiu:
+  case Mips::SLTu:
+    setReg(Dst, Builder.CreateZExt(Builder.CreateICmpULT(getSrc(DI, 1),
+                                                         getSrc(DI, 2)), I32));
+    return;
+  case Mips::SLTi:
+  case Mips::SLT:
+    setReg(Dst, Builder.CreateZExt(Builder.CreateICmpSLT(getSrc(DI, 1),
+                                                         getSrc(DI, 2)), I32));
+    return;
+  case Mips::SLL:
+  case Mips::SLLV:
+  case Mips::SRL:
+  case Mips::SRLV:
+  case Mips::SRA: {
+    Value *o1 = getSrc(DI, 1);
+    Value *o2 = getSrc(DI, 2);
+    //XXX: SRLV is decoded with operands inverted!
+    if (DI->Opcode == Mips::SRLV)
+      std::swap(o1, o2);
+    // Shift amounts wrap at 32, as they do for the handlers on the host
+    o2 = Builder.CreateAnd(o2, ConstantInt::get(I32, 31));
+    Value *V;
+    if (DI->Opcode == Mips::SLL || DI->Opcode == Mips::SLLV)
+      V = Builder.CreateShl(o1, o2);
+    else if (DI->Opcode == Mips::SRA)
+      V = Builder.CreateSDiv(o1, Builder.CreateShl(ConstantInt::get(I32, 1),
+                                                   o2));
+    else
+      V = Builder.CreateLShr(o1, o2);
+    setReg(Dst, V);
+    return;
+  }
+  case Mips::MOVN_I_I:
+  case Mips::MOVZ_I_I: {
+    Value *Cond = Builder.CreateICmpNE(getSrc(DI, 2), ConstantInt::get(I32, 0));
+    if (DI->Opcode == Mips::MOVZ_I_I)
+      Cond = Builder.CreateNot(Cond);
+    setReg(Dst, Builder.CreateSelect(Cond, getSrc(DI, 1), getReg(Dst)));
+    return;
+  }
+  case Mips::LW:
+    setReg(Dst, Builder.CreateAlignedLoad(getAddress(DI, I32), 1));
+    return;
+  case Mips::LHu:
+  case Mips::LH: {
+    Value *V = Builder.CreateAlignedLoad(getAddress(DI, I16), 1);
+    setReg(Dst, DI->Opcode == Mips::LH ? Builder.CreateSExt(V, I32)
+                                       : Builder.CreateZExt(V, I32));
+    return;
+  }
+  case Mips::LBu:
+  case Mips::LB: {
+    Value *V = Builder.CreateAlignedLoad(getAddress(DI, I8), 1);
+    setReg(Dst, DI->Opcode == Mips::LB ? Builder.CreateSExt(V, I32)
+                                       : Builder.CreateZExt(V, I32));
+    return;
+  }
+  case Mips::SW:
+    Builder.CreateAlignedStore(getSrc(DI, 0), getAddress(DI, I32), 1);
+    return;
+  case Mips::SH:
+    Builder.CreateAlignedStore(Builder.CreateTrunc(getSrc(DI, 0), I16),
+                               getAddress(DI, I16), 1);
+    return;
+  case Mips::SB:
+    Builder.CreateAlignedStore(Builder.CreateTrunc(getSrc(DI, 0), I8),
+                               getAddress(DI, I8), 1);
+    return;
+  }
+  llvm_unreachable("Specialized instruction without a JIT translation");
+}
+
+void RegionTranslator::translateBranch(const OiDecodedInst *DI, uint32_t PC) {
+  Value *Zero = ConstantInt::get(I32, 0);
+  Value *Cond = nullptr;
+  uint32_t Target = 0;
+  switch (DI->Opcode) {
+  case Mips::BEQ:
+  case Mips::BNE:
+    Target = PC + DI->Ops[2];
+    if (DI->Opcode == Mips::BEQ)
+      Cond = Builder.CreateICmpEQ(getSrc(DI, 0), getSrc(DI, 1));
+    else
+      Cond = Builder.CreateICmpNE(getSrc(DI, 0), getSrc(DI, 1));
+    break;
+  case Mips::BLTZ:
+    Target = PC + DI->Ops[1];
+    Cond = Builder.CreateICmpSLT(getSrc(DI, 0), Zero);
+    break;
+  case Mips::BGTZ:
+    Target = PC + DI->Ops[1];
+    Cond = Builder.CreateICmpSGT(getSrc(DI, 0), Zero);
+    break;
+  case Mips::BGEZ:
+    Target = PC + DI->Ops[1];
+    Cond = Builder.CreateICmpSGE(getSrc(DI, 0), Zero);
+    break;
+  case Mips::BLEZ:
+    Target = PC + DI->Ops[1];
+    Cond = Builder.CreateICmpSLE(getSrc(DI, 0), Zero);
+    break;
+  case Mips::J:
+    Builder.CreateBr(getTarget(DI->Ops[0]));
+    return;
+  case Mips::JAL:
+    setReg(31, ConstantInt::get(I32, PC + 8));
+    exitTo(ConstantInt::get(I32, DI->Ops[0]));
+    return;
+  case Mips::JR:
+    exitTo(getReg(DI->Ops[0]));
+    return;
+  case Mips::JALR:
+    setReg(31, ConstantInt::get(I32, PC + 8));
+    exitTo(getReg(DI->Ops[1])); // Not operand 0!
+    return;
+  default:
+    llvm_unreachable("Unknown branch");
+  }
+  Builder.CreateCondBr(Cond, getTarget(Target), getTarget(PC + 8));
+}
+
+Function *RegionTranslator::translate(ArrayRef<RegionBlock> Region,
+                                      bool *Enterable) {
+  for (const RegionBlock &RB : Region)
+    BlockMap[RB.first] = BasicBlock::Create(Ctx, "bb" + utohexstr(RB.first),
+                                            F);
+
+  for (const RegionBlock &RB : Region) {
+    Builder.SetInsertPoint(BlockMap[RB.first]);
+    uint32_t PC = RB.first;
+    unsigned N = 0;
+    bool Terminated = false;
+    for (const OiDecodedInst *DI : RB.second->Insts) {
+      if (!DI->Specialized) {
+        // Let the interpreter handle it
+        retire(N);
+        exitTo(ConstantInt::get(I32, PC));
+        Terminated = true;
+        break;
+      }
+      if (IsBranch(DI->Opcode)) {
+        retire(N + 1);
+        translateBranch(DI, PC);
+        Terminated = true;
+        break;
+      }
+      translateInst(DI, PC);
+      ++N;
+      PC += 8;
+    }
+    if (!Terminated) {
+      retire(N);
+      Builder.CreateBr(getTarget(PC));
+    }
+  }
+
+  // Dispatch on the entry PC. Blocks whose first instruction cannot be
+  // translated are not entry points, otherwise the interpreter would keep
+  // re-entering native code without making progress.
+  BasicBlock *NoEntry = BasicBlock::Create(Ctx, "noentry", F);
+  IRBuilder<> NoEntryBuilder(NoEntry);
+  NoEntryBuilder.CreateStore(EntryPC, NextPC);
+  NoEntryBuilder.CreateBr(Exit);
+  SwitchInst *SI = EntryBuilder.CreateSwitch(EntryPC, NoEntry, Region.size());
+  for (unsigned i = 0, e = Region.size(); i != e; ++i) {
+    Enterable[i] = Region[i].second->Insts.front()->Specialized;
+    if (Enterable[i])
+      SI->addCase(ConstantInt::get(cast<IntegerType>(I32), Region[i].first),
+                  BlockMap[Region[i].first]);
+  }
+
+  Builder.SetInsertPoint(Exit);
+  for (unsigned R = 1; R < 32; ++R) {
+    if (!Dirty[R])
+      continue;
+    Builder.CreateStore(Builder.CreateLoad(Regs[R]),
+                        Builder.CreateConstGEP1_32(Bank, R));
+  }
+  Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(Count),
+                                        Builder.CreateLoad(Retired)), Count);
+  Builder.CreateRet(Builder.CreateLoad(NextPC));
+  return F;
+}
+
+} // end anonymous namespace
+
+OiJIT::OiJIT(OiDecodeCache &Cache) : Cache(Cache), NumRegions(0) {}
+
+OiJIT::~OiJIT() {}
+
+bool OiJIT::compile(uint64_t PC) {
+  if (Entries.count((uint32_t) PC))
+    return true;
+
+  // Collect the blocks reachable from PC through direct branches
+  std::vector<RegionBlock> Region;
+  std::vector<uint32_t> Worklist(1, (uint32_t) PC);
+  std::set<uint32_t> Visited;
+  while (!Worklist.empty() && Region.size() < MaxRegionBlocks) {
+    uint32_t Head = Worklist.back();
+    Worklist.pop_back();
+    if (!Visited.insert(Head).second || Entries.count(Head))
+      continue;
+    const OiBasicBlock *BB = Cache.lookupBlock(Head);
+    if (!BB)
+      continue;
+    Region.push_back(std::make_pair(Head, BB));
+
+    bool AllSpecialized = true;
+    for (const OiDecodedInst *DI : BB->Insts)
+      AllSpecialized &= DI->Specialized;
+    if (!AllSpecialized)
+      continue;
+    const OiDecodedInst *Last = BB->Insts.back();
+    uint32_t LastPC = Head + 8 * (BB->size() - 1);
+    switch (Last->Opcode) {
+    case Mips::BEQ:
+    case Mips::BNE:
+      Worklist.push_back(LastPC + 8);
+      Worklist.push_back(LastPC + Last->Ops[2]);
+      break;
+    case Mips::BLTZ:
+    case Mips::BGTZ:
+    case Mips::BGEZ:
+    case Mips::BLEZ:
+      Worklist.push_back(LastPC + 8);
+      Worklist.push_back(LastPC + Last->Ops[1]);
+      break;
+    case Mips::J:
+      Worklist.push_back(Last->Ops[0]);
+      break;
+    case Mips::JAL:
+    case Mips::JR:
+    case Mips::JALR:
+      break;
+    default:
+      // Block was cut at its maximum size
+      Worklist.push_back(LastPC + 8);
+      break;
+    }
+  }
+  if (Region.empty() || !Region.front().second->Insts.front()->Specialized)
+    return false;
+
+  std::string Name = "region" + utohexstr(PC);
+  std::unique_ptr<Module> M(new Module(Name, Context));
+  std::unique_ptr<bool[]> Enterable(new bool[Region.size()]);
+  Function *F = RegionTranslator(Context, *M, Name).translate(Region,
+                                                             Enterable.get());
+#ifndef NDEBUG
+  if (verifyFunction(*F, &dbgs()))
+    llvm_unreachable("JIT produced invalid IR");
+#endif
+
+  if (!EE) {
+    std::string Error;
+    EE.reset(EngineBuilder(std::unique_ptr<Module>(new Module("oii", Context)))
+             .setEngineKind(EngineKind::JIT)
+             .setErrorStr(&Error)
+             .create());
+    if (!EE)
+      report_fatal_error("Could not create the JIT: " + Error);
+  }
+  M->setDataLayout(EE->getDataLayout());
+
+  FunctionPassManager FPM(&*M);
+  FPM.add(createPromoteMemoryToRegisterPass());
+  FPM.add(createInstructionCombiningPass());
+  FPM.add(createReassociatePass());
+  FPM.add(createGVNPass());
+  FPM.add(createCFGSimplificationPass());
+  FPM.doInitialization();
+  FPM.run(*F);
+  FPM.doFinalization();
+
+  EE->addModule(std::move(M));
+  RegionFn Fn = reinterpret_cast<RegionFn>(EE->getFunctionAddress(Name));
+  if (!Fn)
+    return false;
+  for (unsigned i = 0, e = Region.size(); i != e; ++i)
+    if (Enterable[i])
+      Entries[Region[i].first] = Fn;
+  ++NumRegions;
+  DEBUG(dbgs() << "JIT: translated region " << NumRegions << " at 0x"
+               << utohexstr(PC) << " (" << Region.size() << " blocks)\n");
+  return true;
+}
@@ -0,0 +1,54 @@
+//=== OiJIT.h - Hot region JIT tier for the interpreter -*- C++ -*-==//
+//
+// Translates hot guest regions into LLVM IR and compiles them with MCJIT.
+// A region is a set of guest basic blocks, taken from the predecoded
+// cache, that are reachable from a hot function entry through direct
+// branches. Native code runs against the interpreter's Bank and
+// Mem->memory and hands control back whenever it leaves the region.
+//
+//===------------------------------------------------------------===//
+
+#ifndef OIJIT_H
+#define OIJIT_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/DataTypes.h"
+#include <memory>
+
+namespace llvm {
+
+class ExecutionEngine;
+class OiDecodeCache;
+
+class OiJIT {
+public:
+  // Native entry of a translated region. Runs guest code from EntryPC until
+  // control leaves the region, adds the number of retired guest
+  // instructions to *Count and returns the next guest PC.
+  typedef uint32_t (*RegionFn)(uint32_t *Bank, uint8_t *Mem, uint64_t *Count,
+                               uint32_t EntryPC);
+
+  OiJIT(OiDecodeCache &Cache);
+  ~OiJIT();
+
+  // Return the native code able to start executing at PC, or NULL.
+  RegionFn lookup(uint64_t PC) const {
+    return Entries.lookup((uint32_t) PC);
+  }
+
+  // Translate the region starting at PC. Returns false if nothing there
+  // could be translated.
+  bool compile(uint64_t PC);
+
+private:
+  OiDecodeCache &Cache;
+  LLVMContext Context;
+  std::unique_ptr<ExecutionEngine> EE;
+  DenseMap<uint32_t, RegionFn> Entries;
+  unsigned NumRegions;
+};
+
+} // end namespace llvm
+
+#endif
@@ -16,6 +16,9 @@
 
 #define DEBUG_TYPE "staticbt"
 #include "OiMachineModel.h"
+#include "OiMemListener.h"
+#include "OiProfile.h"
+#include "OiTrace.h"
 #include "../lib/Target/Mips/MipsInstrInfo.h"
 #include "StringRefMemoryObject.h"
 #include "SyscallWrapper.h"
@@ -25,9 +28,11 @@
 #include "llvm/MC/MCSymbol.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Atomic.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/Object/ELF.h"
+#include <cmath>
 using namespace llvm;
 
 cl::opt<int32_t>
@@ -72,6 +77,21 @@ void OiMachineModel::ConfigureUserLevelStack(int argc, uint8_t **argv) {
   Bank[29] = dstptr - 4 - Mem->memory;
 }
 
+OiMachineModel *OiMachineModel::CreateThread(uint32_t StackPtr,
+                                             uint32_t NewTid) {
+  OiMachineModel *Child = new OiMachineModel(*this);
+  if (StackPtr)
+    Child->Bank[29] = StackPtr;
+  Child->Profile = nullptr;
+  Child->Trace = nullptr;
+  Child->MemListener = nullptr;
+  Child->Tid = NewTid;
+  Child->ClearTid = 0;
+  Child->Exited = false;
+  Child->LLValid = false;
+  return Child;
+}
+
 
 uint32_t OiMachineModel::HandleAluSrcOperand(const MCOperand &o) {
   if (o.isReg()) {
@@ -89,7 +109,9 @@ double OiMachineModel::HandleDoubleSrcOperand(const MCOperand &o) {
   llvm_unreachable("Invalid Src operand");
 }
 
-uint32_t OiMachineModel::HandleFloatSrcOperand(const MCOperand &o) {
+float OiMachineModel::HandleFloatSrcOperand(const MCOperand &o) {
+  if (o.isReg())
+    return FltBank[ConvToDirective(conv32(o.getReg())) - 34];
   llvm_unreachable("Invalid Src operand");
 }
 
@@ -100,32 +122,38 @@ uint32_t OiMachineModel::HandleDoubleDstOperand(const MCOperand &o) {
 }
 
 uint32_t OiMachineModel::HandleFloatDstOperand(const MCOperand &o) {
+  if (o.isReg())
+    return ConvToDirective(conv32(o.getReg())) - 34;
   llvm_unreachable("Invalid dst operand");
 }
 
+uint32_t OiMachineModel::GetFloatBits(uint32_t Reg) const {
+  uint32_t Bits;
+  memcpy(&Bits, &FltBank[Reg], sizeof(Bits));
+  return Bits;
+}
+
+void OiMachineModel::SetFloatBits(uint32_t Reg, uint32_t Bits) {
+  memcpy(&FltBank[Reg], &Bits, sizeof(Bits));
+}
+
+// FP loads and stores take either base+offset (LDC1) or base+index (LDXC1)
 double OiMachineModel::HandleDoubleLoadOperand(const MCOperand &o, const MCOperand &o2) {
-  if (o.isReg() && o2.isImm()) {
-    uint32_t myimm = o2.getImm();
-    uint32_t reg = ConvToDirective(conv32(o.getReg()));
-    return *reinterpret_cast<double*>(&Mem->memory[Bank[reg] + myimm]);
-  }
-  llvm_unreachable("Invalid Src operand");
+  return *reinterpret_cast<double*>(HandleMemOperand(o, o2));
 }
 
 void OiMachineModel::HandleDoubleSaveOperand(const MCOperand &o, const MCOperand &o2,
                                              double val) {
-  if (o.isReg() && o2.isImm()) {
-    uint32_t myimm = o2.getImm();
-    uint32_t reg = ConvToDirective(conv32(o.getReg()));
-    *reinterpret_cast<double*>(&Mem->memory[Bank[reg] + myimm]) = val;
-    return;
-  }
-  llvm_unreachable("Invalid double save operand");
+  *reinterpret_cast<double*>(HandleMemOperand(o, o2)) = val;
 }
 
-uint32_t OiMachineModel::HandleFloatMemOperand(const MCOperand &o, const MCOperand &o2,
-                                             bool IsLoad) {
-  llvm_unreachable("Invalid Src operand");
+float OiMachineModel::HandleFloatLoadOperand(const MCOperand &o, const MCOperand &o2) {
+  return *reinterpret_cast<float*>(HandleMemOperand(o, o2));
+}
+
+void OiMachineModel::HandleFloatSaveOperand(const MCOperand &o, const MCOperand &o2,
+                                            float val) {
+  *reinterpret_cast<float*>(HandleMemOperand(o, o2)) = val;
 }
 
 uint32_t OiMachineModel::HandleSaveDouble(Value *In, Value *&Low, Value *&High) {
@@ -152,8 +180,15 @@ uint32_t* OiMachineModel::HandleMemOperand(const MCOperand &o, const MCOperand &
   if (o.isReg() && o2.isImm()) {
     uint32_t r = ConvToDirective(conv32(o.getReg()));
     uint32_t imm = o2.getImm();
+    LastMemAddr = Bank[r] + imm;
     return reinterpret_cast<uint32_t*>(&Mem->memory[Bank[r]+imm]);
   }
+  if (o.isReg() && o2.isReg()) {
+    uint32_t r = ConvToDirective(conv32(o.getReg()));
+    uint32_t r2 = ConvToDirective(conv32(o2.getReg()));
+    LastMemAddr = Bank[r] + Bank[r2];
+    return reinterpret_cast<uint32_t*>(&Mem->memory[Bank[r]+Bank[r2]]);
+  }
   llvm_unreachable("Invalid Src operand");
 }
 
@@ -181,60 +216,42 @@ uint32_t OiMachineModel::HandleCallTarget(const MCOperand &o) {
   return false;
 }
 
-static bool custom_isnan(double var)
-{
-  return var != var;
+// Evaluate one of the 16 c.cond.fmt conditions. The low three bits of
+// Cond select which of unordered, equal and less make it true; conditions
+// 8-15 only differ from 0-7 by signaling on quiet NaNs, and FP exceptions
+// are not modelled.
+static bool FPCondition(unsigned Cond, double o0, double o1) {
+  if (o0 != o0 || o1 != o1)
+    return Cond & 1;
+  if (o0 == o1)
+    return Cond & 2;
+  if (o0 < o1)
+    return Cond & 4;
+  return false;
 }
 
 bool OiMachineModel::HandleFCmpOperand(const MCOperand &o, double o0, double o1) {
-  if (o.isImm()) {
-    uint64_t cond = o.getImm();
-    switch (cond) {
-    case 0: // OI_FCOND_F  false
-      return false;
-    case 1: // OI_FCOND_UN unordered - true if either nans
-      return custom_isnan(o0) || custom_isnan(o1);
-    case 2: // OI_FCOND_OEQ equal
-      return o0 == o1;
-    case 3: // OI_FCOND_UEQ unordered or equal
-      return (custom_isnan(o0) || custom_isnan(o1)) || (o0 == o1);
-    case 4: // OI_FCOND_OLT
-      return o0 < o1;
-    case 5: // OI_FCOND_ULT
-      return (custom_isnan(o0) || custom_isnan(o1)) || (o0 < o1);
-    case 6: // OI_FCOND_OLE
-      return o0 <= o1;
-    case 7: // OI_FCOND_ULE
-      return (custom_isnan(o0) || custom_isnan(o1)) || (o0 <= o1);
-    case 8: // OI_FCOND_SF
-      // Exception not implemented
-      llvm_unreachable("Unimplemented FCmp Operand");
-      break;
-    case 9: // OI_FCOND_NGLE - compare not greater or less than equal double 
-            // (w/ except.)
-      llvm_unreachable("Unimplemented FCmp Operand");
-      break;
-    case 10: // OI_FCOND_SEQ
-      llvm_unreachable("Unimplemented FCmp Operand");
-      break;
-    case 11: // OI_FCOND_NGL
-      llvm_unreachable("Unimplemented FCmp Operand");
-      break;
-    case 12: // OI_FCOND_LT
-      return o0 < o1;
-    case 13: // OI_FCOND_NGE
-      llvm_unreachable("Unimplemented FCmp Operand");
-      break;
-    case 14: // OI_FCOND_LE
-      return o0 <= o1;
-    case 15: // OI_FCOND_NGT
-      llvm_unreachable("Unimplemented FCmp Operand");
-      break;
-    }    
-  }
+  if (o.isImm() && o.getImm() >= 0 && o.getImm() < 16)
+    return FPCondition(o.getImm(), o0, o1);
   llvm_unreachable("Unrecognized FCmp Operand");
 }
 
+// Condition code bit named by a MOVT/MOVF operand. Encodings without a cc
+// field use FCC0.
+unsigned OiMachineModel::HandleFCCOperand(const MCOperand &o) {
+  if (o.isReg() && o.getReg() >= Mips::FCC0 && o.getReg() <= Mips::FCC7)
+    return o.getReg() - Mips::FCC0;
+  return 0;
+}
+
+// Convert to a word as cvt.w/trunc.w/round.w do. NaN and out of range
+// values give the MIPS default result for invalid operations.
+static uint32_t FPToWord(double val) {
+  if (!(val > -2147483649.0 && val < 2147483648.0))
+    return 0x7FFFFFFF;
+  return (uint32_t)(int32_t) val;
+}
+
 uint32_t OiMachineModel::HandleBranchTarget(const MCOperand &o, bool IsRelative,
                                             uint64_t CurPC) {
   if (o.isImm()) {
@@ -248,6 +265,88 @@ uint32_t OiMachineModel::HandleBranchTarget(const MCOperand &o, bool IsRelative,
 
 
 uint64_t OiMachineModel::executeInstruction(const MCInst *MI, uint64_t CurPC) {
+  if (Trace)
+    return executeTraced(MI, CurPC);
+  if (MemListener)
+    return executeObserved(MI, CurPC);
+  return interpret(MI, CurPC);
+}
+
+// Bytes accessed by a load or store opcode
+static uint8_t AccessSize(unsigned Opcode) {
+  switch (Opcode) {
+  case Mips::LB:
+  case Mips::LBu:
+  case Mips::SB:
+    return 1;
+  case Mips::LH:
+  case Mips::LHu:
+  case Mips::SH:
+    return 2;
+  case Mips::LDC1:
+  case Mips::LDXC1:
+  case Mips::SDC1:
+  case Mips::SDXC1:
+    return 8;
+  default:
+    return 4;
+  }
+}
+
+uint64_t OiMachineModel::executeTraced(const MCInst *MI, uint64_t CurPC) {
+  uint32_t OldBank[32];
+  double OldDblBank[32];
+  float OldFltBank[64];
+  memcpy(OldBank, Bank, sizeof(Bank));
+  memcpy(OldDblBank, DblBank, sizeof(DblBank));
+  memcpy(OldFltBank, FltBank, sizeof(FltBank));
+  uint32_t OldHi = Hi, OldLo = Lo;
+
+  Trace->inst(CurPC);
+  uint64_t NextPC = interpret(MI, CurPC);
+
+  const MCInstrDesc &Desc = MII.get(MI->getOpcode());
+  if (Desc.mayLoad() || Desc.mayStore()) {
+    Trace->memAccess(Desc.mayStore(), LastMemAddr,
+                     AccessSize(MI->getOpcode()));
+    if (MemListener)
+      MemListener->memAccess(CurPC, LastMemAddr, AccessSize(MI->getOpcode()),
+                             Desc.mayStore());
+  }
+  for (unsigned i = 0; i < 32; ++i)
+    if (Bank[i] != OldBank[i])
+      Trace->regWrite(i, Bank[i]);
+  if (Hi != OldHi)
+    Trace->regWrite(oitrace::RegHi, Hi);
+  if (Lo != OldLo)
+    Trace->regWrite(oitrace::RegLo, Lo);
+  for (unsigned i = 0; i < 32; ++i) {
+    uint64_t Bits, OldBits;
+    memcpy(&Bits, &DblBank[i], sizeof(Bits));
+    memcpy(&OldBits, &OldDblBank[i], sizeof(OldBits));
+    if (Bits != OldBits)
+      Trace->dblWrite(i, Bits);
+  }
+  for (unsigned i = 0; i < 64; ++i) {
+    uint32_t Bits, OldBits;
+    memcpy(&Bits, &FltBank[i], sizeof(Bits));
+    memcpy(&OldBits, &OldFltBank[i], sizeof(OldBits));
+    if (Bits != OldBits)
+      Trace->fltWrite(i, Bits);
+  }
+  return NextPC;
+}
+
+uint64_t OiMachineModel::executeObserved(const MCInst *MI, uint64_t CurPC) {
+  uint64_t NextPC = interpret(MI, CurPC);
+  const MCInstrDesc &Desc = MII.get(MI->getOpcode());
+  if (Desc.mayLoad() || Desc.mayStore())
+    MemListener->memAccess(CurPC, LastMemAddr, AccessSize(MI->getOpcode()),
+                           Desc.mayStore());
+  return NextPC;
+}
+
+uint64_t OiMachineModel::interpret(const MCInst *MI, uint64_t CurPC) {
 #ifndef NDEBUG
   raw_ostream &DebugOut = dbgs();
   if (Verbosity > 0) {
@@ -295,176 +394,213 @@ uint64_t OiMachineModel::executeInstruction(const MCInst *MI, uint64_t CurPC) {
       return CurPC + 8;
     }
   case Mips::MUL_OI:
+  case Mips::MULU_OI:
     {
       if (Verbosity > 0)
-        DebugOut << " \tHandling MUL_OI\n";
-      uint32_t o1 = HandleAluSrcOperand(MI->getOperand(1));
+        DebugOut << " \tHandling MUL_OI, MULU_OI\n";
+      // OpenISA writes the high and low words of the product to two GPRs
+      // (operands 0 and 1) instead of HI/LO; either may be $zero.
       uint32_t o2 = HandleAluSrcOperand(MI->getOperand(2));
-      uint32_t o0 = HandleAluDstOperand(MI->getOperand(0));
-      Bank[o0] = o1 * o2;
+      uint32_t o3 = HandleAluSrcOperand(MI->getOperand(3));
+      uint64_t ans;
+      if (MI->getOpcode() == Mips::MUL_OI)
+        ans = (uint64_t)((int64_t)(int32_t) o2 * (int64_t)(int32_t) o3);
+      else
+        ans = (uint64_t) o2 * o3;
+      unsigned r0 = ConvToDirective(conv32(MI->getOperand(0).getReg()));
+      unsigned r1 = ConvToDirective(conv32(MI->getOperand(1).getReg()));
+      if (r0)
+        Bank[r0] = ans >> 32;
+      if (r1)
+        Bank[r1] = ans & 0xFFFFFFFFULL;
+      return CurPC + 8;
+    }
+  case Mips::DIV_OI:
+  case Mips::DIVU_OI:
+    {
+      if (Verbosity > 0)
+        DebugOut << " \tHandling DIV_OI, DIVU_OI\n";
+      // Remainder goes to operand 0 and quotient to operand 1. The result
+      // of a division by zero (or INT_MIN / -1) is unpredictable on MIPS;
+      // compilers guard it with TEQ, so just avoid trapping the host here.
+      uint32_t o2 = HandleAluSrcOperand(MI->getOperand(2));
+      uint32_t o3 = HandleAluSrcOperand(MI->getOperand(3));
+      uint32_t Quot = 0, Rem = 0;
+      if (o3 == 0) {
+        Rem = o2;
+      } else if (MI->getOpcode() == Mips::DIVU_OI) {
+        Quot = o2 / o3;
+        Rem = o2 % o3;
+      } else if (o2 == 0x80000000U && o3 == 0xFFFFFFFFU) {
+        Quot = o2;
+      } else {
+        Quot = (int32_t) o2 / (int32_t) o3;
+        Rem = (int32_t) o2 % (int32_t) o3;
+      }
+      unsigned r0 = ConvToDirective(conv32(MI->getOperand(0).getReg()));
+      unsigned r1 = ConvToDirective(conv32(MI->getOperand(1).getReg()));
+      if (r0)
+        Bank[r0] = Rem;
+      if (r1)
+        Bank[r1] = Quot;
+      return CurPC + 8;
+    }
+  case Mips::TEQ:
+    {
+      if (Verbosity > 0)
+        DebugOut << " \tHandling TEQ\n";
+      uint32_t o0 = HandleAluSrcOperand(MI->getOperand(0));
+      uint32_t o1 = HandleAluSrcOperand(MI->getOperand(1));
+      if (o0 == o1)
+        report_fatal_error("Guest trap (TEQ) at PC 0x" + utohexstr(CurPC) +
+                           ", most likely an integer division by zero");
       return CurPC + 8;
     }
-//  case Mips::MULTu:
-//    {
-//      if (Verbosity > 0)
-//        DebugOut << " \tHandling MULTU\n";
-//      uint64_t o1 = HandleAluSrcOperand(MI->getOperand(0));
-//      uint64_t o2 = HandleAluSrcOperand(MI->getOperand(1));
-//      uint64_t ans = o1 * o2;
-//      Hi = ans >> 32;
-//      Lo = ans & 0xFFFFFFFFULL;
-//      return CurPC + 8;
-//    }
-//  case Mips::MULT:
-//    {
-//      if (Verbosity > 0)
-//        DebugOut << " \tHandling MULT\n";
-//      int64_t o1 = HandleAluSrcOperand(MI->getOperand(0));
-//      int64_t o2 = HandleAluSrcOperand(MI->getOperand(1));
-//      uint64_t ans = (uint64_t)(o1 * o2);
-//      Hi = ans >> 32;
-//      Lo = ans & 0xFFFFFFFFULL;
-//      return CurPC + 8;
-//    }
-//  case Mips::SDIV:
-//  case Mips::UDIV:
-//    {
-//      if (Verbosity > 0)
-//        DebugOut << " \tHandling DIV\n";
-//      uint32_t o1 = HandleAluSrcOperand(MI->getOperand(0));
-//      uint32_t o2 = HandleAluSrcOperand(MI->getOperand(1));
-//      Lo = o1 / o2;
-//      Hi = o1 % o2;
-//      return CurPC + 8;
-//    }
-//  case Mips::MFHI:
-//    {
-//      if (Verbosity > 0)
-//        DebugOut << " \tHandling MFHI\n";
-//      uint32_t o0 = HandleAluDstOperand(MI->getOperand(0));
-//      Bank[o0] = Hi;
-//      return CurPC + 8;
-//    }
-//  case Mips::MFLO:
-//    {
-//      if (Verbosity > 0)
-//        DebugOut << " \tHandling MFLO\n";
-//      uint32_t o0 = HandleAluDstOperand(MI->getOperand(0));
-//      Bank[o0] = Lo;
-//      return CurPC + 8;
-//    }
+  case Mips::LDXC1:
   case Mips::LDC1:
     {
       if (Verbosity > 0)
-        DebugOut << " \tHandling LDC1\n";
+        DebugOut << " \tHandling LDC1, LDXC1\n";
       uint32_t o1 = HandleDoubleDstOperand(MI->getOperand(0));
       double o2 = HandleDoubleLoadOperand(MI->getOperand(1), MI->getOperand(2));
       DblBank[o1] = o2;
       return CurPC + 8;
     }
+  case Mips::LWXC1:
   case Mips::LWC1:
     {
       if (Verbosity > 0)
-        DebugOut << " \tHandling LWC1\n";
-      llvm_unreachable("LWC1 unimplemented!");
-      break;
+        DebugOut << " \tHandling LWC1, LWXC1\n";
+      uint32_t o1 = HandleFloatDstOperand(MI->getOperand(0));
+      float o2 = HandleFloatLoadOperand(MI->getOperand(1), MI->getOperand(2));
+      FltBank[o1] = o2;
+      return CurPC + 8;
     }
+  case Mips::SDXC1:
   case Mips::SDC1:
     {
       if (Verbosity > 0)
-        DebugOut << " \tHandling SDC1\n";
+        DebugOut << " \tHandling SDC1, SDXC1\n";
       double o1 = HandleDoubleSrcOperand(MI->getOperand(0));
       HandleDoubleSaveOperand(MI->getOperand(1), MI->getOperand(2), 
                               o1);
       return CurPC + 8;
     }
+  case Mips::SWXC1:
   case Mips::SWC1:
     {
       if (Verbosity > 0)
-        DebugOut << " \tHandling SWC1\n";
-      llvm_unreachable("LWC1 unimplemented!");
-      break;
+        DebugOut << " \tHandling SWC1, SWXC1\n";
+      float o1 = HandleFloatSrcOperand(MI->getOperand(0));
+      HandleFloatSaveOperand(MI->getOperand(1), MI->getOperand(2), o1);
+      return CurPC + 8;
+    }
+  // OpenISA compares always set FCC0. The condition numbers follow the
+  // MIPS c.cond.fmt table (see HandleFCmpOperand).
+  case Mips::C_UN_D32:
+  case Mips::C_EQ_D32:
+  case Mips::C_UEQ_D32:
+  case Mips::C_OLT_D32:
+  case Mips::C_ULT_D32:
+  case Mips::C_OLE_D32:
+  case Mips::C_ULE_D32:
+  case Mips::C_UN_S:
+  case Mips::C_EQ_S:
+  case Mips::C_UEQ_S:
+  case Mips::C_OLT_S:
+  case Mips::C_ULT_S:
+  case Mips::C_OLE_S:
+  case Mips::C_ULE_S:
+    {
+      if (Verbosity > 0)
+        DebugOut << " \tHandling C.cond.D, C.cond.S\n";
+      unsigned Cond;
+      bool Single = false;
+      switch (MI->getOpcode()) {
+      case Mips::C_UN_S:  Single = true; // fallthrough
+      case Mips::C_UN_D32:  Cond = 1; break;
+      case Mips::C_EQ_S:  Single = true; // fallthrough
+      case Mips::C_EQ_D32:  Cond = 2; break;
+      case Mips::C_UEQ_S: Single = true; // fallthrough
+      case Mips::C_UEQ_D32: Cond = 3; break;
+      case Mips::C_OLT_S: Single = true; // fallthrough
+      case Mips::C_OLT_D32: Cond = 4; break;
+      case Mips::C_ULT_S: Single = true; // fallthrough
+      case Mips::C_ULT_D32: Cond = 5; break;
+      case Mips::C_OLE_S: Single = true; // fallthrough
+      case Mips::C_OLE_D32: Cond = 6; break;
+      case Mips::C_ULE_S: Single = true; // fallthrough
+      default:              Cond = 7; break;
+      }
+      double o0, o1;
+      if (Single) {
+        o0 = HandleFloatSrcOperand(MI->getOperand(0));
+        o1 = HandleFloatSrcOperand(MI->getOperand(1));
+      } else {
+        o0 = HandleDoubleSrcOperand(MI->getOperand(0));
+        o1 = HandleDoubleSrcOperand(MI->getOperand(1));
+      }
+      SetFCC(0, FPCondition(Cond, o0, o1));
+      return CurPC + 8;
     }
-//  // XXX: Note for FCMP and MOVT: MIPS IV defines several FCC, floating-point
-//  // codes. We always use the 0th bit (MIPS I mode).
-//  // TODO: Implement all 8 CC bits.
-//  case Mips::FCMP_D32:
-//    {
-//      if (Verbosity > 0)
-//        DebugOut << " \tHandling FCMP_D32\n";
-//      double o0 = HandleDoubleSrcOperand(MI->getOperand(0));
-//      double o1 = HandleDoubleSrcOperand(MI->getOperand(1));
-////      if (MI->getOperand(2).getImm() != 2) {
-////        llvm_unreachable("Unimplemented FCC");
-////      }
-//      if (HandleFCmpOperand(MI->getOperand(2), o0, o1))
-//        FCC = 1;
-//      else
-//        FCC = 0;
-//      return CurPC + 8;
-//    }
-//  case Mips::FCMP_S32:
-//    {
-//      if (Verbosity > 0)
-//        DebugOut << " \tHandling FCMP_S32\n";
-//      llvm_unreachable("FCMP_S32 unimplemented!");
-//      break;
-//    }
-    // TODO: implement all fcc bits (get in MI->getOperand(2))
   case Mips::MOVT_I:
+  case Mips::MOVF_I:
     {
       if (Verbosity > 0)
-        DebugOut << " \tHandling MOVT\n";
+        DebugOut << " \tHandling MOVT, MOVF\n";
       uint32_t o1 = HandleAluSrcOperand(MI->getOperand(1));
       uint32_t o0 = HandleAluDstOperand(MI->getOperand(0));
-//      if (MI->getOperand(2).getImm() != 2) {
-//        llvm_unreachable("Unimplemented FCC");
-//      }
-      if (FCC) {
+      if (GetFCC(HandleFCCOperand(MI->getOperand(2))) ==
+          (MI->getOpcode() == Mips::MOVT_I))
         Bank[o0] = o1;
-      } 
       return CurPC + 8;
     }
   case Mips::MOVT_D32:
+  case Mips::MOVF_D32:
     {
       if (Verbosity > 0)
-        DebugOut << " \tHandling MOVT\n";
+        DebugOut << " \tHandling MOVT.D, MOVF.D\n";
       double o1 = HandleDoubleSrcOperand(MI->getOperand(1));
       uint32_t o0 = HandleDoubleDstOperand(MI->getOperand(0));
-//      if (MI->getOperand(2).getImm() != 2) {
-//        llvm_unreachable("Unimplemented FCC");
-//      }
-      if (FCC) {
+      if (GetFCC(HandleFCCOperand(MI->getOperand(2))) ==
+          (MI->getOpcode() == Mips::MOVT_D32))
         DblBank[o0] = o1;
-      } 
       return CurPC + 8;
     }
-  case Mips::MOVF_I:
+  case Mips::MOVT_S:
+  case Mips::MOVF_S:
     {
       if (Verbosity > 0)
-        DebugOut << " \tHandling MOVF\n";
-      uint32_t o1 = HandleAluSrcOperand(MI->getOperand(1));
-      uint32_t o0 = HandleAluDstOperand(MI->getOperand(0));
-//      if (MI->getOperand(2).getImm() != 2) {
-//        llvm_unreachable("Unimplemented FCC");
-//      }
-      if (!FCC) {
-        Bank[o0] = o1;
-      } 
+        DebugOut << " \tHandling MOVT.S, MOVF.S\n";
+      float o1 = HandleFloatSrcOperand(MI->getOperand(1));
+      uint32_t o0 = HandleFloatDstOperand(MI->getOperand(0));
+      if (GetFCC(HandleFCCOperand(MI->getOperand(2))) ==
+          (MI->getOpcode() == Mips::MOVT_S))
+        FltBank[o0] = o1;
       return CurPC + 8;
     }
-  case Mips::MOVF_D32:
+  case Mips::MOVN_I_D32:
+  case Mips::MOVZ_I_D32:
     {
       if (Verbosity > 0)
-        DebugOut << " \tHandling MOVF\n";
+        DebugOut << " \tHandling MOVN.D, MOVZ.D\n";
       double o1 = HandleDoubleSrcOperand(MI->getOperand(1));
+      uint32_t o2 = HandleAluSrcOperand(MI->getOperand(2));
       uint32_t o0 = HandleDoubleDstOperand(MI->getOperand(0));
-      //      if (MI->getOperand(2).getImm() != 2) {
-      //        llvm_unreachable("Unimplemented FCC");
-      //      }
-      if (!FCC) {
+      if ((o2 != 0) == (MI->getOpcode() == Mips::MOVN_I_D32))
         DblBank[o0] = o1;
-      } 
+      return CurPC + 8;
+    }
+  case Mips::MOVN_I_S:
+  case Mips::MOVZ_I_S:
+    {
+      if (Verbosity > 0)
+        DebugOut << " \tHandling MOVN.S, MOVZ.S\n";
+      float o1 = HandleFloatSrcOperand(MI->getOperand(1));
+      uint32_t o2 = HandleAluSrcOperand(MI->getOperand(2));
+      uint32_t o0 = HandleFloatDstOperand(MI->getOperand(0));
+      if ((o2 != 0) == (MI->getOpcode() == Mips::MOVN_I_S))
+        FltBank[o0] = o1;
       return CurPC + 8;
     }
   case Mips::FSUB_D32:
@@ -488,8 +624,44 @@ uint64_t OiMachineModel::executeInstruction(const MCInst *MI, uint64_t CurPC) {
     {
       if (Verbosity > 0)
         DebugOut << " \tHandling FADD_S FSUB_S FMUL_S FDIV_S\n";
-      llvm_unreachable("FSUB_S.. unimplemented!");
-      break;
+      float o1 = HandleFloatSrcOperand(MI->getOperand(1));
+      float o2 = HandleFloatSrcOperand(MI->getOperand(2));
+      uint32_t o0 = HandleFloatDstOperand(MI->getOperand(0));
+      switch (MI->getOpcode()) {
+      case Mips::FADD_S: FltBank[o0] = o1 + o2; break;
+      case Mips::FSUB_S: FltBank[o0] = o1 - o2; break;
+      case Mips::FMUL_S: FltBank[o0] = o1 * o2; break;
+      default:           FltBank[o0] = o1 / o2; break;
+      }
+      return CurPC + 8;
+    }
+  case Mips::MADD_D32:
+  case Mips::MSUB_D32:
+    {
+      if (Verbosity > 0)
+        DebugOut << " \tHandling MADD.D, MSUB.D\n";
+      // fd = fs * ft +/- fr, operands in (fd, fr, fs, ft) order. The
+      // product is rounded first, as madd.fmt is not fused.
+      double o1 = HandleDoubleSrcOperand(MI->getOperand(1));
+      double o2 = HandleDoubleSrcOperand(MI->getOperand(2));
+      double o3 = HandleDoubleSrcOperand(MI->getOperand(3));
+      uint32_t o0 = HandleDoubleDstOperand(MI->getOperand(0));
+      double Prod = o2 * o3;
+      DblBank[o0] = MI->getOpcode() == Mips::MADD_D32 ? Prod + o1 : Prod - o1;
+      return CurPC + 8;
+    }
+  case Mips::MADD_S:
+  case Mips::MSUB_S:
+    {
+      if (Verbosity > 0)
+        DebugOut << " \tHandling MADD.S, MSUB.S\n";
+      float o1 = HandleFloatSrcOperand(MI->getOperand(1));
+      float o2 = HandleFloatSrcOperand(MI->getOperand(2));
+      float o3 = HandleFloatSrcOperand(MI->getOperand(3));
+      uint32_t o0 = HandleFloatDstOperand(MI->getOperand(0));
+      float Prod = o2 * o3;
+      FltBank[o0] = MI->getOpcode() == Mips::MADD_S ? Prod + o1 : Prod - o1;
+      return CurPC + 8;
     }
   case Mips::FMOV_D32:
     {
@@ -500,6 +672,15 @@ uint64_t OiMachineModel::executeInstruction(const MCInst *MI, uint64_t CurPC) {
       DblBank[o0] = o1;
       return CurPC + 8;
     }
+  case Mips::FMOV_S:
+    {
+      if (Verbosity > 0)
+        DebugOut << " \tHandling FMOV.S\n";
+      uint32_t o1 = HandleFloatDstOperand(MI->getOperand(1));
+      uint32_t o0 = HandleFloatDstOperand(MI->getOperand(0));
+      SetFloatBits(o0, GetFloatBits(o1));
+      return CurPC + 8;
+    }
   case Mips::FMUL_D32:
     {
       if (Verbosity > 0)
@@ -520,61 +701,117 @@ uint64_t OiMachineModel::executeInstruction(const MCInst *MI, uint64_t CurPC) {
       DblBank[o0] = o1 / o2;
       return CurPC + 8;
     }
+  case Mips::FSQRT_D32:
+  case Mips::FNEG_D32:
+  case Mips::FABS_D32:
+    {
+      if (Verbosity > 0)
+        DebugOut << " \tHandling SQRT.D, NEG.D, ABS.D\n";
+      double o1 = HandleDoubleSrcOperand(MI->getOperand(1));
+      uint32_t o0 = HandleDoubleDstOperand(MI->getOperand(0));
+      if (MI->getOpcode() == Mips::FSQRT_D32)
+        DblBank[o0] = sqrt(o1);
+      else if (MI->getOpcode() == Mips::FNEG_D32)
+        DblBank[o0] = -o1;
+      else
+        DblBank[o0] = fabs(o1);
+      return CurPC + 8;
+    }
+  case Mips::FSQRT_S:
+  case Mips::FNEG_S:
+  case Mips::FABS_S:
+    {
+      if (Verbosity > 0)
+        DebugOut << " \tHandling SQRT.S, NEG.S, ABS.S\n";
+      float o1 = HandleFloatSrcOperand(MI->getOperand(1));
+      uint32_t o0 = HandleFloatDstOperand(MI->getOperand(0));
+      if (MI->getOpcode() == Mips::FSQRT_S)
+        FltBank[o0] = sqrtf(o1);
+      else if (MI->getOpcode() == Mips::FNEG_S)
+        FltBank[o0] = -o1;
+      else
+        FltBank[o0] = fabsf(o1);
+      return CurPC + 8;
+    }
   case Mips::CVT_D32_W:
     {
       if (Verbosity > 0)
         DebugOut << " \tHandling CVT.D.W\n";
-      llvm_unreachable("CVT.D.W unimplemented!");
-      break;
+      uint32_t o1 = HandleFloatDstOperand(MI->getOperand(1));
+      uint32_t o0 = HandleDoubleDstOperand(MI->getOperand(0));
+      DblBank[o0] = (int32_t) GetFloatBits(o1);
+      return CurPC + 8;
     }
   case Mips::CVT_S_W:
     {
       if (Verbosity > 0)
         DebugOut << " \tHandling CVT.S.W\n";
-      llvm_unreachable("CVT.S.W unimplemented!");
-      break;
+      uint32_t o1 = HandleFloatDstOperand(MI->getOperand(1));
+      uint32_t o0 = HandleFloatDstOperand(MI->getOperand(0));
+      FltBank[o0] = (int32_t) GetFloatBits(o1);
+      return CurPC + 8;
     }
   case Mips::CVT_D32_S:
     {
       if (Verbosity > 0)
         DebugOut << " \tHandling CVT.D.S\n";
-      llvm_unreachable("CVT.D.S unimplemented!");
-      break;
+      float o1 = HandleFloatSrcOperand(MI->getOperand(1));
+      uint32_t o0 = HandleDoubleDstOperand(MI->getOperand(0));
+      DblBank[o0] = o1;
+      return CurPC + 8;
     }
   case Mips::CVT_S_D32:
     {
       if (Verbosity > 0)
         DebugOut << " \tHandling CVT.S.D\n";
-      llvm_unreachable("CVT.S.D unimplemented!");
-      break;
+      double o1 = HandleDoubleSrcOperand(MI->getOperand(1));
+      uint32_t o0 = HandleFloatDstOperand(MI->getOperand(0));
+      FltBank[o0] = (float) o1;
+      return CurPC + 8;
     }
   case Mips::TRUNC_W_D32:
+  case Mips::ROUND_W_D32:
+  case Mips::CEIL_W_D32:
+  case Mips::FLOOR_W_D32:
     {
       if (Verbosity > 0)
-        DebugOut << " \tHandling TRUNC.W.D\n";
-      llvm_unreachable("TRUNC.W.D unimplemented!");
-      break;
+        DebugOut << " \tHandling TRUNC.W.D, ROUND.W.D, CEIL.W.D, FLOOR.W.D\n";
+      double o1 = HandleDoubleSrcOperand(MI->getOperand(1));
+      uint32_t o0 = HandleFloatDstOperand(MI->getOperand(0));
+      if (MI->getOpcode() == Mips::ROUND_W_D32)
+        o1 = rint(o1);
+      else if (MI->getOpcode() == Mips::CEIL_W_D32)
+        o1 = ceil(o1);
+      else if (MI->getOpcode() == Mips::FLOOR_W_D32)
+        o1 = floor(o1);
+      SetFloatBits(o0, FPToWord(o1));
+      return CurPC + 8;
     }
   case Mips::TRUNC_W_S:
+  case Mips::ROUND_W_S:
+  case Mips::CEIL_W_S:
+  case Mips::FLOOR_W_S:
     {
       if (Verbosity > 0)
-        DebugOut << " \tHandling TRUNC.W.S\n";
-      llvm_unreachable("TRUNC.W.S unimplemented!");
-      break;
+        DebugOut << " \tHandling TRUNC.W.S, ROUND.W.S, CEIL.W.S, FLOOR.W.S\n";
+      double o1 = HandleFloatSrcOperand(MI->getOperand(1));
+      uint32_t o0 = HandleFloatDstOperand(MI->getOperand(0));
+      if (MI->getOpcode() == Mips::ROUND_W_S)
+        o1 = rint(o1);
+      else if (MI->getOpcode() == Mips::CEIL_W_S)
+        o1 = ceil(o1);
+      else if (MI->getOpcode() == Mips::FLOOR_W_S)
+        o1 = floor(o1);
+      SetFloatBits(o0, FPToWord(o1));
+      return CurPC + 8;
     }
   case Mips::MFC1:
     {
       if (Verbosity > 0)
         DebugOut << " \tHandling MFC1\n";
-      double o1 = HandleDoubleSrcOperand(MI->getOperand(1));
+      uint32_t o1 = HandleFloatDstOperand(MI->getOperand(1));
       uint32_t o0 = HandleAluDstOperand(MI->getOperand(0));
-      uint64_t tmp = 0;
-      memcpy(&tmp,&o1,sizeof(uint64_t));
-      if (ConvToDirective(conv32(MI->getOperand(1).getReg())) % 2) {
-        Bank[o0] = tmp >> 32;
-      } else {
-        Bank[o0] = tmp & 0xFFFFFFFFULL;
-      }
+      Bank[o0] = GetFloatBits(o1);
       return CurPC + 8;
     }
   case Mips::MTC1:
@@ -582,17 +819,40 @@ uint64_t OiMachineModel::executeInstruction(const MCInst *MI, uint64_t CurPC) {
       if (Verbosity > 0)
         DebugOut << " \tHandling MTC1\n";
       uint32_t o1 = HandleAluSrcOperand(MI->getOperand(1));
-      uint32_t o0 = HandleDoubleDstOperand(MI->getOperand(0));
-      uint64_t val = 0;
-      memcpy(&val,&DblBank[o0],sizeof(uint64_t));
-      if (ConvToDirective(conv32(MI->getOperand(0).getReg())) % 2) {
-        val = val & 0xFFFFFFFFULL;
-        val |= ((uint64_t)(o1)) << 32;
-      } else {
-        val = val & 0xFFFFFFFF00000000ULL;
-        val |= o1;
-      }      
-      DblBank[o0] = val;
+      uint32_t o0 = HandleFloatDstOperand(MI->getOperand(0));
+      SetFloatBits(o0, o1);
+      return CurPC + 8;
+    }
+  case Mips::MFHC1_D32:
+  case Mips::MFLC1_D32:
+    {
+      if (Verbosity > 0)
+        DebugOut << " \tHandling MFHC1, MFLC1\n";
+      double o1 = HandleDoubleSrcOperand(MI->getOperand(1));
+      uint32_t o0 = HandleAluDstOperand(MI->getOperand(0));
+      uint64_t Bits;
+      memcpy(&Bits, &o1, sizeof(Bits));
+      if (MI->getOpcode() == Mips::MFHC1_D32)
+        Bank[o0] = Bits >> 32;
+      else
+        Bank[o0] = Bits & 0xFFFFFFFFULL;
+      return CurPC + 8;
+    }
+  case Mips::MTHC1_D32:
+  case Mips::MTLC1_D32:
+    {
+      if (Verbosity > 0)
+        DebugOut << " \tHandling MTHC1, MTLC1\n";
+      // The destination is duplicated in operands 0 and 1
+      uint32_t o2 = HandleAluSrcOperand(MI->getOperand(2));
+      uint32_t o0 = HandleDoubleDstOperand(MI->getOperand(1));
+      uint64_t Bits;
+      memcpy(&Bits, &DblBank[o0], sizeof(Bits));
+      if (MI->getOpcode() == Mips::MTHC1_D32)
+        Bits = (Bits & 0xFFFFFFFFULL) | ((uint64_t) o2 << 32);
+      else
+        Bits = (Bits & 0xFFFFFFFF00000000ULL) | o2;
+      memcpy(&DblBank[o0], &Bits, sizeof(Bits));
       return CurPC + 8;
     }
   case Mips::BC1T:
@@ -600,9 +860,7 @@ uint64_t OiMachineModel::executeInstruction(const MCInst *MI, uint64_t CurPC) {
     {
       if (Verbosity > 0)
         DebugOut << " \tHandling BC1F, BC1T\n";
-      if (MI->getOpcode() == Mips::BC1T && FCC)
-        return HandleBranchTarget(MI->getOperand(0), true, CurPC);
-      else if (MI->getOpcode() == Mips::BC1F && !FCC)
+      if (GetFCC(0) == (MI->getOpcode() == Mips::BC1T))
         return HandleBranchTarget(MI->getOperand(0), true, CurPC);
       return CurPC + 8;
     }
@@ -953,6 +1211,36 @@ uint64_t OiMachineModel::executeInstruction(const MCInst *MI, uint64_t CurPC) {
     *o1 = (uint16_t)(o0 & 0xFFFF);
     return CurPC + 8;
   }
+  case Mips::LL: {
+    if (Verbosity > 0)
+      DebugOut << " \tHandling LL\n";
+    uint32_t o0 = HandleAluDstOperand(MI->getOperand(0));
+    uint32_t* o1 = HandleMemOperand(MI->getOperand(1), MI->getOperand(2));
+    LLAddr = (uint8_t *)o1 - Mem->memory;
+    LLValue = *o1;
+    LLValid = true;
+    Bank[o0] = LLValue;
+    return CurPC + 8;
+  }
+  case Mips::SC: {
+    if (Verbosity > 0)
+      DebugOut << " \tHandling SC\n";
+    uint32_t o0 = HandleAluDstOperand(MI->getOperand(0));
+    uint32_t o1 = HandleAluSrcOperand(MI->getOperand(1));
+    uint32_t* o2 = HandleMemOperand(MI->getOperand(2), MI->getOperand(3));
+    // Another thread may have stored to the word since LL; the CAS only
+    // lets the store through if the value LL saw is still there.
+    bool Success = LLValid && LLAddr == (uint32_t)((uint8_t *)o2 - Mem->memory)
+      && sys::CompareAndSwap(o2, o1, LLValue) == LLValue;
+    LLValid = false;
+    Bank[o0] = Success;
+    return CurPC + 8;
+  }
+  case Mips::SYNC:
+    if (Verbosity > 0)
+      DebugOut << " \tHandling SYNC\n";
+    sys::MemoryFence();
+    return CurPC + 8;
   case Mips::SW: {
     //  case Mips::SW64: {
     if (Verbosity > 0)
@@ -1012,7 +1300,9 @@ uint64_t OiMachineModel::executeInstruction(const MCInst *MI, uint64_t CurPC) {
     return HandleAluSrcOperand(MI->getOperand(0));
   }
   case Mips::SYSCALL: {
-    ProcessSyscall(this);
+    if (Profile)
+      Profile->countSyscall(Bank[4]);
+    ProcessSyscall(this, CurPC + 8);
     return CurPC + 8;
   }
   case Mips::NOP:
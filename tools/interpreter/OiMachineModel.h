@@ -27,6 +27,11 @@ class ObjectFile;
 
 using namespace object;
 
+class OiAsyncIO;
+class OiMemListener;
+class OiProfile;
+class OiTraceWriter;
+
 class OiMachineModel {
   const MCAsmInfo &MAI;
   const MCInstrInfo &MII;
@@ -34,23 +39,39 @@ class OiMachineModel {
   MCInstPrinter &IP;
 public:
   OiMemoryModel *Mem;
+  OiProfile *Profile;
+  // When set, executeInstruction records every instruction it runs
+  OiTraceWriter *Trace;
+  // When set, executeInstruction reports every guest load and store to it
+  OiMemListener *MemListener;
+  // When set, guest file reads and writes go through it
+  OiAsyncIO *AsyncIO;
 
   OiMachineModel(const MCAsmInfo &MAI, const MCInstrInfo &MII,
                  const MCRegisterInfo &MRI, OiMemoryModel *Mem,
                  MCInstPrinter &IP) 
-    : MAI(MAI), MII(MII), MRI(MRI), IP(IP), Mem(Mem)
+    : MAI(MAI), MII(MII), MRI(MRI), IP(IP), Mem(Mem), Profile(nullptr),
+      Trace(nullptr), MemListener(nullptr), AsyncIO(nullptr), Tid(0), ClearTid(0), Exited(false),
+      RunThread(nullptr), LastMemAddr(0), LLValid(false)
   {
     for (int i = 0; i < 32; ++i) {
       Bank[i] = 0;
     }
     Hi = 0;
     Lo = 0;
-    for (int i = 0; i < 16; ++i) {
+    FCC = 0;
+    for (int i = 0; i < 32; ++i) {
       DblBank[i] = 0.0;
-    }    
+    }
+    for (int i = 0; i < 64; ++i) {
+      FltBank[i] = 0.0f;
+    }
   }
 
   void ConfigureUserLevelStack(int argc, uint8_t **argv);
+  // Create the state of a new guest thread sharing this one's memory, as
+  // done by clone. A zero StackPtr keeps the current stack pointer.
+  OiMachineModel *CreateThread(uint32_t StackPtr, uint32_t NewTid);
   uint64_t executeInstruction(const MCInst *MI, uint64_t CurPC);
   void StartFunction(StringRef &N);
   void FinishFunction();
@@ -61,10 +82,35 @@ public:
   }
 
   uint32_t Bank[32];
+  // FCC holds the eight floating-point condition code bits, FCC0 in bit 0
   uint32_t Hi, Lo, FCC;
-  double   DblBank[16];
+  // Double precision registers D0-D31 and single precision registers
+  // F0-F63. As in static-bt, the two files do not alias each other. Word
+  // values (cvt.*.w sources, trunc.w.* results) live in FltBank as bits.
+  double   DblBank[32];
+  float    FltBank[64];
+
+  // Guest thread id, 0 for the initial thread. Threads created by clone
+  // run until their exit syscall sets Exited; ClearTid is the guest
+  // address zeroed (and futex-woken) when that happens.
+  uint32_t Tid, ClearTid;
+  bool Exited;
+  // Set by the driver to run a cloned guest thread from PC on the calling
+  // host thread. clone fails with ENOSYS while it is NULL.
+  void (*RunThread)(OiMachineModel *MM, uint64_t PC);
 
 private:
+  uint64_t interpret(const MCInst *MI, uint64_t CurPC);
+  uint64_t executeTraced(const MCInst *MI, uint64_t CurPC);
+  uint64_t executeObserved(const MCInst *MI, uint64_t CurPC);
+
+  // Guest address of the last load or store, for tracing and listeners
+  uint32_t LastMemAddr;
+
+  // LL/SC reservation. SC succeeds if the reserved word still holds the
+  // value LL read, checked with an atomic compare-and-swap.
+  uint32_t LLAddr, LLValue;
+  bool LLValid;
 
   uint32_t HandleAluSrcOperand(const MCOperand &o);
   uint32_t HandleAluDstOperand(const MCOperand &o);
@@ -77,19 +123,27 @@ private:
   double HandleDoubleLoadOperand(const MCOperand &o, const MCOperand &o2);
   void HandleDoubleSaveOperand(const MCOperand &o, const MCOperand &o2,
                                double val);
-  uint32_t HandleFloatMemOperand(const MCOperand &o, const MCOperand &o2,
-                             bool IsLoad);
+  float HandleFloatLoadOperand(const MCOperand &o, const MCOperand &o2);
+  void HandleFloatSaveOperand(const MCOperand &o, const MCOperand &o2,
+                              float val);
   uint32_t HandleLUiOperand(const MCOperand &o);
   uint32_t HandleCallTarget(const MCOperand &o);
   bool HandleFCmpOperand(const MCOperand &o, double o0, double o1);
+  unsigned HandleFCCOperand(const MCOperand &o);
+  bool GetFCC(unsigned CC) const { return (FCC >> CC) & 1; }
+  void SetFCC(unsigned CC, bool Val) {
+    FCC = (FCC & ~(1U << CC)) | ((uint32_t) Val << CC);
+  }
   uint32_t HandleBranchTarget(const MCOperand &o, bool IsRelative,
                               uint64_t CurPC);
   uint32_t HandleSaveDouble(Value *In, Value *&Out1, Value *&Out2);
   double HandleDoubleSrcOperand(const MCOperand &o);
   uint32_t HandleDoubleDstOperand(const MCOperand &o);
   uint32_t HandleSaveFloat(Value *In, Value *&V);
-  uint32_t HandleFloatSrcOperand(const MCOperand &o);
+  float HandleFloatSrcOperand(const MCOperand &o);
   uint32_t HandleFloatDstOperand(const MCOperand &o);
+  uint32_t GetFloatBits(uint32_t Reg) const;
+  void SetFloatBits(uint32_t Reg, uint32_t Bits);
 
 
   void printOperand(const MCInst *MI, unsigned OpNo, raw_ostream &O);
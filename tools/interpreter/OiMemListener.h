@@ -0,0 +1,30 @@
+//=== OiMemListener.h - Guest memory access callbacks -*- C++ -*-==//
+//
+// Interface for tools that observe every guest load and store, such as the
+// cache model. A listener is attached to OiMachineModel::MemListener. While
+// none is attached the interpreter runs its usual specialized handlers and
+// pays nothing; attaching one sends execution through the generic
+// executeInstruction path, where accesses are reported.
+//
+//===------------------------------------------------------------===//
+
+#ifndef OIMEMLISTENER_H
+#define OIMEMLISTENER_H
+
+#include "llvm/Support/DataTypes.h"
+
+namespace llvm {
+
+class OiMemListener {
+public:
+  virtual ~OiMemListener() {}
+
+  // The instruction at PC read (or, if IsStore, wrote) Size bytes at guest
+  // address Addr. Called after the instruction executed.
+  virtual void memAccess(uint32_t PC, uint32_t Addr, unsigned Size,
+                         bool IsStore) = 0;
+};
+
+} // end namespace llvm
+
+#endif
@@ -1,26 +1,393 @@
-
-
 #include "OiMemoryModel.h"
 #include "elf32-tiny.h"
 #include "InterpUtils.h"
+#include "llvm/ADT/Twine.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
 
 using namespace llvm;
 
-uint64_t OiMemoryModel::LoadELF(const char *filename)
-{ 
+namespace {
+
+// Dynamic relocations applied to ET_DYN images
+enum {
+  OI_R_MIPS_NONE = 0,
+  OI_R_MIPS_32 = 2,
+  OI_R_MIPS_REL32 = 3,
+  OI_R_MIPS_JUMP_SLOT = 127
+};
+
+// A pre-relocated image: this header, the page ranges of the loaded
+// segments, then the contents of each range at a page-aligned offset so
+// that it can be mapped straight into guest memory.
+const char ImageCacheMagic[8] = { 'O', 'I', 'I', 'M', 'A', 'G', 'E', 0 };
+const uint32_t ImageCacheVersion = 1;
+
+struct ImageCacheHeader {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t PageSize;
+  // Identify the ELF file and load base the image was built from
+  uint64_t SrcSize;
+  int64_t SrcMTime;
+  int64_t SrcMTimeNsec;
+  uint64_t SrcIno;
+  uint32_t DynBase;
+  uint32_t NumRanges;
+  uint32_t Entry;
+  uint32_t HeapPtr;
+  uint32_t LoadBias;
+  uint32_t Pad;
+};
+
+struct ImageCacheRange {
+  uint32_t Addr;
+  uint32_t Size;
+  uint64_t Offset;
+};
+
+uint64_t PageMask() {
+  return sysconf(_SC_PAGESIZE) - 1;
+}
+
+void FatalLoadError(int fd, const Twine &Msg) {
+  close(fd);
+  report_fatal_error(Msg);
+}
+
+// Name of the cached image of filename in CacheDir, from a FNV-1a hash of
+// the path and everything that invalidates the image
+std::string ImageCachePath(const std::string &CacheDir, const char *filename,
+                           const struct stat &St, uint32_t DynBase) {
+  char Real[PATH_MAX];
+  const char *Path = realpath(filename, Real) ? Real : filename;
+  uint64_t Hash = 0xcbf29ce484222325ULL;
+  auto Mix = [&Hash](const void *Data, size_t Size) {
+    for (size_t i = 0; i < Size; ++i) {
+      Hash ^= static_cast<const unsigned char *>(Data)[i];
+      Hash *= 0x100000001b3ULL;
+    }
+  };
+  Mix(Path, strlen(Path));
+  Mix(&St.st_ino, sizeof(St.st_ino));
+  Mix(&St.st_size, sizeof(St.st_size));
+  Mix(&St.st_mtim, sizeof(St.st_mtim));
+  Mix(&DynBase, sizeof(DynBase));
+  std::string Name;
+  raw_string_ostream OS(Name);
+  OS << CacheDir << "/" << format("%016" PRIx64, Hash) << ".oiimg";
+  return OS.str();
+}
+
+void FillCacheKey(ImageCacheHeader &H, const struct stat &St,
+                  uint32_t DynBase) {
+  memset(&H, 0, sizeof(H));
+  memcpy(H.Magic, ImageCacheMagic, sizeof(H.Magic));
+  H.Version = ImageCacheVersion;
+  H.PageSize = PageMask() + 1;
+  H.SrcSize = St.st_size;
+  H.SrcMTime = St.st_mtim.tv_sec;
+  H.SrcMTimeNsec = St.st_mtim.tv_nsec;
+  H.SrcIno = St.st_ino;
+  H.DynBase = DynBase;
+}
+
+// Page-aligned, merged address ranges covering the file-backed part of
+// every PT_LOAD segment; the rest is zero-filled guest memory.
+std::vector<std::pair<uint64_t, uint64_t> >
+LoadedRanges(const std::vector<Elf32_Phdr> &Loads, uint32_t Bias) {
+  uint64_t pagemask = PageMask();
+  std::vector<std::pair<uint64_t, uint64_t> > Ranges;
+  for (const Elf32_Phdr &P : Loads) {
+    if (P.p_filesz == 0)
+      continue;
+    uint64_t Start = ((uint64_t) P.p_vaddr + Bias) & ~pagemask;
+    uint64_t End = ((uint64_t) P.p_vaddr + Bias + P.p_filesz + pagemask) &
+                   ~pagemask;
+    Ranges.push_back(std::make_pair(Start, End));
+  }
+  std::sort(Ranges.begin(), Ranges.end());
+  std::vector<std::pair<uint64_t, uint64_t> > Merged;
+  for (const auto &R : Ranges) {
+    if (!Merged.empty() && R.first <= Merged.back().second)
+      Merged.back().second = std::max(Merged.back().second, R.second);
+    else
+      Merged.push_back(R);
+  }
+  return Merged;
+}
+
+} // end anonymous namespace
+
+OiMemoryModel::OiMemoryModel(uint64_t Size)
+  : TOTALSIZE(Size), heapPtr(0), LoadBias(0) {
+  if (Size == 0 || Size > MAXSIZE)
+    report_fatal_error("guest memory size must be between 1 byte and 4 GiB");
+  // Only reserve the address space; the host commits pages on first touch
+  void *Ptr = mmap(NULL, TOTALSIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (Ptr == MAP_FAILED)
+    report_fatal_error(Twine("reserving guest memory: ") + strerror(errno));
+  memory = reinterpret_cast<uint8_t *>(Ptr);
+}
+
+OiMemoryModel::~OiMemoryModel() {
+  if (memory)
+    munmap(memory, TOTALSIZE);
+}
+
+// Read the ELF and program headers of filename. Returns false if it is not
+// an ELF file.
+static bool ReadELFHeaders(int fd, Elf32_Ehdr &ehdr,
+                           std::vector<Elf32_Phdr> &phdrs) {
+  if ((read(fd, &ehdr, sizeof(ehdr)) != sizeof(ehdr)) ||  // read header
+      (strncmp((char *)ehdr.e_ident, ELFMAG, 4) != 0))    // test elf magic number
+    return false;
+  phdrs.resize(ehdr.e_phnum);
+  for (unsigned i = 0; i < ehdr.e_phnum; i++) {
+    if (pread(fd, &phdrs[i], sizeof(Elf32_Phdr),
+              ehdr.e_phoff + ehdr.e_phentsize * i) != sizeof(Elf32_Phdr))
+      FatalLoadError(fd, "reading ELF program header\n");
+  }
+  return true;
+}
+
+// Distance ET_DYN images are moved by so that their first page lands at
+// DynBase
+static uint32_t ComputeLoadBias(const Elf32_Ehdr &ehdr,
+                                const std::vector<Elf32_Phdr> &phdrs,
+                                uint32_t DynBase) {
+  if (ehdr.e_type != ET_DYN)
+    return 0;
+  uint64_t Lowest = ~0ULL;
+  for (const Elf32_Phdr &P : phdrs)
+    if (P.p_type == PT_LOAD)
+      Lowest = std::min<uint64_t>(Lowest, P.p_vaddr);
+  if (Lowest == ~0ULL)
+    return 0;
+  return DynBase - (Lowest & ~PageMask());
+}
+
+uint64_t OiMemoryModel::GetImageEnd(const char *filename, uint32_t DynBase) {
+  Elf32_Ehdr ehdr;
+  std::vector<Elf32_Phdr> phdrs;
+  int fd;
+  if (!filename || ((fd = open(filename, O_RDONLY)) == -1))
+    return 0;
+  uint64_t End = 0;
+  if (ReadELFHeaders(fd, ehdr, phdrs)) {
+    uint32_t Bias = ComputeLoadBias(ehdr, phdrs, DynBase);
+    for (const Elf32_Phdr &P : phdrs)
+      if (P.p_type == PT_LOAD)
+        End = std::max<uint64_t>(End, (uint64_t) P.p_vaddr + Bias +
+                                          P.p_memsz);
+  }
+  close(fd);
+  return End;
+}
+
+static uint32_t *GuestWord(OiMemoryModel &Mem, uint64_t Addr,
+                           const char *What) {
+  if (Addr + 4 > Mem.TOTALSIZE || Addr % 4 != 0)
+    report_fatal_error(Twine("ELF ") + What + " outside guest memory");
+  return reinterpret_cast<uint32_t *>(&Mem.memory[Addr]);
+}
+
+// Apply the dynamic relocations of an ET_DYN image already loaded at
+// Mem.LoadBias, given the unrelocated address of its dynamic section
+static void RelocateImage(OiMemoryModel &Mem, uint32_t DynamicAddr) {
+  uint32_t Bias = Mem.LoadBias;
+  uint64_t Rel = 0, RelSize = 0, RelEnt = sizeof(Elf32_Rel);
+  uint64_t JmpRel = 0, JmpRelSize = 0;
+  uint64_t SymTab = 0, PltGot = 0;
+  uint32_t LocalGotNo = 0, GotSym = 0, SymTabNo = 0;
+  bool HasGot = false;
+  for (uint64_t Addr = (uint64_t) DynamicAddr + Bias;; Addr += 8) {
+    int32_t Tag = *GuestWord(Mem, Addr, "dynamic section");
+    uint32_t Val = *GuestWord(Mem, Addr + 4, "dynamic section");
+    if (Tag == DT_NULL)
+      break;
+    switch (Tag) {
+    case DT_NEEDED:
+      report_fatal_error("Unsupported: ELF image needs shared libraries");
+    case DT_REL:             Rel = (uint64_t) Val + Bias; break;
+    case DT_RELSZ:           RelSize = Val; break;
+    case DT_RELENT:          RelEnt = Val; break;
+    case DT_JMPREL:          JmpRel = (uint64_t) Val + Bias; break;
+    case DT_PLTRELSZ:        JmpRelSize = Val; break;
+    case DT_SYMTAB:          SymTab = (uint64_t) Val + Bias; break;
+    case DT_PLTGOT:
+      PltGot = (uint64_t) Val + Bias;
+      HasGot = true;
+      break;
+    case DT_MIPS_LOCAL_GOTNO: LocalGotNo = Val; break;
+    case DT_MIPS_GOTSYM:     GotSym = Val; break;
+    case DT_MIPS_SYMTABNO:   SymTabNo = Val; break;
+    default: break;
+    }
+  }
+  if (RelEnt < sizeof(Elf32_Rel))
+    report_fatal_error("Unsupported: ELF relocation entry size");
+
+  // Value of dynamic symbol Index after loading; undefined weak symbols
+  // resolve to 0
+  auto SymbolValue = [&](uint32_t Index) -> uint32_t {
+    uint64_t Addr = SymTab + (uint64_t) Index * sizeof(Elf32_Sym);
+    if (!SymTab || Addr + sizeof(Elf32_Sym) > Mem.TOTALSIZE)
+      report_fatal_error("ELF dynamic symbol outside guest memory");
+    Elf32_Sym Sym;
+    memcpy(&Sym, &Mem.memory[Addr], sizeof(Sym));
+    if (Sym.st_shndx == SHN_UNDEF) {
+      if (ELF32_ST_BIND(Sym.st_info) != STB_WEAK)
+        report_fatal_error("Unsupported: ELF image has undefined symbols");
+      return 0;
+    }
+    if (Sym.st_shndx == SHN_ABS)
+      return Sym.st_value;
+    return Sym.st_value + Bias;
+  };
+
+  // The MIPS GOT is not covered by relocations: local entries move with
+  // the image and global ones take their symbol's address. Entry 0 is the
+  // lazy resolver and entry 1, if its top bit is set, the module pointer.
+  if (HasGot) {
+    uint32_t First =
+      (*GuestWord(Mem, PltGot + 4, "GOT") & 0x80000000) ? 2 : 1;
+    for (uint32_t i = First; i < LocalGotNo; ++i)
+      *GuestWord(Mem, PltGot + 4ULL * i, "GOT") += Bias;
+    for (uint32_t i = GotSym; i < SymTabNo; ++i)
+      *GuestWord(Mem, PltGot + 4ULL * (LocalGotNo + i - GotSym), "GOT") =
+        SymbolValue(i);
+  }
+
+  uint64_t Tables[2][2] = { { Rel, RelSize }, { JmpRel, JmpRelSize } };
+  for (const auto &T : Tables) {
+    for (uint64_t Off = 0; T[0] && Off + sizeof(Elf32_Rel) <= T[1];
+         Off += RelEnt) {
+      uint32_t Offset = *GuestWord(Mem, T[0] + Off, "relocation");
+      uint32_t Info = *GuestWord(Mem, T[0] + Off + 4, "relocation");
+      uint32_t Sym = ELF32_R_SYM(Info);
+      switch (ELF32_R_TYPE(Info)) {
+      case OI_R_MIPS_NONE:
+        break;
+      case OI_R_MIPS_32:
+      case OI_R_MIPS_REL32:
+        *GuestWord(Mem, (uint64_t) Offset + Bias, "relocation target") +=
+          Sym ? SymbolValue(Sym) : Bias;
+        break;
+      case OI_R_MIPS_JUMP_SLOT:
+        *GuestWord(Mem, (uint64_t) Offset + Bias, "relocation target") =
+          SymbolValue(Sym);
+        break;
+      default:
+        report_fatal_error(Twine("Unsupported: ELF dynamic relocation type ") +
+                           Twine(ELF32_R_TYPE(Info)));
+      }
+    }
+  }
+}
+
+// Map a pre-relocated image matching Key into Mem. Returns false if there
+// is none or it is stale.
+static bool LoadCachedImage(OiMemoryModel &Mem, const std::string &CachePath,
+                            const ImageCacheHeader &Key, uint64_t &Entry) {
+  int fd = open(CachePath.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+  ImageCacheHeader H;
+  std::vector<ImageCacheRange> Ranges;
+  bool Valid = read(fd, &H, sizeof(H)) == sizeof(H) &&
+    memcmp(H.Magic, Key.Magic, sizeof(H.Magic)) == 0 &&
+    H.Version == Key.Version && H.PageSize == Key.PageSize &&
+    H.SrcSize == Key.SrcSize && H.SrcMTime == Key.SrcMTime &&
+    H.SrcMTimeNsec == Key.SrcMTimeNsec && H.SrcIno == Key.SrcIno &&
+    H.DynBase == Key.DynBase;
+  if (Valid) {
+    Ranges.resize(H.NumRanges);
+    size_t Bytes = sizeof(ImageCacheRange) * H.NumRanges;
+    Valid = read(fd, Ranges.data(), Bytes) == (ssize_t) Bytes;
+  }
+  for (const ImageCacheRange &R : Ranges)
+    Valid = Valid && (uint64_t) R.Addr + R.Size <= Mem.TOTALSIZE &&
+            R.Offset % H.PageSize == 0;
+  if (!Valid) {
+    close(fd);
+    return false;
+  }
+  for (const ImageCacheRange &R : Ranges) {
+    if (mmap(Mem.memory + R.Addr, R.Size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED, fd, R.Offset) == MAP_FAILED)
+      FatalLoadError(fd, "mapping cached ELF image\n");
+  }
+  close(fd);
+  Entry = H.Entry;
+  Mem.heapPtr = H.HeapPtr;
+  Mem.LoadBias = H.LoadBias;
+  return true;
+}
+
+// Save the loaded and relocated segments of Mem so that later runs can map
+// them with LoadCachedImage. Failing to is only worth a warning.
+static void WriteCachedImage(OiMemoryModel &Mem, const std::string &CachePath,
+                             const ImageCacheHeader &Key,
+                             const std::vector<Elf32_Phdr> &Loads,
+                             uint64_t Entry) {
+  std::vector<std::pair<uint64_t, uint64_t> > Loaded =
+    LoadedRanges(Loads, Mem.LoadBias);
+  ImageCacheHeader H = Key;
+  H.NumRanges = Loaded.size();
+  H.Entry = Entry;
+  H.HeapPtr = Mem.heapPtr;
+  H.LoadBias = Mem.LoadBias;
+  std::vector<ImageCacheRange> Ranges;
+  uint64_t Offset = sizeof(H) + sizeof(ImageCacheRange) * Loaded.size();
+  for (const auto &L : Loaded) {
+    Offset = (Offset + H.PageSize - 1) & ~(uint64_t)(H.PageSize - 1);
+    ImageCacheRange R = { (uint32_t) L.first,
+                          (uint32_t)(L.second - L.first), Offset };
+    Ranges.push_back(R);
+    Offset += R.Size;
+  }
+
+  // Write a private file and rename it, so concurrent runs never map a
+  // partial image
+  std::string Tmp = CachePath + ".tmp" + std::to_string(getpid());
+  int fd = open(Tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    return;
+  bool Ok = write(fd, &H, sizeof(H)) == sizeof(H) &&
+    write(fd, Ranges.data(), sizeof(ImageCacheRange) * Ranges.size()) ==
+      (ssize_t)(sizeof(ImageCacheRange) * Ranges.size());
+  for (const ImageCacheRange &R : Ranges)
+    Ok = Ok && pwrite(fd, Mem.memory + R.Addr, R.Size, R.Offset) ==
+                   (ssize_t) R.Size;
+  close(fd);
+  if (!Ok || rename(Tmp.c_str(), CachePath.c_str()) != 0) {
+    errs() << "oii: warning: cannot write image cache '" << CachePath
+           << "'\n";
+    unlink(Tmp.c_str());
+  }
+}
+
+uint64_t OiMemoryModel::LoadELF(const char *filename, uint32_t DynBase,
+                                const std::string &CacheDir)
+{
   Elf32_Ehdr    ehdr;
-  Elf32_Shdr    shdr;
-  Elf32_Phdr    phdr;
+  std::vector<Elf32_Phdr> phdrs;
   int           fd;
-  unsigned int  i;
-  Elf32_Word    size = 0; 
   uint64_t      entry;
+  uint64_t      mappedEnd = 0;
+  struct stat   st;
 
   //Open application
   if (!filename || ((fd = open(filename, 0)) == -1)) {
@@ -28,82 +395,110 @@ uint64_t OiMemoryModel::LoadELF(const char *filename)
     exit(EXIT_FAILURE);
   }
 
+  //A cached image needs neither parsing nor relocation
+  ImageCacheHeader key;
+  std::string cachePath;
+  if (!CacheDir.empty() && fstat(fd, &st) == 0) {
+    FillCacheKey(key, st, DynBase);
+    cachePath = ImageCachePath(CacheDir, filename, st, DynBase);
+    if (LoadCachedImage(*this, cachePath, key, entry)) {
+      close(fd);
+      return entry;
+    }
+  }
+
   //Test if it's an ELF file
-  if ((read(fd, &ehdr, sizeof(ehdr)) != sizeof(ehdr)) ||  // read header
-      (strncmp((char *)ehdr.e_ident, ELFMAG, 4) != 0) ||          // test elf magic number
-      0) {
+  if (!ReadELFHeaders(fd, ehdr, phdrs)) {
     close(fd);
     return EXIT_FAILURE;
   }
 
+  if (ehdr.e_type == ET_REL) {
+    report_fatal_error("Unsupported: ELF relocatable file");
+    exit(EXIT_FAILURE);
+  }
+  if (ehdr.e_type != ET_EXEC && ehdr.e_type != ET_DYN)
+    FatalLoadError(fd, "Unsupported: ELF file type");
+
+  //Position-independent images are moved to DynBase
+  LoadBias = ComputeLoadBias(ehdr, phdrs, DynBase);
+
   //Set start address
-  entry = ehdr.e_entry;
+  entry = (uint64_t) ehdr.e_entry + LoadBias;
   if (entry > TOTALSIZE) {
     report_fatal_error("the start address of the application is beyond model memory\n");
     close(fd);
     exit(EXIT_FAILURE);
   }
 
-  if (ehdr.e_type == ET_EXEC) {
-    //Get program headers and load segments
-    for (i = 0; i < ehdr.e_phnum; i++) {
-      unsigned int segment_type;
+  //Get program headers and load segments
+  std::vector<Elf32_Phdr> loads;
+  uint64_t dynamicAddr = 0;
+  bool hasDynamic = false;
+  for (const Elf32_Phdr &phdr : phdrs) {
+    switch (phdr.p_type) {
+    case PT_INTERP: { // Requesting program interpreter
+      //Static PIEs may name one; shared libraries are refused when the
+      //dynamic section is processed
+      if (ehdr.e_type != ET_DYN)
+        FatalLoadError(fd, "Unsupported: Dynamically linked object");
+      break;
+    }
+    case PT_DYNAMIC:
+      dynamicAddr = phdr.p_vaddr;
+      hasDynamic = true;
+      break;
+    case PT_LOAD: { // Loadable segment type - load dynamic segments as well
+      uint64_t p_vaddr = (uint64_t) phdr.p_vaddr + LoadBias;
+      uint64_t p_memsz = phdr.p_memsz;
+      uint64_t p_filesz = phdr.p_filesz;
+      Elf32_Off  p_offset = phdr.p_offset;
+      loads.push_back(phdr);
 
-      //Get program headers and load segments
-      lseek(fd, ehdr.e_phoff + ehdr.e_phentsize * i, SEEK_SET);
-      if (read(fd, &phdr, sizeof(phdr)) != sizeof(phdr)) {
-        report_fatal_error("reading ELF program header\n");
-        close(fd);
-        exit(EXIT_FAILURE);
-      }
+      //Error if segment greater then memory
+      if (TOTALSIZE < p_vaddr + p_memsz || p_filesz > p_memsz)
+        FatalLoadError(fd, "not enough memory to load application.\n");
 
-      segment_type = phdr.p_type;
-      
-      switch(segment_type) {
-      case PT_INTERP: { // Requesting program interpreter
-        report_fatal_error("Unsupported: Dynamically linked object");
-        close(fd);
-        exit(EXIT_FAILURE);
-        break;
-      }
-      case PT_LOAD: { // Loadable segment type - load dynamic segments as well
-        Elf32_Addr p_vaddr = phdr.p_vaddr;
-        Elf32_Word p_memsz = phdr.p_memsz;
-        Elf32_Word p_filesz = phdr.p_filesz;
-        Elf32_Off  p_offset = phdr.p_offset;
-        
-        //Error if segment greater then memory
-        if (TOTALSIZE < p_vaddr + p_memsz) {
-          report_fatal_error("not enough memory to load application.\n");
-          close(fd);
-          exit(EXIT_FAILURE);
-        }
-        
-        //Set heap to the end of the segment
-        if (heapPtr < p_vaddr + p_memsz) heapPtr = p_vaddr + p_memsz;
-
-        //Load 
-        lseek(fd, p_offset, SEEK_SET);
-        if (read(fd, memory + p_vaddr, p_filesz) != (signed)p_filesz) {
-          report_fatal_error("reading ELF LOAD segment.\n");
-          close(fd);
-          exit(EXIT_FAILURE);
-        }
+      //Set heap to the end of the segment
+      if (heapPtr < p_vaddr + p_memsz) heapPtr = p_vaddr + p_memsz;
+
+      //Map the file contents privately over the reserved space when
+      //file offset and address agree modulo the page size and no page is
+      //shared with a previous segment. Otherwise, fall back to read().
+      uint64_t pagemask = PageMask();
+      uint64_t mapstart = p_vaddr & ~pagemask;
+      uint64_t mapend = (p_vaddr + p_filesz + pagemask) & ~pagemask;
+      if (p_filesz > 0 && (p_vaddr & pagemask) == (p_offset & pagemask) &&
+          mapstart >= mappedEnd && mapend <= TOTALSIZE) {
+        void *ptr = mmap(memory + mapstart, mapend - mapstart,
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_FIXED, fd, p_offset & ~pagemask);
+        if (ptr == MAP_FAILED)
+          FatalLoadError(fd, "mapping ELF LOAD segment.\n");
+        //The rest of the last file page is not part of this segment
+        memset(memory + p_vaddr + p_filesz, 0,
+               mapend - (p_vaddr + p_filesz));
+        mappedEnd = mapend;
+      } else {
+        if (pread(fd, memory + p_vaddr, p_filesz, p_offset) !=
+            (ssize_t) p_filesz)
+          FatalLoadError(fd, "reading ELF LOAD segment.\n");
         memset(memory + p_vaddr + p_filesz, 0, p_memsz - p_filesz);
-        break;
+        mappedEnd = (p_vaddr + p_memsz + pagemask) & ~pagemask;
       }
-      default:
-        break;
-      };
+      break;
     }
-  }
-  else if (ehdr.e_type == ET_REL) {
-    report_fatal_error("Unsupported: ELF relocatable file");
-    exit(EXIT_FAILURE);
+    default:
+      break;
+    };
   }
 
   //Close file
   close(fd);
+
+  if (ehdr.e_type == ET_DYN && hasDynamic)
+    RelocateImage(*this, dynamicAddr);
+  if (!cachePath.empty())
+    WriteCachedImage(*this, cachePath, key, loads, entry);
   return entry;
 }
-
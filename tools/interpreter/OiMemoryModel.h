@@ -10,21 +10,32 @@
 
 #include "llvm/Support/DataTypes.h"
 #include "llvm/Support/MemoryObject.h"
+#include <string>
 
 class OiMemoryModel : public llvm::MemoryObject {
  public:
-  OiMemoryModel() : TOTALSIZE(50 * (1 << 20)), heapPtr(0) {
-    memory = new uint8_t[TOTALSIZE];
-  }
-  ~OiMemoryModel() {
-    if (memory)
-      delete [] memory;
-  }
- OiMemoryModel(const OiMemoryModel &A) : TOTALSIZE(50 * (1 << 20)) {   
-  }
+  static const uint64_t DEFAULTSIZE = 50 * (1 << 20);
+  static const uint64_t MAXSIZE = 1ULL << 32;
+  // Where position-independent (ET_DYN) images are loaded by default
+  static const uint32_t DEFAULTDYNBASE = 0x400000;
+
+  // Reserve a guest address space of Size bytes. Pages are only committed
+  // by the host when first touched.
+  explicit OiMemoryModel(uint64_t Size = DEFAULTSIZE);
+  ~OiMemoryModel();
+  OiMemoryModel(const OiMemoryModel &) = delete;
+  OiMemoryModel &operator=(const OiMemoryModel &) = delete;
+
+  // Load ELF file into model memory and return ELF entry point. ET_DYN
+  // images are moved to DynBase and relocated. If CacheDir is not empty,
+  // the relocated image is kept there and mapped directly by later runs.
+  uint64_t LoadELF(const char *filename, uint32_t DynBase = DEFAULTDYNBASE,
+                   const std::string &CacheDir = "");
 
-  // Load ELF file into model memory and return ELF entry point
-  uint64_t LoadELF(const char *filename);
+  // Guest address just past the image LoadELF would load, or 0 if
+  // filename is not an ELF file
+  static uint64_t GetImageEnd(const char *filename,
+                              uint32_t DynBase = DEFAULTDYNBASE);
 
   uint64_t getExtent() const override { return TOTALSIZE; }
 
@@ -58,6 +69,8 @@ class OiMemoryModel : public llvm::MemoryObject {
   uint8_t * memory;
   const uint64_t TOTALSIZE;
   unsigned heapPtr;
+  // Added to the addresses in the ELF file when it was loaded
+  uint32_t LoadBias;
 };
 
 
@@ -0,0 +1,145 @@
+//===-- OiProfile.cpp - Guest execution profile ----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Aggregates the counters gathered during interpretation and writes them as
+// JSON. Whole-block executions only bump a per-block counter while running;
+// their opcode mix is expanded here, when the profile is written.
+//
+//===----------------------------------------------------------------------===//
+
+#include "OiProfile.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+
+using namespace llvm;
+
+OiProfile::OiProfile(const MCInstrInfo &MII,
+                     const std::vector<std::pair<uint64_t, StringRef> > &Syms,
+                     uint32_t LoadBias)
+  : MII(MII), LoadBias(LoadBias), IsBranch(MII.getNumOpcodes()),
+    OpcodeCounts(MII.getNumOpcodes()), CurBlock(nullptr), LastPC(0),
+    LastWasBranch(false) {
+  for (unsigned Op = 0, e = MII.getNumOpcodes(); Op != e; ++Op) {
+    const MCInstrDesc &D = MII.get(Op);
+    if (D.isBranch() || D.isIndirectBranch() || D.isCall() || D.isReturn())
+      IsBranch.set(Op);
+  }
+  for (const auto &S : Syms)
+    Symbols.push_back(std::make_pair(S.first, S.second.str()));
+}
+
+bool OiProfile::write(StringRef Filename, StringRef Binary) {
+  std::error_code EC;
+  raw_fd_ostream OS(Filename, EC, sys::fs::F_Text);
+  if (EC) {
+    errs() << "oii: cannot write profile '" << Filename << "': "
+           << EC.message() << "\n";
+    return false;
+  }
+
+  std::vector<uint64_t> Opcodes(OpcodeCounts);
+  std::vector<std::pair<uint32_t, const BlockProfile *> > Sorted;
+  uint64_t Total = 0;
+  for (const auto &I : Blocks) {
+    const BlockProfile &P = I.second;
+    Sorted.push_back(std::make_pair(I.first, &P));
+    Total += P.Insts;
+    if (P.BB)
+      for (const OiDecodedInst *DI : P.BB->Insts)
+        Opcodes[DI->Opcode] += P.BlockExecs;
+  }
+  std::sort(Sorted.begin(), Sorted.end());
+
+  // Attribute each block to the closest symbol at or below it
+  std::vector<uint64_t> FuncEntries(Symbols.size()), FuncInsts(Symbols.size());
+  for (const auto &I : Sorted) {
+    auto It = std::upper_bound(
+        Symbols.begin(), Symbols.end(), (uint64_t) I.first,
+        [](uint64_t A, const std::pair<uint64_t, std::string> &S) {
+          return A < S.first;
+        });
+    if (It == Symbols.begin())
+      continue;
+    unsigned Idx = (It - Symbols.begin()) - 1;
+    FuncInsts[Idx] += I.second->Insts;
+    if (Symbols[Idx].first == I.first)
+      FuncEntries[Idx] += I.second->Count;
+  }
+
+  OS << "{\n  \"binary\": \"";
+  OS.write_escaped(Binary);
+  OS << "\",\n  \"instructions\": " << Total << ",\n";
+
+  OS << "  \"functions\": [";
+  bool First = true;
+  for (unsigned i = 0, e = Symbols.size(); i != e; ++i) {
+    if (FuncInsts[i] == 0)
+      continue;
+    OS << (First ? "\n" : ",\n") << "    { \"name\": \"";
+    OS.write_escaped(Symbols[i].second);
+    OS << "\", \"address\": " << Symbols[i].first - LoadBias
+       << ", \"entries\": " << FuncEntries[i]
+       << ", \"instructions\": " << FuncInsts[i] << " }";
+    First = false;
+  }
+  OS << "\n  ],\n";
+
+  OS << "  \"blocks\": [";
+  First = true;
+  for (const auto &I : Sorted) {
+    OS << (First ? "\n" : ",\n") << "    { \"address\": "
+       << I.first - LoadBias
+       << ", \"count\": " << I.second->Count
+       << ", \"instructions\": " << I.second->Insts << " }";
+    First = false;
+  }
+  OS << "\n  ],\n";
+
+  std::vector<std::pair<uint64_t, uint64_t> > SortedEdges(Edges.begin(),
+                                                          Edges.end());
+  std::sort(SortedEdges.begin(), SortedEdges.end());
+  OS << "  \"edges\": [";
+  First = true;
+  for (const auto &I : SortedEdges) {
+    OS << (First ? "\n" : ",\n") << "    { \"from\": "
+       << (uint32_t)(I.first >> 32) - LoadBias
+       << ", \"to\": " << (uint32_t) I.first - LoadBias
+       << ", \"count\": " << I.second << " }";
+    First = false;
+  }
+  OS << "\n  ],\n";
+
+  OS << "  \"opcodes\": {";
+  First = true;
+  for (unsigned Op = 0, e = Opcodes.size(); Op != e; ++Op) {
+    if (Opcodes[Op] == 0)
+      continue;
+    OS << (First ? "\n" : ",\n") << "    \"" << MII.getName(Op) << "\": "
+       << Opcodes[Op];
+    First = false;
+  }
+  OS << "\n  },\n";
+
+  std::vector<std::pair<uint32_t, uint64_t> > Syscalls(SyscallCounts.begin(),
+                                                       SyscallCounts.end());
+  std::sort(Syscalls.begin(), Syscalls.end());
+  OS << "  \"syscalls\": {";
+  First = true;
+  for (const auto &I : Syscalls) {
+    OS << (First ? "\n" : ",\n") << "    \"" << I.first << "\": " << I.second;
+    First = false;
+  }
+  OS << "\n  }\n}\n";
+  OS.close();
+  bool Failed = OS.has_error();
+  OS.clear_error();
+  return !Failed;
+}
@@ -0,0 +1,103 @@
+//=== OiProfile.h - Guest execution profile -*- C++ -*-==//
+//
+// Collects guest hot-spot information while interpreting: per-block and
+// per-function execution counts, the targets taken by each branch, jump
+// and call, the dynamic opcode mix and syscall counts.
+// It is meant to be cheap enough for release builds and writes a JSON file
+// that the static translator can consume. Addresses are written as in the
+// ELF file, without the bias position-independent programs are loaded at.
+//
+//===------------------------------------------------------------===//
+
+#ifndef OIPROFILE_H
+#define OIPROFILE_H
+
+#include "OiDecodeCache.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+
+class MCInstrInfo;
+
+class OiProfile {
+public:
+  // Symbols and the PCs counted are runtime addresses, LoadBias above the
+  // ones in the ELF file
+  OiProfile(const MCInstrInfo &MII,
+            const std::vector<std::pair<uint64_t, StringRef> > &Symbols,
+            uint32_t LoadBias);
+
+  // Count one execution of the whole block BB starting at PC.
+  void countBlock(uint64_t PC, const OiBasicBlock *BB) {
+    countEdge(PC);
+    BlockProfile &P = Blocks[(uint32_t) PC];
+    ++P.Count;
+    ++P.BlockExecs;
+    P.Insts += BB->size();
+    P.BB = BB;
+    // The insertion above may have moved CurBlock
+    CurBlock = nullptr;
+    LastPC = PC + (BB->size() - 1) * 8;
+    LastWasBranch = IsBranch[BB->Insts.back()->Opcode];
+  }
+
+  // Count one instruction executed outside of block mode. A new block
+  // starts whenever PC does not follow the last instruction.
+  void countInst(uint64_t PC, unsigned Opcode) {
+    countEdge(PC);
+    if (PC != LastPC + 8 || !CurBlock) {
+      CurBlock = &Blocks[(uint32_t) PC];
+      ++CurBlock->Count;
+    }
+    ++CurBlock->Insts;
+    ++OpcodeCounts[Opcode];
+    LastPC = PC;
+    LastWasBranch = IsBranch[Opcode];
+  }
+
+  // Count a guest syscall by its number
+  void countSyscall(uint32_t Num) { ++SyscallCounts[Num]; }
+
+  // Write the profile as JSON. Returns false on I/O errors.
+  bool write(StringRef Filename, StringRef Binary);
+
+private:
+  // Count the edge from the branch at LastPC, if any, to PC. Not taken
+  // branches count an edge to the next instruction.
+  void countEdge(uint64_t PC) {
+    if (LastWasBranch)
+      ++Edges[((uint64_t)(uint32_t)LastPC << 32) | (uint32_t)PC];
+  }
+
+  struct BlockProfile {
+    BlockProfile() : Count(0), Insts(0), BlockExecs(0), BB(nullptr) {}
+    uint64_t Count;      // Times the block was entered
+    uint64_t Insts;      // Instructions retired in it
+    uint64_t BlockExecs; // Entries executed as a whole OiBasicBlock
+    const OiBasicBlock *BB;
+  };
+
+  const MCInstrInfo &MII;
+  std::vector<std::pair<uint64_t, std::string> > Symbols;
+  uint32_t LoadBias;
+  DenseMap<uint32_t, BlockProfile> Blocks;
+  // Keyed by source address << 32 | target address
+  DenseMap<uint64_t, uint64_t> Edges;
+  // Opcodes that may transfer control: branches, jumps, calls and returns
+  BitVector IsBranch;
+  std::vector<uint64_t> OpcodeCounts;
+  DenseMap<uint32_t, uint64_t> SyscallCounts;
+  BlockProfile *CurBlock;
+  uint64_t LastPC;
+  bool LastWasBranch;
+};
+
+} // end namespace llvm
+
+#endif
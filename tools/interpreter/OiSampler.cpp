@@ -0,0 +1,78 @@
+//===-- OiSampler.cpp - Periodic guest execution samples -------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "OiSampler.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+
+using namespace llvm;
+
+typedef support::endian::Writer<support::little> LEWriter;
+
+OiSampler::OiSampler(StringRef Filename, uint64_t Interval,
+                     const MCInstrInfo &MII, std::error_code &EC)
+  : MII(MII), OS(Filename, EC, sys::fs::F_None), Interval(Interval),
+    NextSample(Interval), Mix(MII.getNumOpcodes()),
+    Named(MII.getNumOpcodes()) {
+  if (EC)
+    return;
+  OS.write("OISAMP\0\1", 8);
+  LEWriter W(OS);
+  W.write<uint32_t>(2);
+  W.write<uint64_t>(Interval);
+}
+
+void OiSampler::flushBlocks() {
+  for (const auto &I : BlockCounts)
+    for (const OiDecodedInst *DI : I.first->Insts)
+      Mix[DI->Opcode] += I.second;
+  BlockCounts.clear();
+}
+
+void OiSampler::sample(uint64_t NumInsts, uint64_t PC) {
+  flushBlocks();
+  LEWriter W(OS);
+  uint32_t N = 0;
+  for (unsigned Op = 0, e = Mix.size(); Op != e; ++Op) {
+    if (Mix[Op] == 0)
+      continue;
+    ++N;
+    if (Named[Op])
+      continue;
+    StringRef Name = MII.getName(Op);
+    OS << 'O';
+    W.write<uint32_t>(Op);
+    W.write<uint32_t>(Name.size());
+    OS << Name;
+    Named[Op] = true;
+  }
+
+  OS << 'S';
+  W.write<uint64_t>(NumInsts);
+  W.write<uint32_t>(PC);
+  W.write<uint32_t>(N);
+  for (unsigned Op = 0, e = Mix.size(); Op != e; ++Op) {
+    if (Mix[Op] == 0)
+      continue;
+    W.write<uint32_t>(Op);
+    W.write<uint64_t>(Mix[Op]);
+    Mix[Op] = 0;
+  }
+  // Skip ahead if a long block or native region overshot the interval
+  while (Interval && NextSample <= NumInsts)
+    NextSample += Interval;
+}
+
+bool OiSampler::finish() {
+  OS.flush();
+  bool Failed = OS.has_error();
+  OS.clear_error();
+  return !Failed;
+}
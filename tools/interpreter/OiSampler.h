@@ -0,0 +1,63 @@
+//=== OiSampler.h - Periodic guest execution samples -*- C++ -*-==//
+//
+// Writes a compact binary trace with one record every K retired guest
+// instructions: the instruction count, the current PC and the opcode mix
+// of the instructions retired since the previous record. This is enough
+// for SimPoint-style analysis of long runs without full tracing.
+//
+// The trace starts with the magic "OISAMP\0\1" and a header (version,
+// interval). It is followed by records, each introduced by a kind byte:
+//   'O' u32 opcode, u32 length, name  - first use of an opcode
+//   'S' u64 count, u32 pc, u32 n, n x (u32 opcode, u64 times) - a sample
+// All fields are little endian.
+//
+//===------------------------------------------------------------===//
+
+#ifndef OISAMPLER_H
+#define OISAMPLER_H
+
+#include "OiDecodeCache.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+#include "llvm/Support/raw_ostream.h"
+#include <vector>
+
+namespace llvm {
+
+class MCInstrInfo;
+
+class OiSampler {
+public:
+  // Open Filename for writing; check EC for errors.
+  OiSampler(StringRef Filename, uint64_t Interval, const MCInstrInfo &MII,
+            std::error_code &EC);
+
+  void countBlock(const OiBasicBlock *BB) { ++BlockCounts[BB]; }
+  void countInst(unsigned Opcode) { ++Mix[Opcode]; }
+
+  // Whether a sample is due after NumInsts retired instructions
+  bool due(uint64_t NumInsts) const { return NumInsts >= NextSample; }
+
+  // Write a record for the instructions counted since the last one.
+  void sample(uint64_t NumInsts, uint64_t PC);
+
+  // Fold the block counts into the opcode mix. Call it before the decode
+  // cache drops its blocks.
+  void flushBlocks();
+
+  // Flush buffered records. Returns false on I/O errors.
+  bool finish();
+
+private:
+  const MCInstrInfo &MII;
+  raw_fd_ostream OS;
+  uint64_t Interval, NextSample;
+  DenseMap<const OiBasicBlock *, uint64_t> BlockCounts;
+  std::vector<uint64_t> Mix;
+  std::vector<bool> Named;
+};
+
+} // end namespace llvm
+
+#endif
@@ -0,0 +1,287 @@
+//===-- OiSnapshot.cpp - Guest checkpointing -------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A snapshot is a header with the register file, followed by the guest
+// file descriptors and then by (address, contents) records for every guest
+// page that is not all zeros, ending with an address of ~0. Everything is
+// in host byte order; snapshots are not meant to move between hosts.
+//
+//===----------------------------------------------------------------------===//
+
+#include "OiSnapshot.h"
+#include "OiMachineModel.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace llvm;
+
+namespace {
+
+const char SnapshotMagic[8] = { 'O', 'I', 'S', 'N', 'A', 'P', 0, 1 };
+const uint32_t SnapshotVersion = 2;
+const uint32_t SnapshotPageSize = 4096;
+const uint64_t EndOfPages = ~0ULL;
+
+struct SnapshotHeader {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t PageSize;
+  uint64_t MemSize;
+  uint64_t PC;
+  uint64_t NumInsts;
+  uint32_t HeapPtr;
+  uint32_t NumFds;
+  uint32_t Bank[32];
+  uint32_t Hi, Lo, FCC;
+  uint32_t LoadBias;
+  double DblBank[32];
+  float FltBank[64];
+};
+
+struct SnapshotFd {
+  int32_t Fd;
+  int32_t Flags;
+  int64_t Offset;
+  uint32_t PathLen;
+  uint32_t Pad;
+};
+
+// Descriptors currently open in this process
+std::vector<int> OpenDescriptors() {
+  std::vector<int> Fds;
+  DIR *D = opendir("/proc/self/fd");
+  if (!D)
+    return Fds;
+  int Self = dirfd(D);
+  while (struct dirent *E = readdir(D)) {
+    char *End;
+    long Fd = strtol(E->d_name, &End, 10);
+    if (*End == '\0' && End != E->d_name && Fd != Self)
+      Fds.push_back(Fd);
+  }
+  closedir(D);
+  return Fds;
+}
+
+// Cursor over the snapshot contents, failing on truncated files
+class SnapshotReader {
+  const char *Cur, *End;
+public:
+  SnapshotReader(const MemoryBuffer &Buf)
+    : Cur(Buf.getBufferStart()), End(Buf.getBufferEnd()) {}
+
+  const char *take(uint64_t Size) {
+    if (Size > (uint64_t)(End - Cur))
+      return nullptr;
+    const char *P = Cur;
+    Cur += Size;
+    return P;
+  }
+
+  template <typename T> bool read(T &Val) {
+    const char *P = take(sizeof(T));
+    if (P)
+      memcpy(&Val, P, sizeof(T));
+    return P != nullptr;
+  }
+};
+
+bool ReadHeader(StringRef Filename, std::unique_ptr<MemoryBuffer> &Buf,
+                SnapshotHeader &H) {
+  ErrorOr<std::unique_ptr<MemoryBuffer> > BufOrErr =
+    MemoryBuffer::getFile(Filename, -1, false);
+  if (std::error_code EC = BufOrErr.getError()) {
+    errs() << "oii: cannot read snapshot '" << Filename << "': "
+           << EC.message() << "\n";
+    return false;
+  }
+  Buf = std::move(BufOrErr.get());
+  SnapshotReader R(*Buf);
+  if (!R.read(H) || memcmp(H.Magic, SnapshotMagic, sizeof(H.Magic)) != 0 ||
+      H.Version != SnapshotVersion || H.PageSize != SnapshotPageSize) {
+    errs() << "oii: '" << Filename << "' is not a snapshot of this version\n";
+    return false;
+  }
+  return true;
+}
+
+} // end anonymous namespace
+
+OiSnapshot::OiSnapshot() {
+  for (int Fd : OpenDescriptors()) {
+    if ((unsigned) Fd >= HostFds.size())
+      HostFds.resize(Fd + 1);
+    HostFds[Fd] = true;
+  }
+}
+
+bool OiSnapshot::write(StringRef Filename, const OiMachineModel &MM,
+                       uint64_t PC, uint64_t NumInsts) const {
+  const OiMemoryModel &Mem = *MM.Mem;
+
+  // Only regular files opened by the guest can be reopened on restore
+  std::vector<std::pair<SnapshotFd, std::string> > Fds;
+  for (int Fd : OpenDescriptors()) {
+    struct stat St;
+    if (Fd <= 2 || ((unsigned) Fd < HostFds.size() && HostFds[Fd]) ||
+        fstat(Fd, &St) != 0 || !S_ISREG(St.st_mode))
+      continue;
+    char Path[4096];
+    std::string Link = "/proc/self/fd/" + std::to_string(Fd);
+    ssize_t Len = readlink(Link.c_str(), Path, sizeof(Path));
+    if (Len <= 0 || Len == sizeof(Path))
+      continue;
+    SnapshotFd F;
+    F.Fd = Fd;
+    F.Flags = fcntl(Fd, F_GETFL);
+    F.Offset = lseek(Fd, 0, SEEK_CUR);
+    F.PathLen = Len;
+    F.Pad = 0;
+    Fds.push_back(std::make_pair(F, std::string(Path, Len)));
+  }
+
+  std::error_code EC;
+  raw_fd_ostream OS(Filename, EC, sys::fs::F_None);
+  if (EC) {
+    errs() << "oii: cannot write snapshot '" << Filename << "': "
+           << EC.message() << "\n";
+    return false;
+  }
+
+  SnapshotHeader H;
+  memset(&H, 0, sizeof(H));
+  memcpy(H.Magic, SnapshotMagic, sizeof(H.Magic));
+  H.Version = SnapshotVersion;
+  H.PageSize = SnapshotPageSize;
+  H.MemSize = Mem.TOTALSIZE;
+  H.PC = PC;
+  H.NumInsts = NumInsts;
+  H.HeapPtr = Mem.heapPtr;
+  H.LoadBias = Mem.LoadBias;
+  H.NumFds = Fds.size();
+  memcpy(H.Bank, MM.Bank, sizeof(H.Bank));
+  H.Hi = MM.Hi;
+  H.Lo = MM.Lo;
+  H.FCC = MM.FCC;
+  memcpy(H.DblBank, MM.DblBank, sizeof(H.DblBank));
+  memcpy(H.FltBank, MM.FltBank, sizeof(H.FltBank));
+  OS.write(reinterpret_cast<const char *>(&H), sizeof(H));
+
+  for (const auto &F : Fds) {
+    OS.write(reinterpret_cast<const char *>(&F.first), sizeof(F.first));
+    OS << F.second;
+  }
+
+  // Pages the guest never touched read as zeros and are left out
+  static const char Zeros[SnapshotPageSize] = {};
+  for (uint64_t Addr = 0; Addr < Mem.TOTALSIZE; Addr += SnapshotPageSize) {
+    uint64_t Len = std::min<uint64_t>(SnapshotPageSize, Mem.TOTALSIZE - Addr);
+    const char *Page = reinterpret_cast<const char *>(&Mem.memory[Addr]);
+    if (memcmp(Page, Zeros, Len) == 0)
+      continue;
+    OS.write(reinterpret_cast<const char *>(&Addr), sizeof(Addr));
+    OS.write(Page, Len);
+  }
+  OS.write(reinterpret_cast<const char *>(&EndOfPages), sizeof(EndOfPages));
+
+  OS.close();
+  bool Failed = OS.has_error();
+  OS.clear_error();
+  if (Failed)
+    errs() << "oii: error writing snapshot '" << Filename << "'\n";
+  return !Failed;
+}
+
+bool OiSnapshot::readMemSize(StringRef Filename, uint64_t &MemSize) {
+  std::unique_ptr<MemoryBuffer> Buf;
+  SnapshotHeader H;
+  if (!ReadHeader(Filename, Buf, H))
+    return false;
+  MemSize = H.MemSize;
+  return true;
+}
+
+bool OiSnapshot::restore(StringRef Filename, OiMachineModel &MM, uint64_t &PC,
+                         uint64_t &NumInsts) {
+  std::unique_ptr<MemoryBuffer> Buf;
+  SnapshotHeader H;
+  if (!ReadHeader(Filename, Buf, H))
+    return false;
+  OiMemoryModel &Mem = *MM.Mem;
+  if (H.MemSize != Mem.TOTALSIZE) {
+    errs() << "oii: snapshot '" << Filename << "' needs " << H.MemSize
+           << " bytes of guest memory\n";
+    return false;
+  }
+
+  SnapshotReader R(*Buf);
+  R.take(sizeof(H));
+  for (uint32_t i = 0; i < H.NumFds; ++i) {
+    SnapshotFd F;
+    const char *Path;
+    if (!R.read(F) || !(Path = R.take(F.PathLen))) {
+      errs() << "oii: snapshot '" << Filename << "' is truncated\n";
+      return false;
+    }
+    std::string Name(Path, F.PathLen);
+    if (fcntl(F.Fd, F_GETFD) != -1) {
+      errs() << "oii: warning: cannot restore guest descriptor " << F.Fd
+             << " (" << Name << "): already in use\n";
+      continue;
+    }
+    int Fd = ::open(Name.c_str(), F.Flags & ~(O_CREAT | O_EXCL | O_TRUNC));
+    if (Fd < 0) {
+      errs() << "oii: warning: cannot reopen " << Name << ": "
+             << strerror(errno) << "\n";
+      continue;
+    }
+    if (Fd != F.Fd) {
+      dup2(Fd, F.Fd);
+      ::close(Fd);
+    }
+    lseek(F.Fd, F.Offset, SEEK_SET);
+  }
+
+  for (;;) {
+    uint64_t Addr;
+    if (!R.read(Addr))
+      break;
+    if (Addr == EndOfPages) {
+      memcpy(MM.Bank, H.Bank, sizeof(H.Bank));
+      MM.Hi = H.Hi;
+      MM.Lo = H.Lo;
+      MM.FCC = H.FCC;
+      memcpy(MM.DblBank, H.DblBank, sizeof(H.DblBank));
+      memcpy(MM.FltBank, H.FltBank, sizeof(H.FltBank));
+      Mem.heapPtr = H.HeapPtr;
+      Mem.LoadBias = H.LoadBias;
+      PC = H.PC;
+      NumInsts = H.NumInsts;
+      return true;
+    }
+    if (Addr >= Mem.TOTALSIZE || Addr % SnapshotPageSize != 0)
+      break;
+    uint64_t Len = std::min<uint64_t>(SnapshotPageSize, Mem.TOTALSIZE - Addr);
+    const char *Page = R.take(Len);
+    if (!Page)
+      break;
+    memcpy(&Mem.memory[Addr], Page, Len);
+  }
+  errs() << "oii: snapshot '" << Filename << "' is corrupt\n";
+  return false;
+}
@@ -0,0 +1,48 @@
+//=== OiSnapshot.h - Guest checkpointing -*- C++ -*-==//
+//
+// Saves the state of a running guest to a file and restores it later:
+// the registers of the initial thread, the guest PC and retired
+// instruction count, every non-zero page of guest memory and the host
+// file descriptors the guest opened. Pages are stored sparsely, so a
+// snapshot is roughly as large as the memory the guest actually uses.
+//
+//===------------------------------------------------------------===//
+
+#ifndef OISNAPSHOT_H
+#define OISNAPSHOT_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+#include <vector>
+
+namespace llvm {
+
+class OiMachineModel;
+
+class OiSnapshot {
+public:
+  // Remember the descriptors oii itself holds at this point, so that only
+  // the ones opened afterwards by the guest are saved.
+  OiSnapshot();
+
+  // Save MM, its memory and the guest descriptors. Returns false on I/O
+  // errors.
+  bool write(StringRef Filename, const OiMachineModel &MM, uint64_t PC,
+             uint64_t NumInsts) const;
+
+  // Read the guest memory size recorded in a snapshot, which the memory
+  // model passed to restore() must have.
+  static bool readMemSize(StringRef Filename, uint64_t &MemSize);
+
+  // Load a snapshot into MM and its memory, reopening the guest
+  // descriptors. Returns false if the file is not a valid snapshot.
+  static bool restore(StringRef Filename, OiMachineModel &MM, uint64_t &PC,
+                      uint64_t &NumInsts);
+
+private:
+  std::vector<bool> HostFds;
+};
+
+} // end namespace llvm
+
+#endif
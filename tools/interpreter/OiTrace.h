@@ -0,0 +1,104 @@
+//=== OiTrace.h - Binary execution trace -*- C++ -*-==//
+//
+// Format of the binary execution trace written by oii -trace, and the
+// buffered writer the interpreter uses to produce it. The oii-trace tool
+// reads the same format.
+//
+// A trace starts with the magic "OITRACE\0" and a u32 version, followed
+// by records, each introduced by a kind byte. For every executed
+// instruction there is an Inst record, then its memory access, if any,
+// then one record per register whose value changed. All fields are
+// little endian.
+//
+//===------------------------------------------------------------===//
+
+#ifndef OITRACE_H
+#define OITRACE_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace llvm {
+
+namespace oitrace {
+
+const char Magic[8] = { 'O', 'I', 'T', 'R', 'A', 'C', 'E', 0 };
+const uint32_t Version = 2;
+
+enum RecordKind {
+  Inst = 'I',     // u32 pc
+  Load = 'L',     // u32 address, u8 size
+  Store = 'S',    // u32 address, u8 size
+  RegWrite = 'R', // u8 register, u32 value
+  DblWrite = 'D', // u8 register, u64 bits of DblBank[register]
+  FltWrite = 'F'  // u8 register, u32 bits of FltBank[register]
+};
+
+// Register numbers in RegWrite records beyond the 32 of Bank
+enum {
+  RegHi = 32,
+  RegLo = 33
+};
+
+} // end namespace oitrace
+
+class OiTraceWriter {
+public:
+  // Open Filename for writing; check EC for errors.
+  OiTraceWriter(StringRef Filename, std::error_code &EC)
+    : OS(Filename, EC, sys::fs::F_None), W(OS) {
+    if (EC)
+      return;
+    OS.SetBufferSize(1 << 20);
+    OS.write(oitrace::Magic, sizeof(oitrace::Magic));
+    W.write<uint32_t>(oitrace::Version);
+  }
+
+  void inst(uint32_t PC) {
+    OS << (char) oitrace::Inst;
+    W.write<uint32_t>(PC);
+  }
+
+  void memAccess(bool IsStore, uint32_t Addr, uint8_t Size) {
+    OS << (char) (IsStore ? oitrace::Store : oitrace::Load);
+    W.write<uint32_t>(Addr);
+    W.write<uint8_t>(Size);
+  }
+
+  void regWrite(uint8_t Reg, uint32_t Val) {
+    OS << (char) oitrace::RegWrite;
+    W.write<uint8_t>(Reg);
+    W.write<uint32_t>(Val);
+  }
+
+  void dblWrite(uint8_t Reg, uint64_t Bits) {
+    OS << (char) oitrace::DblWrite;
+    W.write<uint8_t>(Reg);
+    W.write<uint64_t>(Bits);
+  }
+
+  void fltWrite(uint8_t Reg, uint32_t Bits) {
+    OS << (char) oitrace::FltWrite;
+    W.write<uint8_t>(Reg);
+    W.write<uint32_t>(Bits);
+  }
+
+  // Flush buffered records. Returns false on I/O errors.
+  bool finish() {
+    OS.flush();
+    bool Failed = OS.has_error();
+    OS.clear_error();
+    return !Failed;
+  }
+
+private:
+  raw_fd_ostream OS;
+  support::endian::Writer<support::little> W;
+};
+
+} // end namespace llvm
+
+#endif
@@ -1,10 +1,13 @@
 
 #include "elf32-tiny.h"
 #include "SyscallWrapper.h"
+#include "OiAsyncIO.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/DataTypes.h"
+#include "llvm/Support/Format.h"
+#include "llvm/ADT/SmallVector.h"
 #include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,12 +16,22 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/times.h>
 #include <time.h>
 #include <sys/utsname.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 using namespace llvm;
 
@@ -288,49 +301,87 @@ sys_sendfile64		,
   sys_futex		};
 
 
-uint32_t *GetSyscallTable() {
-  static uint32_t syscall_table[] = {
-    666,//sys_restart_syscall,
-    sys_exit,
-    sys_fork,
-    sys_read,
-    sys_write,
-    sys_open,
-    sys_close,
-    sys_creat,
-    sys_time,
-    sys_lseek,
-    sys_getpid,
-    sys_access,
-    sys_kill,
-    sys_dup,
-    sys_times,
-    sys_brk,
-    666,//sys_mmap,
-    sys_munmap,
-    sys_newstat,//sys_stat,
-    666,//sys_lstat,
-    sys_newfstat,//sys_fstat,
-    sys_uname,
-    666,//sys__llseek,
-    sys_readv,
-    sys_writev,
-    666,//sys_mmap2,
-    sys_stat64,
-    sys_lstat64,
-    sys_fstat64,
-    666,//sys_getuid32,
-    666,//sys_getgid32,
-    666,//sys_geteuid32,
-    666,//sys_getegid32,
-    sys_fcntl64,
-    666,//sys_exit_group,
-    sys_socketcall,
-    sys_gettimeofday,
-    sys_settimeofday
+  // Guest clone() and futex() flags, same values as on Linux
+  enum {
+    OI_CLONE_VM = 0x100,
+    OI_CLONE_PARENT_SETTID = 0x100000,
+    OI_CLONE_CHILD_CLEARTID = 0x200000,
+    OI_CLONE_CHILD_SETTID = 0x1000000,
+    OI_FUTEX_WAIT = 0,
+    OI_FUTEX_WAKE = 1,
+    OI_FUTEX_CMD_MASK = 0x7f
   };
-  return syscall_table;
-}
+
+  // Guest futexes are emulated on the host with one FIFO of waiters per
+  // guest address. The table is never destroyed, so threads still blocked
+  // when the guest exits do not touch a dead mutex.
+  struct FutexWaiter {
+    std::condition_variable Cond;
+    bool Woken;
+  };
+
+  struct FutexTable {
+    std::mutex Lock;
+    std::map<uint32_t, std::list<FutexWaiter *> > Queues;
+  };
+
+  FutexTable &GetFutexTable() {
+    static FutexTable *Table = new FutexTable;
+    return *Table;
+  }
+
+  // Block until woken if the word at Addr still holds Val. Timeout is the
+  // guest address of a relative timespec, or 0 to wait forever.
+  int FutexWait(OiMachineModel *MM, uint32_t Addr, uint32_t Val,
+                uint32_t Timeout) {
+    FutexTable &T = GetFutexTable();
+    std::unique_lock<std::mutex> Guard(T.Lock);
+    if (*reinterpret_cast<volatile uint32_t *>(&MM->Mem->memory[Addr]) != Val)
+      return -EAGAIN;
+    FutexWaiter W;
+    W.Woken = false;
+    std::list<FutexWaiter *> &Queue = T.Queues[Addr];
+    std::list<FutexWaiter *>::iterator It = Queue.insert(Queue.end(), &W);
+    if (Timeout == 0) {
+      W.Cond.wait(Guard, [&W] { return W.Woken; });
+      return 0;
+    }
+    const int32_t *TS =
+      reinterpret_cast<const int32_t *>(&MM->Mem->memory[Timeout]);
+    if (W.Cond.wait_for(Guard, std::chrono::seconds(TS[0]) +
+                        std::chrono::nanoseconds(TS[1]),
+                        [&W] { return W.Woken; }))
+      return 0;
+    // Not woken, so W is still queued and Queue is still alive
+    Queue.erase(It);
+    if (Queue.empty())
+      T.Queues.erase(Addr);
+    return -ETIMEDOUT;
+  }
+
+  // Wake up to Count threads waiting on Addr and return how many woke.
+  int FutexWake(uint32_t Addr, uint32_t Count) {
+    FutexTable &T = GetFutexTable();
+    std::lock_guard<std::mutex> Guard(T.Lock);
+    std::map<uint32_t, std::list<FutexWaiter *> >::iterator I =
+      T.Queues.find(Addr);
+    if (I == T.Queues.end())
+      return 0;
+    uint32_t Woken = 0;
+    while (!I->second.empty() && Woken < Count) {
+      FutexWaiter *W = I->second.front();
+      I->second.pop_front();
+      W->Woken = true;
+      W->Cond.notify_one();
+      ++Woken;
+    }
+    if (I->second.empty())
+      T.Queues.erase(I);
+    return Woken;
+  }
+
+  // Guest thread ids follow the host pid, as on Linux
+  std::atomic<uint32_t> LastTid(0);
 
   uint32_t GetInt(OiMachineModel *MM, uint32_t num) {
     return MM->Bank[5 + num];
@@ -346,19 +397,53 @@ uint32_t *GetSyscallTable() {
                  unsigned int size) {
     memcpy(buf,&MM->Mem->memory[MM->Bank[5+argn]],size);
   }
+
+  // Host pointer to Size bytes of guest memory at argument argn, or null if
+  // they are not all inside guest memory
+  unsigned char *GetPointer(OiMachineModel *MM, int argn, uint64_t Size) {
+    uint64_t Addr = MM->Bank[5+argn];
+    if (Addr + Size > MM->Mem->TOTALSIZE)
+      return nullptr;
+    return &MM->Mem->memory[Addr];
+  }
+
+  // Host pointer to the NUL-terminated guest string at argument argn, or
+  // null if it runs past the end of guest memory
+  const char *GetString(OiMachineModel *MM, int argn) {
+    uint64_t Addr = MM->Bank[5+argn];
+    if (Addr >= MM->Mem->TOTALSIZE ||
+        !memchr(&MM->Mem->memory[Addr], 0, MM->Mem->TOTALSIZE - Addr))
+      return nullptr;
+    return reinterpret_cast<const char *>(&MM->Mem->memory[Addr]);
+  }
+
+  // Translate the guest iovec array at argument argn, { u32 base, u32 len }
+  // per entry, into host iovecs pointing into guest memory. Returns 0 or a
+  // negative errno.
+  int GetIOVec(OiMachineModel *MM, int argn, uint32_t Count,
+               SmallVectorImpl<struct iovec> &IOV) {
+    if (Count > IOV_MAX)
+      return -EINVAL;
+    const uint32_t *Guest = reinterpret_cast<const uint32_t *>(
+        GetPointer(MM, argn, Count * 8ULL));
+    if (!Guest)
+      return -EFAULT;
+    IOV.resize(Count);
+    for (uint32_t i = 0; i < Count; ++i) {
+      uint64_t Base = Guest[2 * i], Len = Guest[2 * i + 1];
+      if (Base + Len > MM->Mem->TOTALSIZE)
+        return -EFAULT;
+      IOV[i].iov_base = &MM->Mem->memory[Base];
+      IOV[i].iov_len = Len;
+    }
+    return 0;
+  }
   
 
 }
 
 #define NDEBUG
 
-void ProcessSyscall(OiMachineModel *MM) {
-#ifndef NDEBUG
-  raw_ostream &DebugOut = outs();
-#else
-  raw_ostream &DebugOut = nulls();
-#endif
-#define DEBUG_SYSCALL(x) DebugOut << "Executing syscall: " << x
 #define SET_BUFFER_CORRECT_ENDIAN(x,y,z) memcpy(&MM->Mem->memory[MM->Bank[5+x]],y,z)
 #define FIX_OPEN_FLAGS(dst, src) do {                      \
     dst = 0;                                               \
@@ -416,145 +501,160 @@ void ProcessSyscall(OiMachineModel *MM) {
     dst.st_blksize = src.st_blksize;                                    \
     dst.st_blocks = src.st_blocks;                                      \
   } while (0)
-  
-#define CORRECT_SOCKADDR_STRUCT_TO_HOST(buf)                      
-#define CORRECT_SOCKADDR_STRUCT_TO_GUEST(buf)                          
-#define CORRECT_TIMEVAL_STRUCT(buf)                                     
-#define CORRECT_TIMEZONE_STRUCT(buf)                                    
 
-  const uint32_t *sctbl = GetSyscallTable();
-  const uint32_t syscall = MM->Bank[4];
-  
-  if (syscall == sctbl[0]) {        // restart_syscall
+#define CORRECT_SOCKADDR_STRUCT_TO_HOST(buf)
+#define CORRECT_SOCKADDR_STRUCT_TO_GUEST(buf)
+#define CORRECT_TIMEVAL_STRUCT(buf)
+#define CORRECT_TIMEZONE_STRUCT(buf)
+
+namespace {
+
+  void EmulateRestartSyscall(OiMachineModel *MM, uint64_t NextPC) {
+  }
 
-  } else if (syscall == sctbl[1]) { // exit
-    DEBUG_SYSCALL("exit");
+  void EmulateExit(OiMachineModel *MM, uint64_t NextPC) {
     int exit_status = GetInt(MM, 0);
+    // Only the calling thread ends, unless it is the initial one
+    if (MM->Tid != 0) {
+      MM->Exited = true;
+      return;
+    }
+    if (MM->AsyncIO)
+      MM->AsyncIO->syncAll();
     exit(exit_status);
-  } else if (syscall == sctbl[2]) { // fork
+  }
+
+  // The I/O threads do not survive in the child
+  int ForkGuest(OiMachineModel *MM) {
+    if (MM->AsyncIO)
+      MM->AsyncIO->syncAll();
     int ret = ::fork();
-    SetInt(MM, 0, ret);
-    return;
-  } else if (syscall == sctbl[3]) { // read
-    DEBUG_SYSCALL("read");
+    if (ret == 0)
+      MM->AsyncIO = nullptr;
+    return ret;
+  }
+
+  void EmulateFork(OiMachineModel *MM, uint64_t NextPC) {
+    SetInt(MM, 0, ForkGuest(MM));
+  }
+
+  // read, write, readv and writev hand guest memory straight to the host
+  void EmulateRead(OiMachineModel *MM, uint64_t NextPC) {
     int fd = GetInt(MM, 0);
     unsigned count = GetInt(MM, 2);
-    unsigned char *buf = (unsigned char*) malloc(count);
-    int ret = ::read(fd, buf, count);
-    SetBuffer(MM, 1, buf, ret);
+    unsigned char *buf = GetPointer(MM, 1, count);
+    ssize_t ret;
+    if (!buf)
+      ret = -EFAULT;
+    else if (!MM->AsyncIO || !MM->AsyncIO->read(fd, buf, count, ret))
+      ret = ::read(fd, buf, count);
     SetInt(MM, 0, ret);
-    free(buf);
-    return;
+  }
 
-  } else if (syscall == sctbl[4]) { // write
-    DEBUG_SYSCALL("write");
+  void EmulateWrite(OiMachineModel *MM, uint64_t NextPC) {
     int fd = GetInt(MM, 0);
     unsigned count = GetInt(MM, 2);
-    unsigned char *buf = (unsigned char*) malloc(count);
-    GetBuffer(MM, 1, buf, count);
-    int ret = ::write(fd, buf, count);
+    unsigned char *buf = GetPointer(MM, 1, count);
+    ssize_t ret;
+    if (!buf)
+      ret = -EFAULT;
+    else if (!MM->AsyncIO || !MM->AsyncIO->write(fd, buf, count, ret))
+      ret = ::write(fd, buf, count);
     SetInt(MM, 0, ret);
-    free(buf);
-    return;
+  }
 
-  } else if (syscall == sctbl[5]) { // open
-    DEBUG_SYSCALL("open");
-    unsigned char pathname[100];
-    GetBuffer(MM, 0, pathname, 100);
+  void EmulateOpen(OiMachineModel *MM, uint64_t NextPC) {
     int flags = GetInt(MM, 1);
     int newflags = 0;
     FIX_OPEN_FLAGS(newflags, flags);
     int mode = GetInt(MM, 2);
-    int ret = ::open((char*)pathname, newflags, mode);
+    int ret = ::open(GetString(MM, 0), newflags, mode);
     SetInt(MM, 0, ret);
-    return;
+  }
 
-  } else if (syscall == sctbl[6]) { // close
-    DEBUG_SYSCALL("close");
+  void EmulateClose(OiMachineModel *MM, uint64_t NextPC) {
     int fd = GetInt(MM, 0);
     int ret;
     // Silently ignore attempts to close standard streams (newlib may try to do so when exiting)
+    if (MM->AsyncIO)
+      MM->AsyncIO->close(fd);
     if (fd == STDIN_FILENO || fd == STDOUT_FILENO || fd == STDERR_FILENO)
       ret = 0;
     else
       ret = ::close(fd);
     SetInt(MM, 0, ret);
-    return;
+  }
 
-  } else if (syscall == sctbl[7]) { // creat
-    DEBUG_SYSCALL("creat");
-    unsigned char pathname[100];
-    GetBuffer(MM, 0, pathname, 100);
+  void EmulateCreat(OiMachineModel *MM, uint64_t NextPC) {
     int mode = GetInt(MM, 1);
-    int ret = ::creat((char*)pathname, mode);
+    int ret = ::creat(GetString(MM, 0), mode);
     SetInt(MM, 0, ret);
-    return;
+  }
+
+  void EmulateUnlink(OiMachineModel *MM, uint64_t NextPC) {
+    int ret = ::unlink(GetString(MM, 0));
+    SetInt(MM, 0, ret);
+  }
 
-  } else if (syscall == sctbl[8]) { // time
-    DEBUG_SYSCALL("time");
+  void EmulateTime(OiMachineModel *MM, uint64_t NextPC) {
     time_t param;
     time_t ret = ::time(&param);
     if (GetInt(MM, 0) != 0 && ret != (time_t)-1)
       SET_BUFFER_CORRECT_ENDIAN(0, (unsigned char *)&param,(unsigned) sizeof(time_t));
     SetInt(MM, 0, ret);
-    return;
+  }
 
-  } else if (syscall == sctbl[9]) { // lseek
-    DEBUG_SYSCALL("lseek");
+  void EmulateLseek(OiMachineModel *MM, uint64_t NextPC) {
     off_t offset = GetInt(MM, 1);
     int whence = GetInt(MM, 2);
     int fd = GetInt(MM, 0);
     int ret;
     ret = ::lseek(fd, offset, whence);
     SetInt(MM, 0, ret);
-    return;
+  }
 
-  } else if (syscall == sctbl[10]) { // getpid
-    DEBUG_SYSCALL("getpid");
+  void EmulateGetpid(OiMachineModel *MM, uint64_t NextPC) {
     pid_t ret = getpid();
     SetInt(MM, 0, ret);
-    return;
+  }
 
-  } else if (syscall == sctbl[11]) { // access
-    DEBUG_SYSCALL("access");
-    unsigned char pathname[100];
-    GetBuffer(MM, 0, pathname, 100);
+  void EmulateAccess(OiMachineModel *MM, uint64_t NextPC) {
     int mode = GetInt(MM, 1);
-    int ret = ::access((char*)pathname, mode);
+    int ret = ::access(GetString(MM, 0), mode);
     SetInt(MM, 0, ret);
-    return;
+  }
 
-  } else if (syscall == sctbl[12]) { // kill
-    DEBUG_SYSCALL("kill");
-    SetInt(MM, 0, 0); 
-    return;
+  void EmulateKill(OiMachineModel *MM, uint64_t NextPC) {
+    SetInt(MM, 0, 0);
+  }
 
-  } else if (syscall == sctbl[13]) { // dup
-    DEBUG_SYSCALL("dup");
+  void EmulateDup(OiMachineModel *MM, uint64_t NextPC) {
     int fd = GetInt(MM, 0);
     int ret = dup(fd);
+    // Both descriptors now share one offset
+    if (MM->AsyncIO && ret >= 0) {
+      MM->AsyncIO->exclude(fd);
+      MM->AsyncIO->exclude(ret);
+    }
     SetInt(MM, 0, ret);
-    return;
+  }
 
-  } else if (syscall == sctbl[14]) { // times
-    DEBUG_SYSCALL("times");
+  void EmulateTimes(OiMachineModel *MM, uint64_t NextPC) {
     struct tms buf;
     clock_t ret = ::times(&buf);
     if (ret != (clock_t)-1)
-      SET_BUFFER_CORRECT_ENDIAN(0, (unsigned char*)&buf, 
+      SET_BUFFER_CORRECT_ENDIAN(0, (unsigned char*)&buf,
                                 (unsigned)sizeof(struct tms));
     SetInt(MM, 0, ret);
-    return;
+  }
 
-  } else if (syscall == sctbl[15]) { // brk
-    DEBUG_SYSCALL("brk");
+  void EmulateBrk(OiMachineModel *MM, uint64_t NextPC) {
     int ptr = GetInt(MM, 0);
     llvm_unreachable("brk unimplemented!");
     //SetInt(MM, 0, ref.ac_dyn_loader.mem_map.brk((Elf32_Addr)ptr));
-    return;
+  }
 
-  } else if (syscall == sctbl[16]) { // mmap
-    DEBUG_SYSCALL("mmap");
+  void EmulateMmap(OiMachineModel *MM, uint64_t NextPC) {
     // Supports only anonymous mappings
     int flags = GetInt(MM, 3);
     Elf32_Addr addr = GetInt(MM, 0);
@@ -565,10 +665,9 @@ void ProcessSyscall(OiMachineModel *MM) {
     } else {
       //      SetInt(MM, 0, ref.ac_dyn_loader.mem_map.mmap_anon(addr, size));
     }
-    return;
+  }
 
-  } else if (syscall == sctbl[17]) { // munmap
-    DEBUG_SYSCALL("munmap");
+  void EmulateMunmap(OiMachineModel *MM, uint64_t NextPC) {
     Elf32_Addr addr = GetInt(MM, 0);
     Elf32_Word size = GetInt(MM, 1);
     llvm_unreachable("munmap unimplemented!");
@@ -576,38 +675,31 @@ void ProcessSyscall(OiMachineModel *MM) {
     //            SetInt(MM, 0, 0);
     //    else
       SetInt(MM, 0, -EINVAL);
-    return;
+  }
 
-  } else if (syscall == sctbl[18]) { // stat
-    DEBUG_SYSCALL("stat");
-    unsigned char pathname[256];
-    GetBuffer(MM, 0, pathname, 256);
+  void EmulateStat(OiMachineModel *MM, uint64_t NextPC) {
     struct stat buf;
-    int ret = ::stat((char *)pathname, &buf);
+    int ret = ::stat(GetString(MM, 0), &buf);
     if (ret >= 0) {
       struct oi_stat dst;
       CORRECT_STAT_STRUCT(dst, buf);
       SetBuffer(MM, 1, (unsigned char*)&dst, 60);
     }
     SetInt(MM, 0, ret);
-    return;
+  }
 
-  } else if (syscall == sctbl[19]) { // lstat
-    DEBUG_SYSCALL("lstat");
-    unsigned char pathname[256];
-    GetBuffer(MM, 0, pathname, 256);
+  void EmulateLstat(OiMachineModel *MM, uint64_t NextPC) {
     struct stat buf;
-    int ret = ::lstat((char *)pathname, &buf);
+    int ret = ::lstat(GetString(MM, 0), &buf);
     if (ret >= 0) {
       struct oi_stat dst;
       CORRECT_STAT_STRUCT(dst, buf);
       SetBuffer(MM, 1, (unsigned char*)&dst, 60);
     }
     SetInt(MM, 0, ret);
-    return;
+  }
 
-  } else if (syscall == sctbl[20]) { // fstat
-    DEBUG_SYSCALL("fstat");
+  void EmulateFstat(OiMachineModel *MM, uint64_t NextPC) {
     int fd = GetInt(MM, 0);
     struct stat buf;
     int ret = ::fstat(fd, &buf);
@@ -617,19 +709,16 @@ void ProcessSyscall(OiMachineModel *MM) {
       SetBuffer(MM, 1, (unsigned char*)&dst, 60);
     }
     SetInt(MM, 0, ret);
-    return;
+  }
 
-  } else if (syscall == sctbl[21]) { // uname
-    DEBUG_SYSCALL("uname");
-    struct utsname *buf = (struct utsname*) malloc(sizeof(utsname));
-    int ret = ::uname(buf);
-    SetBuffer(MM, 0, (unsigned char *) buf, sizeof(utsname));
-    free(buf);
+  void EmulateUname(OiMachineModel *MM, uint64_t NextPC) {
+    struct utsname buf;
+    int ret = ::uname(&buf);
+    SetBuffer(MM, 0, (unsigned char *) &buf, sizeof(utsname));
     SetInt(MM, 0, ret);
-    return; 
+  }
 
-  } else if (syscall == sctbl[22]) { // _llseek
-    DEBUG_SYSCALL("_llseek");
+  void EmulateLlseek(OiMachineModel *MM, uint64_t NextPC) {
     unsigned fd = GetInt(MM, 0);
     unsigned long offset_high = GetInt(MM, 1);
     unsigned long offset_low = GetInt(MM, 2);
@@ -650,91 +739,51 @@ void ProcessSyscall(OiMachineModel *MM) {
       ret = -1;
     }
     SetInt(MM, 0, ret);
-    return; 
+  }
 
-  } else if (syscall == sctbl[23]) { // readv
-    DEBUG_SYSCALL("readv");
-    int ret;
+  void EmulateReadv(OiMachineModel *MM, uint64_t NextPC) {
     int fd = GetInt(MM, 0);
-    int iovcnt = GetInt(MM, 2);
-    int *addresses = (int *) malloc(sizeof(int)*iovcnt);
-    struct iovec *buf = (struct iovec *) malloc(sizeof(struct iovec)*iovcnt);
-    GetBuffer(MM, 1, (unsigned char *) buf, sizeof(struct iovec)*iovcnt);
-    for (int i = 0; i < iovcnt; i++) {
-      memcpy(&addresses[i], &buf[i].iov_base, sizeof(int));
-      unsigned char *tmp = (unsigned char *) malloc(buf[i].iov_len);
-      buf[i].iov_base = (void *)tmp;
-    }
-    ret = ::readv(fd, buf, iovcnt);
-    for (int i = 0; i < iovcnt; i++) {
-      SetInt(MM, 1, addresses[i]);
-      SetBuffer(MM, 1, (unsigned char *)buf[i].iov_base, buf[i].iov_len);
-      free (buf[i].iov_base);
-    }
-    free(addresses);
-    free(buf);
+    SmallVector<struct iovec, 8> iov;
+    int ret = GetIOVec(MM, 1, GetInt(MM, 2), iov);
+    if (ret == 0)
+      ret = ::readv(fd, iov.data(), iov.size());
     SetInt(MM, 0, ret);
-    return;
+  }
 
-  } else if (syscall == sctbl[24]) { // writev
-    DEBUG_SYSCALL("writev");
-    int ret;
+  void EmulateWritev(OiMachineModel *MM, uint64_t NextPC) {
     int fd = GetInt(MM, 0);
-    int iovcnt = GetInt(MM, 2);
-    struct iovec *buf = (struct iovec *) malloc(sizeof(struct iovec)*iovcnt);
-    GetBuffer(MM, 1, (unsigned char *) buf, sizeof(struct iovec)*iovcnt);
-    for (int i = 0; i < iovcnt; i++) {
-      unsigned char *tmp;
-      //      buf[i].iov_base = (void *) 
-        //        CORRECT_ENDIAN((unsigned) buf[i].iov_base, sizeof(void *));
-      //      buf[i].iov_len  = buf[i].iov_len;
-      int iov_base = 0;
-      memcpy(&iov_base, &buf[i].iov_base, sizeof(int));
-      SetInt(MM, 1, iov_base);
-      tmp = (unsigned char *) malloc(buf[i].iov_len);
-      buf[i].iov_base = (void *)tmp;
-      GetBuffer(MM, 1, tmp, buf[i].iov_len);
-    }
-    ret = ::writev(fd, buf, iovcnt);
-    for (int i = 0; i < iovcnt; i++) {
-      free (buf[i].iov_base);
-    }
-    free(buf);
+    SmallVector<struct iovec, 8> iov;
+    int ret = GetIOVec(MM, 1, GetInt(MM, 2), iov);
+    if (ret == 0)
+      ret = ::writev(fd, iov.data(), iov.size());
     SetInt(MM, 0, ret);
-    return;
+  }
 
-  } else if (syscall == sctbl[25]) { // mmap2
-    SetInt(MM,0, sctbl[16]);
-    return ProcessSyscall(MM); //redirect to mmap
+  void EmulateMmap2(OiMachineModel *MM, uint64_t NextPC) {
+    EmulateMmap(MM, NextPC);
+  }
 
-  } else if (syscall == sctbl[26]) { // stat64
-    DEBUG_SYSCALL("stat64");
-    unsigned char pathname[256];
-    GetBuffer(MM, 0, pathname, 256);
+  void EmulateStat64(OiMachineModel *MM, uint64_t NextPC) {
     struct stat64 buf;
-    int ret = ::stat64((char *)pathname, &buf);
+    int ret = ::stat64(GetString(MM, 0), &buf);
     if (ret >= 0) {
       //CORRECT_STAT_STRUCT(buf);
       SetBuffer(MM, 1, (unsigned char*)&buf, sizeof(struct stat64));
     }
     SetInt(MM, 0, ret);
-    return;
+  }
 
-  } else if (syscall == sctbl[27]) { // lstat64
-    DEBUG_SYSCALL("lstat64");
-    unsigned char pathname[256];
-    GetBuffer(MM, 0, pathname, 256);
+  void EmulateLstat64(OiMachineModel *MM, uint64_t NextPC) {
     struct stat64 buf;
-    int ret = ::lstat64((char *)pathname, &buf);
+    int ret = ::lstat64(GetString(MM, 0), &buf);
     if (ret >= 0) {
       //CORRECT_STAT_STRUCT(buf);
       SetBuffer(MM, 1, (unsigned char*)&buf, sizeof(struct stat64));
     }
     SetInt(MM, 0, ret);
-    return;
+  }
 
-  } else if (syscall == sctbl[28]) { // fstat64
-    DEBUG_SYSCALL("fstat64");
+  void EmulateFstat64(OiMachineModel *MM, uint64_t NextPC) {
     int fd = GetInt(MM, 0);
     struct stat64 buf;
     int ret = ::fstat64(fd, &buf);
@@ -743,45 +792,35 @@ void ProcessSyscall(OiMachineModel *MM) {
       SetBuffer(MM, 1, (unsigned char*)&buf, sizeof(struct stat64));
     }
     SetInt(MM, 0, ret);
-    return;
+  }
 
-  } else if (syscall == sctbl[29]) { // getuid32
-    DEBUG_SYSCALL("getuid32");
-    uid_t ret = ::getuid();
-    SetInt(MM, 0, (int)ret);
-    return;
+  void EmulateGetuid32(OiMachineModel *MM, uint64_t NextPC) {
+    SetInt(MM, 0, (int)::getuid());
+  }
 
-  } else if (syscall == sctbl[30]) { // getgid32
-    DEBUG_SYSCALL("getgid32");
-    gid_t ret = ::getgid();
-    SetInt(MM, 0, (int)ret);
-    return;
+  void EmulateGetgid32(OiMachineModel *MM, uint64_t NextPC) {
+    SetInt(MM, 0, (int)::getgid());
+  }
 
-  } else if (syscall == sctbl[31]) { // geteuid32
-    DEBUG_SYSCALL("geteuid32");
-    uid_t ret = ::geteuid();
-    SetInt(MM, 0, (int)ret);
-    return;
+  void EmulateGeteuid32(OiMachineModel *MM, uint64_t NextPC) {
+    SetInt(MM, 0, (int)::geteuid());
+  }
 
-  } else if (syscall == sctbl[32]) { // getegid32
-    DEBUG_SYSCALL("getegid32");
-    gid_t ret = ::getegid();
-    SetInt(MM, 0, (int)ret);
-    return;
+  void EmulateGetegid32(OiMachineModel *MM, uint64_t NextPC) {
+    SetInt(MM, 0, (int)::getegid());
+  }
 
-  } else if (syscall == sctbl[33]) { // fcntl64
-    DEBUG_SYSCALL("fcntl64");
-    int ret = -EINVAL;
-    SetInt(MM, 0, ret);
-    return;
+  void EmulateFcntl64(OiMachineModel *MM, uint64_t NextPC) {
+    SetInt(MM, 0, -EINVAL);
+  }
 
-  } else if (syscall == sctbl[34]) { // exit_group
-    DEBUG_SYSCALL("exit_group");
-    int exit_status = GetInt(MM, 0);
-    exit(exit_status);
-    return;
-  } else if (syscall == sctbl[35]) { // socketcall
-    DEBUG_SYSCALL("socketcall");
+  void EmulateExitGroup(OiMachineModel *MM, uint64_t NextPC) {
+    if (MM->AsyncIO)
+      MM->AsyncIO->syncAll();
+    exit(GetInt(MM, 0));
+  }
+
+  void EmulateSocketcall(OiMachineModel *MM, uint64_t NextPC) {
     // See target toolchain include/linux/net.h and include/asm/unistd.h
     // for detailed information on socketcall translation. This works
     // form ARM.
@@ -793,13 +832,11 @@ void ProcessSyscall(OiMachineModel *MM) {
     switch (call) {
     case 1: // Assuming 1 = SYS_SOCKET
       {
-        DEBUG_SYSCALL("\tsocket");
         ret = ::socket(args[0], args[1], args[2]);
         break;
       }
     case 2: // Assuming 2 = SYS_BIND
       {
-        DEBUG_SYSCALL("\tbind");
         struct sockaddr buf;
         SetInt(MM, 0, args[1]);
         GetBuffer(MM, 0, (unsigned char*)&buf, sizeof(struct sockaddr));
@@ -809,7 +846,6 @@ void ProcessSyscall(OiMachineModel *MM) {
       }
     case 3: // Assuming 3 = SYS_CONNECT
       {
-        DEBUG_SYSCALL("\tconnect");
         struct sockaddr buf;
         SetInt(MM, 0, args[1]);
         GetBuffer(MM, 0, (unsigned char*)&buf, sizeof(struct sockaddr));
@@ -819,7 +855,6 @@ void ProcessSyscall(OiMachineModel *MM) {
       }
     case 4: // Assuming 4 = SYS_LISTEN
       {
-        DEBUG_SYSCALL("\tlisten");
         ret = ::listen(args[0], args[1]);
         break;
       }
@@ -827,7 +862,6 @@ void ProcessSyscall(OiMachineModel *MM) {
       {
         struct sockaddr addr;
         socklen_t addrlen;
-        DEBUG_SYSCALL("\taccept");
         ret = ::accept(args[0], &addr, &addrlen);
         CORRECT_SOCKADDR_STRUCT_TO_GUEST(addr);
         //        addrlen = CORRECT_ENDIAN(addrlen, sizeof(socklen_t));
@@ -842,35 +876,167 @@ void ProcessSyscall(OiMachineModel *MM) {
       break;
     }
     SetInt(MM, 0, ret);
-    return;
-  } else if (syscall == sctbl[36]) { // gettimeofday
-    DEBUG_SYSCALL("gettimeofday");
+  }
+
+  void EmulateGettimeofday(OiMachineModel *MM, uint64_t NextPC) {
     int ret = -EINVAL;
     struct timezone tz;
     struct timeval tv;
     ret = ::gettimeofday(&tv, &tz);
     CORRECT_TIMEVAL_STRUCT(tv);
     CORRECT_TIMEZONE_STRUCT(tz);
-    SetBuffer(MM, 0, (unsigned char*)&tv, sizeof(struct timeval));
-    SetBuffer(MM, 1, (unsigned char*)&tz, sizeof(struct timezone));   
+    if (GetInt(MM, 0) != 0)
+      SetBuffer(MM, 0, (unsigned char*)&tv, sizeof(struct timeval));
+    if (GetInt(MM, 1) != 0)
+      SetBuffer(MM, 1, (unsigned char*)&tz, sizeof(struct timezone));
     SetInt(MM, 0, ret);
-    return;
-  } else if (syscall == sctbl[37]) { // settimeofday
-    DEBUG_SYSCALL("settimeofday");
+  }
+
+  void EmulateSettimeofday(OiMachineModel *MM, uint64_t NextPC) {
     int ret = -EPERM;
     llvm_unreachable("settimeofday: Ignored attempt to change host date");
     SetInt(MM, 0, ret);
+  }
+
+  void EmulateClone(OiMachineModel *MM, uint64_t NextPC) {
+    uint32_t flags = GetInt(MM, 0);
+    // Without CLONE_VM the child gets its own copy of memory, as in fork
+    if ((flags & OI_CLONE_VM) == 0) {
+      SetInt(MM, 0, ForkGuest(MM));
+      return;
+    }
+    if (!MM->RunThread) {
+      SetInt(MM, 0, -ENOSYS);
+      return;
+    }
+    uint32_t stack = GetInt(MM, 1);
+    uint32_t ptid = GetInt(MM, 2);
+    uint32_t ctid = GetInt(MM, 4);
+    uint32_t tid = ::getpid() + ++LastTid;
+    OiMachineModel *Child = MM->CreateThread(stack, tid);
+    SetInt(Child, 0, 0);
+    if (flags & OI_CLONE_PARENT_SETTID)
+      *reinterpret_cast<uint32_t *>(&MM->Mem->memory[ptid]) = tid;
+    if (flags & OI_CLONE_CHILD_SETTID)
+      *reinterpret_cast<uint32_t *>(&MM->Mem->memory[ctid]) = tid;
+    if (flags & OI_CLONE_CHILD_CLEARTID)
+      Child->ClearTid = ctid;
+    std::thread([Child, NextPC] {
+      Child->RunThread(Child, NextPC);
+      if (Child->ClearTid) {
+        *reinterpret_cast<volatile uint32_t *>
+          (&Child->Mem->memory[Child->ClearTid]) = 0;
+        FutexWake(Child->ClearTid, 1);
+      }
+      delete Child;
+    }).detach();
+    SetInt(MM, 0, tid);
+  }
+
+  void EmulateFutex(OiMachineModel *MM, uint64_t NextPC) {
+    uint32_t addr = GetInt(MM, 0);
+    uint32_t op = GetInt(MM, 1) & OI_FUTEX_CMD_MASK;
+    uint32_t val = GetInt(MM, 2);
+    int ret = -ENOSYS;
+    if (op == OI_FUTEX_WAIT)
+      ret = FutexWait(MM, addr, val, GetInt(MM, 3));
+    else if (op == OI_FUTEX_WAKE)
+      ret = FutexWake(addr, val);
+    SetInt(MM, 0, ret);
+  }
+
+  void EmulateGettid(OiMachineModel *MM, uint64_t NextPC) {
+    SetInt(MM, 0, MM->Tid ? MM->Tid : ::getpid());
+  }
+
+  struct SyscallDesc {
+    const char *Name;
+    uint32_t Number;
+    const char *Args;
+    void (*Handler)(OiMachineModel *MM, uint64_t NextPC);
+  };
+
+  const SyscallDesc SyscallDescs[] = {
+#define OI_SYSCALL(Handler, Name, Number, Args)                 \
+    { Name, Number, Args, Emulate##Handler },
+#include "OiSyscalls.def"
+  };
+
+  // Guest syscall numbers are dense from sys_syscall, so dispatch is a
+  // direct index into this table
+  class SyscallTable {
+    std::vector<const SyscallDesc *> Table;
+  public:
+    SyscallTable() : Table(sys_futex - sys_syscall + 1) {
+      for (const SyscallDesc &D : SyscallDescs)
+        if (D.Number >= sys_syscall && !Table[D.Number - sys_syscall])
+          Table[D.Number - sys_syscall] = &D;
+    }
+    const SyscallDesc *lookup(uint32_t Number) const {
+      if (Number < sys_syscall || Number - sys_syscall >= Table.size())
+        return nullptr;
+      return Table[Number - sys_syscall];
+    }
+  };
+
+  // Check the pointer and string arguments of D and settle the I/O pending
+  // on its descriptors. Returns false if an argument is outside guest
+  // memory.
+  bool CheckArgs(OiMachineModel *MM, const SyscallDesc &D) {
+    for (unsigned i = 0; D.Args[i]; ++i) {
+      uint32_t Val = GetInt(MM, i);
+      switch (D.Args[i]) {
+      case 'p':
+        if (Val != 0 && !GetPointer(MM, i, 1))
+          return false;
+        break;
+      case 's':
+        if (!GetString(MM, i))
+          return false;
+        break;
+      case 'f':
+        if (MM->AsyncIO)
+          MM->AsyncIO->sync(Val);
+        break;
+      }
+    }
+    return true;
+  }
+
+}
+
+void ProcessSyscall(OiMachineModel *MM, uint64_t NextPC) {
+  static const SyscallTable Syscalls;
+  const SyscallDesc *D = Syscalls.lookup(MM->Bank[4]);
+  if (!D) {
+    /* Default case */
+    SetInt(MM, 0, -EINVAL);
     return;
   }
 
-  /* Default case */
-  SetInt(MM, 0, -EINVAL);
-  return;
+#ifndef NDEBUG
+  raw_ostream &DebugOut = outs();
+  DebugOut << "Executing syscall: " << D->Name << "(";
+  for (unsigned i = 0; D->Args[i]; ++i) {
+    DebugOut << (i ? ", " : "");
+    if (D->Args[i] == 's' && GetString(MM, i))
+      DebugOut << '"' << GetString(MM, i) << '"';
+    else
+      DebugOut << format("0x%x", GetInt(MM, i));
+  }
+  DebugOut << ")\n";
+#endif
+
+  if (!CheckArgs(MM, *D)) {
+    SetInt(MM, 0, -EFAULT);
+    return;
+  }
+  D->Handler(MM, NextPC);
 }
-#undef DEBUG_SYSCALL
 #undef SET_BUFFER_CORRECT_ENDIAN
+#undef FIX_OPEN_FLAGS
 #undef CORRECT_STAT_STRUCT
 #undef CORRECT_SOCKADDR_STRUCT_TO_HOST
 #undef CORRECT_SOCKADDR_STRUCT_TO_GUEST
-#undef CORRECT_TIMEVAL_STRUCT                                     
+#undef CORRECT_TIMEVAL_STRUCT
 #undef CORRECT_TIMEZONE_STRUCT
@@ -3,7 +3,9 @@
 
 #include "OiMachineModel.h"
 
-void ProcessSyscall(llvm::OiMachineModel *MM);
+// Emulate the guest syscall in MM. NextPC is where a thread created by
+// clone starts executing.
+void ProcessSyscall(llvm::OiMachineModel *MM, uint64_t NextPC);
 
 
 #endif
@@ -0,0 +1,55 @@
+/* Control-flow kernel: data-dependent branches, a switch and short calls,
+   so guest basic blocks are small. */
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Result for the default size */
+#define EXPECTED 2081309268u
+
+static unsigned seed = 1;
+
+static unsigned next(void) {
+  seed = seed * 1664525u + 1013904223u;
+  return seed >> 16;
+}
+
+static unsigned collatz(unsigned v) {
+  unsigned steps = 0;
+  while (v != 1 && steps < 64) {
+    if (v & 1)
+      v = 3 * v + 1;
+    else
+      v >>= 1;
+    ++steps;
+  }
+  return steps;
+}
+
+int main(int argc, char **argv) {
+  unsigned n = argc > 1 ? atoi(argv[1]) : 200000;
+  unsigned hist[8] = { 0 };
+  unsigned total = 0;
+  unsigned i;
+
+  for (i = 0; i < n; ++i) {
+    unsigned v = next();
+    switch (v & 7) {
+    case 0: total += collatz(v | 1); break;
+    case 1: total ^= v; break;
+    case 2: total += v > 30000 ? 1 : 2; break;
+    case 3: if (v & 16) total -= 3; else total += 5; break;
+    case 4: total += collatz((v >> 3) | 1); break;
+    default: total += v & 15; break;
+    }
+    ++hist[v & 7];
+  }
+  for (i = 0; i < 8; ++i)
+    total = total * 31 + hist[i];
+  printf("branchy: %u\n", total);
+  /* Only the default size has a known result */
+  if (argc <= 1 && total != EXPECTED) {
+    fprintf(stderr, "branchy: expected %u\n", EXPECTED);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,36 @@
+/* Double precision kernel: daxpy and a dot product over small arrays, so
+   the loop is dominated by LDC1/SDC1 and double arithmetic. */
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Result for the default size; every partial sum is exact in binary */
+#define EXPECTED 1394000000.0
+
+#define N 256
+
+static double x[N], y[N];
+
+int main(int argc, char **argv) {
+  unsigned reps = argc > 1 ? atoi(argv[1]) : 8000;
+  double a = 0.5, dot = 0.0;
+  unsigned i, r;
+
+  for (i = 0; i < N; ++i) {
+    x[i] = i * 0.25;
+    y[i] = (N - i) * 0.125;
+  }
+  for (r = 0; r < reps; ++r) {
+    for (i = 0; i < N; ++i)
+      y[i] = a * x[i] + y[i];
+    for (i = 0; i < N; ++i)
+      dot += x[i] * y[i];
+    a = -a;
+  }
+  printf("fploop: %.6e\n", dot);
+  /* Only the default size has a known result */
+  if (argc <= 1 && dot != EXPECTED) {
+    fprintf(stderr, "fploop: expected %.6e\n", EXPECTED);
+    return 1;
+  }
+  return 0;
+}
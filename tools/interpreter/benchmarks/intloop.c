@@ -0,0 +1,28 @@
+/* Integer ALU kernel: shifts, adds, xors and multiplies in a tight loop,
+   with the working set held in registers. */
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Result for the default size */
+#define EXPECTED 2288233885u
+
+int main(int argc, char **argv) {
+  unsigned n = argc > 1 ? atoi(argv[1]) : 4000000;
+  unsigned a = 12345, b = 67890, c = 0;
+  unsigned i;
+
+  for (i = 0; i < n; ++i) {
+    a ^= a << 13;
+    a ^= a >> 17;
+    a ^= a << 5;
+    b = b * 1103515245u + 12345u;
+    c += (a & 0xff) + (b >> 24) - (i & 3);
+  }
+  printf("intloop: %u\n", a ^ b ^ c);
+  /* Only the default size has a known result */
+  if (argc <= 1 && (a ^ b ^ c) != EXPECTED) {
+    fprintf(stderr, "intloop: expected %u\n", EXPECTED);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,35 @@
+/* Memory copy kernel: word and byte copies between two buffers larger
+   than a typical L1 cache. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Result for the default size */
+#define EXPECTED 4004752825u
+
+#define SIZE (256 * 1024)
+
+static unsigned src[SIZE / 4], dst[SIZE / 4];
+
+int main(int argc, char **argv) {
+  unsigned reps = argc > 1 ? atoi(argv[1]) : 40;
+  unsigned sum = 0;
+  unsigned i, r;
+
+  for (i = 0; i < SIZE / 4; ++i)
+    src[i] = i * 2654435761u;
+  for (r = 0; r < reps; ++r) {
+    for (i = 0; i < SIZE / 4; ++i)
+      dst[i] = src[i];
+    /* Unaligned byte copy, shifted by one each time */
+    memcpy((char *)src + 1, (char *)dst + (r & 3), SIZE - 4);
+    sum += dst[r % (SIZE / 4)] + src[(r * 7) % (SIZE / 4)];
+  }
+  printf("memcopy: %u\n", sum);
+  /* Only the default size has a known result */
+  if (argc <= 1 && sum != EXPECTED) {
+    fprintf(stderr, "memcopy: expected %u\n", EXPECTED);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,184 @@
+#!/usr/bin/env python
+
+"""Run the oii microbenchmark kernels and report guest throughput.
+
+Each kernel is an OpenISA executable that checks its own result and exits
+with a nonzero status, failing the run, if it is wrong. It is timed under
+oii (best of --repeat runs) and then run once more with -profile to get
+its dynamic opcode mix. The report gives guest MIPS (millions of guest instructions
+per second) per kernel and per opcode class. Per-class figures charge each
+class a share of a kernel's time proportional to its share of the
+retired instructions, summed over all kernels.
+
+If a kernel has a translated sibling named <kernel><--native-suffix>
+(for instance built with static-bt), it is timed as well and its speedup
+over oii is reported.
+
+--output writes the results as JSON. --compare reads such a file from a
+previous build and fails if any kernel got slower than --threshold percent.
+"""
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+LOADS = set(['LB', 'LBu', 'LH', 'LHu', 'LW', 'LWL', 'LWR', 'LL', 'LWC1',
+             'LDC1', 'LUXC1', 'LWXC1', 'LDXC1'])
+STORES = set(['SB', 'SH', 'SW', 'SWL', 'SWR', 'SC', 'SWC1', 'SDC1', 'SUXC1',
+              'SWXC1', 'SDXC1'])
+MULDIV = set(['MULT', 'MULTu', 'MUL', 'DIV', 'DIVu', 'SDIV', 'UDIV', 'MFHI',
+              'MFLO', 'MTHI', 'MTLO', 'MADD', 'MADDU', 'MSUB', 'MSUBU'])
+CLASSES = ['int', 'muldiv', 'load', 'store', 'branch', 'fp', 'syscall']
+
+
+def opcode_class(name):
+    if name in LOADS:
+        return 'load'
+    if name in STORES:
+        return 'store'
+    if name in MULDIV:
+        return 'muldiv'
+    if name == 'SYSCALL':
+        return 'syscall'
+    if name[0] in 'BJ':
+        return 'branch'
+    if (name.startswith('F') or name.startswith('CVT') or
+            name.startswith('C_') or name.startswith('MFC1') or
+            name.startswith('MTC1') or name.endswith('_D32') or
+            name.endswith('_S')):
+        return 'fp'
+    return 'int'
+
+
+def run(cmd, args):
+    with open(os.devnull, 'w') as null:
+        start = time.time()
+        status = subprocess.call(cmd + args, stdout=null)
+        elapsed = time.time() - start
+    if status != 0:
+        sys.exit('oii-bench: %s exited with status %d' %
+                 (' '.join(cmd), status))
+    return elapsed
+
+
+def best_of(cmd, args, repeat):
+    return min(run(cmd, args) for _ in range(repeat))
+
+
+def measure(opts, kernel):
+    name = os.path.basename(kernel)
+    oii = [opts.oii] + opts.oii_arg
+    seconds = best_of(oii + [kernel], [], opts.repeat)
+
+    fd, profile = tempfile.mkstemp(suffix='.json')
+    os.close(fd)
+    try:
+        run(oii + ['-profile=' + profile, kernel], [])
+        with open(profile) as f:
+            data = json.load(f)
+    finally:
+        os.unlink(profile)
+
+    mix = dict((c, 0) for c in CLASSES)
+    for opcode, count in data.get('opcodes', {}).items():
+        mix[opcode_class(opcode)] += count
+    insts = data['instructions']
+    result = {
+        'kernel': name,
+        'instructions': insts,
+        'seconds': seconds,
+        'mips': insts / seconds / 1e6 if seconds > 0 else 0.0,
+        'classes': mix,
+    }
+
+    native = kernel + opts.native_suffix
+    if opts.native_suffix and os.access(native, os.X_OK):
+        native_seconds = best_of([native], [], opts.repeat)
+        result['native_seconds'] = native_seconds
+        if native_seconds > 0:
+            result['native_speedup'] = seconds / native_seconds
+    return result
+
+
+def class_throughput(results):
+    insts = dict((c, 0) for c in CLASSES)
+    seconds = dict((c, 0.0) for c in CLASSES)
+    for r in results:
+        for c in CLASSES:
+            n = r['classes'][c]
+            insts[c] += n
+            if r['instructions']:
+                seconds[c] += r['seconds'] * n / float(r['instructions'])
+    return dict((c, insts[c] / seconds[c] / 1e6 if seconds[c] > 0 else 0.0)
+                for c in CLASSES if insts[c])
+
+
+def print_report(results, classes):
+    print('%-12s %14s %10s %10s %10s' %
+          ('kernel', 'instructions', 'seconds', 'MIPS', 'native-x'))
+    for r in results:
+        speedup = r.get('native_speedup')
+        print('%-12s %14d %10.3f %10.2f %10s' %
+              (r['kernel'], r['instructions'], r['seconds'], r['mips'],
+               '%.2f' % speedup if speedup else '-'))
+    print()
+    print('%-12s %10s' % ('class', 'MIPS'))
+    for c in CLASSES:
+        if c in classes:
+            print('%-12s %10.2f' % (c, classes[c]))
+
+
+def compare(results, baseline_file, threshold):
+    with open(baseline_file) as f:
+        baseline = dict((r['kernel'], r) for r in json.load(f)['kernels'])
+    regressed = False
+    for r in results:
+        old = baseline.get(r['kernel'])
+        if not old or not old['mips']:
+            continue
+        change = (r['mips'] - old['mips']) * 100.0 / old['mips']
+        if change < -threshold:
+            print('oii-bench: %s regressed %.1f%% (%.2f -> %.2f MIPS)' %
+                  (r['kernel'], -change, old['mips'], r['mips']),
+                  file=sys.stderr)
+            regressed = True
+    return not regressed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('kernels', nargs='+',
+                        help='OpenISA kernel executables')
+    parser.add_argument('--oii', default='oii', help='oii binary to time')
+    parser.add_argument('--oii-arg', action='append', default=[],
+                        help='extra option passed to oii (repeatable)')
+    parser.add_argument('--repeat', type=int, default=3,
+                        help='timed runs per kernel; the fastest is kept')
+    parser.add_argument('--native-suffix', default='.native',
+                        help='suffix of translated kernels to time too')
+    parser.add_argument('--output', help='write the results as JSON')
+    parser.add_argument('--compare', help='JSON results of a previous run')
+    parser.add_argument('--threshold', type=float, default=5.0,
+                        help='slowdown in percent reported by --compare')
+    opts = parser.parse_args()
+
+    results = [measure(opts, k) for k in opts.kernels]
+    classes = class_throughput(results)
+    print_report(results, classes)
+
+    if opts.output:
+        with open(opts.output, 'w') as f:
+            json.dump({'oii': opts.oii, 'kernels': results,
+                       'classes': classes}, f, indent=2, sort_keys=True)
+    if opts.compare and not compare(results, opts.compare, opts.threshold):
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,46 @@
+/* Syscall-heavy kernel: many small writes, seeks and reads on a scratch
+   file, so the run time is dominated by syscall emulation. */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Result for the default size */
+#define EXPECTED 2546416u
+
+int main(int argc, char **argv) {
+  unsigned n = argc > 1 ? atoi(argv[1]) : 20000;
+  const char *path = argc > 2 ? argv[2] : "oii-bench-syscallio.tmp";
+  char buf[64];
+  unsigned sum = 0;
+  unsigned i;
+  int fd;
+
+  for (i = 0; i < sizeof(buf); ++i)
+    buf[i] = (char)i;
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("open");
+    return 1;
+  }
+  for (i = 0; i < n; ++i) {
+    buf[0] = (char)i;
+    if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+      return 1;
+  }
+  for (i = 0; i < n; ++i) {
+    lseek(fd, (off_t)((i * 7) % n) * sizeof(buf), SEEK_SET);
+    if (read(fd, buf, sizeof(buf)) != sizeof(buf))
+      return 1;
+    sum += (unsigned char)buf[0];
+  }
+  close(fd);
+  unlink(path);
+  printf("syscallio: %u\n", sum);
+  /* Only the default size has a known result */
+  if (argc <= 1 && sum != EXPECTED) {
+    fprintf(stderr, "syscallio: expected %u\n", EXPECTED);
+    return 1;
+  }
+  return 0;
+}
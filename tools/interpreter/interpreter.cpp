@@ -4,8 +4,18 @@
 
 //#define NDEBUG
 #define DBT
+#include "OiAsyncIO.h"
+#include "OiCoSim.h"
+#include "OiDecodeCache.h"
+#include "OiJIT.h"
 #include "OiMachineModel.h"
 #include "OiMemoryModel.h"
+#include "OiCacheModel.h"
+#include "OiHostCalls.h"
+#include "OiProfile.h"
+#include "OiSampler.h"
+#include "OiSnapshot.h"
+#include "OiTrace.h"
 #include "StringRefMemoryObject.h"
 #include "InterpUtils.h"
 #include "llvm/ADT/StringRef.h"
@@ -105,10 +115,250 @@ Cap("cap", cl::desc("Specifies the maximum number of instructions to interpret"
                                 "(Default 0 = unbounded)"),
           cl::init(0ULL));
 
+static cl::opt<unsigned long long>
+MemSize("memsize", cl::desc("Size of the guest address space in MiB, up to "
+                            "4096 (Default 50)"),
+        cl::init(50));
+
+static cl::opt<uint32_t>
+LoadBase("load-base", cl::desc("Guest address position-independent (ET_DYN) "
+                               "programs are loaded at (Default 0x400000)"),
+         cl::init(OiMemoryModel::DEFAULTDYNBASE));
+
+static cl::opt<std::string>
+ImageCacheDir("image-cache", cl::desc("Keep relocated program images in this "
+                                      "directory and map them directly on "
+                                      "later runs"),
+              cl::value_desc("directory"));
+
+static cl::opt<bool>
+NoDecodeCache("no-decode-cache", cl::desc("Disassemble every instruction each "
+                                          "time it is executed instead of "
+                                          "using the predecoded cache, "
+                                          "e.g. for self-modifying code"));
+
+static cl::opt<bool>
+NoBlockExec("no-block-exec", cl::desc("Execute one instruction per dispatch "
+                                      "instead of whole guest basic blocks"));
+
+static cl::opt<bool>
+HostLibc("host-libc", cl::desc("Run guest calls to memcpy, memset, strlen and "
+                               "strcmp with the host C library; each call "
+                               "counts as one instruction (off while tracing "
+                               "or modelling caches)"));
+
+static cl::opt<std::string>
+ProfileFilename("profile", cl::desc("Write a guest execution profile (block, "
+                                    "edge, function, opcode and syscall "
+                                    "counts) to this JSON file; static-bt "
+                                    "reads it with -profile-use"),
+                cl::value_desc("filename"));
+
+static cl::opt<std::string>
+TraceFilename("trace", cl::desc("Write a binary trace of every instruction "
+                                "(PC, register writes, memory accesses) to "
+                                "this file; read it with oii-trace"),
+              cl::value_desc("filename"));
+
+static cl::opt<std::string>
+CacheReportFilename("cache-report", cl::desc("Run guest loads and stores "
+                                             "through a data cache and TLB "
+                                             "model and write per-function "
+                                             "miss rates to this file"),
+                    cl::value_desc("filename"));
+
+static cl::opt<unsigned long long>
+CacheSize("cache-size", cl::desc("Data cache size in KiB for -cache-report "
+                                 "(Default 32)"),
+          cl::init(32));
+
+static cl::opt<unsigned>
+CacheAssoc("cache-assoc", cl::desc("Data cache associativity for "
+                                   "-cache-report (Default 8)"),
+           cl::init(8));
+
+static cl::opt<unsigned>
+CacheLine("cache-line", cl::desc("Data cache line size in bytes for "
+                                 "-cache-report (Default 64)"),
+          cl::init(64));
+
+static cl::opt<unsigned>
+TLBEntries("tlb-entries", cl::desc("Data TLB entries for -cache-report "
+                                   "(Default 64)"),
+           cl::init(64));
+
+static cl::opt<unsigned>
+TLBAssoc("tlb-assoc", cl::desc("Data TLB associativity for -cache-report "
+                               "(Default 4)"),
+         cl::init(4));
+
+static cl::opt<unsigned>
+TLBPage("tlb-page", cl::desc("Page size in bytes of the -cache-report TLB "
+                             "(Default 4096)"),
+        cl::init(4096));
+
+static cl::opt<unsigned long long>
+Skip("skip", cl::desc("Fast-forward this many instructions with tracing and "
+                      "profiling off before turning them on"),
+     cl::init(0ULL));
+
+static cl::opt<unsigned long long>
+Window("window", cl::desc("Number of instructions after -skip that are traced "
+                          "and profiled (Default 0 = until the end)"),
+       cl::init(0ULL));
+
+static cl::opt<std::string>
+SampleFilename("sample-file", cl::desc("Write a binary trace with the PC and "
+                                       "opcode mix every -sample-interval "
+                                       "instructions to this file"),
+               cl::value_desc("filename"));
+
+static cl::opt<unsigned long long>
+SampleInterval("sample-interval", cl::desc("Instructions between samples "
+                                           "(Default 1000000)"),
+               cl::init(1000000ULL));
+
+static cl::opt<std::string>
+SnapshotFilename("snapshot", cl::desc("Save the guest state to this file once "
+                                      "-snapshot-at instructions retired"),
+                 cl::value_desc("filename"));
+
+static cl::opt<unsigned long long>
+SnapshotAt("snapshot-at", cl::desc("Number of retired guest instructions "
+                                   "after which -snapshot is taken"),
+           cl::init(0ULL));
+
+static cl::opt<std::string>
+RestoreFilename("restore", cl::desc("Resume the guest from a snapshot written "
+                                    "by -snapshot instead of starting it"),
+                cl::value_desc("filename"));
+
+static cl::opt<bool>
+AsyncIO("async-io", cl::desc("Service guest reads and writes on regular files "
+                             "with host I/O threads, reading ahead and "
+                             "writing behind"));
+
+static cl::opt<unsigned>
+AsyncIOThreads("async-io-threads", cl::desc("Number of host I/O threads for "
+                                            "-async-io (Default 2)"),
+               cl::init(2));
+
+static cl::opt<unsigned>
+AsyncIOChunk("async-io-chunk", cl::desc("Size in KiB of each -async-io read "
+                                        "or write request (Default 256)"),
+             cl::init(256));
+
+static cl::opt<unsigned>
+AsyncIODepth("async-io-depth", cl::desc("Requests in flight per file with "
+                                        "-async-io (Default 4)"),
+             cl::init(4));
+
+static cl::opt<std::string>
+CoSimFilename("cosim", cl::desc("Compare the registers at every function entry "
+                                "with the stream written by a static-bt "
+                                "-cosim translation of the same program"),
+              cl::value_desc("filename"));
+
+static cl::opt<std::string>
+CoSimIgnore("cosim-ignore", cl::desc("Comma separated registers excluded from "
+                                     "-cosim comparisons (Default: k0, k1, "
+                                     "gp, sp, fp and ra, which hold "
+                                     "addresses)"),
+            cl::init("26,27,28,29,30,31"));
+
+#ifdef DBT
+static cl::opt<bool>
+EnableJIT("jit", cl::desc("Translate hot guest functions to native code with "
+                          "MCJIT (-cap is only checked when leaving native "
+                          "code; disabled by -profile)"));
+
+static cl::opt<unsigned>
+JITThreshold("jit-threshold", cl::desc("Number of calls after which a guest "
+                                       "function is translated by -jit "
+                                       "(Default 100)"),
+             cl::init(100));
+#endif
+
 extern cl::opt<int32_t> Verbosity;
 
 static StringRef ToolName;
 
+// The guest may leave through the exit syscall, which never returns to
+// ExecutionLoop, so the profile is also written from an atexit handler.
+static OiProfile *ActiveProfile = nullptr;
+static std::string ProfiledBinary;
+
+static void WriteProfile() {
+  if (!ActiveProfile)
+    return;
+  ActiveProfile->write(ProfileFilename, ProfiledBinary);
+  ActiveProfile = nullptr;
+}
+
+static OiCacheModel *ActiveCacheModel = nullptr;
+
+static void WriteCacheReport() {
+  if (!ActiveCacheModel)
+    return;
+  ActiveCacheModel->write(CacheReportFilename, ProfiledBinary);
+  ActiveCacheModel = nullptr;
+}
+
+// Same for the samples and trace records still buffered
+static OiSampler *ActiveSampler = nullptr;
+static OiTraceWriter *ActiveTrace = nullptr;
+
+static void FinishSamples() {
+  if (!ActiveSampler)
+    return;
+  if (!ActiveSampler->finish())
+    errs() << ToolName << ": error writing '" << SampleFilename << "'\n";
+  ActiveSampler = nullptr;
+}
+
+static void FinishTrace() {
+  if (!ActiveTrace)
+    return;
+  if (!ActiveTrace->finish())
+    errs() << ToolName << ": error writing '" << TraceFilename << "'\n";
+  ActiveTrace = nullptr;
+}
+
+// Records left in the co-simulation stream when the guest exits
+static OiCoSim *ActiveCoSim = nullptr;
+static uint64_t *ActiveInstCount = nullptr;
+
+static void FinishCoSim() {
+  if (!ActiveCoSim)
+    return;
+  ActiveCoSim->finish(*ActiveInstCount);
+  ActiveCoSim = nullptr;
+}
+
+// Guest threads created by clone run on their own host thread with a
+// private decode cache. They are neither profiled nor JIT-compiled, and
+// -cap does not apply to them.
+static const MCDisassembler *GuestDisAsm = nullptr;
+static const OiHostCalls *GuestHostCalls = nullptr;
+
+static void RunGuestThread(OiMachineModel *MM, uint64_t PC) {
+  OiDecodeCache DecodeCache(*GuestDisAsm, MM->Mem);
+  bool UseBlocks = !NoBlockExec && Verbosity == 0;
+  while (PC != 0 && !MM->Exited) {
+    const OiBasicBlock *BB = nullptr;
+    const OiDecodedInst *DI = nullptr;
+    if (GuestHostCalls && GuestHostCalls->tryCall(MM, PC))
+      continue;
+    if (UseBlocks && (BB = DecodeCache.lookupBlock(PC)))
+      PC = BB->execute(MM, PC);
+    else if ((DI = DecodeCache.lookup(PC)))
+      PC = DI->Handler(MM, DI, PC);
+    else
+      report_fatal_error("invalid instruction encoding in guest thread " +
+                         Twine(MM->Tid));
+  }
+}
+
 std::string TripleName = "mipsel-unknown-unknown";
 
 static const Target *getTarget(const ObjectFile *Obj = NULL) {
@@ -201,7 +451,22 @@ static void ExecutionLoop(StringRef file, int argc, char **argv) {
     return;
   }
 
-  std::unique_ptr<OiMemoryModel> mem(new OiMemoryModel());
+  // Taken before the guest runs, to tell its descriptors apart from ours
+  OiSnapshot Snapshot;
+  uint64_t GuestMemSize = MemSize << 20;
+  if (!RestoreFilename.empty() &&
+      !OiSnapshot::readMemSize(RestoreFilename, GuestMemSize))
+    exit(1);
+  if (RestoreFilename.empty()) {
+    // Grow the address space to fit large images, plus room for the heap
+    // and the stack
+    uint64_t ImageEnd = OiMemoryModel::GetImageEnd(file.data(), LoadBase);
+    uint64_t Needed = ((ImageEnd >> 20) + 9) << 20;
+    if (ImageEnd != 0 && Needed > GuestMemSize)
+      GuestMemSize = std::min(Needed, OiMemoryModel::MAXSIZE);
+  }
+
+  std::unique_ptr<OiMemoryModel> mem(new OiMemoryModel(GuestMemSize));
   std::unique_ptr<OiMachineModel> IP(new OiMachineModel(*AsmInfo, *MII, *MRI, &*mem,
                                                   *InstPrinter));
   // TheTarget->createMCInstPrinter(AsmPrinterVariant, *AsmInfo, *MII, *MRI, *STI));
@@ -211,26 +476,51 @@ static void ExecutionLoop(StringRef file, int argc, char **argv) {
     return;
   }
 
-  uint64_t CurPC = mem->LoadELF(file.data());
-  int i = 0;
-  for (i = 0; i < argc; ++i) {
-    if (file == argv[i])
-      break;
+  uint64_t CurPC;
+  uint64_t numEmulated = 0;
+  if (!RestoreFilename.empty()) {
+    // The snapshot already holds the loaded image and the guest stack
+    if (!OiSnapshot::restore(RestoreFilename, *IP, CurPC, numEmulated))
+      exit(1);
+  } else {
+    CurPC = mem->LoadELF(file.data(), LoadBase, ImageCacheDir);
+    int i = 0;
+    for (i = 0; i < argc; ++i) {
+      if (file == argv[i])
+        break;
+    }
+    argc -= i;
+    IP->ConfigureUserLevelStack(argc, (uint8_t **) &argv[i]);
+  }
+  GuestDisAsm = &*DisAsm;
+  IP->RunThread = RunGuestThread;
+  std::unique_ptr<OiAsyncIO> GuestIO;
+  if (AsyncIO) {
+    GuestIO.reset(new OiAsyncIO(AsyncIOThreads, AsyncIOChunk << 10,
+                                AsyncIODepth));
+    IP->AsyncIO = &*GuestIO;
   }
-  argc -= i;
-  IP->ConfigureUserLevelStack(argc, (uint8_t **) &argv[i]);
   std::error_code ec;
   uint64_t Size;
-  uint64_t numEmulated = 0;
   ArrayRef<uint8_t> Bytes(reinterpret_cast<const uint8_t *>(mem->memory),
 			  mem->TOTALSIZE);
+  OiDecodeCache DecodeCache(*DisAsm, &*mem);
+  // Per-instruction tracing needs the single-step loop
+  bool UseBlocks = !NoDecodeCache && !NoBlockExec && Verbosity == 0;
 
 #ifdef DBT
   DenseMap<uint32_t, uint32_t> HotAddresses;
+  // Native regions run until they exit, so they are only entered while no
+  // instruction count has to be stopped at (see NextStop below)
+  bool UseJIT = EnableJIT && UseBlocks && ProfileFilename.empty() &&
+    TraceFilename.empty() && CoSimFilename.empty() &&
+    CacheReportFilename.empty() &&
+    (SampleFilename.empty() || SampleInterval == 0);
+  std::unique_ptr<OiJIT> JIT;
+  if (UseJIT)
+    JIT.reset(new OiJIT(DecodeCache));
 #endif
 
-#ifndef NDEBUG
-  raw_ostream &DebugOut = dbgs();
   ObjectFile *o;
   ErrorOr<OwningBinary<Binary>> BinaryOrErr = createBinary(file);
   if (std::error_code EC = BinaryOrErr.getError()) {
@@ -244,10 +534,142 @@ static void ExecutionLoop(StringRef file, int argc, char **argv) {
   }
   std::vector<std::pair<uint64_t, StringRef> > Symbols =
     GetSymbolsList(o);
+  // Symbols of position-independent programs moved with the image
+  for (auto &I : Symbols)
+    I.first += mem->LoadBias;
   DenseMap<uint32_t, StringRef> SymbolMap;
   for (const auto &I : Symbols)
     SymbolMap.insert(I);
 
+  std::unique_ptr<OiProfile> Profile;
+  if (!ProfileFilename.empty()) {
+    Profile.reset(new OiProfile(*MII, Symbols, mem->LoadBias));
+    IP->Profile = &*Profile;
+    ActiveProfile = &*Profile;
+    ProfiledBinary = file;
+    atexit(WriteProfile);
+  }
+
+  std::unique_ptr<OiSampler> Sampler;
+  if (!SampleFilename.empty() && SampleInterval != 0) {
+    std::error_code EC;
+    Sampler.reset(new OiSampler(SampleFilename, SampleInterval, *MII, EC));
+    if (EC) {
+      errs() << ToolName << ": '" << SampleFilename << "': " << EC.message()
+             << "\n";
+      return;
+    }
+    ActiveSampler = &*Sampler;
+    atexit(FinishSamples);
+  }
+
+  // The binary trace is written by executeInstruction, so specialized
+  // handlers must not bypass it
+  std::unique_ptr<OiTraceWriter> Tracer;
+  if (!TraceFilename.empty()) {
+    std::error_code EC;
+    Tracer.reset(new OiTraceWriter(TraceFilename, EC));
+    if (EC) {
+      errs() << ToolName << ": '" << TraceFilename << "': " << EC.message()
+             << "\n";
+      return;
+    }
+    IP->Trace = &*Tracer;
+    DecodeCache.setGenericOnly(true);
+    ActiveTrace = &*Tracer;
+    atexit(FinishTrace);
+  }
+
+  // Likewise for memory listeners
+  std::unique_ptr<OiCacheModel> CacheModel;
+  if (!CacheReportFilename.empty()) {
+    OiCacheModel::Config Conf;
+    Conf.CacheSize = CacheSize << 10;
+    Conf.CacheAssoc = CacheAssoc;
+    Conf.LineSize = CacheLine;
+    Conf.TLBEntries = TLBEntries;
+    Conf.TLBAssoc = TLBAssoc;
+    Conf.PageSize = TLBPage;
+    std::string Err = OiCacheModel::validate(Conf);
+    if (!Err.empty()) {
+      errs() << ToolName << ": invalid cache model: " << Err << "\n";
+      return;
+    }
+    CacheModel.reset(new OiCacheModel(Conf, Symbols));
+    IP->MemListener = &*CacheModel;
+    DecodeCache.setGenericOnly(true);
+    ActiveCacheModel = &*CacheModel;
+    ProfiledBinary = file;
+    atexit(WriteCacheReport);
+  }
+
+  // Host library routines would hide the accesses of the guest ones from
+  // the trace and the cache model
+  std::unique_ptr<OiHostCalls> HostCalls;
+  if (HostLibc && !Tracer && !CacheModel) {
+    HostCalls.reset(new OiHostCalls(Symbols));
+    GuestHostCalls = &*HostCalls;
+  }
+
+  // Co-simulation checks happen at the entry of every guest function the
+  // translated program reports, which are found by symbol name
+  std::unique_ptr<OiCoSim> CoSim;
+  DenseMap<uint32_t, uint32_t> CoSimEntries;
+  if (!CoSimFilename.empty()) {
+    uint32_t IgnoreMask = 0;
+    SmallVector<StringRef, 8> Regs;
+    StringRef(CoSimIgnore).split(Regs, ",", -1, false);
+    for (StringRef Reg : Regs) {
+      unsigned N;
+      if (Reg.trim().getAsInteger(10, N) || N >= 32) {
+        errs() << ToolName << ": invalid -cosim-ignore register '" << Reg
+               << "'\n";
+        return;
+      }
+      IgnoreMask |= 1U << N;
+    }
+    CoSim.reset(new OiCoSim(CoSimFilename, IgnoreMask));
+    if (!CoSim->valid())
+      exit(1);
+    for (const auto &I : Symbols) {
+      int Index = CoSim->lookup(I.second);
+      if (Index >= 0)
+        CoSimEntries.insert(std::make_pair((uint32_t) I.first, Index));
+    }
+    ActiveCoSim = &*CoSim;
+    ActiveInstCount = &numEmulated;
+    atexit(FinishCoSim);
+  }
+
+  // -skip and -window turn tracing and profiling off and on. Handlers are
+  // picked for the verbosity at decode time, so turning tracing on drops
+  // the decode cache; turning it off keeps it, since the profile still
+  // points to its blocks.
+  int32_t TraceVerbosity = Verbosity;
+  OiProfile *Counts = Profile.get();
+  auto SetDetailed = [&](bool On) {
+    Verbosity = On ? TraceVerbosity : 0;
+    Counts = On ? Profile.get() : nullptr;
+    IP->Profile = Counts;
+    IP->Trace = On ? Tracer.get() : nullptr;
+    IP->MemListener = On ? CacheModel.get() : nullptr;
+    UseBlocks = !NoDecodeCache && !NoBlockExec && Verbosity == 0;
+    if (On && (TraceVerbosity != 0 || Tracer || CacheModel)) {
+      if (Sampler)
+        Sampler->flushBlocks();
+      DecodeCache.setGenericOnly(Tracer || CacheModel);
+      DecodeCache.invalidate();
+    } else if (!On) {
+      DecodeCache.setGenericOnly(false);
+    }
+  };
+  uint64_t DetailedEnd = Window ? Skip + Window : 0;
+  bool Skipping = Skip > numEmulated;
+  if (Skipping)
+    SetDetailed(false);
+
+#ifndef NDEBUG
+  raw_ostream &DebugOut = dbgs();
   std::unique_ptr<DIContext> DICtx(DIContext::getDWARFContext(*o));
   string LastFileName;
   ifstream SourceFile;
@@ -256,8 +678,72 @@ static void ExecutionLoop(StringRef file, int argc, char **argv) {
   raw_ostream &DebugOut = nulls();
 #endif
 
+  // Whole blocks may not run past -cap, a pending -snapshot-at or the
+  // -skip/-window boundaries
+  bool SnapshotPending = !SnapshotFilename.empty();
+  bool WindowPending = DetailedEnd != 0;
+  auto NextStop = [&]() {
+    uint64_t Stop = Cap ? (uint64_t) Cap : ~0ULL;
+    if (SnapshotPending)
+      Stop = std::min<uint64_t>(Stop, SnapshotAt);
+    if (Skipping)
+      Stop = std::min<uint64_t>(Stop, Skip);
+    if (WindowPending)
+      Stop = std::min<uint64_t>(Stop, DetailedEnd);
+    return Stop;
+  };
+  uint64_t StopAt = NextStop();
+
   do {
     MCInst Inst;
+    if (numEmulated >= StopAt) {
+      if (SnapshotPending && numEmulated >= SnapshotAt) {
+        // The saved descriptor offsets must include the writes behind
+        if (GuestIO)
+          GuestIO->syncAll();
+        if (!Snapshot.write(SnapshotFilename, *IP, CurPC, numEmulated))
+          exit(1);
+        SnapshotPending = false;
+      }
+      if (Skipping && numEmulated >= Skip) {
+        SetDetailed(true);
+        Skipping = false;
+      }
+      if (WindowPending && numEmulated >= DetailedEnd) {
+        SetDetailed(false);
+        WindowPending = false;
+      }
+      StopAt = NextStop();
+    }
+    if (Sampler && Sampler->due(numEmulated))
+      Sampler->sample(numEmulated, CurPC);
+    if (CoSim) {
+      DenseMap<uint32_t, uint32_t>::const_iterator I =
+        CoSimEntries.find((uint32_t) CurPC);
+      if (I != CoSimEntries.end() &&
+          !CoSim->check(I->second, *IP, numEmulated)) {
+        ActiveCoSim = nullptr;
+        exit(1);
+      }
+    }
+    if (HostCalls && HostCalls->tryCall(&*IP, CurPC)) {
+      ++numEmulated;
+      continue;
+    }
+#ifdef DBT
+    if (UseJIT && StopAt == ~0ULL) {
+      if (OiJIT::RegionFn Native = JIT->lookup(CurPC)) {
+        CurPC = Native(IP->Bank, mem->memory, &numEmulated, CurPC);
+        continue;
+      }
+      // Translate functions once they are called often enough
+      if (CurPC != 0 && SymbolMap.count((uint32_t) CurPC)) {
+        uint32_t &funcFreq = HotAddresses[(uint32_t) CurPC];
+        if (++funcFreq == JITThreshold && JIT->compile(CurPC))
+          continue;
+      }
+    }
+#endif
 #ifndef NDEBUG
     StringRef Symbol = SymbolMap.lookup((uint32_t) CurPC);
     StringRef Dummy;
@@ -267,15 +753,6 @@ static void ExecutionLoop(StringRef file, int argc, char **argv) {
                  << "\033[0m\033[1;35m]\033[0m\n2C";
       }
     }
-#ifdef DBT
-    if (CurPC != 0 && Symbol != Dummy) {
-        uint32_t funcFreq = HotAddresses[(uint32_t) CurPC];
-        HotAddresses[(uint32_t) CurPC] = funcFreq + 1;
-        if (funcFreq == 100) {
-          DebugOut << "\n" << Symbol << " is hot!\n";
-        }
-    }
-#endif
     if (Verbosity > 1 || Verbosity == -1) {
       DILineInfoSpecifier SpecFlags(DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath,
 				    DINameKind::LinkageName);
@@ -283,7 +760,7 @@ static void ExecutionLoop(StringRef file, int argc, char **argv) {
     //      SpecFlags |= DILineInfoSpecifier::FunctionName;
     //    if (PrintInlining) {
       DIInliningInfo InliningInfo =
-        DICtx->getInliningInfoForAddress(CurPC, SpecFlags);
+        DICtx->getInliningInfoForAddress(CurPC - mem->LoadBias, SpecFlags);
       uint32_t n = InliningInfo.getNumberOfFrames();
       if (n > 0) {
         for (uint32_t i = 0; i < n; i++) {
@@ -324,8 +801,31 @@ static void ExecutionLoop(StringRef file, int argc, char **argv) {
                << "\033[1;32m]\033[0m";
     }
 #endif
-    if (DisAsm->getInstruction(Inst, Size, Bytes.slice(CurPC), CurPC,
-                               DebugOut, nulls())) {
+    const OiBasicBlock *BB = nullptr;
+    const OiDecodedInst *DI = nullptr;
+    Size = GetInstructionSize();
+    if (UseBlocks && (BB = DecodeCache.lookupBlock(CurPC)) &&
+        numEmulated + BB->size() <= StopAt) {
+      if (Counts)
+        Counts->countBlock(CurPC, BB);
+      if (Sampler)
+        Sampler->countBlock(BB);
+      CurPC = BB->execute(&*IP, CurPC);
+      numEmulated += BB->size();
+    } else if (!NoDecodeCache && (DI = DecodeCache.lookup(CurPC))) {
+      if (Counts)
+        Counts->countInst(CurPC, DI->Opcode);
+      if (Sampler)
+        Sampler->countInst(DI->Opcode);
+      CurPC = DI->Handler(&*IP, DI, CurPC);
+      ++numEmulated;
+    } else if (NoDecodeCache &&
+               DisAsm->getInstruction(Inst, Size, Bytes.slice(CurPC), CurPC,
+                                      DebugOut, nulls())) {
+      if (Counts)
+        Counts->countInst(CurPC, Inst.getOpcode());
+      if (Sampler)
+        Sampler->countInst(Inst.getOpcode());
       CurPC = IP->executeInstruction(&Inst, CurPC);
       ++numEmulated;
     } else {
@@ -337,6 +837,15 @@ static void ExecutionLoop(StringRef file, int argc, char **argv) {
     }
   } while (CurPC != 0 && (Cap == 0 || numEmulated < Cap));
 
+  WriteProfile();
+  WriteCacheReport();
+  FinishSamples();
+  FinishTrace();
+  if (CoSim) {
+    ActiveCoSim = nullptr;
+    if (!CoSim->finish(numEmulated))
+      exit(1);
+  }
 }
 
 int main(int argc, char **argv) {
@@ -353,6 +862,9 @@ int main(int argc, char **argv) {
   llvm::InitializeAllTargetMCs();
   llvm::InitializeAllAsmParsers();
   llvm::InitializeAllDisassemblers();
+  // The JIT tier generates code for the host
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
 
   // Register the target printer for --version.
   cl::AddExtraVersionPrinter(TargetRegistry::printRegisteredTargetsForVersion);
@@ -0,0 +1,242 @@
+//===-- oii-trace.cpp - Filter and summarise oii execution traces ---------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This program reads the binary traces written by oii -trace. By default it
+// prints a summary: instruction and memory access counts, register writes
+// and the hottest PCs. With -dump it prints the records as text instead;
+// -mem-only restricts that to one "L|S address size" line per access, the
+// input format most cache simulators accept.
+//
+//===----------------------------------------------------------------------===//
+
+#include "../interpreter/OiTrace.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <string.h>
+#include <vector>
+using namespace llvm;
+
+static cl::opt<std::string>
+InputFilename(cl::Positional, cl::desc("<trace file>"), cl::init("-"));
+
+static cl::opt<bool>
+Dump("dump", cl::desc("Print every record instead of a summary"));
+
+static cl::opt<bool>
+MemOnly("mem-only", cl::desc("With -dump, print only memory accesses"));
+
+static cl::opt<unsigned long long>
+StartPC("start-pc", cl::desc("Ignore instructions below this address"),
+        cl::init(0));
+
+static cl::opt<unsigned long long>
+EndPC("end-pc", cl::desc("Ignore instructions at or above this address "
+                         "(Default 0 = no limit)"),
+      cl::init(0));
+
+static cl::opt<unsigned>
+Top("top", cl::desc("Number of hottest PCs in the summary (Default 10)"),
+    cl::init(10));
+
+static StringRef ToolName;
+
+static uint32_t Read32(const unsigned char *P) {
+  using namespace support;
+  return endian::read<uint32_t, little, unaligned>(P);
+}
+
+static uint64_t Read64(const unsigned char *P) {
+  using namespace support;
+  return endian::read<uint64_t, little, unaligned>(P);
+}
+
+namespace {
+
+struct Summary {
+  Summary() : Insts(0), Loads(0), Stores(0), LoadBytes(0), StoreBytes(0) {
+    memset(RegWrites, 0, sizeof(RegWrites));
+    memset(DblWrites, 0, sizeof(DblWrites));
+    memset(FltWrites, 0, sizeof(FltWrites));
+  }
+  uint64_t Insts, Loads, Stores, LoadBytes, StoreBytes;
+  uint64_t RegWrites[oitrace::RegLo + 1];
+  uint64_t DblWrites[32];
+  uint64_t FltWrites[64];
+  DenseMap<uint32_t, uint64_t> PCs;
+};
+
+} // end anonymous namespace
+
+static void PrintSummary(const Summary &S) {
+  raw_ostream &OS = outs();
+  OS << "instructions: " << S.Insts << "\n"
+     << "loads:        " << S.Loads << " (" << S.LoadBytes << " bytes)\n"
+     << "stores:       " << S.Stores << " (" << S.StoreBytes << " bytes)\n"
+     << "distinct PCs: " << S.PCs.size() << "\n";
+
+  OS << "register writes:\n";
+  for (unsigned i = 0; i <= oitrace::RegLo; ++i) {
+    if (S.RegWrites[i] == 0)
+      continue;
+    if (i == oitrace::RegHi)
+      OS << "  hi";
+    else if (i == oitrace::RegLo)
+      OS << "  lo";
+    else
+      OS << "  r" << i;
+    OS << ": " << S.RegWrites[i] << "\n";
+  }
+  for (unsigned i = 0; i < 32; ++i)
+    if (S.DblWrites[i])
+      OS << "  d" << i << ": " << S.DblWrites[i] << "\n";
+  for (unsigned i = 0; i < 64; ++i)
+    if (S.FltWrites[i])
+      OS << "  f" << i << ": " << S.FltWrites[i] << "\n";
+
+  std::vector<std::pair<uint64_t, uint32_t> > Hot;
+  for (const auto &I : S.PCs)
+    Hot.push_back(std::make_pair(I.second, I.first));
+  unsigned N = std::min<size_t>(Top, Hot.size());
+  std::partial_sort(Hot.begin(), Hot.begin() + N, Hot.end(),
+                    [](const std::pair<uint64_t, uint32_t> &A,
+                       const std::pair<uint64_t, uint32_t> &B) {
+                      return A.first > B.first ||
+                             (A.first == B.first && A.second < B.second);
+                    });
+  OS << "hottest PCs:\n";
+  for (unsigned i = 0; i < N; ++i)
+    OS << "  " << format("0x%08" PRIx32, Hot[i].second) << ": "
+       << Hot[i].first << "\n";
+}
+
+int main(int argc, char **argv) {
+  // Print a stack trace if we signal out.
+  sys::PrintStackTraceOnErrorSignal();
+  PrettyStackTraceProgram X(argc, argv);
+
+  llvm_shutdown_obj Y; // Call llvm_shutdown() on exit.
+  cl::ParseCommandLineOptions(argc, argv, "OpenISA execution trace reader\n");
+  ToolName = argv[0];
+
+  ErrorOr<std::unique_ptr<MemoryBuffer> > BufOrErr =
+    MemoryBuffer::getFileOrSTDIN(InputFilename);
+  if (std::error_code EC = BufOrErr.getError()) {
+    errs() << ToolName << ": '" << InputFilename << "': " << EC.message()
+           << "\n";
+    return 1;
+  }
+  const unsigned char *Start =
+    reinterpret_cast<const unsigned char *>(BufOrErr.get()->getBufferStart());
+  const unsigned char *End =
+    reinterpret_cast<const unsigned char *>(BufOrErr.get()->getBufferEnd());
+  const size_t HeaderSize = sizeof(oitrace::Magic) + 4;
+  if ((size_t)(End - Start) < HeaderSize ||
+      memcmp(Start, oitrace::Magic, sizeof(oitrace::Magic)) != 0 ||
+      Read32(Start + sizeof(oitrace::Magic)) != oitrace::Version) {
+    errs() << ToolName << ": '" << InputFilename
+           << "' is not an oii trace of this version\n";
+    return 1;
+  }
+
+  Summary S;
+  raw_ostream &OS = outs();
+  bool InRange = false;
+  for (const unsigned char *P = Start + HeaderSize; P != End;) {
+    unsigned Kind = *P;
+    size_t Len;
+    switch (Kind) {
+    case oitrace::Inst:     Len = 4; break;
+    case oitrace::Load:
+    case oitrace::Store:
+    case oitrace::RegWrite:
+    case oitrace::FltWrite: Len = 5; break;
+    case oitrace::DblWrite: Len = 9; break;
+    default:                Len = ~(size_t) 0; break;
+    }
+    if (Len > (size_t)(End - P - 1)) {
+      errs() << ToolName << ": '" << InputFilename
+             << "': corrupt record at offset " << (P - Start) << "\n";
+      return 1;
+    }
+    const unsigned char *Data = P + 1;
+    P += Len + 1;
+
+    if (Kind == oitrace::Inst) {
+      uint32_t PC = Read32(Data);
+      InRange = PC >= StartPC && (EndPC == 0 || PC < EndPC);
+      if (!InRange)
+        continue;
+      if (Dump && !MemOnly)
+        OS << format("I 0x%08" PRIx32, PC) << "\n";
+      ++S.Insts;
+      ++S.PCs[PC];
+      continue;
+    }
+    if (!InRange)
+      continue;
+
+    switch (Kind) {
+    case oitrace::Load:
+    case oitrace::Store: {
+      uint32_t Addr = Read32(Data);
+      uint8_t Size = Data[4];
+      if (Dump)
+        OS << (char) Kind << format(" 0x%08" PRIx32, Addr) << " "
+           << (unsigned) Size << "\n";
+      if (Kind == oitrace::Load) {
+        ++S.Loads;
+        S.LoadBytes += Size;
+      } else {
+        ++S.Stores;
+        S.StoreBytes += Size;
+      }
+      break;
+    }
+    case oitrace::RegWrite: {
+      uint8_t Reg = Data[0];
+      uint32_t Val = Read32(Data + 1);
+      if (Dump && !MemOnly)
+        OS << "R " << (unsigned) Reg << format(" 0x%08" PRIx32, Val) << "\n";
+      if (Reg <= oitrace::RegLo)
+        ++S.RegWrites[Reg];
+      break;
+    }
+    case oitrace::DblWrite: {
+      uint8_t Reg = Data[0];
+      uint64_t Bits = Read64(Data + 1);
+      if (Dump && !MemOnly)
+        OS << "D " << (unsigned) Reg << format(" 0x%016" PRIx64, Bits) << "\n";
+      if (Reg < 32)
+        ++S.DblWrites[Reg];
+      break;
+    }
+    case oitrace::FltWrite: {
+      uint8_t Reg = Data[0];
+      uint32_t Bits = Read32(Data + 1);
+      if (Dump && !MemOnly)
+        OS << "F " << (unsigned) Reg << format(" 0x%08" PRIx32, Bits) << "\n";
+      if (Reg < 64)
+        ++S.FltWrites[Reg];
+      break;
+    }
+    }
+  }
+
+  if (!Dump)
+    PrintSummary(S);
+  return 0;
+}
@@ -11,6 +11,7 @@
 #include "llvm/IR/PatternMatch.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Support/raw_ostream.h"
+#include <atomic>
 
 //#define COMBINE2
 #define NDEBUG
@@ -18,9 +19,10 @@
 using namespace llvm;
 using namespace PatternMatch;
 
-static unsigned numMatches1 = 0;
+// Functions may be optimized concurrently, each in its own context
+static std::atomic<unsigned> numMatches1(0);
 #ifdef COMBINE2
-static unsigned numMatches2 = 0;
+static std::atomic<unsigned> numMatches2(0);
 #endif
 
 static void OiCombine(Instruction *v, IRBuilder<> &Builder) {
@@ -49,12 +51,12 @@ static void OiCombine(Instruction *v, IRBuilder<> &Builder) {
         //      AddInst->dump();
         //      GEP->dump();
         Value *V1 =
-            Builder.CreatePtrToInt(Ptr, Type::getInt32Ty(getGlobalContext()));
+            Builder.CreatePtrToInt(Ptr, Type::getInt32Ty(v->getContext()));
         AddInst->setOperand(0, V1);
         Builder.SetInsertPoint(v);
         Value *V2 = Builder.CreateAdd(AddInst, X);
         Value *AddCast =
-            Builder.CreateIntToPtr(V2, Type::getInt8PtrTy(getGlobalContext()));
+            Builder.CreateIntToPtr(V2, Type::getInt8PtrTy(v->getContext()));
         //     V2->dump();
         GEP->replaceAllUsesWith(AddCast);
         ++numMatches2;
@@ -65,7 +67,7 @@ static void OiCombine(Instruction *v, IRBuilder<> &Builder) {
 }
 
 bool OiCombinePass::runOnFunction(Function &F) {
-  IRBuilder<> Builder(getGlobalContext());
+  IRBuilder<> Builder(F.getContext());
 #ifndef NDEBUG
   errs() << "Hello: ";
   errs().write_escaped(F.getName()) << '\n';
@@ -0,0 +1,528 @@
+//===-- OiFramePass.cpp - Recover guest stack frames ----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Runs after the per-function pipeline, when the guest stack pointer of a
+// function is an SSA value loaded from its register global. Every value is
+// classified as the stack pointer on entry plus a known offset, as unrelated
+// to it, or as derived from it in some other way (Bad). The value of the
+// stack pointer global itself is tracked through the function too, so that
+// reloads after calls keep their offset.
+//
+// A function qualifies if no stack pointer value is Bad, and stack pointer
+// values are only used as addresses of loads and stores, compared, or
+// handed to callees through the stack pointer global. Its slots are the
+// (offset, size) pairs of those accesses; a slot below the entry stack
+// pointer that no other access overlaps becomes an alloca.
+//
+// Callees may still access the frame of their caller above the stack
+// pointer they are given: stack arguments, and the home area of the
+// argument registers. Each function is summarized by whether it returns
+// with the stack pointer it got, and by how many bytes above it it may
+// access. At each call, the slots in reach of the callee are written back
+// to the shadow memory before it and reloaded after it. A function that
+// lets its stack pointer escape, such as a varargs function taking the
+// address of its arguments, may reach the whole frame of its caller.
+// Pointers into a frame are not expected to be used after that frame, or
+// the callee they were passed to, returns.
+//
+//===----------------------------------------------------------------------===//
+
+#include "OiFramePass.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include <algorithm>
+#include <map>
+
+using namespace llvm;
+
+namespace {
+// What is known about a value, or about the stack pointer global at some
+// point: whether it is the stack pointer on entry plus Off
+struct SPValue {
+  enum KindTy { Undef, NotSP, Known, Bad };
+  KindTy Kind;
+  int64_t Off;
+
+  SPValue(KindTy K = Undef, int64_t O = 0) : Kind(K), Off(K == Known ? O : 0) {}
+
+  bool isTracked() const { return Kind == Known || Kind == Bad; }
+  bool operator==(const SPValue &O) const {
+    return Kind == O.Kind && Off == O.Off;
+  }
+  bool operator!=(const SPValue &O) const { return !(*this == O); }
+  SPValue join(const SPValue &O) const {
+    if (Kind == Undef)
+      return O;
+    if (O.Kind == Undef || *this == O)
+      return *this;
+    return SPValue(Bad);
+  }
+  SPValue add(int64_t C) const {
+    return Kind == Known ? SPValue(Known, Off + C) : *this;
+  }
+};
+
+const int64_t Unbounded = INT64_MAX;
+
+// How a function treats the stack of its caller
+struct FrameInfo {
+  // The stack pointer global holds its entry value again on return
+  bool PreservesSP;
+  // Bytes above the entry stack pointer that the function or its callees
+  // may access, or Unbounded
+  int64_t MaxIncoming;
+  FrameInfo() : PreservesSP(true), MaxIncoming(0) {}
+  bool operator!=(const FrameInfo &O) const {
+    return PreservesSP != O.PreservesSP || MaxIncoming != O.MaxIncoming;
+  }
+};
+
+// End of the bytes a callee with MaxIncoming may access, when called with
+// the stack pointer at Off
+int64_t reachOf(int64_t Off, int64_t MaxIncoming) {
+  if (MaxIncoming == Unbounded || Off + MaxIncoming > (1 << 24))
+    return Unbounded;
+  return Off + MaxIncoming;
+}
+
+class FrameRecovery {
+public:
+  FrameRecovery(Module &M, GlobalVariable *SP, GlobalVariable *Shadow)
+      : M(M), SP(SP), Shadow(Shadow) {}
+  // Returns the number of slots moved to allocas
+  unsigned run();
+
+private:
+  struct FunctionState {
+    DenseMap<const Value *, SPValue> Vals;
+    DenseMap<const BasicBlock *, SPValue> MemOut;
+    // The stack pointer global before each call
+    DenseMap<const Instruction *, SPValue> AtCall;
+    bool Escapes;
+  };
+
+  const FrameInfo &getCalleeInfo(const Instruction &I) const;
+  SPValue getValue(const FunctionState &FS, const Value *V) const;
+  SPValue evaluateOperands(const FunctionState &FS, const Instruction &I) const;
+  SPValue evaluate(const FunctionState &FS, Instruction &I, SPValue &Mem) const;
+  bool isAllowedUse(const FunctionState &FS, const Instruction &I,
+                    unsigned OpNo) const;
+  void analyze(Function &F, FunctionState &FS) const;
+  bool summarize(Function &F, const FunctionState &FS);
+  bool summarizeIndirect();
+  unsigned promote(Function &F, const FunctionState &FS);
+
+  Module &M;
+  GlobalVariable *SP, *Shadow;
+  DenseMap<const Function *, FrameInfo> Info;
+  // Any of the functions whose address is taken, for indirect calls
+  FrameInfo Indirect;
+  // Functions only declared, which are host code
+  FrameInfo Host;
+};
+}
+
+static unsigned getAccessSize(Type *Ty) {
+  if (Ty->isIntegerTy())
+    return (Ty->getIntegerBitWidth() + 7) / 8;
+  if (Ty->isFloatTy())
+    return 4;
+  if (Ty->isDoubleTy())
+    return 8;
+  return 0;
+}
+
+static Value *getAccessPointer(Instruction &I) {
+  if (auto *LI = dyn_cast<LoadInst>(&I))
+    return LI->getPointerOperand();
+  if (auto *SI = dyn_cast<StoreInst>(&I))
+    return SI->getPointerOperand();
+  return nullptr;
+}
+
+static Type *getAccessType(Instruction &I) {
+  if (auto *SI = dyn_cast<StoreInst>(&I))
+    return SI->getValueOperand()->getType();
+  return I.getType();
+}
+
+const FrameInfo &FrameRecovery::getCalleeInfo(const Instruction &I) const {
+  ImmutableCallSite CS(&I);
+  auto *F = dyn_cast<Function>(CS.getCalledValue()->stripPointerCasts());
+  if (!F)
+    return Indirect;
+  auto It = Info.find(F);
+  return It == Info.end() ? Host : It->second;
+}
+
+SPValue FrameRecovery::getValue(const FunctionState &FS,
+                                const Value *V) const {
+  if (!isa<Instruction>(V))
+    return SPValue(SPValue::NotSP);
+  return FS.Vals.lookup(V);
+}
+
+// The value of an instruction that does nothing we can follow
+SPValue FrameRecovery::evaluateOperands(const FunctionState &FS,
+                                        const Instruction &I) const {
+  SPValue Res(SPValue::NotSP);
+  for (const Use &U : I.operands()) {
+    SPValue V = getValue(FS, U.get());
+    if (V.isTracked())
+      return SPValue(SPValue::Bad);
+    if (V.Kind == SPValue::Undef)
+      Res = V;
+  }
+  return Res;
+}
+
+// Returns the value of I, given the stack pointer global before it in Mem,
+// and updates Mem to after it.
+SPValue FrameRecovery::evaluate(const FunctionState &FS, Instruction &I,
+                                SPValue &Mem) const {
+  if (auto *LI = dyn_cast<LoadInst>(&I)) {
+    if (LI->getPointerOperand() == SP)
+      return Mem;
+    return SPValue(SPValue::NotSP);
+  }
+  if (auto *SI = dyn_cast<StoreInst>(&I)) {
+    if (SI->getPointerOperand() == SP) {
+      SPValue V = getValue(FS, SI->getValueOperand());
+      Mem = V.Kind == SPValue::NotSP ? SPValue(SPValue::Bad) : V;
+    }
+    return SPValue(SPValue::NotSP);
+  }
+  if (isa<CallInst>(&I)) {
+    if (!getCalleeInfo(I).PreservesSP && Mem.Kind != SPValue::Undef)
+      Mem = SPValue(SPValue::Bad);
+    return SPValue(SPValue::NotSP);
+  }
+
+  switch (I.getOpcode()) {
+  case Instruction::Add:
+  case Instruction::Sub: {
+    SPValue A = getValue(FS, I.getOperand(0));
+    SPValue B = getValue(FS, I.getOperand(1));
+    auto *CA = dyn_cast<ConstantInt>(I.getOperand(0));
+    auto *CB = dyn_cast<ConstantInt>(I.getOperand(1));
+    bool IsAdd = I.getOpcode() == Instruction::Add;
+    if (A.isTracked() && CB)
+      return A.add(IsAdd ? CB->getSExtValue() : -CB->getSExtValue());
+    if (B.isTracked() && CA && IsAdd)
+      return B.add(CA->getSExtValue());
+    return evaluateOperands(FS, I);
+  }
+  case Instruction::PHI: {
+    SPValue Res;
+    for (const Use &U : I.operands())
+      Res = Res.join(getValue(FS, U.get()));
+    return Res;
+  }
+  case Instruction::Select:
+    if (getValue(FS, I.getOperand(0)).isTracked())
+      return SPValue(SPValue::Bad);
+    return getValue(FS, I.getOperand(1)).join(getValue(FS, I.getOperand(2)));
+  case Instruction::BitCast:
+    return getValue(FS, I.getOperand(0));
+  case Instruction::IntToPtr:
+  case Instruction::PtrToInt:
+    // Only guest addresses are host addresses without a shadow memory
+    if (!Shadow)
+      return getValue(FS, I.getOperand(0));
+    return evaluateOperands(FS, I);
+  case Instruction::GetElementPtr: {
+    auto *GEP = cast<GetElementPtrInst>(&I);
+    if (Shadow && GEP->getPointerOperand() == Shadow &&
+        GEP->getNumIndices() == 2) {
+      auto *C = dyn_cast<ConstantInt>(GEP->getOperand(1));
+      if (C && C->isZero())
+        return getValue(FS, GEP->getOperand(2));
+    }
+    SPValue Base = getValue(FS, GEP->getPointerOperand());
+    Type *ElemTy = GEP->getPointerOperandType()->getPointerElementType();
+    if (Base.isTracked() && GEP->getNumIndices() == 1 &&
+        ElemTy->isIntegerTy(8))
+      if (auto *C = dyn_cast<ConstantInt>(GEP->getOperand(1)))
+        return Base.add(C->getSExtValue());
+    return evaluateOperands(FS, I);
+  }
+  default:
+    return evaluateOperands(FS, I);
+  }
+}
+
+// Whether operand OpNo of I may be a stack pointer value without letting
+// it escape
+bool FrameRecovery::isAllowedUse(const FunctionState &FS, const Instruction &I,
+                                 unsigned OpNo) const {
+  switch (I.getOpcode()) {
+  case Instruction::Load:
+    return true;
+  case Instruction::Store:
+    return OpNo == 1 || cast<StoreInst>(&I)->getPointerOperand() == SP;
+  case Instruction::ICmp:
+    return true;
+  case Instruction::Select:
+    if (OpNo == 0)
+      return false;
+  // Fall through
+  case Instruction::PHI:
+  case Instruction::Add:
+  case Instruction::Sub:
+  case Instruction::BitCast:
+  case Instruction::GetElementPtr:
+  case Instruction::IntToPtr:
+  case Instruction::PtrToInt:
+    return getValue(FS, &I).Kind == SPValue::Known;
+  default:
+    return false;
+  }
+}
+
+void FrameRecovery::analyze(Function &F, FunctionState &FS) const {
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (BasicBlock &BB : F) {
+      SPValue Mem;
+      if (&BB == &F.getEntryBlock())
+        Mem = SPValue(SPValue::Known, 0);
+      for (pred_iterator PI = pred_begin(&BB), PE = pred_end(&BB); PI != PE;
+           ++PI)
+        Mem = Mem.join(FS.MemOut.lookup(*PI));
+      for (Instruction &I : BB) {
+        if (isa<CallInst>(&I))
+          FS.AtCall[&I] = Mem;
+        SPValue V = evaluate(FS, I, Mem);
+        if (I.getType()->isVoidTy())
+          continue;
+        SPValue Old = FS.Vals.lookup(&I);
+        SPValue New = Old.join(V);
+        if (New != Old) {
+          FS.Vals[&I] = New;
+          Changed = true;
+        }
+      }
+      SPValue Old = FS.MemOut.lookup(&BB);
+      SPValue New = Old.join(Mem);
+      if (New != Old) {
+        FS.MemOut[&BB] = New;
+        Changed = true;
+      }
+    }
+  }
+
+  FS.Escapes = false;
+  for (BasicBlock &BB : F)
+    for (Instruction &I : BB) {
+      if (getValue(FS, &I).Kind == SPValue::Bad)
+        FS.Escapes = true;
+      for (unsigned OpNo = 0; OpNo < I.getNumOperands(); ++OpNo)
+        if (getValue(FS, I.getOperand(OpNo)).isTracked() &&
+            !isAllowedUse(FS, I, OpNo))
+          FS.Escapes = true;
+    }
+}
+
+// Updates the summary of F from its analysis. Returns whether it changed.
+bool FrameRecovery::summarize(Function &F, const FunctionState &FS) {
+  FrameInfo New;
+  for (BasicBlock &BB : F) {
+    if (!isa<ReturnInst>(BB.getTerminator()))
+      continue;
+    SPValue Mem = FS.MemOut.lookup(&BB);
+    if (Mem.Kind != SPValue::Undef && Mem != SPValue(SPValue::Known, 0))
+      New.PreservesSP = false;
+  }
+
+  if (FS.Escapes) {
+    New.MaxIncoming = Unbounded;
+  } else {
+    for (BasicBlock &BB : F)
+      for (Instruction &I : BB) {
+        if (Value *Ptr = getAccessPointer(I)) {
+          SPValue P = getValue(FS, Ptr);
+          if (P.Kind == SPValue::Known)
+            New.MaxIncoming = std::max(
+                New.MaxIncoming,
+                reachOf(P.Off, getAccessSize(getAccessType(I))));
+        } else if (isa<CallInst>(&I)) {
+          SPValue At = FS.AtCall.lookup(&I);
+          if (At.Kind == SPValue::Bad)
+            New.MaxIncoming = Unbounded;
+          else if (At.Kind == SPValue::Known)
+            New.MaxIncoming = std::max(
+                New.MaxIncoming,
+                reachOf(At.Off, getCalleeInfo(I).MaxIncoming));
+        }
+      }
+  }
+
+  // Keep the fixed point iteration monotonic
+  FrameInfo &Old = Info[&F];
+  New.PreservesSP &= Old.PreservesSP;
+  New.MaxIncoming = std::max(New.MaxIncoming, Old.MaxIncoming);
+  if (!(New != Old))
+    return false;
+  Old = New;
+  return true;
+}
+
+bool FrameRecovery::summarizeIndirect() {
+  FrameInfo New;
+  for (Function &F : M) {
+    if (F.isDeclaration() || !F.hasAddressTaken())
+      continue;
+    const FrameInfo &FI = Info[&F];
+    New.PreservesSP &= FI.PreservesSP;
+    New.MaxIncoming = std::max(New.MaxIncoming, FI.MaxIncoming);
+  }
+  if (!(New != Indirect))
+    return false;
+  Indirect = New;
+  return true;
+}
+
+unsigned FrameRecovery::promote(Function &F, const FunctionState &FS) {
+  // Accesses at a known offset, by (offset, size)
+  typedef std::pair<int64_t, unsigned> SlotTy;
+  std::map<SlotTy, std::vector<Instruction *>> Accesses;
+  for (BasicBlock &BB : F)
+    for (Instruction &I : BB) {
+      Value *Ptr = getAccessPointer(I);
+      if (!Ptr)
+        continue;
+      SPValue P = getValue(FS, Ptr);
+      if (P.Kind != SPValue::Known)
+        continue;
+      unsigned Size = getAccessSize(getAccessType(I));
+      if (Size == 0)
+        return 0;
+      Accesses[SlotTy(P.Off, Size)].push_back(&I);
+    }
+
+  // Slots of the own frame that do not overlap any other
+  std::vector<std::pair<SlotTy, AllocaInst *>> Slots;
+  int64_t PrevEnd = INT64_MIN;
+  for (auto I = Accesses.begin(), E = Accesses.end(); I != E; ++I) {
+    int64_t Off = I->first.first, End = Off + I->first.second;
+    auto Next = std::next(I);
+    bool Overlaps =
+        Off < PrevEnd || (Next != E && Next->first.first < End);
+    PrevEnd = std::max(PrevEnd, End);
+    if (Overlaps || End > 0)
+      continue;
+
+    Type *Ty = getAccessType(*I->second.front());
+    for (Instruction *Access : I->second)
+      if (getAccessType(*Access) != Ty)
+        Ty = IntegerType::get(F.getContext(), I->first.second * 8);
+    AllocaInst *A = new AllocaInst(Ty, nullptr, "stack" + Twine(-Off),
+                                   F.getEntryBlock().begin());
+    SmallVector<WeakVH, 8> OldPtrs;
+    for (Instruction *Access : I->second) {
+      Value *Ptr = A;
+      Type *AccessTy = getAccessType(*Access);
+      if (AccessTy != Ty)
+        Ptr = new BitCastInst(A, AccessTy->getPointerTo(), "", Access);
+      unsigned PtrOpNo = isa<LoadInst>(Access) ? 0 : 1;
+      OldPtrs.push_back(Access->getOperand(PtrOpNo));
+      Access->setOperand(PtrOpNo, Ptr);
+    }
+    for (WeakVH &V : OldPtrs)
+      if (V)
+        RecursivelyDeleteTriviallyDeadInstructions(V);
+    Slots.push_back(std::make_pair(I->first, A));
+  }
+  if (Slots.empty())
+    return 0;
+
+  // Hand the slots in reach of each callee over through the shadow memory
+  std::vector<CallInst *> Calls;
+  for (BasicBlock &BB : F)
+    for (Instruction &I : BB)
+      if (auto *CI = dyn_cast<CallInst>(&I))
+        Calls.push_back(CI);
+  for (CallInst *CI : Calls) {
+    SPValue At = FS.AtCall.lookup(CI);
+    if (At.Kind != SPValue::Known)
+      continue;
+    int64_t Lo = At.Off, Hi = reachOf(At.Off, getCalleeInfo(*CI).MaxIncoming);
+    IRBuilder<> Before(CI), After(CI->getNextNode());
+    Value *Base = nullptr;
+    for (auto &Slot : Slots) {
+      int64_t Off = Slot.first.first;
+      if (Off >= Hi || Off + (int64_t)Slot.first.second <= Lo)
+        continue;
+      if (!Base)
+        Base = Before.CreateLoad(SP);
+      AllocaInst *A = Slot.second;
+      Value *Idx = Before.CreateAdd(Base, Before.getInt32(Off - At.Off));
+      Type *PtrTy = A->getAllocatedType()->getPointerTo();
+      Value *Ptr;
+      if (Shadow) {
+        Value *Idxs[] = {Before.getInt32(0), Idx};
+        Ptr = Before.CreateBitCast(Before.CreateGEP(Shadow, Idxs), PtrTy);
+      } else {
+        Ptr = Before.CreateIntToPtr(Idx, PtrTy);
+      }
+      Before.CreateStore(Before.CreateLoad(A), Ptr);
+      After.CreateStore(After.CreateLoad(Ptr), A);
+    }
+  }
+  return Slots.size();
+}
+
+unsigned FrameRecovery::run() {
+  if (!SP)
+    return 0;
+
+  for (Function &F : M)
+    if (!F.isDeclaration())
+      Info[&F] = FrameInfo();
+
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (Function &F : M) {
+      if (F.isDeclaration())
+        continue;
+      FunctionState FS;
+      analyze(F, FS);
+      Changed |= summarize(F, FS);
+    }
+    Changed |= summarizeIndirect();
+  }
+
+  unsigned NumSlots = 0;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    FunctionState FS;
+    analyze(F, FS);
+    if (!FS.Escapes)
+      NumSlots += promote(F, FS);
+  }
+  return NumSlots;
+}
+
+bool OiFramePass::runOnModule(Module &M) {
+  NumSlots = FrameRecovery(M, SP, Shadow).run();
+  return NumSlots > 0;
+}
+
+char OiFramePass::ID = 0;
+static RegisterPass<OiFramePass>
+    X("oiframe", "OpenISA guest stack frame recovery", false, false);
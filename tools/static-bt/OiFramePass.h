@@ -0,0 +1,37 @@
+//=== OiFramePass.h - Recover guest stack frames ----------------*- C++ -*-==//
+//
+// Guest stack slots live in the shadow memory. This pass finds the slots of
+// each function's own frame that are only accessed at a known offset from
+// the guest stack pointer, and whose address never escapes, and moves them
+// to allocas that mem2reg can promote.
+//
+//===------------------------------------------------------------===//
+
+#ifndef OIFRAMEPASS_H
+#define OIFRAMEPASS_H
+
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/Pass.h"
+
+namespace llvm {
+
+struct OiFramePass : public ModulePass {
+  static char ID;
+  // SP is the register global of the guest stack pointer. Shadow is the
+  // shadow memory global, or null if guest addresses are host addresses.
+  explicit OiFramePass(GlobalVariable *SP = nullptr,
+                       GlobalVariable *Shadow = nullptr)
+      : ModulePass(ID), SP(SP), Shadow(Shadow), NumSlots(0) {}
+
+  virtual bool runOnModule(Module &M);
+
+  // Number of stack slots moved to allocas by the last run
+  unsigned getNumSlots() const { return NumSlots; }
+
+private:
+  GlobalVariable *SP, *Shadow;
+  unsigned NumSlots;
+};
+}
+
+#endif
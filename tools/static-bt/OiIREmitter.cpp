@@ -7,10 +7,13 @@
 
 #include "../lib/Target/Mips/MipsInstrInfo.h"
 #include "OiIREmitter.h"
+#include "OiProfileData.h"
 #include "StringRefMemoryObject.h"
 #include "SBTUtils.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/IR/CFG.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/PatternMatch.h"
 #include "llvm/MC/MCInstrInfo.h"
 #include "llvm/MC/MCSymbol.h"
@@ -18,6 +21,7 @@
 #include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/Object/ELF.h"
 #include <algorithm>
@@ -52,6 +56,10 @@ cl::opt<bool> AggrOptimizeStack(
 cl::opt<bool> NoShadow(
     "noshadow",
     cl::desc("Avoid adding shadowimage offset to every memory access"));
+
+cl::opt<bool> CoSim(
+    "cosim", cl::desc("Call oi_cosim_hook at every function entry, for "
+                      "co-simulation against oii -cosim"));
 }
 
 bool OiIREmitter::FindSectionOffset(StringRef Name, uint64_t &SectionAddr) {
@@ -292,13 +300,14 @@ bool OiIREmitter::ExtractJumpTargets(
     std::vector<BasicBlock *> &JumpTargets, uint32_t Count) {
   for (uint64_t I = 0;; ++I) {
     uint32_t Candidate = *(const uint32_t *)(&ShadowImage[JT + (I << 2)]);
+    ImageReads.push_back(std::make_pair(JT + (I << 2), Candidate));
     if (ValidPtrs.count(Candidate) == 0)
       break;
+    if (GetFuncAddr(Funcs, Candidate) != FuncAddr)
+      break;
     BasicBlock *BB = nullptr;
     if (!HandleBackEdge(Candidate, BB))
       llvm_unreachable("Failed to handle backedge");
-    if (GetFuncAddr(Funcs, Candidate) != FuncAddr)
-      break;
     if (Count != 0 && I > Count)
       break;
     JumpTargets.emplace_back(BB);
@@ -314,53 +323,76 @@ class PatchSectionBuilder {
   StructType *S1;
   std::vector<Constant *> PatchPairs;
   Module *TheModule;
+  LLVMContext &Context;
 
 public:
-  PatchSectionBuilder(Module *M) : TheModule(M) { preparePatchSection(); }
+  PatchSectionBuilder(Module *M) : TheModule(M), Context(M->getContext()) {
+    preparePatchSection();
+  }
 
   void preparePatchSection() {
     std::vector<Type *> S1Types;
-    S1Types.push_back(Type::getInt32Ty(getGlobalContext()));
-    S1Types.push_back(Type::getInt8PtrTy(getGlobalContext()));
+    S1Types.push_back(Type::getInt32Ty(Context));
+    S1Types.push_back(Type::getInt8PtrTy(Context));
     S1 = StructType::create(S1Types);
   }
 
   void addPair(uint32_t Addr, Constant *BB) {
     std::vector<Constant *> Elmts;
     Elmts.push_back(
-        ConstantInt::get(Type::getInt32Ty(getGlobalContext()), Addr));
+        ConstantInt::get(Type::getInt32Ty(Context), Addr));
     if (isa<Function>(BB))
-      Elmts.push_back(ConstantExpr::getPointerCast(BB, Type::getInt8PtrTy(getGlobalContext())));
+      Elmts.push_back(ConstantExpr::getPointerCast(BB, Type::getInt8PtrTy(Context)));
     else
       Elmts.push_back(BB);
     PatchPairs.push_back(ConstantStruct::get(S1, Elmts));
   }
 
-  GlobalVariable *finish() {
+  // Re-add the pairs of a section built by finish()
+  void addPairs(const GlobalVariable *GV) {
+    const Constant *Pairs = GV->getInitializer()->getAggregateElement(1U);
+    for (unsigned I = 0, E = Pairs->getType()->getArrayNumElements(); I != E;
+         ++I) {
+      Constant *Pair = Pairs->getAggregateElement(I);
+      addPair(cast<ConstantInt>(Pair->getAggregateElement(0U))->getZExtValue(),
+              Pair->getAggregateElement(1U));
+    }
+  }
+
+  GlobalVariable *finish(StringRef Name = "PatchSection",
+                         GlobalValue::LinkageTypes Linkage =
+                             GlobalValue::ExternalLinkage) {
     ArrayType *AT = ArrayType::get(S1, PatchPairs.size());
     Constant *VAT = ConstantArray::get(AT, PatchPairs);
     std::vector<Type *> S2Types;
-    S2Types.push_back(Type::getInt32Ty(getGlobalContext()));
+    S2Types.push_back(Type::getInt32Ty(Context));
     S2Types.push_back(AT);
     StructType *S2 = StructType::create(S2Types);
     std::vector<Constant *> Elmts;
-    Elmts.push_back(ConstantInt::get(Type::getInt32Ty(getGlobalContext()),
+    Elmts.push_back(ConstantInt::get(Type::getInt32Ty(Context),
                                      PatchPairs.size()));
     Elmts.push_back(VAT);
     Constant *CS = ConstantStruct::get(S2, Elmts);
-    return new GlobalVariable(*TheModule, S2, false,
-                              GlobalValue::ExternalLinkage, CS, "PatchSection");
+    return new GlobalVariable(*TheModule, S2, false, Linkage, CS, Name);
   }
 };
 
+// Single-function modules emit their share of the PatchSection under this
+// name; MergePatchSections() joins them once they are linked together.
+static const char PartialPatchSection[] = "PatchSection.part";
+
 bool OiIREmitter::ProcessIndirectJumps() {
+  if (!CollectCodePointers())
+    return false;
+  return ResolveIndirectJumps();
+}
+
+// Finds the code pointers stored in data, through the relocations against
+// .text, and patches the shadow image with their final address.
+bool OiIREmitter::CollectCodePointers() {
   //  uint64_t FinalAddr = 0xFFFFFFFFUL;
   std::error_code ec;
-  // Store all code ptrs which we discover via relocations
-  std::unordered_set<uint64_t> CodePtrs;
   uint64_t TextOffset;
-  PatchSectionBuilder PSBuilder(&*TheModule);
-  std::sort(FunctionAddrs.begin(), FunctionAddrs.end());
 
   if (!FindSectionOffset(".text", TextOffset))
     return false;
@@ -382,6 +414,7 @@ bool OiIREmitter::ProcessIndirectJumps() {
       continue;
     if (name.endswith("pdr") || !name.startswith(".rel."))
       continue;
+    HasRelocations = true;
     name = name.drop_front(4);
     uint64_t PatchedSecAddr;
     if (!FindSectionOffset(name, PatchedSecAddr))
@@ -421,37 +454,64 @@ bool OiIREmitter::ProcessIndirectJumps() {
 #ifndef NDEBUG
       outs() << "REL at " << format("%8" PRIx64, offset) << " Found ";
       outs() << "Contents:" << format("%8" PRIx64,
-                                      (*(int *)(&ShadowImage[offset])));
+                                      (*(const int *)(&ShadowImage[offset])));
 #endif
-      TargetAddr += *(uint32_t *)(&ShadowImage[offset]);
+      TargetAddr += *(const uint32_t *)(&ShadowImage[offset]);
       TargetAddr += TextOffset;
       CodePtrs.insert(TargetAddr);
+      CodePtrRelocs.push_back(std::make_pair(offset, TargetAddr));
 #ifndef NDEBUG
       outs() << " TargetAddr = " << format("%8" PRIx64, TargetAddr) << "\n";
 #endif
-      BasicBlock *BB = nullptr;
-      if (!HandleBackEdge(TargetAddr, BB))
-        llvm_unreachable("Failed to handle backedge");
-      auto p = std::equal_range(FunctionAddrs.begin(), FunctionAddrs.end(),
-                                TargetAddr);
-      if (!OneRegion && p.first != p.second) {
-        PSBuilder.addPair(offset, BB->getParent());
-      } else {
-        if (OneRegion && p.first != p.second) {
-          IndFunctionAddrs.insert(*p.first);
-        }
-        PSBuilder.addPair(offset, BlockAddress::get(BB));
-      }
-      IndirectDestinations.push_back(BB);
-      IndirectDestinationsAddrs.push_back(TargetAddr);
       // Patch ShadowImage with fixed address
-      *(int *)(&ShadowImage[offset]) = TargetAddr;
+      *(int *)(&OwnShadowImage[offset]) = TargetAddr;
     }
   }
-  PSBuilder.finish();
-  uint64_t TableSize = IndirectDestinations.size();
-  uint32_t NumJumpsOK = 0;
-  uint32_t NumJumpsWarning = 0;
+  return true;
+}
+
+// A single-function module only resolves the code pointers and jump table
+// entries that land in its own function.
+bool OiIREmitter::OwnsCodeAddr(uint64_t Addr) const {
+  if (!Parent)
+    return true;
+  auto upper = std::upper_bound(FunctionAddrs.begin(), FunctionAddrs.end(),
+                                Addr);
+  return upper != FunctionAddrs.begin() && *--upper == CurFunAddr;
+}
+
+bool OiIREmitter::ResolveIndirectJumps() {
+  // Code pointers are collected once, by the module that owns the image
+  const OiIREmitter &Image = Parent ? *Parent : *this;
+  PatchSectionBuilder PSBuilder(&*TheModule);
+  std::sort(FunctionAddrs.begin(), FunctionAddrs.end());
+
+  for (const auto &Reloc : Image.CodePtrRelocs) {
+    uint64_t offset = Reloc.first;
+    uint64_t TargetAddr = Reloc.second;
+    if (!OwnsCodeAddr(TargetAddr))
+      continue;
+    BasicBlock *BB = nullptr;
+    if (!HandleBackEdge(TargetAddr, BB))
+      llvm_unreachable("Failed to handle backedge");
+    auto p = std::equal_range(FunctionAddrs.begin(), FunctionAddrs.end(),
+                              TargetAddr);
+    if (!OneRegion && p.first != p.second) {
+      PSBuilder.addPair(offset, BB->getParent());
+    } else {
+      if (OneRegion && p.first != p.second) {
+        IndFunctionAddrs.insert(*p.first);
+      }
+      PSBuilder.addPair(offset, BlockAddress::get(BB));
+    }
+    IndirectDestinations.push_back(BB);
+    IndirectDestinationsAddrs.push_back(TargetAddr);
+  }
+  if (Parent)
+    PSBuilder.finish(PartialPatchSection, GlobalValue::PrivateLinkage);
+  else
+    PSBuilder.finish();
+  uint64_t TableSize = Image.CodePtrRelocs.size();
 
   if (TableSize != 0) {
     for (const auto &IJE : IndirectJumps) {
@@ -463,7 +523,7 @@ bool OiIREmitter::ProcessIndirectJumps() {
       uint64_t FuncAddr = GetFuncAddr(FunctionAddrs, Addr);
       if (JT != 0 || MatchIndirectJumpTable(first, JT)) {
         std::vector<BasicBlock *> JumpTargets;
-        if (ExtractJumpTargets(JT, CodePtrs, FunctionAddrs, FuncAddr,
+        if (ExtractJumpTargets(JT, Image.CodePtrs, FunctionAddrs, FuncAddr,
                                JumpTargets, IJE.JTCount)) {
           Value *v = nullptr;
           if (IJE.JTAddress != 0) {
@@ -474,7 +534,7 @@ bool OiIREmitter::ProcessIndirectJumps() {
             uint32_t CaseVal = 0;
             for (auto Dest : JumpTargets) {
               Swi->addCase(ConstantInt::get(
-                               Type::getInt32Ty(getGlobalContext()), CaseVal),
+                               Type::getInt32Ty(Context), CaseVal),
                            Dest);
               CaseVal += 4;
               // Add all targets, except the last one, which was already added
@@ -484,9 +544,10 @@ bool OiIREmitter::ProcessIndirectJumps() {
             }
             v = Swi;
           } else {
+            PromoteIndirectJump(Ins, Addr, first, FuncAddr);
             IndirectBrInst *Ind = Builder.CreateIndirectBr(
                 Builder.CreateIntToPtr(first,
-                                       Type::getInt32PtrTy(getGlobalContext())),
+                                       Type::getInt32PtrTy(Context)),
                 JumpTargets.size());
             std::set<BasicBlock *> JumpTargetsSet;
             JumpTargetsSet.insert(JumpTargets.begin(), JumpTargets.end());
@@ -502,14 +563,17 @@ bool OiIREmitter::ProcessIndirectJumps() {
           continue;
         }
       }
-      if (NumJumpsWarning++ == 0)
+      // Single-function modules leave the warning to the merged statistics
+      if (NumJumpsWarning++ == 0 && !Parent) {
         printf("WARNING: Failed to retrieve jump table base address for "
                "indirect jump. Assuming all targets in function.\n");
-      dyn_cast<Instruction>(first)->getParent()->dump();
+        dyn_cast<Instruction>(first)->getParent()->dump();
+      }
 
+      PromoteIndirectJump(Ins, Addr, first, FuncAddr);
       IndirectBrInst *v = Builder.CreateIndirectBr(
           Builder.CreateIntToPtr(first,
-                                  Type::getInt32PtrTy(getGlobalContext())),
+                                  Type::getInt32PtrTy(Context)),
           IndirectDestinations.size());
       for (int I = 0, E = IndirectDestinations.size(); I != E; ++I) {
         BasicBlock *targetBB = IndirectDestinations[I];
@@ -519,7 +583,7 @@ bool OiIREmitter::ProcessIndirectJumps() {
         v->addDestination(IndirectDestinations[I]);
         if (&targetBB->getParent()->getEntryBlock() == targetBB) {
           BasicBlock *NewEntry =
-              BasicBlock::Create(getGlobalContext(), "newentry",
+              BasicBlock::Create(Context, "newentry",
                                  targetBB->getParent(), targetBB);
           Builder.SetInsertPoint(NewEntry);
           Builder.CreateBr(targetBB);
@@ -529,13 +593,15 @@ bool OiIREmitter::ProcessIndirectJumps() {
       first = GetFirstInstruction(first, v);
       InsMap[Addr] = dyn_cast<Instruction>(first);
     }
+  } else if (!OneRegion && HasGuestCodePtrs()) {
+    for (const auto &IJE : IndirectJumps) {
+      assert(IJE.JTAddress == 0 && "Jump tables need relocations");
+      DispatchIndirectJump(IJE.Ins, IJE.InsAddress, IJE.Index);
+    }
   }
 
-  printf("INFO: Processed %d indirect jumps: %d warnings.\n",
-         NumJumpsOK + NumJumpsWarning, NumJumpsWarning);
-  printf("INFO: Program uses %d indirect calls.\n", (int)IndirectCalls.size());
-  printf("INFO: Program has %d indirect calls targets.\n",
-         (int)IndFunctionAddrs.size());
+  if (!Parent)
+    PrintIndirectJumpStats(NumJumpsOK, NumJumpsWarning, IndirectCalls.size());
 
   if (OneRegion && IndirectCalls.size() > 0) {
     assert(IndFunctionAddrs.size() > 0 &&
@@ -560,11 +626,18 @@ bool OiIREmitter::ProcessIndirectJumps() {
       InsMap[Addr] = dyn_cast<Instruction>(first);
       continue;
     }
+    PromoteIndirectCall(Ins, Addr, first);
+    if (HasGuestCodePtrs()) {
+      DispatchIndirectCall(Ins, Addr, first);
+      Ins->eraseFromParent();
+      InsMap[Addr] = dyn_cast<Instruction>(first);
+      continue;
+    }
     Type *ft = PointerType::getUnqual(
-        FunctionType::get(Type::getVoidTy(getGlobalContext()),
+        FunctionType::get(Type::getVoidTy(Context),
                           /*isvararg*/ false));
     Builder.CreateCall(Builder.CreatePointerCast(
-        Builder.CreateIntToPtr(first, Type::getInt32PtrTy(getGlobalContext())),
+        Builder.CreateIntToPtr(first, Type::getInt32PtrTy(Context)),
         ft));
     Ins->eraseFromParent();
     InsMap[Addr] = dyn_cast<Instruction>(first);
@@ -573,6 +646,355 @@ bool OiIREmitter::ProcessIndirectJumps() {
   return true;
 }
 
+// Indirect transfers are tested against at most this many of the targets
+// the profile saw them take, each taking at least MinPromotedPercent of
+// their executions
+static const unsigned MaxPromotedTargets = 2;
+static const unsigned MinPromotedPercent = 20;
+
+// Branch weights are 32-bit; scales the counts of a branch together
+static SmallVector<uint32_t, 4> ScaleWeights(ArrayRef<uint64_t> Counts) {
+  uint64_t Max = *std::max_element(Counts.begin(), Counts.end());
+  uint64_t Scale = Max / (UINT32_MAX - 1) + 1;
+  SmallVector<uint32_t, 4> Weights;
+  for (uint64_t C : Counts)
+    Weights.push_back(C / Scale + 1);
+  return Weights;
+}
+
+// Weights the guest conditional branch at CurAddr, translated to Br, by how
+// often it went to its target and to FallThrough
+void OiIREmitter::AddBranchWeights(Instruction *Br, uint64_t FallThrough) {
+  uint64_t Taken, NotTaken;
+  if (!Profile || !Profile->getBranchCounts(CurAddr, FallThrough, Taken,
+                                            NotTaken))
+    return;
+  uint64_t Counts[] = {Taken, NotTaken};
+  Br->setMetadata(LLVMContext::MD_prof,
+                  MDBuilder(Context).createBranchWeights(ScaleWeights(Counts)));
+}
+
+// Targets of the indirect transfer at Addr worth testing for, most frequent
+// first, with their counts in Counts and the executions of the transfer in
+// Total
+std::vector<uint64_t>
+OiIREmitter::GetPromotedTargets(uint64_t Addr, uint64_t &Total,
+                                std::vector<uint64_t> &Counts) {
+  std::vector<uint64_t> Targets;
+  Total = 0;
+  if (!Profile)
+    return Targets;
+  std::vector<OiProfileData::Edge> Edges = Profile->getTargets(Addr);
+  for (const auto &E : Edges)
+    Total += E.Count;
+  for (const auto &E : Edges) {
+    if (Targets.size() == MaxPromotedTargets ||
+        E.Count * 100 < Total * MinPromotedPercent)
+      break;
+    Targets.push_back(E.To);
+    Counts.push_back(E.Count);
+  }
+  return Targets;
+}
+
+// Splits the block of Ins before it, and tests Target against the value of
+// each of Cases in turn, branching to its block on a match. Ins is left at
+// the start of the block taken when none matches, which Builder points to.
+void OiIREmitter::EmitTargetGuards(
+    Instruction *Ins, Value *Target,
+    ArrayRef<std::pair<Constant *, BasicBlock *>> Cases,
+    ArrayRef<uint64_t> Counts, uint64_t Total) {
+  BasicBlock *Head = Ins->getParent();
+  BasicBlock *Fallback = Head->splitBasicBlock(Ins);
+  Head->getTerminator()->eraseFromParent();
+  MDBuilder MDB(Context);
+  BasicBlock *Cur = Head;
+  uint64_t Remaining = Total;
+  for (unsigned I = 0, E = Cases.size(); I != E; ++I) {
+    BasicBlock *Next = Fallback;
+    if (I + 1 != E)
+      Next = BasicBlock::Create(Context, "", Head->getParent(), Fallback);
+    Remaining -= Counts[I];
+    Builder.SetInsertPoint(Cur);
+    BranchInst *Br = Builder.CreateCondBr(
+        Builder.CreateICmpEQ(Target, Cases[I].first), Cases[I].second, Next);
+    uint64_t Weights[] = {Counts[I], Remaining};
+    Br->setMetadata(LLVMContext::MD_prof,
+                    MDB.createBranchWeights(ScaleWeights(Weights)));
+    Cur = Next;
+  }
+  Builder.SetInsertPoint(Ins);
+}
+
+// Calls the most frequent targets of the indirect call at Addr, replaced by
+// Ins, directly when Target matches them.
+void OiIREmitter::PromoteIndirectCall(Instruction *Ins, uint64_t Addr,
+                                      Value *Target) {
+  uint64_t Total;
+  std::vector<uint64_t> Counts, PromotedCounts;
+  std::vector<uint64_t> Targets = GetPromotedTargets(Addr, Total, Counts);
+  std::vector<std::pair<Constant *, BasicBlock *>> Cases;
+  BasicBlock *Join = nullptr;
+  for (unsigned I = 0; I < Targets.size(); ++I) {
+    // main is not named after its address
+    uint64_t T = Targets[I];
+    if (T == MainFunAddr ||
+        !std::binary_search(FunctionAddrs.begin(), FunctionAddrs.end(), T))
+      continue;
+    if (!Join)
+      Join = Ins->getParent()->splitBasicBlock(Ins->getNextNode());
+    std::string Name = Twine("a").concat(Twine::utohexstr(T)).str();
+    Constant *Fn = TheModule->getOrInsertFunction(
+        Name, FunctionType::get(Type::getVoidTy(Context), false));
+    BasicBlock *Direct =
+        BasicBlock::Create(Context, "", Join->getParent(), Join);
+    IRBuilder<> DirectBuilder(Direct);
+    DirectBuilder.CreateCall(Fn);
+    DirectBuilder.CreateBr(Join);
+    Constant *Key = HasGuestCodePtrs()
+                        ? ConstantInt::get(Type::getInt32Ty(Context), T)
+                        : ConstantExpr::getPointerCast(
+                              Fn, Type::getInt32Ty(Context));
+    Cases.push_back(std::make_pair(Key, Direct));
+    PromotedCounts.push_back(Counts[I]);
+  }
+  if (!Cases.empty())
+    EmitTargetGuards(Ins, Target, Cases, PromotedCounts, Total);
+}
+
+// Branches to the most frequent targets of the indirect jump at Addr,
+// replaced by Ins, when Target holds their address.
+void OiIREmitter::PromoteIndirectJump(Instruction *Ins, uint64_t Addr,
+                                      Value *Target, uint64_t FuncAddr) {
+  uint64_t Total;
+  std::vector<uint64_t> Counts, PromotedCounts;
+  std::vector<uint64_t> Targets = GetPromotedTargets(Addr, Total, Counts);
+  std::vector<std::pair<Constant *, BasicBlock *>> Cases;
+  Function *F = Ins->getParent()->getParent();
+  for (unsigned I = 0; I < Targets.size(); ++I) {
+    // Code pointers to the target hold the address of this block
+    auto It = std::find(IndirectDestinationsAddrs.begin(),
+                        IndirectDestinationsAddrs.end(), Targets[I]);
+    if (It == IndirectDestinationsAddrs.end() ||
+        GetFuncAddr(FunctionAddrs, Targets[I]) != FuncAddr)
+      continue;
+    BasicBlock *BB =
+        IndirectDestinations[It - IndirectDestinationsAddrs.begin()];
+    if (BB->getParent() != F || &F->getEntryBlock() == BB)
+      continue;
+    Cases.push_back(std::make_pair(
+        ConstantExpr::getPtrToInt(BlockAddress::get(BB),
+                                  Type::getInt32Ty(Context)),
+        BB));
+    PromotedCounts.push_back(Counts[I]);
+  }
+  if (!Cases.empty())
+    EmitTargetGuards(Ins, Target, Cases, PromotedCounts, Total);
+}
+
+// Without relocations, code pointers are not patched to host addresses and
+// keep their guest value, in data and in registers alike.
+bool OiIREmitter::HasGuestCodePtrs() const {
+  const OiIREmitter &Image = Parent ? *Parent : *this;
+  return !Image.HasRelocations;
+}
+
+// Calls the function at the guest address Target before Ins, the indirect
+// call at Addr. Each call site caches the last target it looked up with
+// oi_dispatch().
+void OiIREmitter::DispatchIndirectCall(Instruction *Ins, uint64_t Addr,
+                                       Value *Target) {
+  Type *Int32Ty = Type::getInt32Ty(Context);
+  Type *PtrTy = Type::getInt8PtrTy(Context);
+  std::string Suffix = Twine::utohexstr(Addr).str();
+  // Starts at an address no instruction has, so that the first call misses
+  // even through a null code pointer
+  auto *LastGuest = new GlobalVariable(
+      *TheModule, Int32Ty, false, GlobalValue::PrivateLinkage,
+      ConstantInt::get(Int32Ty, ~0U), "ic.guest." + Suffix);
+  auto *LastHost = new GlobalVariable(
+      *TheModule, PtrTy, false, GlobalValue::PrivateLinkage,
+      ConstantPointerNull::get(cast<PointerType>(PtrTy)),
+      "ic.host." + Suffix);
+  Value *Lookup = TheModule->getOrInsertFunction(
+      "oi_dispatch", FunctionType::get(PtrTy, Int32Ty, false));
+
+  Value *Miss = Builder.CreateICmpNE(Builder.CreateLoad(LastGuest), Target);
+  TerminatorInst *Then = SplitBlockAndInsertIfThen(
+      Miss, Ins, false, MDBuilder(Context).createBranchWeights(1, 64));
+  IRBuilder<> MissBuilder(Then);
+  MissBuilder.CreateStore(MissBuilder.CreateCall(Lookup, Target), LastHost);
+  MissBuilder.CreateStore(Target, LastGuest);
+
+  Builder.SetInsertPoint(Ins);
+
+  Type *FnPtrTy = PointerType::getUnqual(
+      FunctionType::get(Type::getVoidTy(Context), false));
+  Builder.CreateCall(
+      Builder.CreateBitCast(Builder.CreateLoad(LastHost), FnPtrTy));
+}
+
+// Starts a block at every target the indirect jump at Addr may take that
+// can be found: the words of its jump table, read until one is not an
+// instruction of the function, and the targets it took when profiled.
+void OiIREmitter::SplitGuestJumpTargets(uint64_t Addr, Value *Target,
+                                        uint64_t FuncAddr) {
+  auto InFunction = [&](uint64_t T) {
+    return T >= FuncAddr && T < CurAddr &&
+           (T - FuncAddr) % GetInstructionSize() == 0 &&
+           GetFuncAddr(FunctionAddrs, T) == FuncAddr;
+  };
+  BasicBlock *BB;
+  uint64_t JT;
+  if (MatchIndirectJumpTable(Target, JT)) {
+    for (uint64_t Entry = JT; Entry + 4 <= ShadowImage.size(); Entry += 4) {
+      uint32_t Candidate = *(const uint32_t *)(&ShadowImage[Entry]);
+      ImageReads.push_back(std::make_pair(Entry, Candidate));
+      if (!InFunction(Candidate))
+        break;
+      if (!HandleBackEdge(Candidate, BB))
+        llvm_unreachable("Failed to handle backedge");
+    }
+  }
+  if (Profile) {
+    for (const OiProfileData::Edge &E : Profile->getTargets(Addr))
+      if (InFunction(E.To) && !HandleBackEdge(E.To, BB))
+        llvm_unreachable("Failed to handle backedge");
+  }
+}
+
+// Jumps to the block at the guest address Target, replacing the indirect
+// jump Ins at Addr, through a switch over the blocks of the function. Targets
+// that start no block, because SplitGuestJumpTargets() could not find them,
+// trap.
+void OiIREmitter::DispatchIndirectJump(Instruction *Ins, uint64_t Addr,
+                                       Value *Target) {
+  uint64_t FuncAddr = GetFuncAddr(FunctionAddrs, Addr);
+  SplitGuestJumpTargets(Addr, Target, FuncAddr);
+  Function *F = Ins->getParent()->getParent();
+  std::vector<std::pair<uint64_t, BasicBlock *>> Blocks;
+  for (const auto &I : BBMap) {
+    uint64_t BBAddr;
+    BasicBlock *BB = I.getValue();
+    if (!BB || BB->getParent() != F || &F->getEntryBlock() == BB ||
+        !I.getKey().startswith("bb") ||
+        I.getKey().substr(2).getAsInteger(16, BBAddr) ||
+        GetFuncAddr(FunctionAddrs, BBAddr) != FuncAddr)
+      continue;
+    Blocks.push_back(std::make_pair(BBAddr, BB));
+  }
+  std::sort(Blocks.begin(), Blocks.end());
+
+  BasicBlock *Invalid = BasicBlock::Create(Context, "badjump", F);
+  IRBuilder<> InvalidBuilder(Invalid);
+  InvalidBuilder.CreateCall(
+      Intrinsic::getDeclaration(&*TheModule, Intrinsic::trap));
+  InvalidBuilder.CreateUnreachable();
+
+  Builder.SetInsertPoint(Ins);
+  SwitchInst *SI = Builder.CreateSwitch(Target, Invalid, Blocks.size());
+  for (const auto &B : Blocks)
+    SI->addCase(Builder.getInt32(B.first), B.second);
+  Ins->eraseFromParent();
+  Value *first = GetFirstInstruction(Target, SI);
+  InsMap[Addr] = dyn_cast<Instruction>(first);
+}
+
+// Defines oi_dispatch(), which maps the guest address of a function to its
+// host address by binary search in a table sorted by guest address. Nothing
+// is emitted if no indirect call needs it.
+void OiIREmitter::BuildDispatchTable() {
+  Function *Lookup = TheModule->getFunction("oi_dispatch");
+  if (!Lookup)
+    return;
+  Type *Int32Ty = Type::getInt32Ty(Context);
+  Type *PtrTy = Type::getInt8PtrTy(Context);
+  std::vector<std::pair<uint64_t, Function *>> Funcs;
+  for (Function &F : *TheModule) {
+    uint64_t Addr;
+    if (!F.isDeclaration() && F.getName().startswith("a") &&
+        !F.getName().substr(1).getAsInteger(16, Addr))
+      Funcs.push_back(std::make_pair(Addr, &F));
+  }
+  std::sort(Funcs.begin(), Funcs.end());
+
+  StructType *EntryTy = StructType::get(Int32Ty, PtrTy, nullptr);
+  std::vector<Constant *> Entries;
+  for (const auto &F : Funcs)
+    Entries.push_back(ConstantStruct::get(
+        EntryTy, ConstantInt::get(Int32Ty, F.first),
+        ConstantExpr::getPointerCast(F.second, PtrTy), nullptr));
+  ArrayType *AT = ArrayType::get(EntryTy, Entries.size());
+  auto *Table = new GlobalVariable(*TheModule, AT, true,
+                                   GlobalValue::PrivateLinkage,
+                                   ConstantArray::get(AT, Entries),
+                                   "oi_dispatch_table");
+
+  Value *Guest = Lookup->arg_begin();
+  Guest->setName("guest");
+  BasicBlock *Entry = BasicBlock::Create(Context, "entry", Lookup);
+  BasicBlock *Loop = BasicBlock::Create(Context, "loop", Lookup);
+  BasicBlock *Body = BasicBlock::Create(Context, "body", Lookup);
+  BasicBlock *Found = BasicBlock::Create(Context, "found", Lookup);
+  BasicBlock *Next = BasicBlock::Create(Context, "next", Lookup);
+  BasicBlock *Invalid = BasicBlock::Create(Context, "badcall", Lookup);
+  IRBuilder<> B(Entry);
+  B.CreateBr(Loop);
+
+  // Look in [Lo, Hi)
+  B.SetInsertPoint(Loop);
+  PHINode *Lo = B.CreatePHI(Int32Ty, 2, "lo");
+  PHINode *Hi = B.CreatePHI(Int32Ty, 2, "hi");
+  Lo->addIncoming(B.getInt32(0), Entry);
+  Hi->addIncoming(B.getInt32(Entries.size()), Entry);
+  B.CreateCondBr(B.CreateICmpULT(Lo, Hi), Body, Invalid);
+
+  B.SetInsertPoint(Body);
+  Value *Mid = B.CreateLShr(B.CreateAdd(Lo, Hi), 1, "mid");
+  Value *KeyIdxs[] = {B.getInt32(0), Mid, B.getInt32(0)};
+  Value *Key = B.CreateLoad(B.CreateGEP(Table, KeyIdxs), "key");
+  B.CreateCondBr(B.CreateICmpEQ(Key, Guest), Found, Next);
+
+  B.SetInsertPoint(Found);
+  Value *HostIdxs[] = {B.getInt32(0), Mid, B.getInt32(1)};
+  B.CreateRet(B.CreateLoad(B.CreateGEP(Table, HostIdxs)));
+
+  B.SetInsertPoint(Next);
+  Value *Below = B.CreateICmpULT(Key, Guest);
+  Lo->addIncoming(B.CreateSelect(Below, B.CreateAdd(Mid, B.getInt32(1)), Lo),
+                  Next);
+  Hi->addIncoming(B.CreateSelect(Below, Hi, Mid), Next);
+  B.CreateBr(Loop);
+
+  B.SetInsertPoint(Invalid);
+  B.CreateCall(Intrinsic::getDeclaration(&*TheModule, Intrinsic::trap));
+  B.CreateUnreachable();
+}
+
+void OiIREmitter::PrintIndirectJumpStats(uint32_t NumOK, uint32_t NumWarning,
+                                         uint32_t NumCalls) {
+  printf("INFO: Processed %d indirect jumps: %d warnings.\n",
+         NumOK + NumWarning, NumWarning);
+  printf("INFO: Program uses %d indirect calls.\n", (int)NumCalls);
+  printf("INFO: Program has %d indirect calls targets.\n",
+         (int)IndFunctionAddrs.size());
+}
+
+// Joins the partial PatchSections of the single-function modules linked into
+// this one, in link order, into the PatchSection read by the runtime.
+void OiIREmitter::MergePatchSections() {
+  PatchSectionBuilder PSBuilder(&*TheModule);
+  std::vector<GlobalVariable *> Parts;
+  for (GlobalVariable &GV : TheModule->globals())
+    if (GV.getName().startswith(PartialPatchSection))
+      Parts.push_back(&GV);
+  for (GlobalVariable *GV : Parts) {
+    PSBuilder.addPairs(GV);
+    GV->eraseFromParent();
+  }
+  PSBuilder.finish();
+}
+
 void OiIREmitter::BuildShadowImage() {
   ShadowSize = 0;
 
@@ -607,8 +1029,8 @@ void OiIREmitter::BuildShadowImage() {
   // Allocate some space for the stack
   // ShadowSize += 10 << 20;
   ShadowSize += StackSize;
-  ShadowImage.clear();
-  ShadowImage.resize(ShadowSize);
+  OwnShadowImage.clear();
+  OwnShadowImage.resize(ShadowSize);
 
   for (auto &i : Obj->sections()) {
     uint64_t SectionAddr = i.getAddress();
@@ -628,12 +1050,12 @@ void OiIREmitter::BuildShadowImage() {
     if (error(i.getContents(Bytes)))
       continue;;
     StringRefMemoryObject memoryObject(Bytes);
-    memoryObject.readBytes(&ShadowImage[0] + SectionAddr + Offset, SectionAddr,
-                           SectSize);
+    memoryObject.readBytes(&OwnShadowImage[0] + SectionAddr + Offset,
+                           SectionAddr, SectSize);
   }
 
   Constant *c = ConstantDataArray::get(
-      getGlobalContext(),
+      Context,
       ArrayRef<uint8_t>(
           reinterpret_cast<const unsigned char *>(&ShadowImage[0]),
           ShadowSize));
@@ -646,7 +1068,7 @@ void OiIREmitter::BuildShadowImage() {
 
 void OiIREmitter::UpdateShadowImage() {
   Constant *c = ConstantDataArray::get(
-      getGlobalContext(),
+      Context,
       ArrayRef<uint8_t>(
           reinterpret_cast<const unsigned char *>(&ShadowImage[0]),
           ShadowSize));
@@ -654,10 +1076,24 @@ void OiIREmitter::UpdateShadowImage() {
   dyn_cast<GlobalVariable>(ShadowImageValue)->setInitializer(c);
 }
 
+void OiIREmitter::SetTargetLayout() {
+  if (CodeTarget == "arm") {
+    TheModule->setTargetTriple("armv4t--linux-eabi");
+    TheModule->setDataLayout(
+        "e-m:e-p:32:32-i64:64-v128:64:128-a:0:32-n32-S64");
+  } else { // i386 data layout
+    TheModule->setTargetTriple("i386-unknown-linux-gnu");
+    TheModule->setDataLayout(
+        "e-m:e-p:32:32-f64:32:64-f80:32-n8:16:32-S128");
+  }
+}
+
+// Single-function modules only declare the registers; the module they are
+// linked into defines them.
 void OiIREmitter::BuildRegisterFile() {
-  Type *ty = Type::getInt32Ty(getGlobalContext());
-  Type *dblTy = Type::getDoubleTy(getGlobalContext());
-  Type *fltTy = Type::getFloatTy(getGlobalContext());
+  Type *ty = Type::getInt32Ty(Context);
+  Type *dblTy = Type::getDoubleTy(Context);
+  Type *fltTy = Type::getFloatTy(Context);
   // 128 base regs  0-127
   // 128 float regs 128-255
   // LO 256
@@ -674,22 +1110,67 @@ void OiIREmitter::BuildRegisterFile() {
       ci = ConstantFP::get(fltTy, 0.0f);
       myty = fltTy;
     }
+    if (Parent)
+      ci = nullptr;
     GlobalVariable *gv = new GlobalVariable(
         *TheModule, myty, false, GlobalValue::ExternalLinkage, ci, RegName);
     GlobalRegs[I] = gv;
   }
   for (int I = 0; I < 64; ++I) {
-    Constant *ci = ConstantFP::get(dblTy, 0.0);
+    Constant *ci = Parent ? nullptr : ConstantFP::get(dblTy, 0.0);
     GlobalVariable *gv = new GlobalVariable(
         *TheModule, dblTy, false, GlobalValue::ExternalLinkage, ci, "dblreg");
     DblGlobalRegs[I] = gv;
   }
 }
 
+// The globals of BuildRegisterFile(), the integer and float ones first
+std::vector<GlobalVariable *> OiIREmitter::GetRegisterGlobals() const {
+  std::vector<GlobalVariable *> Res;
+  for (int I = 1; I < 259; ++I)
+    Res.push_back(cast<GlobalVariable>(GlobalRegs[I]));
+  for (int I = 0; I < 64; ++I)
+    Res.push_back(cast<GlobalVariable>(DblGlobalRegs[I]));
+  return Res;
+}
+
+// The register globals the calling convention passes arguments and results
+// in, the same ones -abi-locals syncs
+void OiIREmitter::GetAbiRegisterGlobals(
+    std::vector<GlobalVariable *> &Args,
+    std::vector<GlobalVariable *> &Rets) const {
+  for (unsigned I = ConvToDirective(Mips::A0); I <= ConvToDirective(Mips::A3);
+       ++I)
+    Args.push_back(cast<GlobalVariable>(GlobalRegs[I]));
+  Args.push_back(cast<GlobalVariable>(GlobalRegs[ConvToDirective(Mips::F12)]));
+  Args.push_back(cast<GlobalVariable>(GlobalRegs[ConvToDirective(Mips::F14)]));
+  for (unsigned I = ConvToDirectiveDbl(Mips::D6);
+       I < ConvToDirectiveDbl(Mips::D8); ++I)
+    Args.push_back(cast<GlobalVariable>(DblGlobalRegs[I]));
+
+  for (unsigned I = ConvToDirective(Mips::V0); I <= ConvToDirective(Mips::V1);
+       ++I)
+    Rets.push_back(cast<GlobalVariable>(GlobalRegs[I]));
+  Rets.push_back(cast<GlobalVariable>(GlobalRegs[ConvToDirective(Mips::F0)]));
+  Rets.push_back(
+      cast<GlobalVariable>(DblGlobalRegs[ConvToDirectiveDbl(Mips::F0)]));
+}
+
+GlobalVariable *OiIREmitter::GetStackPointerGlobal() const {
+  return cast<GlobalVariable>(GlobalRegs[ConvToDirective(Mips::SP)]);
+}
+
+// The global guest addresses index, or null if they are host addresses
+GlobalVariable *OiIREmitter::GetShadowMemory() const {
+  if (NoShadow)
+    return nullptr;
+  return cast<GlobalVariable>(ShadowImageValue);
+}
+
 void OiIREmitter::BuildLocalRegisterFile() {
-  Type *ty = Type::getInt32Ty(getGlobalContext());
-  Type *dblTy = Type::getDoubleTy(getGlobalContext());
-  Type *fltTy = Type::getFloatTy(getGlobalContext());
+  Type *ty = Type::getInt32Ty(Context);
+  Type *dblTy = Type::getDoubleTy(Context);
+  Type *fltTy = Type::getFloatTy(Context);
   // 128 base regs  0-127
   // 128 float regs 128-255
   // LO 256
@@ -730,20 +1211,21 @@ void OiIREmitter::BuildLocalRegisterFile() {
 void OiIREmitter::StartFunction(StringRef N, uint64_t Addr) {
   FunctionType *FT;
   Function *F;
-  FunctionAddrs.push_back(Addr);
+  if (!Parent)
+    FunctionAddrs.push_back(Addr);
   if (FirstFunction) {
     if (OneRegion) {
-      SmallVector<Type *, 8> args(2, Type::getInt32Ty(getGlobalContext()));
-      FT = FunctionType::get(Type::getVoidTy(getGlobalContext()), args,
+      SmallVector<Type *, 8> args(2, Type::getInt32Ty(Context));
+      FT = FunctionType::get(Type::getVoidTy(Context), args,
                              /*isvararg*/ false);
       F = Function::Create(FT, Function::ExternalLinkage, "main", &*TheModule);
       BasicBlock *BBEntry =
-        BasicBlock::Create(getGlobalContext(), "entrypoint", F, &*F->begin());
+        BasicBlock::Create(Context, "entrypoint", F, &*F->begin());
       Builder.SetInsertPoint(BBEntry);
       BuildLocalRegisterFile();
       // This BB terminator will be adjusted in FixEntryPoint()
     } else {
-      FT = FunctionType::get(Type::getVoidTy(getGlobalContext()), false);
+      FT = FunctionType::get(Type::getVoidTy(Context), false);
       F = reinterpret_cast<Function *>(TheModule->getOrInsertFunction(N, FT));
     }
     FirstFunction = false;
@@ -757,7 +1239,7 @@ void OiIREmitter::StartFunction(StringRef N, uint64_t Addr) {
     CurFunAddr = CurAddr + GetInstructionSize();
     SpilledRegs.clear();
     if (!OneRegion) {
-      FT = FunctionType::get(Type::getVoidTy(getGlobalContext()), false);
+      FT = FunctionType::get(Type::getVoidTy(Context), false);
       F = reinterpret_cast<Function *>(TheModule->getOrInsertFunction(N, FT));
       // Create a function with no parameters
       BasicBlock *BB = CreateBB(CurAddr + GetInstructionSize(), F);
@@ -771,11 +1253,12 @@ void OiIREmitter::StartFunction(StringRef N, uint64_t Addr) {
 }
 
 void OiIREmitter::StartMainFunction(uint64_t Addr) {
-  FunctionAddrs.push_back(Addr);
+  if (!Parent)
+    FunctionAddrs.push_back(Addr);
   MainFunAddr = Addr;
   if (FirstFunction) {
-    SmallVector<Type *, 8> args(2, Type::getInt32Ty(getGlobalContext()));
-    FunctionType *FT = FunctionType::get(Type::getVoidTy(getGlobalContext()),
+    SmallVector<Type *, 8> args(2, Type::getInt32Ty(Context));
+    FunctionType *FT = FunctionType::get(Type::getVoidTy(Context),
                                          args, /*isvararg*/ false);
     Function *F = Function::Create(FT, Function::ExternalLinkage, "main", &*TheModule);
     FirstFunction = false;
@@ -790,8 +1273,8 @@ void OiIREmitter::StartMainFunction(uint64_t Addr) {
     SpilledRegs.clear();
     BasicBlock *BB;
     if (!OneRegion) {
-      SmallVector<Type *, 8> args(2, Type::getInt32Ty(getGlobalContext()));
-      FunctionType *FT = FunctionType::get(Type::getVoidTy(getGlobalContext()),
+      SmallVector<Type *, 8> args(2, Type::getInt32Ty(Context));
+      FunctionType *FT = FunctionType::get(Type::getVoidTy(Context),
                                            args, /*isvararg*/ false);
       Function *F =
           Function::Create(FT, Function::ExternalLinkage, "main", &*TheModule);
@@ -811,11 +1294,11 @@ void OiIREmitter::StartMainFunction(uint64_t Addr) {
 void OiIREmitter::InsertStartupCode(uint64_t Addr) {
   Function *F = Builder.GetInsertBlock()->getParent();
   // Initialize the stack (aligned to 32 bytes)
-  Value *size = ConstantInt::get(Type::getInt32Ty(getGlobalContext()),
+  Value *size = ConstantInt::get(Type::getInt32Ty(Context),
                                  ShadowSize & 0xFFFFFFE0);
   if (NoShadow) {
     Value *shadow = Builder.CreatePtrToInt(
-        ShadowImageValue, Type::getInt32Ty(getGlobalContext()));
+        ShadowImageValue, Type::getInt32Ty(Context));
     Value *fixedSize = Builder.CreateAdd(size, shadow);
     Builder.CreateStore(fixedSize, Regs[ConvToDirective(Mips::SP)]);
   } else {
@@ -829,23 +1312,23 @@ void OiIREmitter::InsertStartupCode(uint64_t Addr) {
     Builder.CreateStore(argv, Regs[ConvToDirective(Mips::A1)]);
   } else {
     Value *ptr = Builder.CreatePtrToInt(ShadowImageValue,
-                                        Type::getInt32Ty(getGlobalContext()));
+                                        Type::getInt32Ty(Context));
     Value *fixed = Builder.CreateSub(argv, ptr);
     Builder.CreateStore(fixed, Regs[ConvToDirective(Mips::A1)]);
-    Value *iv = Builder.CreateAlloca(Type::getInt32Ty(getGlobalContext()));
-    Value *zero = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0U);
-    Value *two = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 2U);
-    Value *one = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 1U);
+    Value *iv = Builder.CreateAlloca(Type::getInt32Ty(Context));
+    Value *zero = ConstantInt::get(Type::getInt32Ty(Context), 0U);
+    Value *two = ConstantInt::get(Type::getInt32Ty(Context), 2U);
+    Value *one = ConstantInt::get(Type::getInt32Ty(Context), 1U);
     Builder.CreateStore(zero, iv);
-    BasicBlock *bb1 = BasicBlock::Create(getGlobalContext(), "loopbody", F);
-    BasicBlock *bb2 = BasicBlock::Create(getGlobalContext(), "loopexit", F);
+    BasicBlock *bb1 = BasicBlock::Create(Context, "loopbody", F);
+    BasicBlock *bb2 = BasicBlock::Create(Context, "loopexit", F);
     Builder.CreateBr(bb1);
     Builder.SetInsertPoint(bb1);
     Value *ivload = Builder.CreateLoad(iv);
     Value *ivshr = Builder.CreateShl(ivload, two);
     Value *argvsum = Builder.CreateAdd(argv, ivshr);
     Value *argvptr = Builder.CreateIntToPtr(
-        argvsum, Type::getInt32PtrTy(getGlobalContext()));
+        argvsum, Type::getInt32PtrTy(Context));
     Value *elem = Builder.CreateLoad(argvptr);
     Value *elemfixed = Builder.CreateSub(elem, ptr);
     Builder.CreateStore(elemfixed, argvptr);
@@ -870,7 +1353,7 @@ BasicBlock *OiIREmitter::CreateBB(uint64_t Addr, Function *F) {
     if (F == 0) {
       F = Builder.GetInsertBlock()->getParent();
     }
-    BBMap[Idx] = BasicBlock::Create(getGlobalContext(), Idx, F);
+    BBMap[Idx] = BasicBlock::Create(Context, Idx, F);
   }
   return BBMap[Idx];
 }
@@ -1014,11 +1497,42 @@ void OiIREmitter::FixEntryBB() {
   if (pred_begin(BB) == pred_end(BB))
     return;
   BasicBlock *NewEntry = BasicBlock::Create(
-      getGlobalContext(), "newentry", Builder.GetInsertBlock()->getParent(), BB);
+      Context, "newentry", Builder.GetInsertBlock()->getParent(), BB);
   Builder.SetInsertPoint(NewEntry);
   Builder.CreateBr(BB);
 }
 
+// Report the guest registers to the co-simulation runtime on entry to the
+// function being built. Registers are read from the globals, which hold
+// the caller's state at this point. Index comes from AddCoSimName().
+void OiIREmitter::InsertCoSimHook(unsigned Index) {
+  Type *ty = Type::getInt32Ty(Context);
+  FunctionType *FT =
+      FunctionType::get(Type::getVoidTy(Context), ty, false);
+  Value *Hook = TheModule->getOrInsertFunction("oi_cosim_hook", FT);
+  Builder.CreateCall(Hook, ConstantInt::get(ty, Index));
+}
+
+// Emit @oi_cosim_names, the guest symbol of each hook index, and
+// @oi_cosim_count for the co-simulation runtime.
+void OiIREmitter::BuildCoSimTable() {
+  Type *ty = Type::getInt32Ty(Context);
+  Type *PtrTy = Type::getInt8PtrTy(Context);
+  std::vector<Constant *> Names;
+  for (const std::string &Name : CoSimNames) {
+    Constant *Str = ConstantDataArray::getString(Context, Name);
+    GlobalVariable *GV =
+        new GlobalVariable(*TheModule, Str->getType(), true,
+                           GlobalValue::PrivateLinkage, Str, "cosim.name");
+    Names.push_back(ConstantExpr::getPointerCast(GV, PtrTy));
+  }
+  ArrayType *AT = ArrayType::get(PtrTy, Names.size());
+  new GlobalVariable(*TheModule, AT, true, GlobalValue::ExternalLinkage,
+                     ConstantArray::get(AT, Names), "oi_cosim_names");
+  new GlobalVariable(*TheModule, ty, true, GlobalValue::ExternalLinkage,
+                     ConstantInt::get(ty, Names.size()), "oi_cosim_count");
+}
+
 void OiIREmitter::FixBBTerminators() {
   Function *F = Builder.GetInsertBlock()->getParent();
   std::vector<BasicBlock *> ToDelete;
@@ -1130,7 +1644,7 @@ bool OiIREmitter::BuildReturns() {
     ReadMap[ConvToDirective(Mips::RA)] = true;
 
     Value *Target =
-        Builder.CreateIntToPtr(ra, Type::getInt8PtrTy(getGlobalContext()));
+        Builder.CreateIntToPtr(ra, Type::getInt8PtrTy(Context));
     std::vector<BasicBlock *> CallSitesBBs;
     for (auto CallAddr : CallSites) {
       std::string Idx = Twine("bb").concat(Twine::utohexstr(CallAddr)).str();
@@ -1215,11 +1729,11 @@ bool OiIREmitter::HandleIndirectCallOneRegion(uint64_t Addr, Value *src,
   BasicBlock *Ret = CreateBB(Addr + GetInstructionSize());
   Builder.CreateStore(
       ConstantExpr::getPtrToInt(BlockAddress::get(Ret),
-                                Type::getInt32Ty(getGlobalContext())),
+                                Type::getInt32Ty(Context)),
       Regs[ConvToDirective(Mips::RA)]);
   WriteMap[ConvToDirective(Mips::RA)] = true;
   IndirectBrInst *v = Builder.CreateIndirectBr(
-      Builder.CreateIntToPtr(src, Type::getInt32PtrTy(getGlobalContext())),
+      Builder.CreateIntToPtr(src, Type::getInt32PtrTy(Context)),
       FunctionBBs.size());
   for (int I = 0, E = FunctionBBs.size(); I != E; ++I) {
     v->addDestination(FunctionBBs[I]);
@@ -1241,7 +1755,7 @@ bool OiIREmitter::HandleLocalCallOneRegion(uint64_t Addr, Value *&V,
   BasicBlock *Ret = CreateBB(CurAddr + GetInstructionSize());
   Value *first = Builder.CreateStore(
       ConstantExpr::getPointerCast(BlockAddress::get(Ret),
-                                   Type::getInt32Ty(getGlobalContext())),
+                                   Type::getInt32Ty(Context)),
       Regs[ConvToDirective(Mips::RA)]);
   WriteMap[ConvToDirective(Mips::RA)] = true;
   V = Builder.CreateBr(Target);
@@ -1258,7 +1772,7 @@ bool OiIREmitter::HandleLocalCall(uint64_t Addr, uint32_t Count, Value *&V,
   std::string Name = Twine("a").concat(Twine::utohexstr(Addr)).str();
   StringRef NameRef(Name);
   HandleFunctionExitPoint(Count, First);
-  FunctionType *ft = FunctionType::get(Type::getVoidTy(getGlobalContext()),
+  FunctionType *ft = FunctionType::get(Type::getVoidTy(Context),
                                        /*isvararg*/ false);
   Value *fun = TheModule->getOrInsertFunction(NameRef, ft);
   V = Builder.CreateCall(fun);
@@ -1277,16 +1791,16 @@ Value *OiIREmitter::HandleGetFunctionAddr(uint64_t Addr) {
     else
       Target = CreateBB(Addr);
     return ConstantExpr::getPointerCast(BlockAddress::get(Target),
-                                        Type::getInt32Ty(getGlobalContext()));
+                                        Type::getInt32Ty(Context));
   }
 
   std::string Name = Twine("a").concat(Twine::utohexstr(Addr)).str();
   StringRef NameRef(Name);
-  FunctionType *ft = FunctionType::get(Type::getVoidTy(getGlobalContext()),
+  FunctionType *ft = FunctionType::get(Type::getVoidTy(Context),
                                        /*isvararg*/ false);
   return ConstantExpr::getPointerCast(
       TheModule->getOrInsertFunction(NameRef, ft),
-      Type::getInt32Ty(getGlobalContext()));
+      Type::getInt32Ty(Context));
 }
 
 Value *OiIREmitter::AccessSpillMemory(unsigned Idx, bool IsLoad) {
@@ -1295,7 +1809,7 @@ Value *OiIREmitter::AccessSpillMemory(unsigned Idx, bool IsLoad) {
     Function *CurFun = Builder.GetInsertBlock()->getParent();
     IRBuilder<> Builder(&CurFun->getEntryBlock(),
                         CurFun->getEntryBlock().begin());
-    ptr = Builder.CreateAlloca(Type::getInt32Ty(getGlobalContext()), 0,
+    ptr = Builder.CreateAlloca(Type::getInt32Ty(Context), 0,
                                StringRef("frame") + Twine(Idx));
     SpilledRegs[Idx] = ptr;
   }
@@ -1309,20 +1823,20 @@ Value *OiIREmitter::AccessShadowMemory(Value *Idx, bool IsLoad, int width,
   Type *targetType = 0;
   switch (width) {
   case 8:
-    targetType = Type::getInt8PtrTy(getGlobalContext());
+    targetType = Type::getInt8PtrTy(Context);
     break;
   case 16:
-    targetType = Type::getInt16PtrTy(getGlobalContext());
+    targetType = Type::getInt16PtrTy(Context);
     break;
   case 32:
     if (isFloat) {
-      targetType = Type::getFloatPtrTy(getGlobalContext());
+      targetType = Type::getFloatPtrTy(Context);
     } else {
-      targetType = Type::getInt32PtrTy(getGlobalContext());
+      targetType = Type::getInt32PtrTy(Context);
     }
     break;
   case 64:
-    targetType = Type::getDoublePtrTy(getGlobalContext());
+    targetType = Type::getDoublePtrTy(Context);
     break;
   default:
     llvm_unreachable("Invalid memory access width");
@@ -1334,7 +1848,7 @@ Value *OiIREmitter::AccessShadowMemory(Value *Idx, bool IsLoad, int width,
       *First = GetFirstInstruction(*First, ptr);
   } else {
     SmallVector<Value *, 4> Idxs;
-    Idxs.push_back(ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0U));
+    Idxs.push_back(ConstantInt::get(Type::getInt32Ty(Context), 0U));
     Idxs.push_back(Idx);
     Value *gep = Builder.CreateGEP(ShadowImageValue, Idxs);
     ptr = Builder.CreateBitCast(gep, targetType);
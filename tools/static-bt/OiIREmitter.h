@@ -26,15 +26,19 @@
 namespace llvm {
 
 extern cl::opt<bool> NoLocals;
+extern cl::opt<bool> AbiLocals;
 extern cl::opt<bool> OneRegion;
 extern cl::opt<bool> OptimizeStack;
 extern cl::opt<bool> AggrOptimizeStack;
 extern cl::opt<bool> NoShadow;
+extern cl::opt<bool> CoSim;
 
 namespace object {
 class ObjectFile;
 }
 
+class OiProfileData;
+
 using namespace object;
 
 class OiIREmitter {
@@ -56,9 +60,11 @@ public:
     uint32_t JTCount;
   };
 
-  OiIREmitter(const ObjectFile *obj, uint64_t Stacksz, StringRef CodeTarget)
-      : Obj(obj), TheModule(new Module("outputtest", getGlobalContext())),
-        CodeTarget(CodeTarget), Builder(getGlobalContext()),
+  OiIREmitter(const ObjectFile *obj, uint64_t Stacksz, StringRef CodeTarget,
+              LLVMContext &Ctx)
+      : Obj(obj), Context(Ctx), Parent(nullptr),
+        TheModule(new Module("outputtest", Ctx)), CodeTarget(CodeTarget),
+        Builder(Ctx), ShadowImage(OwnShadowImage),
         Regs(SmallVector<Value *, 259>(259)),
         GlobalRegs(SmallVector<Value *, 259>(259)),
         DblRegs(SmallVector<Value *, 64>(64)),
@@ -69,24 +75,53 @@ public:
         CurFunAddr(0), MainFunAddr(0), CurBlockAddr(0), StackSize(Stacksz),
         IndirectDestinations(),
         IndirectDestinationsAddrs(), IndirectJumps(), IndirectCalls(),
-        CommonSymbols() {
+        CommonSymbols(), NumJumpsOK(0), NumJumpsWarning(0), Profile(nullptr),
+        HasRelocations(false) {
     BuildShadowImage();
     BuildRegisterFile();
-    if (CodeTarget == "arm") {
-      TheModule->setTargetTriple("armv4t--linux-eabi");
-      TheModule->setDataLayout(
-          "e-m:e-p:32:32-i64:64-v128:64:128-a:0:32-n32-S64");
-    } else { // i386 data layout
-      TheModule->setTargetTriple("i386-unknown-linux-gnu");
-      TheModule->setDataLayout(
-          "e-m:e-p:32:32-f64:32:64-f80:32-n8:16:32-S128");
-    }
+    SetTargetLayout();
+  }
+
+  // Builds a module holding a single function of the program translated by
+  // P, in its own context. The shadow image, register file and the rest of
+  // the program are declared only; they are defined by P's module, which
+  // this one is linked into. Funcs lists the start of every function.
+  OiIREmitter(const OiIREmitter &P, LLVMContext &Ctx, ArrayRef<uint64_t> Funcs)
+      : Obj(P.Obj), Context(Ctx), Parent(&P),
+        TheModule(new Module("outputtest", Ctx)), CodeTarget(P.CodeTarget),
+        Builder(Ctx), ShadowImage(P.ShadowImage),
+        Regs(SmallVector<Value *, 259>(259)),
+        GlobalRegs(SmallVector<Value *, 259>(259)),
+        DblRegs(SmallVector<Value *, 64>(64)),
+        DblGlobalRegs(SmallVector<Value *, 64>(64)), SpilledRegs(),
+        FirstFunction(true), EntryPointBB(nullptr), CurAddr(0),
+        CurSection(nullptr), BBMap(), InsMap(), ReadMap(), WriteMap(),
+        DblReadMap(), DblWriteMap(), FunctionCallMap(), FunctionRetMap(),
+        CurFunAddr(0), MainFunAddr(0), CurBlockAddr(0),
+        StackSize(P.StackSize), ShadowSize(P.ShadowSize),
+        IndirectDestinations(), IndirectDestinationsAddrs(), IndirectJumps(),
+        IndirectCalls(), CommonSymbols(),
+        FunctionAddrs(Funcs.begin(), Funcs.end()), NumJumpsOK(0),
+        NumJumpsWarning(0), Profile(P.Profile), HasRelocations(false) {
+    ShadowImageValue = new GlobalVariable(
+        *TheModule, ArrayType::get(Type::getInt8Ty(Ctx), ShadowSize), false,
+        GlobalValue::ExternalLinkage, nullptr, "ShadowMemory");
+    for (const auto &Sym : P.CommonSymbols)
+      CommonSymbols[Sym.getKey()] = Sym.getValue();
+    BuildRegisterFile();
+    SetTargetLayout();
   }
+
   const ObjectFile *Obj;
+  LLVMContext &Context;
+  // The translator whose module this one is linked into, if any
+  const OiIREmitter *Parent;
   std::unique_ptr<Module> TheModule;
   StringRef CodeTarget;
   IRBuilder<> Builder;
-  std::vector<uint8_t> ShadowImage;
+  std::vector<uint8_t> OwnShadowImage;
+  // OwnShadowImage, or the parent's image for a single-function module
+  const std::vector<uint8_t> &ShadowImage;
   SmallVector<Value *, 259> Regs, GlobalRegs;
   SmallVector<Value *, 64> DblRegs, DblGlobalRegs;
   SpilledRegsTy SpilledRegs;
@@ -111,11 +146,23 @@ public:
   std::vector<std::pair<Instruction *, uint64_t>> IndirectCalls;
   std::vector<Value *> IndirectCallsIndexes;
   llvm::StringMap<uint64_t> CommonSymbols;
+  std::vector<std::string> CoSimNames;
 
   std::vector<uint64_t> FunctionAddrs;
   std::set<uint64_t> IndFunctionAddrs;
   std::vector<BasicBlock *> FunctionBBs;
 
+  // Code pointers found in data relocations, as (patched address, target)
+  std::vector<std::pair<uint64_t, uint64_t>> CodePtrRelocs;
+  std::unordered_set<uint64_t> CodePtrs;
+  uint32_t NumJumpsOK, NumJumpsWarning;
+  // Shadow image words read while resolving jump tables, as (address, value)
+  std::vector<std::pair<uint32_t, uint32_t>> ImageReads;
+  // Execution counts from oii, with -profile-use
+  const OiProfileData *Profile;
+  // Whether the program has relocations, set by CollectCodePointers()
+  bool HasRelocations;
+
   void AddIndirectJump(Instruction *Ins, Value *Idx, uint64_t JT = 0,
                        uint32_t Count = 0) {
     IndirectJumps.emplace_back(IndirectJumpEntry(Ins, CurAddr, Idx, JT, Count));
@@ -130,9 +177,33 @@ public:
                           std::vector<BasicBlock *> &JumpTargets,
                           uint32_t Count);
   bool ProcessIndirectJumps();
+  void AddBranchWeights(Instruction *Br, uint64_t FallThrough);
+  std::vector<uint64_t> GetPromotedTargets(uint64_t Addr, uint64_t &Total,
+                                           std::vector<uint64_t> &Counts);
+  void EmitTargetGuards(Instruction *Ins, Value *Target,
+                        ArrayRef<std::pair<Constant *, BasicBlock *>> Cases,
+                        ArrayRef<uint64_t> Counts, uint64_t Total);
+  void PromoteIndirectCall(Instruction *Ins, uint64_t Addr, Value *Target);
+  void PromoteIndirectJump(Instruction *Ins, uint64_t Addr, Value *Target,
+                           uint64_t FuncAddr);
+  bool HasGuestCodePtrs() const;
+  void DispatchIndirectCall(Instruction *Ins, uint64_t Addr, Value *Target);
+  void SplitGuestJumpTargets(uint64_t Addr, Value *Target, uint64_t FuncAddr);
+  void DispatchIndirectJump(Instruction *Ins, uint64_t Addr, Value *Target);
+  void BuildDispatchTable();
+  bool CollectCodePointers();
+  bool ResolveIndirectJumps();
+  void PrintIndirectJumpStats(uint32_t NumOK, uint32_t NumWarning,
+                              uint32_t NumCalls);
+  void MergePatchSections();
   void BuildShadowImage();
   void UpdateShadowImage();
   void BuildRegisterFile();
+  std::vector<GlobalVariable *> GetRegisterGlobals() const;
+  void GetAbiRegisterGlobals(std::vector<GlobalVariable *> &Args,
+                             std::vector<GlobalVariable *> &Rets) const;
+  GlobalVariable *GetStackPointerGlobal() const;
+  GlobalVariable *GetShadowMemory() const;
   void BuildLocalRegisterFile();
   bool HandleBackEdge(uint64_t Addr, BasicBlock *&Target);
   bool HandleIndirectCallOneRegion(uint64_t Addr, Value *src,
@@ -156,6 +227,12 @@ public:
   void HandleFunctionEntryPoint(Value **First = 0);
   void HandleFunctionExitPoint(uint32_t Count, Value **First = 0);
   void FixEntryBB();
+  unsigned AddCoSimName(StringRef Name) {
+    CoSimNames.push_back(Name);
+    return CoSimNames.size() - 1;
+  }
+  void InsertCoSimHook(unsigned Index);
+  void BuildCoSimTable();
   void FixBBTerminators();
   void FixEntryPoint();
   void UpdateCurAddr(uint64_t val) {
@@ -166,6 +243,8 @@ public:
 
 private:
   bool FindSectionOffset(StringRef Name, uint64_t &SectionAddr);
+  bool OwnsCodeAddr(uint64_t Addr) const;
+  void SetTargetLayout();
 };
 }
 
@@ -53,11 +53,22 @@ void OiInstTranslate::FinishFunction() {
 }
 
 void OiInstTranslate::FinishModule() {
+  // A single-function module only resolves its own indirect jumps; the rest
+  // is done once its parent has linked all of them.
+  if (IREmitter.Parent) {
+    if (!IREmitter.ResolveIndirectJumps())
+      llvm_unreachable("ResolveIndirectJumps failed.");
+    return;
+  }
   if (!IREmitter.ProcessIndirectJumps())
     llvm_unreachable("ProcessIndirectJumps failed.");
   // Update shadow image initializer in case ProcessIndirectJumps changed
   // memory
   IREmitter.UpdateShadowImage();
+  if (!OneRegion && IREmitter.HasGuestCodePtrs())
+    IREmitter.BuildDispatchTable();
+  if (CoSim && !OneRegion)
+    IREmitter.BuildCoSimTable();
   if (DebugIR && !OneRegion)
     IREmitter.Builder.GetInsertBlock()->getParent()->getParent()->dump();
 
@@ -71,6 +82,33 @@ void OiInstTranslate::FinishModule() {
   }
 }
 
+// Prepares a translator whose functions are built by single-function
+// translators: the code pointers they resolve are collected here first.
+void OiInstTranslate::CollectCodePointers() {
+  if (!IREmitter.CollectCodePointers())
+    llvm_unreachable("CollectCodePointers failed.");
+}
+
+// Completes a module that single-function modules were linked into, given
+// the indirect jump statistics added up over them.
+void OiInstTranslate::FinishLinkedModule(uint32_t NumJumpsOK,
+                                         uint32_t NumJumpsWarning,
+                                         uint32_t NumIndirectCalls) {
+  if (NumJumpsWarning != 0)
+    printf("WARNING: Failed to retrieve jump table base address for "
+           "indirect jump. Assuming all targets in function.\n");
+  IREmitter.PrintIndirectJumpStats(NumJumpsOK, NumJumpsWarning,
+                                   NumIndirectCalls);
+  IREmitter.MergePatchSections();
+  IREmitter.UpdateShadowImage();
+  if (IREmitter.HasGuestCodePtrs())
+    IREmitter.BuildDispatchTable();
+  if (CoSim)
+    IREmitter.BuildCoSimTable();
+  if (DebugIR)
+    IREmitter.TheModule->dump();
+}
+
 Module *OiInstTranslate::takeModule() { return IREmitter.TheModule.release(); }
 
 bool OiInstTranslate::HandleAluSrcOperand(const MCOperand &o, Value *&V,
@@ -78,7 +116,7 @@ bool OiInstTranslate::HandleAluSrcOperand(const MCOperand &o, Value *&V,
   if (o.isReg()) {
     unsigned reg = ConvToDirective(conv32(o.getReg()));
     if (reg == 0) {
-      V = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0);
+      V = ConstantInt::get(Type::getInt32Ty(Context), 0);
       return true;
     }
     V = Builder.CreateLoad(IREmitter.Regs[reg]);
@@ -135,10 +173,10 @@ bool OiInstTranslate::HandleAluSrcOperand(const MCOperand &o, Value *&V,
         V = Builder.getInt32(0);
       return true;
     }
-    V = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), myimm);
+    V = ConstantInt::get(Type::getInt32Ty(Context), myimm);
     return true;
   } else if (o.isFPImm()) {
-    V = ConstantFP::get(getGlobalContext(), APFloat(o.getFPImm()));
+    V = ConstantFP::get(Context, APFloat(o.getFPImm()));
     return true;
   }
   llvm_unreachable("Invalid Src operand");
@@ -163,7 +201,7 @@ bool OiInstTranslate::HandleFloatSrcOperand(const MCOperand &o, Value *&V,
     unsigned reg = ConvToDirective(conv32(o.getReg()));
     Value *v = Builder.CreateLoad(IREmitter.Regs[reg]);
     // Assume little endian for doubles
-    V = Builder.CreateBitCast(v, Type::getFloatTy(getGlobalContext()));
+    V = Builder.CreateBitCast(v, Type::getFloatTy(Context));
     if (First != 0)
       *First = GetFirstInstruction(*First, V);
     ReadMap[reg] = true;
@@ -209,13 +247,13 @@ bool OiInstTranslate::HandleDoubleMemOperand(const MCOperand &o,
         Value *V1 = 0, *fixedV0 = 0;
         if (NoShadow) {
           Value *shadow = Builder.CreatePtrToInt(
-              IREmitter.ShadowImageValue, Type::getInt32Ty(getGlobalContext()));
+              IREmitter.ShadowImageValue, Type::getInt32Ty(Context));
           fixedV0 = Builder.CreateAdd(V0, shadow);
           V1 = fixedV0;
         } else if (UndefinedSymbol) {
           V1 = Builder.CreateSub(
               V0, Builder.CreatePtrToInt(IREmitter.ShadowImageValue,
-                                         Type::getInt32Ty(getGlobalContext())));
+                                         Type::getInt32Ty(Context)));
         } else {
           V1 = V0;
         }
@@ -223,7 +261,7 @@ bool OiInstTranslate::HandleDoubleMemOperand(const MCOperand &o,
         // Assume little endian doubles
         unsigned reg = ConvToDirective(conv32(o.getReg()));
         if (reg == 0) {
-          base = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0);
+          base = ConstantInt::get(Type::getInt32Ty(Context), 0);
         } else {
           base = Builder.CreateLoad(IREmitter.Regs[reg]);
           ReadMap[reg] = true;
@@ -236,11 +274,11 @@ bool OiInstTranslate::HandleDoubleMemOperand(const MCOperand &o,
         llvm_unreachable("Don't know how to handle this relocation");
       }
     } else {
-      idx = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), myimm);
+      idx = ConstantInt::get(Type::getInt32Ty(Context), myimm);
       // Assume little endian doubles
       unsigned reg = ConvToDirective(conv32(o.getReg()));
       if (reg == 0) {
-        base = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0);
+        base = ConstantInt::get(Type::getInt32Ty(Context), 0);
       } else {
         base = Builder.CreateLoad(IREmitter.Regs[reg]);
         ReadMap[reg] = true;
@@ -256,13 +294,13 @@ bool OiInstTranslate::HandleDoubleMemOperand(const MCOperand &o,
     unsigned reg = ConvToDirective(conv32(o.getReg()));
     unsigned reg2 = ConvToDirective(conv32(o2.getReg()));
     if (reg == 0) {
-      base = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0);
+      base = ConstantInt::get(Type::getInt32Ty(Context), 0);
     } else {
       base = Builder.CreateLoad(IREmitter.Regs[reg]);
       ReadMap[reg] = true;
     }
     if (reg2 == 0) {
-      idx = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0);
+      idx = ConstantInt::get(Type::getInt32Ty(Context), 0);
     } else {
       idx = Builder.CreateLoad(IREmitter.Regs[reg2]);
       ReadMap[reg2] = true;
@@ -293,13 +331,13 @@ bool OiInstTranslate::HandleFloatMemOperand(const MCOperand &o,
         Value *V1 = 0, *fixedV0 = 0;
         if (NoShadow) {
           Value *shadow = Builder.CreatePtrToInt(
-              IREmitter.ShadowImageValue, Type::getInt32Ty(getGlobalContext()));
+              IREmitter.ShadowImageValue, Type::getInt32Ty(Context));
           fixedV0 = Builder.CreateAdd(V0, shadow);
           V1 = fixedV0;
         } else if (UndefinedSymbol) {
           V1 = Builder.CreateSub(
               V0, Builder.CreatePtrToInt(IREmitter.ShadowImageValue,
-                                         Type::getInt32Ty(getGlobalContext())));
+                                         Type::getInt32Ty(Context)));
         } else {
           V1 = V0;
         }
@@ -307,7 +345,7 @@ bool OiInstTranslate::HandleFloatMemOperand(const MCOperand &o,
         // Assume little endian doubles
         unsigned reg = ConvToDirective(conv32(o.getReg()));
         if (reg == 0) {
-          base = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0);
+          base = ConstantInt::get(Type::getInt32Ty(Context), 0);
         } else {
           base = Builder.CreateLoad(IREmitter.Regs[reg]);
           ReadMap[reg] = true;
@@ -320,10 +358,10 @@ bool OiInstTranslate::HandleFloatMemOperand(const MCOperand &o,
         llvm_unreachable("Don't know how to handle this relocation");
       }
     } else {
-      idx = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), myimm);
+      idx = ConstantInt::get(Type::getInt32Ty(Context), myimm);
       unsigned reg = ConvToDirective(conv32(o.getReg()));
       if (reg == 0) {
-        base = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0);
+        base = ConstantInt::get(Type::getInt32Ty(Context), 0);
       } else {
         base = Builder.CreateLoad(IREmitter.Regs[reg]);
         ReadMap[reg] = true;
@@ -339,13 +377,13 @@ bool OiInstTranslate::HandleFloatMemOperand(const MCOperand &o,
     unsigned reg = ConvToDirective(conv32(o.getReg()));
     unsigned reg2 = ConvToDirective(conv32(o2.getReg()));
     if (reg == 0) {
-      base = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0);
+      base = ConstantInt::get(Type::getInt32Ty(Context), 0);
     } else {
       base = Builder.CreateLoad(IREmitter.Regs[reg]);
       ReadMap[reg] = true;
     }
     if (reg2 == 0) {
-      idx = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0);
+      idx = ConstantInt::get(Type::getInt32Ty(Context), 0);
     } else {
       idx = Builder.CreateLoad(IREmitter.Regs[reg2]);
       ReadMap[reg2] = true;
@@ -361,12 +399,12 @@ bool OiInstTranslate::HandleFloatMemOperand(const MCOperand &o,
 }
 
 bool OiInstTranslate::HandleSaveDouble(Value *In, Value *&Low, Value *&High) {
-  Value *v1 = Builder.CreateBitCast(In, Type::getInt64Ty(getGlobalContext()));
+  Value *v1 = Builder.CreateBitCast(In, Type::getInt64Ty(Context));
   Value *v2 = Builder.CreateLShr(
-      v1, ConstantInt::get(Type::getInt64Ty(getGlobalContext()), 32));
+      v1, ConstantInt::get(Type::getInt64Ty(Context), 32));
   // Assume little endian for doubles
-  High = Builder.CreateSExtOrTrunc(v2, Type::getInt32Ty(getGlobalContext()));
-  Low = Builder.CreateSExtOrTrunc(v1, Type::getInt32Ty(getGlobalContext()));
+  High = Builder.CreateSExtOrTrunc(v2, Type::getInt32Ty(Context));
+  Low = Builder.CreateSExtOrTrunc(v1, Type::getInt32Ty(Context));
   return true;
 }
 
@@ -378,36 +416,36 @@ bool OiInstTranslate::HandleSaveFloat(Value *In, Value *&V) {
 bool OiInstTranslate::HandleMemExpr(const MCExpr &exp, Value *&V, bool IsLoad) {
   if (const MCConstantExpr *ce = dyn_cast<const MCConstantExpr>(&exp)) {
     Value *idx =
-        ConstantInt::get(Type::getInt32Ty(getGlobalContext()), ce->getValue());
+        ConstantInt::get(Type::getInt32Ty(Context), ce->getValue());
     V = IREmitter.AccessShadowMemory(idx, IsLoad);
     return true;
   } else if (const MCSymbolRefExpr *se =
                  dyn_cast<const MCSymbolRefExpr>(&exp)) {
     V = IREmitter.TheModule->getOrInsertGlobal(
-        se->getSymbol().getName(), Type::getInt32Ty(getGlobalContext()));
+        se->getSymbol().getName(), Type::getInt32Ty(Context));
     if (se->getKind() == MCSymbolRefExpr::VK_Mips_ABS_HI) {
       Value *V0 = Builder.CreateCast(Instruction::PtrToInt, V,
-                                     Type::getInt32Ty(getGlobalContext()));
+                                     Type::getInt32Ty(Context));
       Value *V1 = Builder.CreateLShr(
-          V0, ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 16));
+          V0, ConstantInt::get(Type::getInt32Ty(Context), 16));
       Value *V2 = Builder.CreateShl(
-          V1, ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 16));
+          V1, ConstantInt::get(Type::getInt32Ty(Context), 16));
       V = V2;
     } else if (se->getKind() == MCSymbolRefExpr::VK_Mips_ABS_LO) {
       Value *V0 = Builder.CreateCast(Instruction::PtrToInt, V,
-                                     Type::getInt32Ty(getGlobalContext()));
+                                     Type::getInt32Ty(Context));
       Value *V1 = Builder.CreateAnd(
-          V0, ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0xFFFF));
+          V0, ConstantInt::get(Type::getInt32Ty(Context), 0xFFFF));
       V = V1;
     } else if (se->getKind() != MCSymbolRefExpr::VK_None) {
       llvm_unreachable("Unhandled SymbolRef Kind");
     }
     return true;
     //    GlobalVariable(IREmitter.TheModule,
-    //               Type::getInt32Ty(getGlobalContext()),
+    //               Type::getInt32Ty(Context),
     //               false,
     //              GlobalValue::LinkageTypes::ExternalLinkage,
-    //              Constant::getNullValue(Type::getInt32Ty(getGlobalContext())),
+    //              Constant::getNullValue(Type::getInt32Ty(Context)),
     //             se->getSymbol().getName(),
     //             0, GlobalVariable::NotThreadLocal, 0, true);
   }
@@ -433,13 +471,13 @@ bool OiInstTranslate::HandleMemOperand(const MCOperand &o, const MCOperand &o2,
         Value *V1 = 0;
         if (NoShadow) {
           Value *shadow = Builder.CreatePtrToInt(
-              IREmitter.ShadowImageValue, Type::getInt32Ty(getGlobalContext()));
+              IREmitter.ShadowImageValue, Type::getInt32Ty(Context));
           Value *fixedV0 = Builder.CreateAdd(V0, shadow);
           V0 = fixedV0;
         } else if (UndefinedSymbol) {
           V0 = Builder.CreateSub(
               V0, Builder.CreatePtrToInt(IREmitter.ShadowImageValue,
-                                         Type::getInt32Ty(getGlobalContext())));
+                                         Type::getInt32Ty(Context)));
         }
         V1 = V0;
         if (First != 0)
@@ -448,7 +486,7 @@ bool OiInstTranslate::HandleMemOperand(const MCOperand &o, const MCOperand &o2,
         unsigned reg = ConvToDirective(conv32(o.getReg()));
         Value *base;
         if (reg == 0) {
-          base = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0);
+          base = ConstantInt::get(Type::getInt32Ty(Context), 0);
         } else {
           base = Builder.CreateLoad(IREmitter.Regs[reg]);
           ReadMap[reg] = true;
@@ -464,11 +502,11 @@ bool OiInstTranslate::HandleMemOperand(const MCOperand &o, const MCOperand &o2,
         llvm_unreachable("Don't know how to handle this relocation");
       }
     } else {
-      idx = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), myimm);
+      idx = ConstantInt::get(Type::getInt32Ty(Context), myimm);
       unsigned reg = ConvToDirective(conv32(o.getReg()));
       Value *base;
       if (reg == 0) {
-        base = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0);
+        base = ConstantInt::get(Type::getInt32Ty(Context), 0);
       } else {
         base = Builder.CreateLoad(IREmitter.Regs[reg]);
         ReadMap[reg] = true;
@@ -523,10 +561,10 @@ bool OiInstTranslate::HandleGetSpilledAddress(const MCOperand &o,
     imm += 100000;
   Value *ptr = IREmitter.AccessSpillMemory(imm, false);
   Value *castptr =
-      Builder.CreatePtrToInt(ptr, Type::getInt32Ty(getGlobalContext()));
+      Builder.CreatePtrToInt(ptr, Type::getInt32Ty(Context));
   if (!NoShadow) {
     Value *shadow = Builder.CreatePtrToInt(
-        IREmitter.ShadowImageValue, Type::getInt32Ty(getGlobalContext()));
+        IREmitter.ShadowImageValue, Type::getInt32Ty(Context));
     Value *fixed = Builder.CreateSub(castptr, shadow);
     V = Builder.CreateStore(fixed, IREmitter.Regs[dstReg]);
   } else {
@@ -1557,7 +1595,7 @@ bool OiInstTranslate::HandleFCmpOperand(const MCOperand &o, Value *o0,
     Value *cmp = 0;
     switch (cond) {
     case 0: // OI_FCOND_F  false
-      cmp = ConstantInt::get(Type::getInt1Ty(getGlobalContext()), 0);
+      cmp = ConstantInt::get(Type::getInt1Ty(Context), 0);
       break;
     case 1: // OI_FCOND_UN unordered - true if either nans
       cmp = Builder.CreateFCmpUNO(o0, o1);
@@ -1583,7 +1621,7 @@ bool OiInstTranslate::HandleFCmpOperand(const MCOperand &o, Value *o0,
     case 8: // OI_FCOND_SF
       // Exception not implemented
       llvm_unreachable("Unimplemented FCmp Operand");
-      cmp = ConstantInt::get(Type::getInt1Ty(getGlobalContext()), 0);
+      cmp = ConstantInt::get(Type::getInt1Ty(Context), 0);
       break;
     case 9: // OI_FCOND_NGLE - compare not greater or less than equal double
             // (w/ except.)
@@ -1650,13 +1688,6 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
 #else
   raw_ostream &DebugOut = nulls();
 #endif
-  struct LastLDIData {
-    Value *DstOperand = nullptr;
-    Constant *SrcOperand = nullptr;
-    uint64_t Addr = 0;
-  };
-  static LastLDIData LDIData;
-
   switch (MI->getOpcode()) {
   case Mips::ADDiu:
   case Mips::ADDu: {
@@ -1699,12 +1730,12 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
     if (HandleAluSrcOperand(MI->getOperand(1), o1, &first) &&
         HandleAluDstOperand(MI->getOperand(0), o0)) {
       std::vector<Type *> types;
-      types.push_back(Type::getInt32Ty(getGlobalContext()));
+      types.push_back(Type::getInt32Ty(Context));
       Value *CtlzFunc = Intrinsic::getDeclaration(IREmitter.TheModule.get(),
                                                   Intrinsic::ctlz, types);
       std::vector<Value *> args;
       args.push_back(o1);
-      args.push_back(ConstantInt::get(Type::getInt1Ty(getGlobalContext()), 0));
+      args.push_back(ConstantInt::get(Type::getInt1Ty(Context), 0));
       Value *V = Builder.CreateCall(CtlzFunc, args);
       Builder.CreateStore(V, o0);
       assert(isa<Instruction>(first) && "Need to rework map logic");
@@ -1728,19 +1759,19 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
         HandleAluDstOperand(MI->getOperand(1), dst2)) {
       Value *o0e, *o1e;
       if (MI->getOpcode() == Mips::MUL_OI) {
-        o0e = Builder.CreateSExt(o0, Type::getInt64Ty(getGlobalContext()));
-        o1e = Builder.CreateSExt(o1, Type::getInt64Ty(getGlobalContext()));
+        o0e = Builder.CreateSExt(o0, Type::getInt64Ty(Context));
+        o1e = Builder.CreateSExt(o1, Type::getInt64Ty(Context));
       } else { // MULU
-        o0e = Builder.CreateZExt(o0, Type::getInt64Ty(getGlobalContext()));
-        o1e = Builder.CreateZExt(o1, Type::getInt64Ty(getGlobalContext()));
+        o0e = Builder.CreateZExt(o0, Type::getInt64Ty(Context));
+        o1e = Builder.CreateZExt(o1, Type::getInt64Ty(Context));
       }
       Value *v = Builder.CreateMul(o0e, o1e);
       Value *V1 = Builder.CreateLShr(
-          v, ConstantInt::get(Type::getInt64Ty(getGlobalContext()), 32));
+          v, ConstantInt::get(Type::getInt64Ty(Context), 32));
       Value *V2 =
-          Builder.CreateSExtOrTrunc(V1, Type::getInt32Ty(getGlobalContext()));
+          Builder.CreateSExtOrTrunc(V1, Type::getInt32Ty(Context));
       Value *V3 =
-          Builder.CreateSExtOrTrunc(v, Type::getInt32Ty(getGlobalContext()));
+          Builder.CreateSExtOrTrunc(v, Type::getInt32Ty(Context));
       if (dst2)
         Builder.CreateStore(V3, dst2);
       if (dst1)
@@ -1886,8 +1917,8 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
       }
       if (failed)
         break;
-      Value *one = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 1U);
-      Value *zero = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0U);
+      Value *one = ConstantInt::get(Type::getInt32Ty(Context), 1U);
+      Value *zero = ConstantInt::get(Type::getInt32Ty(Context), 0U);
       Value *select = Builder.CreateSelect(cmp, one, zero);
       WriteMap[258] = true; // Ignores other FCC fields
       Builder.CreateStore(select, IREmitter.Regs[258]);
@@ -1937,9 +1968,9 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
       }
       if (failed)
         break;
-      Value *one = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 1U);
+      Value *one = ConstantInt::get(Type::getInt32Ty(Context), 1U);
       Value *zero =
-        ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0U);
+        ConstantInt::get(Type::getInt32Ty(Context), 0U);
       Value *select = Builder.CreateSelect(cmp, one, zero);
       WriteMap[258] = true; // Ignores other FCC fields
       Builder.CreateStore(select, IREmitter.Regs[258]);
@@ -1956,7 +1987,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
         HandleAluSrcOperand(MI->getOperand(2), o2,
                             &first) && // fcc0 encoded as reg1 TODO:fix
         HandleAluDstOperand(MI->getOperand(0), o0)) {
-      Value *zero = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0U);
+      Value *zero = ConstantInt::get(Type::getInt32Ty(Context), 0U);
       Value *cmp;
       Value *fcc = Builder.CreateLoad(IREmitter.Regs[258]);
       if (MI->getOpcode() == Mips::MOVT_I)
@@ -1980,7 +2011,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
         HandleAluSrcOperand(MI->getOperand(2), o2,
                             &first) && // fcc0 encoded as reg1 TODO:fix
         HandleDoubleDstOperand(MI->getOperand(0), o0)) {
-      Value *zero = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0U);
+      Value *zero = ConstantInt::get(Type::getInt32Ty(Context), 0U);
       Value *cmp;
       Value *fcc = Builder.CreateLoad(IREmitter.Regs[258]);
       if (MI->getOpcode() == Mips::MOVT_D32)
@@ -2004,7 +2035,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
         HandleAluSrcOperand(MI->getOperand(2), o2,
                             &first) && // fcc0 encoded as reg1 TODO:fix
         HandleFloatDstOperand(MI->getOperand(0), o0)) {
-      Value *zero = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0U);
+      Value *zero = ConstantInt::get(Type::getInt32Ty(Context), 0U);
       Value *cmp;
       Value *fcc = Builder.CreateLoad(IREmitter.Regs[258]);
       if (MI->getOpcode() == Mips::MOVT_S)
@@ -2159,7 +2190,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
     Value *o0, *o1, *first = 0;
     if (HandleDoubleSrcOperand(MI->getOperand(1), o1, &first) &&
         HandleDoubleDstOperand(MI->getOperand(0), o0)) {
-      std::vector<Type *> types(1, Type::getDoubleTy(getGlobalContext()));
+      std::vector<Type *> types(1, Type::getDoubleTy(Context));
       Value *SqrtFunc = Intrinsic::getDeclaration(IREmitter.TheModule.get(),
                                                   Intrinsic::sqrt, types);
       Value *V = Builder.CreateCall(SqrtFunc, o1);
@@ -2174,7 +2205,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
     Value *o0, *o1, *first = 0;
     if (HandleFloatSrcOperand(MI->getOperand(1), o1, &first) &&
         HandleFloatDstOperand(MI->getOperand(0), o0)) {
-      std::vector<Type *> types(1, Type::getFloatTy(getGlobalContext()));
+      std::vector<Type *> types(1, Type::getFloatTy(Context));
       Value *SqrtFunc = Intrinsic::getDeclaration(IREmitter.TheModule.get(),
                                                   Intrinsic::sqrt, types);
       Value *V = Builder.CreateCall(SqrtFunc, o1);
@@ -2213,7 +2244,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
     Value *o0, *o1, *first = 0;
     if (HandleDoubleSrcOperand(MI->getOperand(1), o1, &first) &&
         HandleDoubleDstOperand(MI->getOperand(0), o0)) {
-      std::vector<Type *> types(1, Type::getDoubleTy(getGlobalContext()));
+      std::vector<Type *> types(1, Type::getDoubleTy(Context));
       Value *FabsFunc = Intrinsic::getDeclaration(IREmitter.TheModule.get(),
                                                   Intrinsic::fabs, types);
       Value *V = Builder.CreateCall(FabsFunc, o1);
@@ -2228,7 +2259,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
     Value *o0, *o1, *first = 0;
     if (HandleFloatSrcOperand(MI->getOperand(1), o1, &first) &&
         HandleFloatDstOperand(MI->getOperand(0), o0)) {
-      std::vector<Type *> types(1, Type::getFloatTy(getGlobalContext()));
+      std::vector<Type *> types(1, Type::getFloatTy(Context));
       Value *FabsFunc = Intrinsic::getDeclaration(IREmitter.TheModule.get(),
                                                   Intrinsic::fabs, types);
       Value *V = Builder.CreateCall(FabsFunc, o1);
@@ -2244,9 +2275,9 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
     if (HandleFloatSrcOperand(MI->getOperand(1), o1) &&
         HandleDoubleDstOperand(MI->getOperand(0), o0)) {
       Value *v0 =
-          Builder.CreateBitCast(o1, Type::getInt32Ty(getGlobalContext()));
+          Builder.CreateBitCast(o1, Type::getInt32Ty(Context));
       Value *v1 =
-          Builder.CreateSIToFP(v0, Type::getDoubleTy(getGlobalContext()));
+          Builder.CreateSIToFP(v0, Type::getDoubleTy(Context));
       Builder.CreateStore(v1, o0);
       Value *first = GetFirstInstruction(o1, v0);
       assert(isa<Instruction>(first) && "Need to rework map logic");
@@ -2261,8 +2292,8 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
         HandleFloatDstOperand(MI->getOperand(0), o0)) {
       Value *V;
       Value *v1 = Builder.CreateSIToFP(
-          Builder.CreateBitCast(o1, Type::getInt32Ty(getGlobalContext())),
-          Type::getFloatTy(getGlobalContext()));
+          Builder.CreateBitCast(o1, Type::getInt32Ty(Context)),
+          Type::getFloatTy(Context));
       HandleSaveFloat(v1, V);
       Builder.CreateStore(V, o0);
       Value *first = GetFirstInstruction(first, o1, v1);
@@ -2277,7 +2308,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
     if (HandleFloatSrcOperand(MI->getOperand(1), o1, &first) &&
         HandleDoubleDstOperand(MI->getOperand(0), o0)) {
       Value *v1 =
-          Builder.CreateFPExt(o1, Type::getDoubleTy(getGlobalContext()));
+          Builder.CreateFPExt(o1, Type::getDoubleTy(Context));
       Builder.CreateStore(v1, o0);
       Value *first = GetFirstInstruction(o1, v1);
       assert(isa<Instruction>(first) && "Need to rework map logic");
@@ -2291,7 +2322,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
     if (HandleDoubleSrcOperand(MI->getOperand(1), o1, &first) &&
         HandleFloatDstOperand(MI->getOperand(0), o0)) {
       Value *v1 =
-          Builder.CreateFPTrunc(o1, Type::getFloatTy(getGlobalContext()));
+          Builder.CreateFPTrunc(o1, Type::getFloatTy(Context));
       HandleSaveFloat(v1, v);
       Builder.CreateStore(v, o0);
       assert(isa<Instruction>(first) && "Need to rework map logic");
@@ -2305,9 +2336,9 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
     if (HandleDoubleSrcOperand(MI->getOperand(1), o1, &first) &&
         HandleFloatDstOperand(MI->getOperand(0), o0)) {
       Value *v1 =
-          Builder.CreateFPToSI(o1, Type::getInt32Ty(getGlobalContext()));
+          Builder.CreateFPToSI(o1, Type::getInt32Ty(Context));
       Builder.CreateStore(
-          Builder.CreateBitCast(v1, Type::getFloatTy(getGlobalContext())),
+          Builder.CreateBitCast(v1, Type::getFloatTy(Context)),
           o0);
       first = GetFirstInstruction(first, o1, o0, v1);
       assert(isa<Instruction>(first) && "Need to rework map logic");
@@ -2322,9 +2353,9 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
         HandleFloatDstOperand(MI->getOperand(0), o0)) {
       Value *V;
       Value *v1 =
-          Builder.CreateFPToSI(o1, Type::getInt32Ty(getGlobalContext()));
+          Builder.CreateFPToSI(o1, Type::getInt32Ty(Context));
       Value *v3 =
-          Builder.CreateBitCast(v1, Type::getFloatTy(getGlobalContext()));
+          Builder.CreateBitCast(v1, Type::getFloatTy(Context));
       HandleSaveFloat(v3, V);
       Builder.CreateStore(V, o0);
       first = GetFirstInstruction(first, o1, v1);
@@ -2340,7 +2371,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
         HandleAluDstOperand(MI->getOperand(0), o0)) {
       Value *v = Builder.CreateStore(
           o1,
-          Builder.CreateBitCast(o0, Type::getFloatPtrTy(getGlobalContext())));
+          Builder.CreateBitCast(o0, Type::getFloatPtrTy(Context)));
       Value *first = GetFirstInstruction(o1, o0, v);
       assert(isa<Instruction>(first) && "Need to rework map logic");
       IREmitter.InsMap[IREmitter.CurAddr] = dyn_cast<Instruction>(first);
@@ -2373,7 +2404,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
         HandleFloatDstOperand(MI->getOperand(0), o0)) {
       Value *v = Builder.CreateStore(
           o1,
-          Builder.CreateBitCast(o0, Type::getInt32PtrTy(getGlobalContext())));
+          Builder.CreateBitCast(o0, Type::getInt32PtrTy(Context)));
       first = GetFirstInstruction(first, o1, o0, v);
       assert(isa<Instruction>(first) && "Need to rework map logic");
       IREmitter.InsMap[IREmitter.CurAddr] = dyn_cast<Instruction>(first);
@@ -2398,14 +2429,14 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
         lo = o1;
       }
       Value *v3 =
-          Builder.CreateZExtOrTrunc(hi, Type::getInt64Ty(getGlobalContext()));
+          Builder.CreateZExtOrTrunc(hi, Type::getInt64Ty(Context));
       Value *v4 =
-          Builder.CreateZExtOrTrunc(lo, Type::getInt64Ty(getGlobalContext()));
+          Builder.CreateZExtOrTrunc(lo, Type::getInt64Ty(Context));
       Value *v5 = Builder.CreateShl(
-          v3, ConstantInt::get(Type::getInt64Ty(getGlobalContext()), 32));
+          v3, ConstantInt::get(Type::getInt64Ty(Context), 32));
       Value *v6 = Builder.CreateOr(v5, v4);
       Value *dblSrc =
-          Builder.CreateBitCast(v6, Type::getDoubleTy(getGlobalContext()));
+          Builder.CreateBitCast(v6, Type::getDoubleTy(Context));
       Builder.CreateStore(dblSrc, o0);
       first = GetFirstInstruction(first, o1, previousVal);
       assert(isa<Instruction>(first) && "Need to rework map logic");
@@ -2422,15 +2453,18 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
       if (MI->getOpcode() == Mips::BC1T) {
         ReadMap[258] = true;
         cmp = Builder.CreateSExtOrTrunc(Builder.CreateLoad(IREmitter.Regs[258]),
-                                        Type::getInt1Ty(getGlobalContext()));
+                                        Type::getInt1Ty(Context));
       } else {
         ReadMap[258] = true;
         cmp = Builder.CreateICmpEQ(
             Builder.CreateLoad(IREmitter.Regs[258]),
-            ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0U));
+            ConstantInt::get(Type::getInt32Ty(Context), 0U));
       }
-      Builder.CreateCondBr(cmp, True, IREmitter.CreateBB(IREmitter.CurAddr +
-                                                         GetInstructionSize()));
+      Value *v = Builder.CreateCondBr(
+          cmp, True,
+          IREmitter.CreateBB(IREmitter.CurAddr + GetInstructionSize()));
+      IREmitter.AddBranchWeights(cast<Instruction>(v),
+                                 IREmitter.CurAddr + GetInstructionSize());
       assert(isa<Instruction>(cmp) && "Need to rework map logic");
       IREmitter.InsMap[IREmitter.CurAddr] = dyn_cast<Instruction>(cmp);
     }
@@ -2510,7 +2544,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
     if (HandleAluSrcOperand(MI->getOperand(1), o1, &first) &&
         HandleAluSrcOperand(MI->getOperand(2), o2, &first) &&
         HandleAluDstOperand(MI->getOperand(0), o0)) {
-      Value *zero = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0U);
+      Value *zero = ConstantInt::get(Type::getInt32Ty(Context), 0U);
       Value *cmp;
       if (MI->getOpcode() == Mips::MOVN_I_I) {
         cmp = Builder.CreateICmpNE(o2, zero);
@@ -2533,7 +2567,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
     if (HandleDoubleSrcOperand(MI->getOperand(1), o1, &first) &&
         HandleAluSrcOperand(MI->getOperand(2), o2) &&
         HandleDoubleDstOperand(MI->getOperand(0), o0)) {
-      Value *zero = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0U);
+      Value *zero = ConstantInt::get(Type::getInt32Ty(Context), 0U);
       Value *cmp;
       if (MI->getOpcode() == Mips::MOVN_I_D32) {
         cmp = Builder.CreateICmpNE(o2, zero);
@@ -2556,7 +2590,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
     if (HandleFloatSrcOperand(MI->getOperand(1), o1, &first) &&
         HandleAluSrcOperand(MI->getOperand(2), o2) &&
         HandleFloatDstOperand(MI->getOperand(0), o0)) {
-      Value *zero = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0U);
+      Value *zero = ConstantInt::get(Type::getInt32Ty(Context), 0U);
       Value *cmp;
       if (MI->getOpcode() == Mips::MOVN_I_D32) {
         cmp = Builder.CreateICmpNE(o2, zero);
@@ -2675,8 +2709,8 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
         HandleAluDstOperand(MI->getOperand(0), o0)) {
 
       Function *F = Builder.GetInsertBlock()->getParent();
-      BasicBlock *BB1 = BasicBlock::Create(getGlobalContext(), "", F);
-      BasicBlock *BB2 = BasicBlock::Create(getGlobalContext(), "", F);
+      BasicBlock *BB1 = BasicBlock::Create(Context, "", F);
+      BasicBlock *BB2 = BasicBlock::Create(Context, "", F);
       BasicBlock *FT =
           IREmitter.CreateBB(IREmitter.CurAddr + GetInstructionSize());
 
@@ -2687,8 +2721,8 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
         cmp = Builder.CreateICmpSLT(o1, o2);
       Builder.CreateCondBr(cmp, BB1, BB2);
 
-      Value *one = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 1U);
-      Value *zero = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0U);
+      Value *one = ConstantInt::get(Type::getInt32Ty(Context), 1U);
+      Value *zero = ConstantInt::get(Type::getInt32Ty(Context), 0U);
 
       Builder.SetInsertPoint(BB1);
       Builder.CreateStore(one, o0);
@@ -2725,25 +2759,27 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
         HandleBranchTarget(MI->getOperand(2), True);
         cmp = Builder.CreateICmpNE(o1, o2);
       } else if (MI->getOpcode() == Mips::BLTZ) {
-        o2 = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0U);
+        o2 = ConstantInt::get(Type::getInt32Ty(Context), 0U);
         HandleBranchTarget(MI->getOperand(1), True);
         cmp = Builder.CreateICmpSLT(o1, o2);
       } else if (MI->getOpcode() == Mips::BLEZ) {
-        o2 = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0U);
+        o2 = ConstantInt::get(Type::getInt32Ty(Context), 0U);
         HandleBranchTarget(MI->getOperand(1), True);
         cmp = Builder.CreateICmpSLE(o1, o2);
       } else if (MI->getOpcode() == Mips::BGEZ) {
-        o2 = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0U);
+        o2 = ConstantInt::get(Type::getInt32Ty(Context), 0U);
         HandleBranchTarget(MI->getOperand(1), True);
         cmp = Builder.CreateICmpSGE(o1, o2);
       } else { /*  Mips::BGTZ  */
-        o2 = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0U);
+        o2 = ConstantInt::get(Type::getInt32Ty(Context), 0U);
         HandleBranchTarget(MI->getOperand(1), True);
         cmp = Builder.CreateICmpSGT(o1, o2);
       }
       Value *v = Builder.CreateCondBr(
           cmp, True,
           IREmitter.CreateBB(IREmitter.CurAddr + GetInstructionSize()));
+      IREmitter.AddBranchWeights(cast<Instruction>(v),
+                                 IREmitter.CurAddr + GetInstructionSize());
       first = GetFirstInstruction(first, o1, o2, cmp, v);
       assert(isa<Instruction>(first) && "Need to rework map logic");
       IREmitter.InsMap[IREmitter.CurAddr] = dyn_cast<Instruction>(first);
@@ -2771,9 +2807,9 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
                          true, 16)) {
       Value *ext;
       if (MI->getOpcode() == Mips::LH)
-        ext = Builder.CreateSExt(src, Type::getInt32Ty(getGlobalContext()));
+        ext = Builder.CreateSExt(src, Type::getInt32Ty(Context));
       else
-        ext = Builder.CreateZExt(src, Type::getInt32Ty(getGlobalContext()));
+        ext = Builder.CreateZExt(src, Type::getInt32Ty(Context));
       Builder.CreateStore(ext, dst);
       assert(isa<Instruction>(first) && "Need to rework map logic");
       IREmitter.InsMap[IREmitter.CurAddr] = dyn_cast<Instruction>(first);
@@ -2788,9 +2824,9 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
                          true, 16, -1)) { // -1 offset
       Value *v = Builder.CreateIntToPtr(
           Builder.CreateAdd(
-              Builder.CreatePtrToInt(dst, Type::getInt32Ty(getGlobalContext())),
-              ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 2)),
-          Type::getInt16PtrTy(getGlobalContext()));
+              Builder.CreatePtrToInt(dst, Type::getInt32Ty(Context)),
+              ConstantInt::get(Type::getInt32Ty(Context), 2)),
+          Type::getInt16PtrTy(Context));
       Builder.CreateStore(src, v);
       assert(isa<Instruction>(first) && "Need to rework map logic");
       IREmitter.InsMap[IREmitter.CurAddr] = dyn_cast<Instruction>(first);
@@ -2803,7 +2839,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
     if (HandleAluDstOperand(MI->getOperand(0), dst) &&
         HandleMemOperand(MI->getOperand(1), MI->getOperand(2), src, &first,
                          true, 16)) {
-      Value *v = Builder.CreateBitCast(dst, Type::getInt16PtrTy(getGlobalContext()));
+      Value *v = Builder.CreateBitCast(dst, Type::getInt16PtrTy(Context));
       Builder.CreateStore(src, v);
       assert(isa<Instruction>(first) && "Need to rework map logic");
       IREmitter.InsMap[IREmitter.CurAddr] = dyn_cast<Instruction>(first);
@@ -2819,9 +2855,9 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
                          true, 8)) {
       Value *ext;
       if (MI->getOpcode() == Mips::LB)
-        ext = Builder.CreateSExt(src, Type::getInt32Ty(getGlobalContext()));
+        ext = Builder.CreateSExt(src, Type::getInt32Ty(Context));
       else
-        ext = Builder.CreateZExt(src, Type::getInt32Ty(getGlobalContext()));
+        ext = Builder.CreateZExt(src, Type::getInt32Ty(Context));
       Builder.CreateStore(ext, dst);
       assert(isa<Instruction>(first) && "Need to rework map logic");
       IREmitter.InsMap[IREmitter.CurAddr] = dyn_cast<Instruction>(first);
@@ -2847,7 +2883,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
     if (HandleAluSrcOperand(MI->getOperand(0), src, &first1) &&
         HandleMemOperand(MI->getOperand(1), MI->getOperand(2), dst, &first2,
                          false, 8)) {
-      Value *tr = Builder.CreateTrunc(src, Type::getInt8Ty(getGlobalContext()));
+      Value *tr = Builder.CreateTrunc(src, Type::getInt8Ty(Context));
       Builder.CreateStore(tr, dst);
       first = GetFirstInstruction(first1, src, tr, first2);
       assert(isa<Instruction>(first) && "Need to rework map logic");
@@ -2862,7 +2898,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
         HandleMemOperand(MI->getOperand(1), MI->getOperand(2), dst, &first2,
                          false, 16)) {
       Value *tr =
-          Builder.CreateTrunc(src, Type::getInt16Ty(getGlobalContext()));
+          Builder.CreateTrunc(src, Type::getInt16Ty(Context));
       Builder.CreateStore(tr, dst);
       first = GetFirstInstruction(first1, src, tr, first2);
       assert(isa<Instruction>(first) && "Need to rework map logic");
@@ -2878,8 +2914,8 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
                          false, 16, -1)) { // -1 offset
       Value *tr = Builder.CreateTrunc(
           Builder.CreateLShr(
-              src, ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 16)),
-          Type::getInt16Ty(getGlobalContext()));
+              src, ConstantInt::get(Type::getInt32Ty(Context), 16)),
+          Type::getInt16Ty(Context));
       Builder.CreateStore(tr, dst);
       first = GetFirstInstruction(first1, src, tr, first2);
       assert(isa<Instruction>(first) && "Need to rework map logic");
@@ -2893,7 +2929,7 @@ void OiInstTranslate::printInstruction(const MCInst *MI, raw_ostream &O) {
     if (HandleAluSrcOperand(MI->getOperand(0), src, &first1) &&
         HandleMemOperand(MI->getOperand(1), MI->getOperand(2), dst, &first2,
                          false, 16)) {
-      Value *tr = Builder.CreateTrunc(src, Type::getInt16Ty(getGlobalContext()));
+      Value *tr = Builder.CreateTrunc(src, Type::getInt16Ty(Context));
       Builder.CreateStore(tr, dst);
       first = GetFirstInstruction(first1, src, tr, first2);
       assert(isa<Instruction>(first) && "Need to rework map logic");
@@ -37,15 +37,31 @@ public:
                   const MCRegisterInfo &MRI, const ObjectFile *obj,
                   uint64_t Stacksz, StringRef CodeTarget)
       : MCInstPrinter(MAI, MII, MRI), Obj(obj),
-        IREmitter(obj, Stacksz, CodeTarget),
+        IREmitter(obj, Stacksz, CodeTarget, getGlobalContext()),
+        Context(IREmitter.Context),
         RelocReader(&*IREmitter.TheModule, obj, IREmitter.CurSection,
                     IREmitter.CurAddr, IREmitter.CommonSymbols),
         Syscalls(IREmitter, CodeTarget), Builder(IREmitter.Builder),
         ReadMap(IREmitter.ReadMap), WriteMap(IREmitter.WriteMap),
         CodeTarget(CodeTarget) {
-    RelocReader.ResolveAllDataRelocations(IREmitter.ShadowImage);
+    RelocReader.ResolveAllDataRelocations(IREmitter.OwnShadowImage);
   }
 
+  // Translator for a single function of the program translated by Parent,
+  // into a module of its own in Ctx. See the matching OiIREmitter
+  // constructor.
+  OiInstTranslate(const MCAsmInfo &MAI, const MCInstrInfo &MII,
+                  const MCRegisterInfo &MRI, const OiInstTranslate &Parent,
+                  LLVMContext &Ctx, ArrayRef<uint64_t> FunctionAddrs)
+      : MCInstPrinter(MAI, MII, MRI), Obj(Parent.Obj),
+        IREmitter(Parent.IREmitter, Ctx, FunctionAddrs),
+        Context(IREmitter.Context),
+        RelocReader(&*IREmitter.TheModule, Obj, IREmitter.CurSection,
+                    IREmitter.CurAddr, IREmitter.CommonSymbols),
+        Syscalls(IREmitter, Parent.CodeTarget), Builder(IREmitter.Builder),
+        ReadMap(IREmitter.ReadMap), WriteMap(IREmitter.WriteMap),
+        CodeTarget(Parent.CodeTarget) {}
+
   // Autogenerated by tblgen.
   void printInstruction(const MCInst *MI, raw_ostream &O);
   static const char *getRegisterName(unsigned RegNo);
@@ -56,21 +72,76 @@ public:
 
   bool printAliasInstr(const MCInst *MI, raw_ostream &OS);
   Module *takeModule();
+  Module *getModule() { return &*IREmitter.TheModule; }
   void StartFunction(StringRef N, uint64_t Addr);
   void StartMainFunction(uint64_t Addr);
   void FinishFunction();
   void FinishModule();
+  void CollectCodePointers();
+  void FinishLinkedModule(uint32_t NumJumpsOK, uint32_t NumJumpsWarning,
+                          uint32_t NumIndirectCalls);
+  void GetIndirectJumpStats(uint32_t &NumJumpsOK, uint32_t &NumJumpsWarning,
+                            uint32_t &NumIndirectCalls) const {
+    NumJumpsOK = IREmitter.NumJumpsOK;
+    NumJumpsWarning = IREmitter.NumJumpsWarning;
+    NumIndirectCalls = IREmitter.IndirectCalls.size();
+  }
+  const std::vector<std::pair<uint32_t, uint32_t>> &GetImageReads() const {
+    return IREmitter.ImageReads;
+  }
+  const std::vector<std::pair<uint64_t, uint64_t>> &GetCodePtrRelocs() const {
+    return IREmitter.CodePtrRelocs;
+  }
+  bool HasRelocations() const { return !IREmitter.HasGuestCodePtrs(); }
+  const std::vector<uint8_t> &GetShadowImage() const {
+    return IREmitter.ShadowImage;
+  }
+  uint64_t GetShadowSize() const { return IREmitter.ShadowSize; }
+  std::vector<GlobalVariable *> GetRegisterGlobals() const {
+    return IREmitter.GetRegisterGlobals();
+  }
+  void GetAbiRegisterGlobals(std::vector<GlobalVariable *> &Args,
+                             std::vector<GlobalVariable *> &Rets) const {
+    IREmitter.GetAbiRegisterGlobals(Args, Rets);
+  }
+  GlobalVariable *GetStackPointerGlobal() const {
+    return IREmitter.GetStackPointerGlobal();
+  }
+  GlobalVariable *GetShadowMemory() const {
+    return IREmitter.GetShadowMemory();
+  }
+  // Single-function translators made from this one share its profile
+  void SetProfile(const OiProfileData *P) { IREmitter.Profile = P; }
+  const OiProfileData *GetProfile() const { return IREmitter.Profile; }
+  void ListRelocations(
+      const SectionRef &Section,
+      std::vector<RelocationReader::ResolvedRelocation> &Relocs) {
+    RelocReader.ListRelocations(Section, Relocs);
+  }
+  unsigned AddCoSimName(StringRef Name) {
+    return IREmitter.AddCoSimName(Name);
+  }
+  void InsertCoSimHook(unsigned Index) { IREmitter.InsertCoSimHook(Index); }
   void UpdateCurAddr(uint64_t val) { IREmitter.UpdateCurAddr(val); }
   void SetCurSection(const SectionRef *i) { IREmitter.SetCurSection(i); }
 
 private:
+  // The last LDI seen, to be fused with the LDIHI that follows it
+  struct LastLDIData {
+    Value *DstOperand = nullptr;
+    Constant *SrcOperand = nullptr;
+    uint64_t Addr = 0;
+  };
+
   const ObjectFile *Obj;
   OiIREmitter IREmitter;
+  LLVMContext &Context;
   RelocationReader RelocReader;
   SyscallsIface Syscalls;
   IRBuilder<> &Builder;
   DenseMap<int32_t, bool> &ReadMap, &WriteMap;
   StringRef CodeTarget;
+  LastLDIData LDIData;
 
   bool HandleAluSrcOperand(const MCOperand &o, Value *&V, Value **First = 0);
   bool HandleAluDstOperand(const MCOperand &o, Value *&V);
@@ -0,0 +1,174 @@
+//===-- OiProfileData.cpp - Guest execution profile from oii --------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The profile is JSON, which the YAML parser reads as a flow document. Only
+// the function and edge counts are kept; the block, opcode and syscall
+// sections are skipped.
+//
+//===----------------------------------------------------------------------===//
+
+#include "OiProfileData.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/YAMLParser.h"
+#include <algorithm>
+
+using namespace llvm;
+
+static bool ReadInteger(yaml::Node *N, uint64_t &V) {
+  auto *S = dyn_cast_or_null<yaml::ScalarNode>(N);
+  SmallString<32> Storage;
+  return S && !S->getValue(Storage).getAsInteger(10, V);
+}
+
+static StringRef GetKey(yaml::KeyValueNode &KV,
+                        SmallVectorImpl<char> &Storage) {
+  auto *S = dyn_cast_or_null<yaml::ScalarNode>(KV.getKey());
+  return S ? S->getValue(Storage) : StringRef();
+}
+
+// Reads the array of objects N, passing the integer members named in Names
+// to Add, in that order. Missing members read as zero.
+template <typename AddFn>
+static bool ReadObjects(yaml::Node *N, ArrayRef<StringRef> Names, AddFn Add) {
+  auto *Seq = dyn_cast_or_null<yaml::SequenceNode>(N);
+  if (!Seq)
+    return false;
+  for (yaml::Node &Elem : *Seq) {
+    auto *Obj = dyn_cast<yaml::MappingNode>(&Elem);
+    if (!Obj)
+      return false;
+    SmallVector<uint64_t, 4> Vals(Names.size());
+    for (yaml::KeyValueNode &KV : *Obj) {
+      SmallString<16> Storage;
+      auto I = std::find(Names.begin(), Names.end(), GetKey(KV, Storage));
+      if (I != Names.end() &&
+          !ReadInteger(KV.getValue(), Vals[I - Names.begin()]))
+        return false;
+    }
+    Add(Vals);
+  }
+  return true;
+}
+
+static bool CompareEdges(const OiProfileData::Edge &A,
+                         const OiProfileData::Edge &B) {
+  return A.From < B.From || (A.From == B.From && A.To < B.To);
+}
+
+static bool CompareSource(const OiProfileData::Edge &E, uint64_t Addr) {
+  return E.From < Addr;
+}
+
+std::unique_ptr<OiProfileData> OiProfileData::read(StringRef Filename,
+                                                   std::string &Error) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Buf = MemoryBuffer::getFile(Filename);
+  if (!Buf) {
+    Error = Buf.getError().message();
+    return nullptr;
+  }
+
+  std::unique_ptr<OiProfileData> P(new OiProfileData());
+  SourceMgr SM;
+  yaml::Stream YS((*Buf)->getBuffer(), SM);
+  yaml::document_iterator DI = YS.begin();
+  auto *Root = DI == YS.end()
+                   ? nullptr
+                   : dyn_cast_or_null<yaml::MappingNode>(DI->getRoot());
+  bool OK = Root != nullptr;
+  if (OK) {
+    for (yaml::KeyValueNode &KV : *Root) {
+      SmallString<16> Storage;
+      StringRef Key = GetKey(KV, Storage);
+      if (Key == "binary") {
+        auto *S = dyn_cast_or_null<yaml::ScalarNode>(KV.getValue());
+        SmallString<64> Value;
+        OK = S != nullptr;
+        if (OK)
+          P->Binary = S->getValue(Value);
+      } else if (Key == "instructions") {
+        OK = ReadInteger(KV.getValue(), P->TotalInstructions);
+      } else if (Key == "functions") {
+        StringRef Names[] = {"address", "entries", "instructions"};
+        OK = ReadObjects(KV.getValue(), Names, [&](ArrayRef<uint64_t> V) {
+          FunctionCounts &C = P->Functions[V[0]];
+          C.Entries = V[1];
+          C.Instructions = V[2];
+          P->FirstFunction = std::min(P->FirstFunction, V[0]);
+          P->LastFunction = std::max(P->LastFunction, V[0]);
+        });
+      } else if (Key == "edges") {
+        StringRef Names[] = {"from", "to", "count"};
+        OK = ReadObjects(KV.getValue(), Names, [&](ArrayRef<uint64_t> V) {
+          Edge E = {V[0], V[1], V[2]};
+          P->Edges.push_back(E);
+        });
+      }
+      if (!OK)
+        break;
+    }
+  }
+  if (!OK || YS.failed()) {
+    Error = "not a profile written by oii -profile";
+    return nullptr;
+  }
+
+  std::sort(P->Edges.begin(), P->Edges.end(), CompareEdges);
+  return P;
+}
+
+ArrayRef<OiProfileData::Edge> OiProfileData::getEdgesIn(uint64_t Begin,
+                                                        uint64_t End) const {
+  auto B = std::lower_bound(Edges.begin(), Edges.end(), Begin, CompareSource);
+  auto E = std::lower_bound(B, Edges.end(), End, CompareSource);
+  return makeArrayRef(Edges).slice(B - Edges.begin(), E - B);
+}
+
+ArrayRef<OiProfileData::Edge>
+OiProfileData::getEdgesFrom(uint64_t Addr) const {
+  return getEdgesIn(Addr, Addr + 1);
+}
+
+bool OiProfileData::getBranchCounts(uint64_t Addr, uint64_t FallThrough,
+                                    uint64_t &Taken,
+                                    uint64_t &NotTaken) const {
+  Taken = NotTaken = 0;
+  for (const Edge &E : getEdgesFrom(Addr))
+    (E.To == FallThrough ? NotTaken : Taken) += E.Count;
+  return Taken + NotTaken > 0;
+}
+
+std::vector<OiProfileData::Edge>
+OiProfileData::getTargets(uint64_t Addr) const {
+  ArrayRef<Edge> From = getEdgesFrom(Addr);
+  std::vector<Edge> Res(From.begin(), From.end());
+  std::stable_sort(Res.begin(), Res.end(), [](const Edge &A, const Edge &B) {
+    return A.Count > B.Count;
+  });
+  return Res;
+}
+
+bool OiProfileData::hasFunctionsIn(uint64_t Begin, uint64_t End) const {
+  for (const auto &F : Functions)
+    if (F.first >= Begin && F.first < End)
+      return true;
+  return false;
+}
+
+uint64_t OiProfileData::getEntries(uint64_t Addr) const {
+  auto I = Functions.find(Addr);
+  return I == Functions.end() ? 0 : I->second.Entries;
+}
+
+uint64_t OiProfileData::getInstructions(uint64_t Addr) const {
+  auto I = Functions.find(Addr);
+  return I == Functions.end() ? 0 : I->second.Instructions;
+}
@@ -0,0 +1,75 @@
+//=== OiProfileData.h - Guest execution profile from oii -------*- C++ -*-==//
+//
+// Reads the JSON profile that oii writes with -profile: how many times each
+// guest function ran and executed instructions, and how many times each
+// branch, jump or call went to each target. Not taken branches count as an
+// edge to the next instruction. Addresses are the ones in the ELF file.
+//
+//===------------------------------------------------------------===//
+
+#ifndef OIPROFILEDATA_H
+#define OIPROFILEDATA_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+class OiProfileData {
+public:
+  struct Edge {
+    uint64_t From, To, Count;
+  };
+
+  // Returns null and sets Error if Filename cannot be read or parsed.
+  static std::unique_ptr<OiProfileData> read(StringRef Filename,
+                                             std::string &Error);
+
+  // Edges leaving the instruction at Addr, sorted by target
+  ArrayRef<Edge> getEdgesFrom(uint64_t Addr) const;
+  // Edges leaving instructions in [Begin, End), sorted by source and target
+  ArrayRef<Edge> getEdgesIn(uint64_t Begin, uint64_t End) const;
+  // Times the conditional branch at Addr fell through to FallThrough and
+  // went anywhere else. Returns false if the branch never ran.
+  bool getBranchCounts(uint64_t Addr, uint64_t FallThrough, uint64_t &Taken,
+                       uint64_t &NotTaken) const;
+  // Targets of the indirect jump or call at Addr, most frequent first
+  std::vector<Edge> getTargets(uint64_t Addr) const;
+
+  // Times the function at Addr was entered, and instructions retired in it
+  uint64_t getEntries(uint64_t Addr) const;
+  uint64_t getInstructions(uint64_t Addr) const;
+  uint64_t getTotalInstructions() const { return TotalInstructions; }
+
+  // The program oii ran, as named on its command line
+  StringRef getBinary() const { return Binary; }
+  // Whether any function that ran starts in [Begin, End)
+  bool hasFunctionsIn(uint64_t Begin, uint64_t End) const;
+  // Lowest and highest addresses of the functions that ran. Functions
+  // outside this range may have been left out of the profile.
+  uint64_t getFirstFunction() const { return FirstFunction; }
+  uint64_t getLastFunction() const { return LastFunction; }
+
+private:
+  OiProfileData()
+      : TotalInstructions(0), FirstFunction(~0ULL), LastFunction(0) {}
+
+  struct FunctionCounts {
+    uint64_t Entries, Instructions;
+  };
+
+  std::vector<Edge> Edges;
+  DenseMap<uint64_t, FunctionCounts> Functions;
+  uint64_t TotalInstructions;
+  uint64_t FirstFunction, LastFunction;
+  std::string Binary;
+};
+
+} // end namespace llvm
+
+#endif
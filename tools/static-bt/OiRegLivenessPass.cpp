@@ -0,0 +1,261 @@
+//===-- OiRegLivenessPass.cpp - Drop syncs of dead registers --------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Runs after the per-function pipeline, when the register copies made at
+// function entries, calls and returns are plain loads and stores of the
+// register globals. Each register is a separate problem; for every function
+// F we compute:
+//
+//  - MustMod(F): registers F stores on every path to a return, itself or
+//    through its callees, and MayMod(F), those it stores on some path;
+//  - Ref(F): registers whose value on entry to F may be read;
+//  - LiveOut(F): registers that may be read after F returns. This is the
+//    union of what is live after each call to F, or every register if the
+//    address of F is taken.
+//
+// A store to a register that is not live after it is deleted. Indirect
+// calls may read any register. Functions that are only declared are host
+// code, which does not see the register globals.
+//
+//===----------------------------------------------------------------------===//
+
+#include "OiRegLivenessPass.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+using namespace llvm;
+
+OiRegLiveness::OiRegLiveness(Module &M, ArrayRef<GlobalVariable *> Regs)
+    : M(M), NumRegs(Regs.size()), Pinned(Regs.size()), NumDeleted(0) {
+  for (unsigned I = 0; I < NumRegs; ++I) {
+    RegIndex[Regs[I]] = I;
+    for (const User *U : Regs[I]->users()) {
+      if (isa<LoadInst>(U))
+        continue;
+      if (auto *SI = dyn_cast<StoreInst>(U))
+        if (SI->getPointerOperand() == Regs[I])
+          continue;
+      Pinned.set(I);
+      break;
+    }
+  }
+}
+
+int OiRegLiveness::getRegIndex(const Value *Ptr) const {
+  auto I = RegIndex.find(Ptr);
+  return I == RegIndex.end() ? -1 : (int)I->second;
+}
+
+OiRegLiveness::FunctionInfo *
+OiRegLiveness::getCalleeInfo(const Instruction &I) {
+  ImmutableCallSite CS(&I);
+  if (!CS)
+    return nullptr;
+  auto *F = dyn_cast<Function>(CS.getCalledValue()->stripPointerCasts());
+  if (!F)
+    return nullptr;
+  auto It = Info.find(F);
+  return It == Info.end() ? nullptr : &It->second;
+}
+
+bool OiRegLiveness::isIndirectCall(const Instruction &I) const {
+  ImmutableCallSite CS(&I);
+  return CS && !isa<Function>(CS.getCalledValue()->stripPointerCasts());
+}
+
+BitVector
+OiRegLiveness::getLiveOut(BasicBlock &BB, const FunctionInfo &FI,
+                          const DenseMap<BasicBlock *, BitVector> &In) const {
+  if (isa<ReturnInst>(BB.getTerminator()))
+    return FI.LiveOut;
+  BitVector Live(NumRegs);
+  for (succ_iterator SI = succ_begin(&BB), SE = succ_end(&BB); SI != SE; ++SI)
+    Live |= In.find(*SI)->second;
+  return Live;
+}
+
+// Moves Live from after I to before it
+void OiRegLiveness::transferLive(Instruction &I, BitVector &Live) {
+  if (auto *LI = dyn_cast<LoadInst>(&I)) {
+    int Reg = getRegIndex(LI->getPointerOperand());
+    if (Reg >= 0)
+      Live.set(Reg);
+  } else if (auto *SI = dyn_cast<StoreInst>(&I)) {
+    int Reg = getRegIndex(SI->getPointerOperand());
+    if (Reg >= 0)
+      Live.reset(Reg);
+  } else if (FunctionInfo *Callee = getCalleeInfo(I)) {
+    Live.reset(Callee->MustMod);
+    Live |= Callee->Ref;
+  } else if (isIndirectCall(I)) {
+    Live.set();
+  }
+}
+
+// One round of the greatest fixed point of MustMod and of the least one of
+// MayMod
+bool OiRegLiveness::computeMod(Function &F) {
+  FunctionInfo &FI = Info[&F];
+  BitVector MayMod = FI.MayMod;
+  DenseMap<BasicBlock *, BitVector> Out;
+  for (BasicBlock &BB : F)
+    Out[&BB] = BitVector(NumRegs, true);
+
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (BasicBlock &BB : F) {
+      BitVector Mod(NumRegs, &BB != &F.getEntryBlock());
+      for (pred_iterator PI = pred_begin(&BB), PE = pred_end(&BB); PI != PE;
+           ++PI)
+        Mod &= Out[*PI];
+      for (Instruction &I : BB) {
+        if (auto *SI = dyn_cast<StoreInst>(&I)) {
+          int Reg = getRegIndex(SI->getPointerOperand());
+          if (Reg >= 0) {
+            Mod.set(Reg);
+            MayMod.set(Reg);
+          }
+        } else if (FunctionInfo *Callee = getCalleeInfo(I)) {
+          Mod |= Callee->MustMod;
+          MayMod |= Callee->MayMod;
+        } else if (isIndirectCall(I)) {
+          MayMod.set();
+        }
+      }
+      if (Mod != Out[&BB]) {
+        Out[&BB] = Mod;
+        Changed = true;
+      }
+    }
+  }
+
+  BitVector MustMod(NumRegs, true);
+  for (BasicBlock &BB : F)
+    if (isa<ReturnInst>(BB.getTerminator()))
+      MustMod &= Out[&BB];
+  if (MustMod == FI.MustMod && MayMod == FI.MayMod)
+    return false;
+  FI.MustMod = MustMod;
+  FI.MayMod = MayMod;
+  return true;
+}
+
+// Solves the liveness of F for its current LiveOut, then adds what is live
+// after each call to the LiveOut of the callee. With Delete, also deletes
+// the dead stores. Returns whether Ref(F) or the LiveOut of a callee grew.
+bool OiRegLiveness::computeLiveness(Function &F, bool Delete) {
+  DenseMap<BasicBlock *, BitVector> In;
+  for (BasicBlock &BB : F)
+    In[&BB] = BitVector(NumRegs);
+  FunctionInfo &FI = Info[&F];
+
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (Function::iterator BI = F.end(), BE = F.begin(); BI != BE;) {
+      BasicBlock &BB = *--BI;
+      BitVector Live = getLiveOut(BB, FI, In);
+      for (BasicBlock::reverse_iterator I = BB.rbegin(), E = BB.rend(); I != E;
+           ++I)
+        transferLive(*I, Live);
+      if (Live != In[&BB]) {
+        In[&BB] = Live;
+        Changed = true;
+      }
+    }
+  }
+
+  Changed = false;
+  std::vector<StoreInst *> Dead;
+  for (BasicBlock &BB : F) {
+    BitVector Live = getLiveOut(BB, FI, In);
+    for (BasicBlock::reverse_iterator I = BB.rbegin(), E = BB.rend(); I != E;
+         ++I) {
+      if (auto *SI = dyn_cast<StoreInst>(&*I)) {
+        int Reg = getRegIndex(SI->getPointerOperand());
+        if (Delete && Reg >= 0 && !Live.test(Reg) && !Pinned.test(Reg))
+          Dead.push_back(SI);
+      } else if (FunctionInfo *Callee = getCalleeInfo(*I)) {
+        BitVector LiveOut = Callee->LiveOut;
+        LiveOut |= Live;
+        if (LiveOut != Callee->LiveOut) {
+          Callee->LiveOut = LiveOut;
+          Changed = true;
+        }
+      }
+      transferLive(*I, Live);
+    }
+  }
+
+  const BitVector &Ref = In[&F.getEntryBlock()];
+  if (Ref != FI.Ref) {
+    FI.Ref = Ref;
+    Changed = true;
+  }
+
+  for (StoreInst *SI : Dead) {
+    Value *V = SI->getValueOperand();
+    SI->eraseFromParent();
+    RecursivelyDeleteTriviallyDeadInstructions(V);
+  }
+  NumDeleted += Dead.size();
+  return Changed;
+}
+
+unsigned OiRegLiveness::run(bool Delete) {
+  if (NumRegs == 0)
+    return 0;
+
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    FunctionInfo &FI = Info[&F];
+    FI.MustMod = BitVector(NumRegs, true);
+    FI.MayMod = BitVector(NumRegs);
+    FI.Ref = BitVector(NumRegs);
+    FI.LiveOut = BitVector(NumRegs, F.hasAddressTaken());
+  }
+
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (Function &F : M)
+      if (!F.isDeclaration())
+        Changed |= computeMod(F);
+  }
+
+  Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (Function &F : M)
+      if (!F.isDeclaration())
+        Changed |= computeLiveness(F, false);
+  }
+
+  if (!Delete)
+    return 0;
+  // LiveOut and Ref are final, so deleting stores changes neither
+  for (Function &F : M)
+    if (!F.isDeclaration())
+      computeLiveness(F, true);
+  return NumDeleted;
+}
+
+bool OiRegLivenessPass::runOnModule(Module &M) {
+  NumDeleted = OiRegLiveness(M, Regs).run(true);
+  return NumDeleted > 0;
+}
+
+char OiRegLivenessPass::ID = 0;
+static RegisterPass<OiRegLivenessPass>
+    X("oiregliveness", "OpenISA register liveness across calls", false, false);
@@ -0,0 +1,88 @@
+//=== OiRegLivenessPass.h - Drop syncs of dead registers --------*- C++ -*-==//
+//
+// Translated functions copy the guest registers they use between the
+// register globals and locals at calls and returns. OiRegLiveness analyses
+// the register globals over the whole call graph; OiRegLivenessPass uses it
+// to delete the stores to them that no function reads.
+//
+//===------------------------------------------------------------===//
+
+#ifndef OIREGLIVENESSPASS_H
+#define OIREGLIVENESSPASS_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/Pass.h"
+#include <vector>
+
+namespace llvm {
+
+class BasicBlock;
+class Instruction;
+
+// Summaries of the functions of a module, in terms of Regs: bit I of each
+// set stands for Regs[I].
+class OiRegLiveness {
+public:
+  struct FunctionInfo {
+    // Stored on every path to a return, by the function or its callees
+    BitVector MustMod;
+    // Stored on some path, by the function or its callees
+    BitVector MayMod;
+    // May be read with the value they have on entry
+    BitVector Ref;
+    // May be read after the function returns
+    BitVector LiveOut;
+  };
+
+  OiRegLiveness(Module &M, ArrayRef<GlobalVariable *> Regs);
+
+  // Computes the summaries. With Delete, also deletes the stores to
+  // registers that are not live after them, and returns how many there were.
+  unsigned run(bool Delete);
+
+  // Summary of F, if F is defined in the module
+  const FunctionInfo *getInfo(const Function *F) const {
+    auto I = Info.find(F);
+    return I == Info.end() ? nullptr : &I->second;
+  }
+  int getRegIndex(const Value *Ptr) const;
+
+private:
+  FunctionInfo *getCalleeInfo(const Instruction &I);
+  bool isIndirectCall(const Instruction &I) const;
+  BitVector getLiveOut(BasicBlock &BB, const FunctionInfo &FI,
+                       const DenseMap<BasicBlock *, BitVector> &In) const;
+  void transferLive(Instruction &I, BitVector &Live);
+  bool computeMod(Function &F);
+  bool computeLiveness(Function &F, bool Delete);
+
+  Module &M;
+  unsigned NumRegs;
+  DenseMap<const Value *, unsigned> RegIndex;
+  // Registers whose address escapes; their stores are always kept
+  BitVector Pinned;
+  DenseMap<const Function *, FunctionInfo> Info;
+  unsigned NumDeleted;
+};
+
+struct OiRegLivenessPass : public ModulePass {
+  static char ID;
+  // Regs are the register globals of the module the pass runs on
+  explicit OiRegLivenessPass(ArrayRef<GlobalVariable *> Regs = None)
+      : ModulePass(ID), Regs(Regs.begin(), Regs.end()), NumDeleted(0) {}
+
+  virtual bool runOnModule(Module &M);
+
+  // Number of stores deleted by the last run
+  unsigned getNumDeleted() const { return NumDeleted; }
+
+private:
+  std::vector<GlobalVariable *> Regs;
+  unsigned NumDeleted;
+};
+}
+
+#endif
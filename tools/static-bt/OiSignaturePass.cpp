@@ -0,0 +1,155 @@
+//===-- OiSignaturePass.cpp - Recover function signatures -----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The arguments of a function are the argument registers in its Ref set, and
+// its results the result registers it may store and that are live after it
+// returns (see OiRegLivenessPass). The new function stores each argument to
+// its register global on entry and returns the values of the result
+// registers; callers load the arguments before the call and store the
+// results after it. The program behaves the same whatever registers are
+// chosen. The per-function pipeline then forwards the values through the
+// loads and stores, and OiRegLivenessPass deletes the stores that are left
+// dead.
+//
+// Functions used by anything but direct calls keep their signature, as
+// indirect calls cannot tell what the callee expects. That includes the
+// blockaddresses of jump table and code pointer targets, which
+// Function::hasAddressTaken() does not count.
+//
+//===----------------------------------------------------------------------===//
+
+#include "OiSignaturePass.h"
+#include "OiRegLivenessPass.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+
+using namespace llvm;
+
+static Type *getRegType(const GlobalVariable *GV) {
+  return GV->getType()->getElementType();
+}
+
+// Whether every use of F is a direct call to it
+static bool OnlyCalledDirectly(const Function *F) {
+  for (const Use &U : F->uses()) {
+    auto *CI = dyn_cast<CallInst>(U.getUser());
+    // The callee is the last operand of a call
+    if (!CI || U.getOperandNo() != CI->getNumArgOperands())
+      return false;
+  }
+  return true;
+}
+
+static void RewriteFunction(Function *F, ArrayRef<GlobalVariable *> Args,
+                            ArrayRef<GlobalVariable *> Rets) {
+  LLVMContext &Ctx = F->getContext();
+  SmallVector<Type *, 8> Params, Results;
+  for (GlobalVariable *GV : Args)
+    Params.push_back(getRegType(GV));
+  for (GlobalVariable *GV : Rets)
+    Results.push_back(getRegType(GV));
+  Type *RetTy = Type::getVoidTy(Ctx);
+  if (Results.size() == 1)
+    RetTy = Results[0];
+  else if (Results.size() > 1)
+    RetTy = StructType::get(Ctx, Results);
+
+  Function *NF = Function::Create(FunctionType::get(RetTy, Params, false),
+                                  F->getLinkage());
+  NF->copyAttributesFrom(F);
+  F->getParent()->getFunctionList().insert(F, NF);
+  NF->takeName(F);
+  NF->getBasicBlockList().splice(NF->begin(), F->getBasicBlockList());
+
+  IRBuilder<> Builder(NF->getEntryBlock().getFirstInsertionPt());
+  unsigned I = 0;
+  for (Argument &A : NF->args()) {
+    A.setName(Args[I]->getName());
+    Builder.CreateStore(&A, Args[I++]);
+  }
+
+  if (!Rets.empty()) {
+    for (BasicBlock &BB : *NF) {
+      auto *RI = dyn_cast<ReturnInst>(BB.getTerminator());
+      if (!RI)
+        continue;
+      Builder.SetInsertPoint(RI);
+      Value *RV;
+      if (Rets.size() == 1) {
+        RV = Builder.CreateLoad(Rets[0]);
+      } else {
+        RV = UndefValue::get(RetTy);
+        for (unsigned J = 0; J < Rets.size(); ++J)
+          RV = Builder.CreateInsertValue(RV, Builder.CreateLoad(Rets[J]), J);
+      }
+      Builder.CreateRet(RV);
+      RI->eraseFromParent();
+    }
+  }
+
+  // Only direct calls use F, see OnlyCalledDirectly()
+  SmallVector<CallInst *, 8> Calls;
+  for (User *U : F->users())
+    Calls.push_back(cast<CallInst>(U));
+  for (CallInst *CI : Calls) {
+    Builder.SetInsertPoint(CI);
+    SmallVector<Value *, 8> Vals;
+    for (GlobalVariable *GV : Args)
+      Vals.push_back(Builder.CreateLoad(GV));
+    CallInst *NC = Builder.CreateCall(NF, Vals);
+    NC->setCallingConv(CI->getCallingConv());
+    NC->setTailCall(CI->isTailCall());
+    for (unsigned J = 0; J < Rets.size(); ++J) {
+      Value *V = Rets.size() == 1 ? NC : Builder.CreateExtractValue(NC, J);
+      Builder.CreateStore(V, Rets[J]);
+    }
+    CI->eraseFromParent();
+  }
+  F->eraseFromParent();
+}
+
+bool OiSignaturePass::runOnModule(Module &M) {
+  NumRewritten = 0;
+  OiRegLiveness Liveness(M, Regs);
+  Liveness.run(false);
+
+  std::vector<Function *> Candidates;
+  for (Function &F : M) {
+    if (F.isDeclaration() || !OnlyCalledDirectly(&F) ||
+        F.getFunctionType()->getNumParams() != 0 ||
+        !F.getReturnType()->isVoidTy())
+      continue;
+    Candidates.push_back(&F);
+  }
+
+  for (Function *F : Candidates) {
+    const OiRegLiveness::FunctionInfo *FI = Liveness.getInfo(F);
+    std::vector<GlobalVariable *> Args, Rets;
+    for (GlobalVariable *GV : ArgRegs) {
+      int Reg = Liveness.getRegIndex(GV);
+      if (Reg >= 0 && FI->Ref.test(Reg))
+        Args.push_back(GV);
+    }
+    for (GlobalVariable *GV : RetRegs) {
+      int Reg = Liveness.getRegIndex(GV);
+      if (Reg >= 0 && FI->MayMod.test(Reg) && FI->LiveOut.test(Reg))
+        Rets.push_back(GV);
+    }
+    if (Args.empty() && Rets.empty())
+      continue;
+    RewriteFunction(F, Args, Rets);
+    ++NumRewritten;
+  }
+  return NumRewritten > 0;
+}
+
+char OiSignaturePass::ID = 0;
+static RegisterPass<OiSignaturePass>
+    X("oisignature", "OpenISA function signature recovery", false, false);
@@ -0,0 +1,43 @@
+//=== OiSignaturePass.h - Recover function signatures -----------*- C++ -*-==//
+//
+// Translated functions take no parameters and return nothing; arguments and
+// results travel in the register globals. This pass gives each function
+// whose callers are all known a parameter for every argument register it
+// reads on entry, and returns the result registers its callers read, so
+// that the values can be passed without going through memory.
+//
+//===------------------------------------------------------------===//
+
+#ifndef OISIGNATUREPASS_H
+#define OISIGNATUREPASS_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/Pass.h"
+#include <vector>
+
+namespace llvm {
+
+struct OiSignaturePass : public ModulePass {
+  static char ID;
+  // Regs are all the register globals of the module, ArgRegs and RetRegs
+  // the ones the calling convention passes arguments and results in.
+  explicit OiSignaturePass(ArrayRef<GlobalVariable *> Regs = None,
+                           ArrayRef<GlobalVariable *> ArgRegs = None,
+                           ArrayRef<GlobalVariable *> RetRegs = None)
+      : ModulePass(ID), Regs(Regs.begin(), Regs.end()),
+        ArgRegs(ArgRegs.begin(), ArgRegs.end()),
+        RetRegs(RetRegs.begin(), RetRegs.end()), NumRewritten(0) {}
+
+  virtual bool runOnModule(Module &M);
+
+  // Number of functions given a new signature by the last run
+  unsigned getNumRewritten() const { return NumRewritten; }
+
+private:
+  std::vector<GlobalVariable *> Regs, ArgRegs, RetRegs;
+  unsigned NumRewritten;
+};
+}
+
+#endif
@@ -0,0 +1,124 @@
+//===-- OiTranslationCache.cpp - Per-function translation cache -----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// An entry is the file <key>.bc in the cache directory: four 32-bit words
+// (the indirect jump statistics and the number of image words), the image
+// words as (address, value) pairs, then the bitcode. Words are in host byte
+// order, as entries are not meant to move between hosts.
+//
+//===----------------------------------------------------------------------===//
+
+#include "OiTranslationCache.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstring>
+
+using namespace llvm;
+
+const char OiTranslationCache::Version[] = "static-bt translation cache 2";
+
+static void EntryPath(StringRef Dir, StringRef Key, SmallVectorImpl<char> &P) {
+  P.clear();
+  sys::path::append(P, Dir, Key + ".bc");
+}
+
+static void AppendWord(std::string &S, uint32_t W) {
+  S.append(reinterpret_cast<const char *>(&W), sizeof(W));
+}
+
+bool OiTranslationCache::lookup(StringRef Key,
+                                const std::vector<uint8_t> &Image,
+                                TranslationResult &R) {
+  SmallString<128> Path;
+  EntryPath(Dir, Key, Path);
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Buf = MemoryBuffer::getFile(Path.str());
+  if (!Buf) {
+    ++Misses;
+    return false;
+  }
+
+  StringRef Data = (*Buf)->getBuffer();
+  uint32_t Header[4];
+  if (Data.size() < sizeof(Header)) {
+    ++Misses;
+    return false;
+  }
+  memcpy(Header, Data.data(), sizeof(Header));
+  uint64_t ReadsSize = (uint64_t)Header[3] * 2 * sizeof(uint32_t);
+  if (Data.size() - sizeof(Header) < ReadsSize) {
+    ++Misses;
+    return false;
+  }
+
+  // The entry only holds if the jump tables it was built from did not change
+  const char *P = Data.data() + sizeof(Header);
+  std::vector<std::pair<uint32_t, uint32_t>> Reads(Header[3]);
+  for (auto &Read : Reads) {
+    memcpy(&Read.first, P, sizeof(uint32_t));
+    memcpy(&Read.second, P + sizeof(uint32_t), sizeof(uint32_t));
+    P += 2 * sizeof(uint32_t);
+    uint32_t Cur;
+    if ((uint64_t)Read.first + sizeof(Cur) > Image.size()) {
+      ++Misses;
+      return false;
+    }
+    memcpy(&Cur, &Image[Read.first], sizeof(Cur));
+    if (Cur != Read.second) {
+      ++Misses;
+      return false;
+    }
+  }
+
+  R.NumJumpsOK = Header[0];
+  R.NumJumpsWarning = Header[1];
+  R.NumIndirectCalls = Header[2];
+  R.ImageReads = std::move(Reads);
+  R.Bitcode.assign(P, Data.end());
+  ++Hits;
+  return true;
+}
+
+void OiTranslationCache::store(StringRef Key, const TranslationResult &R) {
+  if (sys::fs::create_directories(Dir))
+    return;
+
+  std::string Entry;
+  AppendWord(Entry, R.NumJumpsOK);
+  AppendWord(Entry, R.NumJumpsWarning);
+  AppendWord(Entry, R.NumIndirectCalls);
+  AppendWord(Entry, R.ImageReads.size());
+  for (const auto &Read : R.ImageReads) {
+    AppendWord(Entry, Read.first);
+    AppendWord(Entry, Read.second);
+  }
+  Entry += R.Bitcode;
+
+  // Write to a temporary and rename it, so readers never see half an entry
+  SmallString<128> Model, TmpPath, Path;
+  sys::path::append(Model, Dir, Key + "-%%%%%%.tmp");
+  int FD;
+  if (sys::fs::createUniqueFile(Model.str(), FD, TmpPath))
+    return;
+  {
+    raw_fd_ostream OS(FD, /*shouldClose*/ true);
+    OS << Entry;
+    OS.close();
+    if (OS.has_error()) {
+      OS.clear_error();
+      sys::fs::remove(TmpPath.str());
+      return;
+    }
+  }
+  EntryPath(Dir, Key, Path);
+  if (sys::fs::rename(TmpPath.str(), Path.str()))
+    sys::fs::remove(TmpPath.str());
+}
@@ -0,0 +1,59 @@
+//=== OiTranslationCache.h - Per-function translation cache -*- C++ -*-==//
+//
+// Keeps the bitcode of translated functions on disk, so that rebuilding a
+// guest binary only retranslates the functions that changed. An entry is
+// named after a hash of everything the translation of its function depends
+// on, except for the jump table words of the shadow image: the entry lists
+// those, and is only used while they still hold the same values.
+//
+//===------------------------------------------------------------===//
+
+#ifndef OITRANSLATIONCACHE_H
+#define OITRANSLATIONCACHE_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+
+// A function translated into a module of its own
+struct TranslationResult {
+  std::string Bitcode;
+  uint32_t NumJumpsOK = 0;
+  uint32_t NumJumpsWarning = 0;
+  uint32_t NumIndirectCalls = 0;
+  // Shadow image words the translation depends on, as (address, value)
+  std::vector<std::pair<uint32_t, uint32_t>> ImageReads;
+};
+
+class OiTranslationCache {
+public:
+  // Part of every key; bump it whenever the translation of the same input
+  // changes.
+  static const char Version[];
+
+  explicit OiTranslationCache(StringRef Dir)
+      : Dir(Dir), Hits(0), Misses(0) {}
+
+  // Fill R from the entry named Key, if there is one that agrees with Image.
+  bool lookup(StringRef Key, const std::vector<uint8_t> &Image,
+              TranslationResult &R);
+  // Save R under Key. Entries appear atomically, so several translators may
+  // share a directory; failing to write one only costs a later miss.
+  void store(StringRef Key, const TranslationResult &R);
+
+  unsigned getHits() const { return Hits; }
+  unsigned getMisses() const { return Misses; }
+
+private:
+  std::string Dir;
+  std::atomic<unsigned> Hits, Misses;
+};
+
+} // end namespace llvm
+
+#endif
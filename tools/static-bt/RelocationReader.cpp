@@ -6,6 +6,7 @@
 #include "llvm/IR/Value.h"
 #include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
 
 using namespace llvm;
 
@@ -15,7 +16,6 @@ bool RelocationReader::ResolveRelocation(uint64_t &Res, uint64_t *Type,
                                          StringRef &SymbolNotFound,
                                          bool DirectCall) {
   relocation_iterator Rel = (*CurSection).relocation_end();
-  std::error_code ec;
   StringRef Name;
   if (!CheckRelocation(Rel, Name))
     return false;
@@ -25,6 +25,13 @@ bool RelocationReader::ResolveRelocation(uint64_t &Res, uint64_t *Type,
       llvm_unreachable("Error getting relocation type");
   }
 
+  return ResolveSymbol(Name, Res, SymbolNotFound, DirectCall);
+}
+
+bool RelocationReader::ResolveSymbol(StringRef Name, uint64_t &Res,
+                                     StringRef &SymbolNotFound,
+                                     bool DirectCall) {
+  std::error_code ec;
   auto it = CommonSymbols.find(Name);
   if (it != CommonSymbols.end()) {
     Res = it->getValue();
@@ -104,7 +111,8 @@ bool RelocationReader::ResolveRelocation(Value *&Res, uint64_t *Type,
   if (IsFuncAddr)
     *IsFuncAddr = false;
   if (ResolveRelocation(IntRes, Type, SymbolNotFound, DirectCall)) {
-    Res = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), IntRes);
+    Res =
+        ConstantInt::get(Type::getInt32Ty(TheModule->getContext()), IntRes);
     if (!SymbolNotFound.size()) {
       return true;
     }
@@ -114,10 +122,9 @@ bool RelocationReader::ResolveRelocation(Value *&Res, uint64_t *Type,
     return false;
   }
   if (SymbolNotFound.size() > 0) {
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(TheModule->getContext());
     Res = ConstantExpr::getPointerCast(
-        TheModule->getOrInsertGlobal(SymbolNotFound,
-                                     Type::getInt32Ty(getGlobalContext())),
-        Type::getInt32Ty(getGlobalContext()));
+        TheModule->getOrInsertGlobal(SymbolNotFound, Int32Ty), Int32Ty);
     if (UndefinedSymbol)
       *UndefinedSymbol = true;
     return true;
@@ -150,6 +157,31 @@ bool RelocationReader::CheckRelocation(relocation_iterator &Rel,
   return false;
 }
 
+void RelocationReader::ListRelocations(
+    const SectionRef &Section, std::vector<ResolvedRelocation> &Relocs) {
+  uint64_t offset = GetELFOffset(Section);
+  for (const SectionRef &RelocSec : SectionRelocMap[Section]) {
+    for (const RelocationRef &Reloc : RelocSec.relocations()) {
+      ResolvedRelocation R;
+      if (error(Reloc.getOffset(R.Addr)))
+        break;
+      R.Addr += offset;
+      if (error(Reloc.getType(R.Type)))
+        llvm_unreachable("Error getting relocation type");
+      SymbolRef symb = *(Reloc.getSymbol());
+      if (error(symb.getName(R.Symbol)))
+        continue;
+      StringRef NotFound;
+      R.Value = 0;
+      R.Resolved = ResolveSymbol(R.Symbol, R.Value, NotFound, false);
+      Relocs.push_back(R);
+    }
+  }
+  std::stable_sort(Relocs.begin(), Relocs.end(),
+                   [](const ResolvedRelocation &A,
+                      const ResolvedRelocation &B) { return A.Addr < B.Addr; });
+}
+
 void RelocationReader::ResolveAllDataRelocations(
     std::vector<uint8_t> &ShadowImage) {
   for (auto MapEntry : SectionRelocMap) {
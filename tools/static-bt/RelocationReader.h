@@ -9,6 +9,7 @@
 #include "llvm/ADT/StringMap.h"
 #include "llvm/Object/ObjectFile.h"
 #include <map>
+#include <vector>
 
 namespace llvm {
 
@@ -24,6 +25,15 @@ using namespace object;
 
 class RelocationReader {
 public:
+  // A relocation of a code section, with the value its symbol resolves to
+  struct ResolvedRelocation {
+    uint64_t Addr;
+    uint64_t Type;
+    StringRef Symbol;
+    uint64_t Value;
+    bool Resolved;
+  };
+
   RelocationReader(llvm::Module *M, const ObjectFile *obj,
                    const SectionRef *&secptr, uint64_t &addrptr,
                    llvm::StringMap<uint64_t> &commonsymbols)
@@ -41,7 +51,12 @@ public:
   bool ResolveRelocation(llvm::Value *&Res, uint64_t *Type,
                          bool *UndefinedSymbol, bool *IsFuncAddr = 0,
                          bool DirectCall = false);
+  bool ResolveSymbol(StringRef Name, uint64_t &Res, StringRef &SymbolNotFound,
+                     bool DirectCall);
   bool CheckRelocation(relocation_iterator &Rel, StringRef &Name);
+  // All the relocations of Section, sorted by the address they patch
+  void ListRelocations(const SectionRef &Section,
+                       std::vector<ResolvedRelocation> &Relocs);
   void ResolveAllDataRelocations(std::vector<uint8_t>& ShadowImage);
 
 private:
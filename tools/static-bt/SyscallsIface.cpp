@@ -11,8 +11,8 @@
 using namespace llvm;
 
 bool SyscallsIface::HandleLibcAtoi(Value *&V, Value **First) {
-  SmallVector<Type *, 8> args(1, Type::getInt32Ty(getGlobalContext()));
-  FunctionType *ft = FunctionType::get(Type::getInt32Ty(getGlobalContext()),
+  SmallVector<Type *, 8> args(1, Type::getInt32Ty(Context));
+  FunctionType *ft = FunctionType::get(Type::getInt32Ty(Context),
                                        args, /*isvararg*/ false);
   Value *fun = TheModule->getOrInsertFunction("atoi", ft);
   SmallVector<Value *, 8> params;
@@ -21,7 +21,7 @@ bool SyscallsIface::HandleLibcAtoi(Value *&V, Value **First) {
     *First = GetFirstInstruction(*First, f);
   Value *addrbuf = IREmitter.AccessShadowMemory(f, false);
   params.push_back(
-      Builder.CreatePtrToInt(addrbuf, Type::getInt32Ty(getGlobalContext())));
+      Builder.CreatePtrToInt(addrbuf, Type::getInt32Ty(Context)));
   V = Builder.CreateStore(Builder.CreateCall(fun, params),
                           IREmitter.Regs[ConvToDirective(Mips::V0)]);
   ReadMap[ConvToDirective(Mips::A0)] = true;
@@ -30,8 +30,8 @@ bool SyscallsIface::HandleLibcAtoi(Value *&V, Value **First) {
 }
 
 bool SyscallsIface::HandleLibcMalloc(Value *&V, Value **First) {
-  SmallVector<Type *, 8> args(1, Type::getInt32Ty(getGlobalContext()));
-  FunctionType *ft = FunctionType::get(Type::getInt32Ty(getGlobalContext()),
+  SmallVector<Type *, 8> args(1, Type::getInt32Ty(Context));
+  FunctionType *ft = FunctionType::get(Type::getInt32Ty(Context),
                                        args, /*isvararg*/ false);
   Value *fun = TheModule->getOrInsertFunction("malloc", ft);
   SmallVector<Value *, 8> params;
@@ -44,7 +44,7 @@ bool SyscallsIface::HandleLibcMalloc(Value *&V, Value **First) {
     V = Builder.CreateStore(mal, IREmitter.Regs[ConvToDirective(Mips::V0)]);
   } else {
     Value *ptr = Builder.CreatePtrToInt(IREmitter.ShadowImageValue,
-                                        Type::getInt32Ty(getGlobalContext()));
+                                        Type::getInt32Ty(Context));
     Value *fixed = Builder.CreateSub(mal, ptr);
     V = Builder.CreateStore(fixed, IREmitter.Regs[ConvToDirective(Mips::V0)]);
   }
@@ -54,8 +54,8 @@ bool SyscallsIface::HandleLibcMalloc(Value *&V, Value **First) {
 }
 
 bool SyscallsIface::HandleLibcCalloc(Value *&V, Value **First) {
-  SmallVector<Type *, 8> args(2, Type::getInt32Ty(getGlobalContext()));
-  FunctionType *ft = FunctionType::get(Type::getInt32Ty(getGlobalContext()),
+  SmallVector<Type *, 8> args(2, Type::getInt32Ty(Context));
+  FunctionType *ft = FunctionType::get(Type::getInt32Ty(Context),
                                        args, /*isvararg*/ false);
   Value *fun = TheModule->getOrInsertFunction("calloc", ft);
   Value *f = Builder.CreateLoad(IREmitter.Regs[ConvToDirective(Mips::A0)]);
@@ -70,7 +70,7 @@ bool SyscallsIface::HandleLibcCalloc(Value *&V, Value **First) {
     V = Builder.CreateStore(mal, IREmitter.Regs[ConvToDirective(Mips::V0)]);
   } else {
     Value *ptr = Builder.CreatePtrToInt(IREmitter.ShadowImageValue,
-                                        Type::getInt32Ty(getGlobalContext()));
+                                        Type::getInt32Ty(Context));
     Value *fixed = Builder.CreateSub(mal, ptr);
     V = Builder.CreateStore(fixed, IREmitter.Regs[ConvToDirective(Mips::V0)]);
   }
@@ -81,8 +81,8 @@ bool SyscallsIface::HandleLibcCalloc(Value *&V, Value **First) {
 }
 
 bool SyscallsIface::HandleLibcFree(Value *&V, Value **First) {
-  SmallVector<Type *, 8> args(1, Type::getInt32Ty(getGlobalContext()));
-  FunctionType *ft = FunctionType::get(Type::getVoidTy(getGlobalContext()),
+  SmallVector<Type *, 8> args(1, Type::getInt32Ty(Context));
+  FunctionType *ft = FunctionType::get(Type::getVoidTy(Context),
                                        args, /*isvararg*/ false);
   Value *fun = TheModule->getOrInsertFunction("free", ft);
   SmallVector<Value *, 8> params;
@@ -91,15 +91,15 @@ bool SyscallsIface::HandleLibcFree(Value *&V, Value **First) {
     *First = GetFirstInstruction(*First, f);
   Value *addrbuf = IREmitter.AccessShadowMemory(f, false);
   params.push_back(
-      Builder.CreatePtrToInt(addrbuf, Type::getInt32Ty(getGlobalContext())));
+      Builder.CreatePtrToInt(addrbuf, Type::getInt32Ty(Context)));
   V = Builder.CreateCall(fun, params);
   ReadMap[ConvToDirective(Mips::A0)] = true;
   return true;
 }
 
 bool SyscallsIface::HandleLibcExit(Value *&V, Value **First) {
-  SmallVector<Type *, 8> args(1, Type::getInt32Ty(getGlobalContext()));
-  FunctionType *ft = FunctionType::get(Type::getVoidTy(getGlobalContext()),
+  SmallVector<Type *, 8> args(1, Type::getInt32Ty(Context));
+  FunctionType *ft = FunctionType::get(Type::getVoidTy(Context),
                                        args, /*isvararg*/ false);
   Value *fun = TheModule->getOrInsertFunction("exit", ft);
   SmallVector<Value *, 8> params;
@@ -115,13 +115,13 @@ bool SyscallsIface::HandleLibcExit(Value *&V, Value **First) {
 bool SyscallsIface::HandleGenericInt(Value *&V, StringRef Name, int numargs,
                                      int numret, ArgType *ArgTypes,
                                      Value **First) {
-  SmallVector<Type *, 8> args(numargs, Type::getInt32Ty(getGlobalContext()));
+  SmallVector<Type *, 8> args(numargs, Type::getInt32Ty(Context));
   FunctionType *ft;
   if (numret == 0)
-    ft = FunctionType::get(Type::getVoidTy(getGlobalContext()), args,
+    ft = FunctionType::get(Type::getVoidTy(Context), args,
                            /*isvararg*/ false);
   else if (numret == 1)
-    ft = FunctionType::get(Type::getInt32Ty(getGlobalContext()), args,
+    ft = FunctionType::get(Type::getInt32Ty(Context), args,
                            /*isvararg*/ false);
   else
     llvm_unreachable("Unhandled return size.");
@@ -137,12 +137,12 @@ bool SyscallsIface::HandleGenericInt(Value *&V, StringRef Name, int numargs,
         *First = GetFirstInstruction(*First, f);
       switch (ArgTypes[I]) {
       case AT_Ptr: {
-        Value *zero = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0);
+        Value *zero = ConstantInt::get(Type::getInt32Ty(Context), 0);
         Value *cmp = Builder.CreateICmpEQ(f, zero);
         Value *ptr = IREmitter.AccessShadowMemory(f, false);
         Value * final = Builder.CreateSelect(
             cmp, zero,
-            Builder.CreatePtrToInt(ptr, Type::getInt32Ty(getGlobalContext())));
+            Builder.CreatePtrToInt(ptr, Type::getInt32Ty(Context)));
         params.push_back(final);
         break;
       }
@@ -167,10 +167,10 @@ bool SyscallsIface::HandleGenericInt(Value *&V, StringRef Name, int numargs,
       if (NoShadow) {
         V = Builder.CreateStore(V, IREmitter.Regs[ConvToDirective(Mips::V0)]);
       } else {
-        Value *zero = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0);
+        Value *zero = ConstantInt::get(Type::getInt32Ty(Context), 0);
         Value *cmp = Builder.CreateICmpEQ(V, zero);
         Value *ptr = Builder.CreatePtrToInt(
-            IREmitter.ShadowImageValue, Type::getInt32Ty(getGlobalContext()));
+            IREmitter.ShadowImageValue, Type::getInt32Ty(Context));
         Value *fixed = Builder.CreateSub(V, ptr);
         Value *final = Builder.CreateSelect(cmp, zero, fixed);
         V = Builder.CreateStore(final,
@@ -193,9 +193,9 @@ bool SyscallsIface::HandleGenericInt(Value *&V, StringRef Name, int numargs,
 
 Function *SyscallsIface::createTranslateCTypeFunction() {
   SmallVector<Type *, 1> args;
-  args.push_back(Type::getInt32Ty(getGlobalContext()));
+  args.push_back(Type::getInt32Ty(Context));
   FunctionType *FT =
-      FunctionType::get(Type::getInt32Ty(getGlobalContext()), args, false);
+      FunctionType::get(Type::getInt32Ty(Context), args, false);
   Constant *C =
       TheModule->getOrInsertFunction("__xlated_ctype_toupper_loc", FT);
   auto *F = dyn_cast<Function>(C);
@@ -203,31 +203,33 @@ Function *SyscallsIface::createTranslateCTypeFunction() {
   if (F->size() > 0)
     return F;
 
-  // Need to create the function
-  BasicBlock *BB = BasicBlock::Create(getGlobalContext(), "", F);
-  IRBuilder<> PBuilder(getGlobalContext());
+  // Need to create the function. Every single-function module that uses it
+  // has its own copy, so let the linker keep just one.
+  F->setLinkage(GlobalValue::LinkOnceODRLinkage);
+  BasicBlock *BB = BasicBlock::Create(Context, "", F);
+  IRBuilder<> PBuilder(Context);
   PBuilder.SetInsertPoint(BB);
 
   GlobalVariable *GV = new GlobalVariable(
-      *TheModule, Type::getInt1Ty(getGlobalContext()), false,
+      *TheModule, Type::getInt1Ty(Context), false,
       GlobalValue::PrivateLinkage,
-      ConstantInt::get(Type::getInt1Ty(getGlobalContext()), 0),
+      ConstantInt::get(Type::getInt1Ty(Context), 0),
       "__ctype_xlated");
 
   GlobalVariable *XlatedValGV = new GlobalVariable(
-      *TheModule, Type::getInt32Ty(getGlobalContext()), false,
+      *TheModule, Type::getInt32Ty(Context), false,
       GlobalValue::PrivateLinkage,
-      ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0),
+      ConstantInt::get(Type::getInt32Ty(Context), 0),
       "__ctype_xlated_val");
 
   Value *XlatedVal = PBuilder.CreatePtrToInt(
-      XlatedValGV, Type::getInt32Ty(getGlobalContext()));
+      XlatedValGV, Type::getInt32Ty(Context));
   Value *LoadGV = PBuilder.CreateLoad(GV);
-  Value *one = ConstantInt::get(Type::getInt1Ty(getGlobalContext()), 1U);
+  Value *one = ConstantInt::get(Type::getInt1Ty(Context), 1U);
   Value *cmp = PBuilder.CreateICmpEQ(LoadGV, one);
 
-  BasicBlock *BBTrue = BasicBlock::Create(getGlobalContext(), "", F);
-  BasicBlock *BBFalse = BasicBlock::Create(getGlobalContext(), "", F);
+  BasicBlock *BBTrue = BasicBlock::Create(Context, "", F);
+  BasicBlock *BBFalse = BasicBlock::Create(Context, "", F);
 
   assert(F->arg_size() == 1 && "Wrong function arguments");
   Value *InputVal = F->arg_begin();
@@ -238,9 +240,9 @@ Function *SyscallsIface::createTranslateCTypeFunction() {
 
   PBuilder.SetInsertPoint(BBFalse);
   Value *Shadow = PBuilder.CreatePtrToInt(IREmitter.ShadowImageValue,
-                                          Type::getInt32Ty(getGlobalContext()));
+                                          Type::getInt32Ty(Context));
   Value *Ptr = PBuilder.CreateIntToPtr(InputVal,
-                                       Type::getInt32PtrTy(getGlobalContext()));
+                                       Type::getInt32PtrTy(Context));
   PBuilder.CreateStore(PBuilder.CreateSub(PBuilder.CreateLoad(Ptr), Shadow),
                        XlatedValGV);
   PBuilder.CreateStore(one, GV);
@@ -251,9 +253,9 @@ Function *SyscallsIface::createTranslateCTypeFunction() {
 
 Function *SyscallsIface::createTranslateToLowerFunction() {
   SmallVector<Type *, 1> args;
-  args.push_back(Type::getInt32Ty(getGlobalContext()));
+  args.push_back(Type::getInt32Ty(Context));
   FunctionType *FT =
-      FunctionType::get(Type::getInt32Ty(getGlobalContext()), args, false);
+      FunctionType::get(Type::getInt32Ty(Context), args, false);
   Constant *C =
       TheModule->getOrInsertFunction("__xlated_ctype_tolower_loc", FT);
   auto *F = dyn_cast<Function>(C);
@@ -262,30 +264,31 @@ Function *SyscallsIface::createTranslateToLowerFunction() {
     return F;
 
   // Need to create the function
-  BasicBlock *BB = BasicBlock::Create(getGlobalContext(), "", F);
-  IRBuilder<> PBuilder(getGlobalContext());
+  F->setLinkage(GlobalValue::LinkOnceODRLinkage);
+  BasicBlock *BB = BasicBlock::Create(Context, "", F);
+  IRBuilder<> PBuilder(Context);
   PBuilder.SetInsertPoint(BB);
 
   GlobalVariable *GV = new GlobalVariable(
-      *TheModule, Type::getInt1Ty(getGlobalContext()), false,
+      *TheModule, Type::getInt1Ty(Context), false,
       GlobalValue::PrivateLinkage,
-      ConstantInt::get(Type::getInt1Ty(getGlobalContext()), 0),
+      ConstantInt::get(Type::getInt1Ty(Context), 0),
       "__ctype_tolower_xlated");
 
   GlobalVariable *XlatedValGV = new GlobalVariable(
-      *TheModule, Type::getInt32Ty(getGlobalContext()), false,
+      *TheModule, Type::getInt32Ty(Context), false,
       GlobalValue::PrivateLinkage,
-      ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0),
+      ConstantInt::get(Type::getInt32Ty(Context), 0),
       "__ctype_tolower_xlated_val");
 
   Value *XlatedVal = PBuilder.CreatePtrToInt(
-      XlatedValGV, Type::getInt32Ty(getGlobalContext()));
+      XlatedValGV, Type::getInt32Ty(Context));
   Value *LoadGV = PBuilder.CreateLoad(GV);
-  Value *one = ConstantInt::get(Type::getInt1Ty(getGlobalContext()), 1U);
+  Value *one = ConstantInt::get(Type::getInt1Ty(Context), 1U);
   Value *cmp = PBuilder.CreateICmpEQ(LoadGV, one);
 
-  BasicBlock *BBTrue = BasicBlock::Create(getGlobalContext(), "", F);
-  BasicBlock *BBFalse = BasicBlock::Create(getGlobalContext(), "", F);
+  BasicBlock *BBTrue = BasicBlock::Create(Context, "", F);
+  BasicBlock *BBFalse = BasicBlock::Create(Context, "", F);
 
   assert(F->arg_size() == 1 && "Wrong function arguments");
   Value *InputVal = F->arg_begin();
@@ -296,9 +299,9 @@ Function *SyscallsIface::createTranslateToLowerFunction() {
 
   PBuilder.SetInsertPoint(BBFalse);
   Value *Shadow = PBuilder.CreatePtrToInt(IREmitter.ShadowImageValue,
-                                          Type::getInt32Ty(getGlobalContext()));
+                                          Type::getInt32Ty(Context));
   Value *Ptr = PBuilder.CreateIntToPtr(InputVal,
-                                       Type::getInt32PtrTy(getGlobalContext()));
+                                       Type::getInt32PtrTy(Context));
   PBuilder.CreateStore(PBuilder.CreateSub(PBuilder.CreateLoad(Ptr), Shadow),
                        XlatedValGV);
   PBuilder.CreateStore(one, GV);
@@ -308,9 +311,9 @@ Function *SyscallsIface::createTranslateToLowerFunction() {
 
 Function *SyscallsIface::createTranslateBLocFunction() {
   SmallVector<Type *, 1> args;
-  args.push_back(Type::getInt32Ty(getGlobalContext()));
+  args.push_back(Type::getInt32Ty(Context));
   FunctionType *FT =
-      FunctionType::get(Type::getInt32Ty(getGlobalContext()), args, false);
+      FunctionType::get(Type::getInt32Ty(Context), args, false);
   Constant *C =
       TheModule->getOrInsertFunction("__xlated_ctype_b_loc", FT);
   auto *F = dyn_cast<Function>(C);
@@ -319,30 +322,31 @@ Function *SyscallsIface::createTranslateBLocFunction() {
     return F;
 
   // Need to create the function
-  BasicBlock *BB = BasicBlock::Create(getGlobalContext(), "", F);
-  IRBuilder<> PBuilder(getGlobalContext());
+  F->setLinkage(GlobalValue::LinkOnceODRLinkage);
+  BasicBlock *BB = BasicBlock::Create(Context, "", F);
+  IRBuilder<> PBuilder(Context);
   PBuilder.SetInsertPoint(BB);
 
   GlobalVariable *GV = new GlobalVariable(
-      *TheModule, Type::getInt1Ty(getGlobalContext()), false,
+      *TheModule, Type::getInt1Ty(Context), false,
       GlobalValue::PrivateLinkage,
-      ConstantInt::get(Type::getInt1Ty(getGlobalContext()), 0),
+      ConstantInt::get(Type::getInt1Ty(Context), 0),
       "__ctype_bloc_xlated");
 
   GlobalVariable *XlatedValGV = new GlobalVariable(
-      *TheModule, Type::getInt32Ty(getGlobalContext()), false,
+      *TheModule, Type::getInt32Ty(Context), false,
       GlobalValue::PrivateLinkage,
-      ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0),
+      ConstantInt::get(Type::getInt32Ty(Context), 0),
       "__ctype_bloc_xlated_val");
 
   Value *XlatedVal = PBuilder.CreatePtrToInt(
-      XlatedValGV, Type::getInt32Ty(getGlobalContext()));
+      XlatedValGV, Type::getInt32Ty(Context));
   Value *LoadGV = PBuilder.CreateLoad(GV);
-  Value *one = ConstantInt::get(Type::getInt1Ty(getGlobalContext()), 1U);
+  Value *one = ConstantInt::get(Type::getInt1Ty(Context), 1U);
   Value *cmp = PBuilder.CreateICmpEQ(LoadGV, one);
 
-  BasicBlock *BBTrue = BasicBlock::Create(getGlobalContext(), "", F);
-  BasicBlock *BBFalse = BasicBlock::Create(getGlobalContext(), "", F);
+  BasicBlock *BBTrue = BasicBlock::Create(Context, "", F);
+  BasicBlock *BBFalse = BasicBlock::Create(Context, "", F);
 
   assert(F->arg_size() == 1 && "Wrong function arguments");
   Value *InputVal = F->arg_begin();
@@ -353,9 +357,9 @@ Function *SyscallsIface::createTranslateBLocFunction() {
 
   PBuilder.SetInsertPoint(BBFalse);
   Value *Shadow = PBuilder.CreatePtrToInt(IREmitter.ShadowImageValue,
-                                          Type::getInt32Ty(getGlobalContext()));
+                                          Type::getInt32Ty(Context));
   Value *Ptr = PBuilder.CreateIntToPtr(InputVal,
-                                       Type::getInt32PtrTy(getGlobalContext()));
+                                       Type::getInt32PtrTy(Context));
   PBuilder.CreateStore(PBuilder.CreateSub(PBuilder.CreateLoad(Ptr), Shadow),
                        XlatedValGV);
   PBuilder.CreateStore(one, GV);
@@ -366,7 +370,7 @@ Function *SyscallsIface::createTranslateBLocFunction() {
 bool SyscallsIface::HandleCTypeToUpperLoc(Value *&V, Value **First) {
   SmallVector<Type *, 1> args;
   FunctionType *ft =
-      FunctionType::get(Type::getInt32Ty(getGlobalContext()), args,
+      FunctionType::get(Type::getInt32Ty(Context), args,
                         /*isvararg*/ false);
   Value *fun = TheModule->getOrInsertFunction("__ctype_toupper_loc", ft);
   Value *AdaptorFunction = createTranslateCTypeFunction();
@@ -385,7 +389,7 @@ bool SyscallsIface::HandleCTypeToUpperLoc(Value *&V, Value **First) {
   params2.push_back(V);
   V = Builder.CreateCall(AdaptorFunction, params2);
   Value *ptr = Builder.CreatePtrToInt(IREmitter.ShadowImageValue,
-                                      Type::getInt32Ty(getGlobalContext()));
+                                      Type::getInt32Ty(Context));
   Value *fixed = Builder.CreateSub(V, ptr);
   V = Builder.CreateStore(fixed, IREmitter.Regs[ConvToDirective(Mips::V0)]);
   WriteMap[ConvToDirective(Mips::V0)] = true;
@@ -395,7 +399,7 @@ bool SyscallsIface::HandleCTypeToUpperLoc(Value *&V, Value **First) {
 bool SyscallsIface::HandleCTypeToLowerLoc(Value *&V, Value **First) {
   SmallVector<Type *, 1> args;
   FunctionType *ft =
-      FunctionType::get(Type::getInt32Ty(getGlobalContext()), args,
+      FunctionType::get(Type::getInt32Ty(Context), args,
                         /*isvararg*/ false);
   Value *fun = TheModule->getOrInsertFunction("__ctype_tolower_loc", ft);
   Value *AdaptorFunction = createTranslateToLowerFunction();
@@ -414,7 +418,7 @@ bool SyscallsIface::HandleCTypeToLowerLoc(Value *&V, Value **First) {
   params2.push_back(V);
   V = Builder.CreateCall(AdaptorFunction, params2);
   Value *ptr = Builder.CreatePtrToInt(IREmitter.ShadowImageValue,
-                                      Type::getInt32Ty(getGlobalContext()));
+                                      Type::getInt32Ty(Context));
   Value *fixed = Builder.CreateSub(V, ptr);
   V = Builder.CreateStore(fixed, IREmitter.Regs[ConvToDirective(Mips::V0)]);
   WriteMap[ConvToDirective(Mips::V0)] = true;
@@ -424,7 +428,7 @@ bool SyscallsIface::HandleCTypeToLowerLoc(Value *&V, Value **First) {
 bool SyscallsIface::HandleCTypeBLoc(Value *&V, Value **First) {
   SmallVector<Type *, 1> args;
   FunctionType *ft =
-      FunctionType::get(Type::getInt32Ty(getGlobalContext()), args,
+      FunctionType::get(Type::getInt32Ty(Context), args,
                         /*isvararg*/ false);
   Value *fun = TheModule->getOrInsertFunction("__ctype_b_loc", ft);
   Value *AdaptorFunction = createTranslateBLocFunction();
@@ -443,7 +447,7 @@ bool SyscallsIface::HandleCTypeBLoc(Value *&V, Value **First) {
   params2.push_back(V);
   V = Builder.CreateCall(AdaptorFunction, params2);
   Value *ptr = Builder.CreatePtrToInt(IREmitter.ShadowImageValue,
-                                      Type::getInt32Ty(getGlobalContext()));
+                                      Type::getInt32Ty(Context));
   Value *fixed = Builder.CreateSub(V, ptr);
   V = Builder.CreateStore(fixed, IREmitter.Regs[ConvToDirective(Mips::V0)]);
   WriteMap[ConvToDirective(Mips::V0)] = true;
@@ -451,8 +455,8 @@ bool SyscallsIface::HandleCTypeBLoc(Value *&V, Value **First) {
 }
 
 bool SyscallsIface::HandleLibcPuts(Value *&V, Value **First) {
-  SmallVector<Type *, 8> args(1, Type::getInt32Ty(getGlobalContext()));
-  FunctionType *ft = FunctionType::get(Type::getInt32Ty(getGlobalContext()),
+  SmallVector<Type *, 8> args(1, Type::getInt32Ty(Context));
+  FunctionType *ft = FunctionType::get(Type::getInt32Ty(Context),
                                        args, /*isvararg*/ false);
   Value *fun = TheModule->getOrInsertFunction("puts", ft);
   SmallVector<Value *, 8> params;
@@ -461,7 +465,7 @@ bool SyscallsIface::HandleLibcPuts(Value *&V, Value **First) {
     *First = GetFirstInstruction(*First, f);
   Value *addrbuf = IREmitter.AccessShadowMemory(f, false);
   params.push_back(
-      Builder.CreatePtrToInt(addrbuf, Type::getInt32Ty(getGlobalContext())));
+      Builder.CreatePtrToInt(addrbuf, Type::getInt32Ty(Context)));
   V = Builder.CreateStore(Builder.CreateCall(fun, params),
                           IREmitter.Regs[ConvToDirective(Mips::V0)]);
   ReadMap[ConvToDirective(Mips::A0)] = true;
@@ -470,8 +474,8 @@ bool SyscallsIface::HandleLibcPuts(Value *&V, Value **First) {
 }
 
 bool SyscallsIface::HandleLibcMemset(Value *&V, Value **First) {
-  SmallVector<Type *, 8> args(3, Type::getInt32Ty(getGlobalContext()));
-  FunctionType *ft = FunctionType::get(Type::getInt32Ty(getGlobalContext()),
+  SmallVector<Type *, 8> args(3, Type::getInt32Ty(Context));
+  FunctionType *ft = FunctionType::get(Type::getInt32Ty(Context),
                                        args, /*isvararg*/ false);
   Value *fun = TheModule->getOrInsertFunction("memset", ft);
   SmallVector<Value *, 8> params;
@@ -480,7 +484,7 @@ bool SyscallsIface::HandleLibcMemset(Value *&V, Value **First) {
     *First = GetFirstInstruction(*First, f);
   Value *addrbuf = IREmitter.AccessShadowMemory(f, false);
   params.push_back(
-      Builder.CreatePtrToInt(addrbuf, Type::getInt32Ty(getGlobalContext())));
+      Builder.CreatePtrToInt(addrbuf, Type::getInt32Ty(Context)));
   params.push_back(
       Builder.CreateLoad(IREmitter.Regs[ConvToDirective(Mips::A1)]));
   params.push_back(
@@ -497,8 +501,8 @@ bool SyscallsIface::HandleLibcMemset(Value *&V, Value **First) {
 // XXX: Handling a fixed number of 4 arguments, since we cannot infer how many
 // arguments the program is using with fprintf
 bool SyscallsIface::HandleLibcFprintf(Value *&V, Value **First) {
-  SmallVector<Type *, 8> args(2, Type::getInt32Ty(getGlobalContext()));
-  FunctionType *ft = FunctionType::get(Type::getInt32Ty(getGlobalContext()),
+  SmallVector<Type *, 8> args(2, Type::getInt32Ty(Context));
+  FunctionType *ft = FunctionType::get(Type::getInt32Ty(Context),
                                        args, /*isvararg*/ true);
   Value *fun = TheModule->getOrInsertFunction("fprintf", ft);
   SmallVector<Value *, 8> params;
@@ -509,7 +513,7 @@ bool SyscallsIface::HandleLibcFprintf(Value *&V, Value **First) {
   Value *addrbuf = IREmitter.AccessShadowMemory(
       Builder.CreateLoad(IREmitter.Regs[ConvToDirective(Mips::A1)]), false);
   params.push_back(
-      Builder.CreatePtrToInt(addrbuf, Type::getInt32Ty(getGlobalContext())));
+      Builder.CreatePtrToInt(addrbuf, Type::getInt32Ty(Context)));
   params.push_back(
       Builder.CreateLoad(IREmitter.Regs[ConvToDirective(Mips::A2)]));
   params.push_back(
@@ -527,8 +531,8 @@ bool SyscallsIface::HandleLibcFprintf(Value *&V, Value **First) {
 // XXX: Handling a fixed number of 4 arguments, since we cannot infer how many
 // arguments the program is using with printf
 bool SyscallsIface::HandleLibcPrintf(Value *&V, Value **First) {
-  SmallVector<Type *, 8> args(1, Type::getInt32Ty(getGlobalContext()));
-  FunctionType *ft = FunctionType::get(Type::getInt32Ty(getGlobalContext()),
+  SmallVector<Type *, 8> args(1, Type::getInt32Ty(Context));
+  FunctionType *ft = FunctionType::get(Type::getInt32Ty(Context),
                                        args, /*isvararg*/ true);
   Value *fun = TheModule->getOrInsertFunction("printf", ft);
   SmallVector<Value *, 8> params;
@@ -537,7 +541,7 @@ bool SyscallsIface::HandleLibcPrintf(Value *&V, Value **First) {
     *First = GetFirstInstruction(*First, f);
   Value *addrbuf = IREmitter.AccessShadowMemory(f, false);
   params.push_back(
-      Builder.CreatePtrToInt(addrbuf, Type::getInt32Ty(getGlobalContext())));
+      Builder.CreatePtrToInt(addrbuf, Type::getInt32Ty(Context)));
   params.push_back(
       Builder.CreateLoad(IREmitter.Regs[ConvToDirective(Mips::A1)]));
   params.push_back(
@@ -557,8 +561,8 @@ bool SyscallsIface::HandleLibcPrintf(Value *&V, Value **First) {
 // XXX: Handling a fixed number of 4 arguments, since we cannot infer how many
 // arguments the program is using with scanf
 bool SyscallsIface::HandleLibcScanf(Value *&V, Value **First) {
-  SmallVector<Type *, 8> args(1, Type::getInt32Ty(getGlobalContext()));
-  FunctionType *ft = FunctionType::get(Type::getInt32Ty(getGlobalContext()),
+  SmallVector<Type *, 8> args(1, Type::getInt32Ty(Context));
+  FunctionType *ft = FunctionType::get(Type::getInt32Ty(Context),
                                        args, /*isvararg*/ true);
   Value *fun = TheModule->getOrInsertFunction("__isoc99_scanf", ft);
   SmallVector<Value *, 8> params;
@@ -573,13 +577,13 @@ bool SyscallsIface::HandleLibcScanf(Value *&V, Value **First) {
   Value *addrbuf3 = IREmitter.AccessShadowMemory(
       Builder.CreateLoad(IREmitter.Regs[ConvToDirective(Mips::A3)]), false);
   params.push_back(
-      Builder.CreatePtrToInt(addrbuf0, Type::getInt32Ty(getGlobalContext())));
+      Builder.CreatePtrToInt(addrbuf0, Type::getInt32Ty(Context)));
   params.push_back(
-      Builder.CreatePtrToInt(addrbuf1, Type::getInt32Ty(getGlobalContext())));
+      Builder.CreatePtrToInt(addrbuf1, Type::getInt32Ty(Context)));
   params.push_back(
-      Builder.CreatePtrToInt(addrbuf2, Type::getInt32Ty(getGlobalContext())));
+      Builder.CreatePtrToInt(addrbuf2, Type::getInt32Ty(Context)));
   params.push_back(
-      Builder.CreatePtrToInt(addrbuf3, Type::getInt32Ty(getGlobalContext())));
+      Builder.CreatePtrToInt(addrbuf3, Type::getInt32Ty(Context)));
   V = Builder.CreateStore(Builder.CreateCall(fun, params),
                           IREmitter.Regs[ConvToDirective(Mips::V0)]);
   ReadMap[ConvToDirective(Mips::A0)] = true;
@@ -591,8 +595,8 @@ bool SyscallsIface::HandleLibcScanf(Value *&V, Value **First) {
 }
 
 bool SyscallsIface::HandleXstat(Value *&V, Value **First) {
-  SmallVector<Type *, 8> args(3, Type::getInt32Ty(getGlobalContext()));
-  FunctionType *ft = FunctionType::get(Type::getInt32Ty(getGlobalContext()),
+  SmallVector<Type *, 8> args(3, Type::getInt32Ty(Context));
+  FunctionType *ft = FunctionType::get(Type::getInt32Ty(Context),
                                        args, /*isvararg*/false);
   Value *fun = TheModule->getOrInsertFunction("__xstat", ft);
   SmallVector<Value *, 8> params;
@@ -603,11 +607,11 @@ bool SyscallsIface::HandleXstat(Value *&V, Value **First) {
   params.push_back(Builder.CreatePtrToInt(
       IREmitter.AccessShadowMemory(
           Builder.CreateLoad(IREmitter.Regs[ConvToDirective(Mips::A1)]), false),
-      Type::getInt32Ty(getGlobalContext())));
+      Type::getInt32Ty(Context)));
   Value *StatStruct = Builder.CreatePtrToInt(
       IREmitter.AccessShadowMemory(
           Builder.CreateLoad(IREmitter.Regs[ConvToDirective(Mips::A2)]), false),
-      Type::getInt32Ty(getGlobalContext()));
+      Type::getInt32Ty(Context));
   params.push_back(StatStruct);
   V = Builder.CreateStore(Builder.CreateCall(fun, params),
                           IREmitter.Regs[ConvToDirective(Mips::V0)]);
@@ -617,13 +621,13 @@ bool SyscallsIface::HandleXstat(Value *&V, Value **First) {
       Builder.CreateLoad(Builder.CreateIntToPtr(
           Builder.CreateAdd(
               StatStruct,
-              ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 44)),
-          Type::getInt32PtrTy(getGlobalContext()))),
+              ConstantInt::get(Type::getInt32Ty(Context), 44)),
+          Type::getInt32PtrTy(Context))),
       Builder.CreateIntToPtr(
           Builder.CreateAdd(
               StatStruct,
-              ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 48)),
-          Type::getInt32PtrTy(getGlobalContext())));
+              ConstantInt::get(Type::getInt32Ty(Context), 48)),
+          Type::getInt32PtrTy(Context)));
   ReadMap[ConvToDirective(Mips::A0)] = true;
   ReadMap[ConvToDirective(Mips::A1)] = true;
   ReadMap[ConvToDirective(Mips::A2)] = true;
@@ -640,10 +644,10 @@ bool SyscallsIface::HandleLibcLseek(Value *&V, Value **First) {
   }
 
   SmallVector<Type *, 8> args;
-  args.push_back(Type::getInt32Ty(getGlobalContext()));
-  args.push_back(Type::getInt64Ty(getGlobalContext()));
-  args.push_back(Type::getInt32Ty(getGlobalContext()));
-  FunctionType *ft = FunctionType::get(Type::getInt32Ty(getGlobalContext()),
+  args.push_back(Type::getInt32Ty(Context));
+  args.push_back(Type::getInt64Ty(Context));
+  args.push_back(Type::getInt32Ty(Context));
+  FunctionType *ft = FunctionType::get(Type::getInt32Ty(Context),
                                        args, /*isvararg*/ false);
   Value *fun = TheModule->getOrInsertFunction("lseek", ft);
   SmallVector<Value *, 8> params;
@@ -652,7 +656,7 @@ bool SyscallsIface::HandleLibcLseek(Value *&V, Value **First) {
     *First = GetFirstInstruction(*First, Arg0);
   Value *Arg1 = Builder.CreateZExt(
       Builder.CreateLoad(IREmitter.Regs[ConvToDirective(Mips::A1)]),
-      Type::getInt64Ty(getGlobalContext()));
+      Type::getInt64Ty(Context));
   Value *Arg2 = Builder.CreateLoad(IREmitter.Regs[ConvToDirective(Mips::A2)]);
   params.push_back(Arg0);
   params.push_back(Arg1);
@@ -674,13 +678,13 @@ bool SyscallsIface::HandleGenericDouble(Value *&V, StringRef Name, int numargs,
     switch (ArgTypes[I]) {
     case AT_Int32:
     case AT_Ptr:
-      args.push_back(Type::getInt32Ty(getGlobalContext()));
+      args.push_back(Type::getInt32Ty(Context));
       break;
     case AT_Float:
-      args.push_back(Type::getFloatTy(getGlobalContext()));
+      args.push_back(Type::getFloatTy(Context));
       break;
     case AT_Double:
-      args.push_back(Type::getDoubleTy(getGlobalContext()));
+      args.push_back(Type::getDoubleTy(Context));
       break;
     default:
       llvm_unreachable("Unhandled arg type for HandleGenericDouble");
@@ -689,21 +693,21 @@ bool SyscallsIface::HandleGenericDouble(Value *&V, StringRef Name, int numargs,
 
   FunctionType *ft;
   if (numret == 0)
-    ft = FunctionType::get(Type::getVoidTy(getGlobalContext()), args,
+    ft = FunctionType::get(Type::getVoidTy(Context), args,
                            /*isvararg*/ false);
   else if (numret == 1) {
     switch(ArgTypes[numargs]) {
     case AT_Double:
-      ft = FunctionType::get(Type::getDoubleTy(getGlobalContext()), args,
+      ft = FunctionType::get(Type::getDoubleTy(Context), args,
                              /*isvararg*/ false);
       break;
     case AT_Float:
-      ft = FunctionType::get(Type::getFloatTy(getGlobalContext()), args,
+      ft = FunctionType::get(Type::getFloatTy(Context), args,
                              /*isvararg*/ false);
       break;
     case AT_Ptr:
     case AT_Int32:
-      ft = FunctionType::get(Type::getInt32Ty(getGlobalContext()), args,
+      ft = FunctionType::get(Type::getInt32Ty(Context), args,
                              /*isvararg*/ false);
       break;
     default:
@@ -715,23 +719,23 @@ bool SyscallsIface::HandleGenericDouble(Value *&V, StringRef Name, int numargs,
 
   AttributeSet attrs;
   if (CodeTarget == "arm") {
-    attrs = attrs.addAttribute(getGlobalContext(), AttributeSet::FunctionIndex,
+    attrs = attrs.addAttribute(Context, AttributeSet::FunctionIndex,
                                Attribute::NoUnwind)
-                .addAttribute(getGlobalContext(), AttributeSet::FunctionIndex,
+                .addAttribute(Context, AttributeSet::FunctionIndex,
                               "less-precise-fpmad", "false")
-                .addAttribute(getGlobalContext(), AttributeSet::FunctionIndex,
+                .addAttribute(Context, AttributeSet::FunctionIndex,
                               "no-frame-pointer-elim", "true")
-                .addAttribute(getGlobalContext(), AttributeSet::FunctionIndex,
+                .addAttribute(Context, AttributeSet::FunctionIndex,
                               "no-frame-pointer-elim-non-leaf", "true")
-                .addAttribute(getGlobalContext(), AttributeSet::FunctionIndex,
+                .addAttribute(Context, AttributeSet::FunctionIndex,
                               "no-infs-fp-math", "false")
-                .addAttribute(getGlobalContext(), AttributeSet::FunctionIndex,
+                .addAttribute(Context, AttributeSet::FunctionIndex,
                               "no-nans-fp-math", "false")
-                .addAttribute(getGlobalContext(), AttributeSet::FunctionIndex,
+                .addAttribute(Context, AttributeSet::FunctionIndex,
                               "stack-protector-buffer-size", "8")
-                .addAttribute(getGlobalContext(), AttributeSet::FunctionIndex,
+                .addAttribute(Context, AttributeSet::FunctionIndex,
                               "unsafe-fp-math", "false")
-                .addAttribute(getGlobalContext(), AttributeSet::FunctionIndex,
+                .addAttribute(Context, AttributeSet::FunctionIndex,
                               "use-soft-float", "false");
   }
 
@@ -752,7 +756,7 @@ bool SyscallsIface::HandleGenericDouble(Value *&V, StringRef Name, int numargs,
           *First = GetFirstInstruction(*First, f);
         Value *addrbuf = IREmitter.AccessShadowMemory(f, false);
         params.push_back(Builder.CreatePtrToInt(
-            addrbuf, Type::getInt32Ty(getGlobalContext())));
+            addrbuf, Type::getInt32Ty(Context)));
         ReadMap[ConvToDirective(Mips::A0) + numInts++ + (numDoubles << 1) +
                 numFloats] = true;
         break;
@@ -818,10 +822,10 @@ bool SyscallsIface::HandleGenericDouble(Value *&V, StringRef Name, int numargs,
       if (NoShadow) {
         V = Builder.CreateStore(V, IREmitter.Regs[ConvToDirective(Mips::V0)]);
       } else {
-        Value *zero = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0);
+        Value *zero = ConstantInt::get(Type::getInt32Ty(Context), 0);
         Value *cmp = Builder.CreateICmpEQ(V, zero);
         Value *ptr = Builder.CreatePtrToInt(
-            IREmitter.ShadowImageValue, Type::getInt32Ty(getGlobalContext()));
+            IREmitter.ShadowImageValue, Type::getInt32Ty(Context));
         Value *fixed = Builder.CreateSub(V, ptr);
         Value *final = Builder.CreateSelect(cmp, zero, fixed);
         V = Builder.CreateStore(final,
@@ -839,8 +843,8 @@ bool SyscallsIface::HandleGenericDouble(Value *&V, StringRef Name, int numargs,
 }
 
 bool SyscallsIface::HandleLibcAtof(Value *&V, Value **First) {
-  SmallVector<Type *, 8> args(1, Type::getInt32Ty(getGlobalContext()));
-  FunctionType *ft = FunctionType::get(Type::getDoubleTy(getGlobalContext()),
+  SmallVector<Type *, 8> args(1, Type::getInt32Ty(Context));
+  FunctionType *ft = FunctionType::get(Type::getDoubleTy(Context),
                                        args, /*isvararg*/ true);
   Value *fun = TheModule->getOrInsertFunction("atof", ft);
   SmallVector<Value *, 8> params;
@@ -850,7 +854,7 @@ bool SyscallsIface::HandleLibcAtof(Value *&V, Value **First) {
     *First = GetFirstInstruction(*First, f);
   Value *addrbuf = IREmitter.AccessShadowMemory(f, false);
   params.push_back(
-      Builder.CreatePtrToInt(addrbuf, Type::getInt32Ty(getGlobalContext())));
+      Builder.CreatePtrToInt(addrbuf, Type::getInt32Ty(Context)));
 
   Value *call = Builder.CreateCall(fun, params);
   V = call;
@@ -862,8 +866,8 @@ bool SyscallsIface::HandleLibcAtof(Value *&V, Value **First) {
 }
 
 bool SyscallsIface::HandleSyscallWrite(Value *&V, Value **First) {
-  SmallVector<Type *, 8> args(3, Type::getInt32Ty(getGlobalContext()));
-  FunctionType *ft = FunctionType::get(Type::getInt32Ty(getGlobalContext()),
+  SmallVector<Type *, 8> args(3, Type::getInt32Ty(Context));
+  FunctionType *ft = FunctionType::get(Type::getInt32Ty(Context),
                                        args, /*isvararg*/ false);
   Value *fun = TheModule->getOrInsertFunction("write", ft);
   SmallVector<Value *, 8> params;
@@ -874,7 +878,7 @@ bool SyscallsIface::HandleSyscallWrite(Value *&V, Value **First) {
   Value *addrbuf = IREmitter.AccessShadowMemory(
       Builder.CreateLoad(IREmitter.Regs[ConvToDirective(Mips::A1)]), false);
   params.push_back(
-      Builder.CreatePtrToInt(addrbuf, Type::getInt32Ty(getGlobalContext())));
+      Builder.CreatePtrToInt(addrbuf, Type::getInt32Ty(Context)));
   params.push_back(
       Builder.CreateLoad(IREmitter.Regs[ConvToDirective(Mips::A2)]));
 
@@ -17,8 +17,9 @@ public:
   enum ArgType { AT_Int32, AT_Float, AT_Double, AT_Ptr, AT_PtrPtr };
 
   SyscallsIface(OiIREmitter &ir, StringRef CodeTarget)
-      : CodeTarget(CodeTarget), IREmitter(ir), TheModule(ir.TheModule),
-        Builder(ir.Builder), ReadMap(ir.ReadMap), WriteMap(ir.WriteMap) {}
+      : CodeTarget(CodeTarget), IREmitter(ir), Context(ir.Context),
+        TheModule(ir.TheModule), Builder(ir.Builder), ReadMap(ir.ReadMap),
+        WriteMap(ir.WriteMap) {}
 
   bool HandleSyscallWrite(Value *&V, Value **First = 0);
   bool HandleLibcAtoi(Value *&V, Value **First = 0);
@@ -50,6 +51,7 @@ private:
 
   StringRef CodeTarget;
   OiIREmitter &IREmitter;
+  LLVMContext &Context;
   std::unique_ptr<Module> &TheModule;
   IRBuilder<> &Builder;
   DenseMap<int32_t, bool> &ReadMap, &WriteMap;
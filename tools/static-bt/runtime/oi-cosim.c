@@ -0,0 +1,70 @@
+/*===-- oi-cosim.c - Co-simulation runtime for static-bt output -----------===*\
+|*                                                                            *|
+|*                     The LLVM Compiler Infrastructure                       *|
+|*                                                                            *|
+|* This file is distributed under the University of Illinois Open Source      *|
+|* License. See LICENSE.TXT for details.                                      *|
+|*                                                                            *|
+|*===----------------------------------------------------------------------===*|
+|*                                                                            *|
+|* Link this file with a program translated by static-bt -cosim. Each        *|
+|* translated function entry then appends a record with the guest registers  *|
+|* to the file named by $OI_COSIM_FILE (default "cosim.trace"), which may be *|
+|* a FIFO read by oii -cosim running the same program.                       *|
+|*                                                                            *|
+|* The stream starts with the magic "OICOSIM\0", a u32 version and the       *|
+|* symbol table: u32 count, then count x (u32 length, name). Each record is  *|
+|* a u32 symbol index, the 32 general purpose registers, hi and lo. All      *|
+|* fields are in host byte order.                                            *|
+|*                                                                            *|
+\*===----------------------------------------------------------------------===*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern const char *const oi_cosim_names[];
+extern const int32_t oi_cosim_count;
+
+#define REG(N) extern uint32_t reg##N;
+REG(1) REG(2) REG(3) REG(4) REG(5) REG(6) REG(7) REG(8) REG(9) REG(10)
+REG(11) REG(12) REG(13) REG(14) REG(15) REG(16) REG(17) REG(18) REG(19)
+REG(20) REG(21) REG(22) REG(23) REG(24) REG(25) REG(26) REG(27) REG(28)
+REG(29) REG(30) REG(31) REG(256) REG(257)
+#undef REG
+
+static FILE *Out;
+
+static void Write32(uint32_t V) { fwrite(&V, sizeof(V), 1, Out); }
+
+static void OpenStream(void) {
+  static const char Magic[8] = { 'O', 'I', 'C', 'O', 'S', 'I', 'M', 0 };
+  const char *Name = getenv("OI_COSIM_FILE");
+  int32_t I;
+  Out = fopen(Name ? Name : "cosim.trace", "wb");
+  if (!Out) {
+    perror("oi-cosim");
+    exit(1);
+  }
+  fwrite(Magic, sizeof(Magic), 1, Out);
+  Write32(1);
+  Write32(oi_cosim_count);
+  for (I = 0; I < oi_cosim_count; ++I) {
+    uint32_t Len = strlen(oi_cosim_names[I]);
+    Write32(Len);
+    fwrite(oi_cosim_names[I], 1, Len, Out);
+  }
+}
+
+void oi_cosim_hook(int32_t Index) {
+  uint32_t Rec[35] = {
+    Index, 0,     reg1,  reg2,  reg3,  reg4,  reg5,  reg6,  reg7,
+    reg8,  reg9,  reg10, reg11, reg12, reg13, reg14, reg15, reg16,
+    reg17, reg18, reg19, reg20, reg21, reg22, reg23, reg24, reg25,
+    reg26, reg27, reg28, reg29, reg30, reg31, reg257, reg256
+  };
+  if (!Out)
+    OpenStream();
+  fwrite(Rec, sizeof(Rec), 1, Out);
+}
@@ -8,16 +8,24 @@
 #include "StringRefMemoryObject.h"
 #include "SBTUtils.h"
 #include "OiCombinePass.h"
+#include "OiFramePass.h"
+#include "OiProfileData.h"
+#include "OiRegLivenessPass.h"
+#include "OiSignaturePass.h"
+#include "OiTranslationCache.h"
 //#include "MCFunction.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/DataTypes.h"
 #include "llvm/Analysis/Passes.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/PassManager.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/Linker/Linker.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/Triple.h"
@@ -43,8 +51,10 @@
 #include "llvm/Support/GraphWriter.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/MemoryObject.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/PrettyStackTrace.h"
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/SourceMgr.h"
@@ -53,8 +63,11 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <cstring>
+#include <deque>
+#include <thread>
 
 namespace llvm {
 
@@ -90,6 +103,28 @@ static cl::opt<std::string> OutputFilename("o", cl::desc("Output filename"),
 static cl::opt<bool>
     Optimize("optimize", cl::desc("Optimize the output LLVM bitcode file"));
 
+static cl::opt<unsigned>
+    OptLevel("O", cl::Prefix, cl::init(0),
+             cl::desc("Optimization level: -O1, -O2 or -O3 follow -optimize "
+                      "with the standard pipeline, including inlining and "
+                      "loop optimizations. -time-passes reports the time "
+                      "taken by each pass"));
+
+static cl::opt<bool> NoRegLiveness(
+    "noregliveness",
+    cl::desc("When optimizing, keep the register copies made at calls and "
+             "returns even for registers that are not live across them"));
+
+static cl::opt<bool> NoSignatures(
+    "nosignatures",
+    cl::desc("When optimizing, keep translated functions without parameters "
+             "or results, passing them in the register globals"));
+
+static cl::opt<bool> NoFrames(
+    "noframes",
+    cl::desc("When optimizing, keep guest stack slots in the shadow memory "
+             "instead of recovering them as locals"));
+
 static cl::opt<uint32_t>
     StackSize("stacksize", cl::desc("Specifies the space reserved for the stack"
                                     "(Default 300B)"),
@@ -98,6 +133,24 @@ static cl::opt<uint32_t>
 static cl::opt<bool> Dump("dump",
                           cl::desc("Dump the output LLVM bitcode file"));
 
+static cl::opt<unsigned>
+    Jobs("j", cl::desc("Translate functions on this many threads, each into "
+                       "a module of its own (Default 1)"),
+         cl::init(1));
+
+static cl::opt<std::string>
+    CacheDir("cache-dir",
+             cl::desc("Keep translated functions in this directory and "
+                      "reuse them while their code does not change"),
+             cl::value_desc("directory"));
+
+static cl::opt<std::string>
+    ProfileUse("profile-use",
+               cl::desc("Weight branches, promote indirect calls and jumps "
+                        "to their usual targets and mark hot and cold "
+                        "functions after this oii -profile file"),
+               cl::value_desc("filename"));
+
 static cl::list<std::string> MAttrs("mattr", cl::CommaSeparated,
                                     cl::desc("Target specific attributes"),
                                     cl::value_desc("a1,+a2,-a3,..."));
@@ -172,29 +225,153 @@ static tool_output_file *GetBitcodeOutputStream() {
   return Out;
 }
 
-void OptimizeAndWriteBitcode(OiInstTranslate *oit) {
-  Module *m = oit->takeModule();
-  FunctionPassManager OurFPM(m);
+// The per-function pipeline of -optimize, which also starts -O<n>
+static void AddFunctionPasses(FunctionPassManager &FPM) {
+  FPM.add(new DataLayoutPass());
+  FPM.add(createVerifierPass());
+  FPM.add(createPromoteMemoryToRegisterPass());
+  FPM.add(new OiCombinePass());
+  FPM.add(createInstructionCombiningPass());
+  FPM.add(createReassociatePass());
+  FPM.add(createGVNPass());
+  FPM.add(createCFGSimplificationPass());
+}
 
-  if (Optimize) {
-    outs() << "Running verification and basic optimization pipeline...\n";
-    OurFPM.add(createVerifierPass());
-    OurFPM.add(createPromoteMemoryToRegisterPass());
-    OurFPM.add(new OiCombinePass());
-    OurFPM.add(createInstructionCombiningPass());
-    OurFPM.add(createReassociatePass());
-    OurFPM.add(createGVNPass());
-    OurFPM.add(createCFGSimplificationPass());
-
-    OurFPM.doInitialization();
-
-    for (Module::iterator I = m->begin(); I != m->end(); ++I) {
-      if (I->isDeclaration())
+// Runs the per-function pipeline over every function defined in M. It only
+// touches M and its context, so modules of different contexts may be
+// optimized concurrently.
+static void OptimizeFunctions(Module *M) {
+  FunctionPassManager OurFPM(M);
+  AddFunctionPasses(OurFPM);
+  OurFPM.doInitialization();
+  for (Module::iterator I = M->begin(); I != M->end(); ++I) {
+    if (I->isDeclaration())
+      continue;
+    verifyFunction(*I);
+    OurFPM.run(*I);
+  }
+  OurFPM.doFinalization();
+}
+
+// Deletes the stores to register globals that no function reads, found by
+// a liveness analysis of the registers over the call graph of M. It needs
+// the whole program, after the per-function pipeline has turned the copies
+// between the register globals and locals into plain loads and stores.
+static void RemoveDeadRegisterSyncs(Module *M,
+                                    ArrayRef<GlobalVariable *> Regs) {
+  OiRegLivenessPass *Pass = new OiRegLivenessPass(Regs);
+  PassManager PM;
+  PM.add(Pass);
+  PM.run(*M);
+  printf("INFO: Register liveness removed %u register copies.\n",
+         Pass->getNumDeleted());
+}
+
+// Gives the functions of M parameters and results for the argument and
+// result registers they use, and forwards the values through the register
+// globals with the per-function pipeline.
+static void RecoverSignatures(Module *M, ArrayRef<GlobalVariable *> Regs,
+                              ArrayRef<GlobalVariable *> ArgRegs,
+                              ArrayRef<GlobalVariable *> RetRegs) {
+  OiSignaturePass *Pass = new OiSignaturePass(Regs, ArgRegs, RetRegs);
+  PassManager PM;
+  PM.add(Pass);
+  PM.run(*M);
+  printf("INFO: Recovered the signature of %u functions.\n",
+         Pass->getNumRewritten());
+  if (Pass->getNumRewritten() > 0)
+    OptimizeFunctions(M);
+}
+
+// Moves the guest stack slots of the functions of M to allocas, and promotes
+// them with the per-function pipeline.
+static void RecoverFrames(Module *M, GlobalVariable *SP,
+                          GlobalVariable *Shadow) {
+  OiFramePass *Pass = new OiFramePass(SP, Shadow);
+  PassManager PM;
+  PM.add(Pass);
+  PM.run(*M);
+  printf("INFO: Recovered %u guest stack slots as locals.\n",
+         Pass->getNumSlots());
+  if (Pass->getNumSlots() > 0)
+    OptimizeFunctions(M);
+}
+
+// Functions that retired at least this percentage of the profiled guest
+// instructions are hinted for inlining
+static const unsigned HotPercent = 1;
+
+// Marks the hottest functions of M under Profile for inlining, and the
+// functions that never ran as cold. Only functions between the first and
+// last ones that ran are known not to have run.
+static void ApplyProfile(Module *M, const OiProfileData &Profile) {
+  unsigned NumHot = 0, NumCold = 0;
+  uint64_t Total = Profile.getTotalInstructions();
+  for (Function &F : *M) {
+    uint64_t Addr;
+    if (F.isDeclaration() || !F.getName().startswith("a") ||
+        F.getName().substr(1).getAsInteger(16, Addr))
+      continue;
+    uint64_t Insts = Profile.getInstructions(Addr);
+    if (Insts == 0) {
+      if (Addr < Profile.getFirstFunction() ||
+          Addr > Profile.getLastFunction())
         continue;
-      verifyFunction(*I);
-      OurFPM.run(*I);
+      F.addFnAttr(Attribute::Cold);
+      ++NumCold;
+    } else if (Insts * 100 >= Total * HotPercent) {
+      F.addFnAttr(Attribute::InlineHint);
+      ++NumHot;
     }
   }
+  printf("INFO: Profile marked %u functions hot and %u cold.\n", NumHot,
+         NumCold);
+}
+
+// Runs the standard module pipeline of -O<n> over the whole program
+static void OptimizeModule(Module *M) {
+  PassManagerBuilder Builder;
+  Builder.OptLevel = OptLevel;
+  Builder.Inliner = createFunctionInliningPass(OptLevel, 0);
+  Builder.LoopVectorize = OptLevel > 1;
+  Builder.SLPVectorize = OptLevel > 1;
+
+  PassManager MPM;
+  MPM.add(new DataLayoutPass());
+  Builder.populateModulePassManager(MPM);
+  MPM.run(*M);
+}
+
+// FunctionsOptimized tells that the per-function pipeline already ran, on
+// the single-function modules linked into oit's.
+void OptimizeAndWriteBitcode(OiInstTranslate *oit, bool FunctionsOptimized) {
+  std::vector<GlobalVariable *> Regs = oit->GetRegisterGlobals();
+  std::vector<GlobalVariable *> ArgRegs, RetRegs;
+  oit->GetAbiRegisterGlobals(ArgRegs, RetRegs);
+  GlobalVariable *SP = oit->GetStackPointerGlobal();
+  GlobalVariable *Shadow = oit->GetShadowMemory();
+  const OiProfileData *Profile = oit->GetProfile();
+  Module *m = oit->takeModule();
+
+  if (Profile)
+    ApplyProfile(m, *Profile);
+  if ((Optimize || OptLevel > 0) && !FunctionsOptimized) {
+    outs() << "Running verification and basic optimization pipeline...\n";
+    OptimizeFunctions(m);
+  }
+  // Co-simulation hooks read every register from the globals
+  if ((Optimize || OptLevel > 0) && !CoSim) {
+    if (!NoSignatures)
+      RecoverSignatures(m, Regs, ArgRegs, RetRegs);
+    if (!NoRegLiveness)
+      RemoveDeadRegisterSyncs(m, Regs);
+  }
+  if ((Optimize || OptLevel > 0) && !NoFrames)
+    RecoverFrames(m, SP, Shadow);
+  if (OptLevel > 0) {
+    outs() << "Running -O" << OptLevel << " optimization pipeline...\n";
+    OptimizeModule(m);
+  }
 
   // Set up the optimizer pipeline.  Start with registering info about how the
   // target lays out data structures.
@@ -226,6 +403,156 @@ void OptimizeAndWriteBitcode(OiInstTranslate *oit) {
   delete m;
 }
 
+namespace {
+// A function to translate: the bytes of one symbol of a text section, up to
+// the next symbol
+struct TranslationItem {
+  SectionRef Section;
+  StringRef Name;
+  StringRef Bytes;   // Contents of the whole section
+  uint64_t SectionAddr;
+  uint64_t Start;    // Section offsets of the symbol
+  uint64_t End;
+  uint64_t Offset;   // Added to section offsets to get guest addresses
+  int CoSimIndex;    // Co-simulation hook index, or -1 for no hook
+  // Relocations of the section, with -cache-dir
+  const std::vector<RelocationReader::ResolvedRelocation> *Relocs;
+};
+}
+
+// Everything the translation of Item depends on, other than the shadow
+// image words its cache entry lists: the options, the code and relocations
+// of the function and the code pointers into it (Owned). Optimized tells
+// whether the per-function pipeline runs before the module is cached.
+static std::string
+TranslationKey(const OiInstTranslate &IP, const TranslationItem &Item,
+               uint64_t NextFunAddr,
+               ArrayRef<std::pair<uint64_t, uint64_t>> Owned, bool Optimized) {
+  MD5 Hash;
+  auto AddInt = [&Hash](uint64_t V) {
+    uint8_t Bytes[8];
+    for (unsigned I = 0; I < 8; ++I)
+      Bytes[I] = V >> (I * 8);
+    Hash.update(Bytes);
+  };
+  auto AddString = [&](StringRef S) {
+    AddInt(S.size());
+    Hash.update(S);
+  };
+
+  AddString(OiTranslationCache::Version);
+  AddString(CodeTarget);
+  AddInt(OneRegion);
+  AddInt(NoLocals);
+  AddInt(AbiLocals);
+  AddInt(OptimizeStack);
+  AddInt(AggrOptimizeStack);
+  AddInt(NoShadow);
+  AddInt(Optimized);
+  AddInt(Item.CoSimIndex + 1);
+  AddInt(Item.Name == "main");
+  AddInt(IP.GetShadowSize());
+
+  uint64_t Begin = Item.Start + Item.Offset, End = Item.End + Item.Offset;
+  AddInt(Begin);
+  AddInt(End);
+  AddInt(NextFunAddr);
+  // The last instruction may reach past End
+  AddString(Item.Bytes.slice(Item.Start, Item.End + GetInstructionSize()));
+
+  auto R = std::lower_bound(
+      Item.Relocs->begin(), Item.Relocs->end(), Begin,
+      [](const RelocationReader::ResolvedRelocation &R, uint64_t A) {
+        return R.Addr < A;
+      });
+  for (; R != Item.Relocs->end() && R->Addr < End; ++R) {
+    AddInt(R->Addr);
+    AddInt(R->Type);
+    AddString(R->Symbol);
+    AddInt(R->Resolved);
+    AddInt(R->Value);
+  }
+
+  // Indirect jumps are only resolved if the program has code pointers, and
+  // dispatched on guest addresses if it has no relocations
+  AddInt(IP.GetCodePtrRelocs().empty());
+  AddInt(IP.HasRelocations());
+  for (const auto &Ptr : Owned) {
+    AddInt(Ptr.first);
+    AddInt(Ptr.second);
+  }
+
+  // Branch weights and promoted targets come from the edges leaving the code
+  AddInt(IP.GetProfile() != nullptr);
+  if (IP.GetProfile())
+    for (const auto &E :
+         IP.GetProfile()->getEdgesIn(Begin, End + GetInstructionSize())) {
+      AddInt(E.From);
+      AddInt(E.To);
+      AddInt(E.Count);
+    }
+
+  MD5::MD5Result Result;
+  Hash.final(Result);
+  SmallString<32> Str;
+  MD5::stringifyResult(Result, Str);
+  return Str.str();
+}
+
+// Translate one function into IP's module. NumProcessed, if given, counts
+// instructions for the progress dots.
+static void TranslateFunction(OiInstTranslate &IP,
+                              const MCDisassembler &DisAsm,
+                              const TranslationItem &Item,
+                              uint64_t *NumProcessed) {
+#ifndef NDEBUG
+  raw_ostream &DebugOut = DebugFlag ? dbgs() : nulls();
+#else
+  raw_ostream &DebugOut = nulls();
+#endif
+  ArrayRef<uint8_t> Bytes(
+      reinterpret_cast<const uint8_t *>(Item.Bytes.data()), Item.Bytes.size());
+  uint64_t eoffset = Item.Offset;
+
+  IP.SetCurSection(&Item.Section);
+  if (Item.Name == "main")
+    IP.StartMainFunction(Item.Start + eoffset);
+  else
+    IP.StartFunction(
+        Twine("a").concat(Twine::utohexstr(Item.Start + eoffset)).str(),
+        Item.Start + eoffset);
+  if (Item.CoSimIndex >= 0)
+    IP.InsertCoSimHook(Item.CoSimIndex);
+  uint64_t Size;
+  for (uint64_t Index = Item.Start; Index < Item.End; Index += Size) {
+    MCInst Inst;
+
+    IP.UpdateCurAddr(Index + eoffset);
+    if (DisAsm.getInstruction(Inst, Size, Bytes.slice(Index),
+                              Item.SectionAddr + Index, DebugOut, nulls())) {
+#ifndef NDEBUG
+      outs() << format("%8" PRIx64 ":", eoffset + Index);
+      outs() << "\t";
+      DumpBytes(StringRef(Item.Bytes.data() + Index, Size));
+#endif
+      IP.printInst(&Inst, outs(), "");
+      if (NumProcessed && ++*NumProcessed % 10000 == 0) {
+        outs() << ".";
+      }
+#ifndef NDEBUG
+      outs() << "\n";
+#endif
+    } else {
+      errs() << ToolName << ": warning: invalid instruction encoding\n";
+      DumpBytes(StringRef(Item.Bytes.data() + Index, Size));
+      exit(1);
+      if (Size == 0)
+        Size = 1; // skip illegible bytes
+    }
+  }
+  IP.FinishFunction();
+}
+
 static void DisassembleObject(const ObjectFile *Obj, bool InlineRelocs) {
   const Target *TheTarget = getTarget(Obj);
   // getTarget() will have already issued a diagnostic if necessary, so
@@ -294,10 +621,20 @@ static void DisassembleObject(const ObjectFile *Obj, bool InlineRelocs) {
     return;
   }
 
-#ifdef NDEBUG
-  uint64_t NumProcessed = 0;
-  outs() << "Binary translation in progress...";
-#endif
+  std::unique_ptr<OiProfileData> Profile;
+  if (!ProfileUse.empty()) {
+    std::string Error;
+    Profile = OiProfileData::read(ProfileUse, Error);
+    if (!Profile) {
+      errs() << ToolName << ": cannot read profile '" << ProfileUse
+             << "': " << Error << "\n";
+      return;
+    }
+  }
+
+  // Split the text sections into one work item per function
+  std::vector<TranslationItem> Items;
+  std::deque<std::vector<RelocationReader::ResolvedRelocation>> SectionRelocs;
   std::error_code ec;
   for (const SectionRef &i : Obj->sections()) {
     if (error(ec))
@@ -305,8 +642,6 @@ static void DisassembleObject(const ObjectFile *Obj, bool InlineRelocs) {
     if (!i.isText())
       continue;
 
-    IP->SetCurSection(&i);
-
     uint64_t SectionAddr = i.getAddress();
 
     // Make a list of all the symbols in this section.
@@ -336,13 +671,13 @@ static void DisassembleObject(const ObjectFile *Obj, bool InlineRelocs) {
     StringRef BytesStr;
     if (error(i.getContents(BytesStr)))
       break;
-    ArrayRef<uint8_t> Bytes(reinterpret_cast<const uint8_t *>(BytesStr.data()),
-                            BytesStr.size());
 
-    uint64_t Size;
-    uint64_t Index;
     uint64_t SectSize = i.getSize();
 
+    SectionRelocs.emplace_back();
+    if (!CacheDir.empty())
+      IP->ListRelocations(i, SectionRelocs.back());
+
     // Disassemble symbol by symbol.
     for (unsigned si = 0, se = Symbols.size(); si != se; ++si) {
       uint64_t Start = Symbols[si].first;
@@ -358,62 +693,189 @@ static void DisassembleObject(const ObjectFile *Obj, bool InlineRelocs) {
         // This symbol has the same address as the next symbol. Skip it.
         continue;
 
-#ifndef NDEBUG
-      outs() << '\n' << Symbols[si].second << ":\n";
-#endif
-
-#ifndef NDEBUG
-      raw_ostream &DebugOut = DebugFlag ? dbgs() : nulls();
-#else
-      raw_ostream &DebugOut = nulls();
-#endif
-      uint64_t eoffset = SectionAddr;
+      TranslationItem Item;
+      Item.Section = i;
+      Item.Name = Symbols[si].second;
+      Item.Bytes = BytesStr;
+      Item.SectionAddr = SectionAddr;
+      Item.Start = Start;
+      Item.End = End;
+      Item.Offset = SectionAddr;
       /* Relocatable object */
       if (SectionAddr == 0)
-        eoffset = GetELFOffset(i);
+        Item.Offset = GetELFOffset(i);
+      // main is not hooked: its startup code sets up the stack and
+      // arguments in locals only, so the globals do not reflect them.
+      Item.CoSimIndex = -1;
+      if (CoSim && !OneRegion && Item.Name != "main")
+        Item.CoSimIndex = IP->AddCoSimName(Item.Name);
+      Item.Relocs = &SectionRelocs.back();
+      Items.push_back(Item);
+    }
+  }
 
-      if (Symbols[si].second == "main")
-        IP->StartMainFunction(Start + eoffset);
-      else
-        IP->StartFunction(
-            Twine("a").concat(Twine::utohexstr(Start + eoffset)).str(),
-            Start + eoffset);
-      for (Index = Start; Index < End; Index += Size) {
-        MCInst Inst;
-
-        IP->UpdateCurAddr(Index + eoffset);
-        if (DisAsm->getInstruction(Inst, Size, Bytes.slice(Index),
-                                   SectionAddr + Index, DebugOut, nulls())) {
+  // A profile of another program, or of this one loaded elsewhere, would
+  // not match any of its addresses
+  if (Profile) {
+    uint64_t ImageBegin = ~0ULL, ImageEnd = 0;
+    for (const TranslationItem &Item : Items) {
+      ImageBegin = std::min(ImageBegin, Item.Start + Item.Offset);
+      ImageEnd = std::max(ImageEnd, Item.End + Item.Offset + 1);
+    }
+    if (sys::path::stem(Profile->getBinary()) !=
+        sys::path::stem(Obj->getFileName())) {
+      errs() << ToolName << ": warning: profile '" << ProfileUse
+             << "' is for '" << Profile->getBinary() << "', ignoring it\n";
+      Profile.reset();
+    } else if (!Profile->hasFunctionsIn(ImageBegin, ImageEnd)) {
+      errs() << ToolName << ": warning: no function in profile '"
+             << ProfileUse << "' is in the translated code, ignoring it\n";
+      Profile.reset();
+    } else {
+      IP->SetProfile(&*Profile);
+    }
+  }
+
+  // One-region mode builds the whole program as a single function
+  unsigned NumThreads = OneRegion ? 1 : Jobs;
+  bool UseCache = !OneRegion && !CacheDir.empty();
+  if (OneRegion && !CacheDir.empty())
+    errs() << ToolName << ": warning: -cache-dir is ignored with -oneregion\n";
 #ifndef NDEBUG
-          outs() << format("%8" PRIx64 ":", eoffset + Index);
-          outs() << "\t";
-          DumpBytes(StringRef(BytesStr.data() + Index, Size));
+  // Translation lists every instruction on outs(); keep the listing readable
+  if (NumThreads > 1) {
+    errs() << ToolName << ": warning: -j is ignored in builds with assertions"
+           << "\n";
+    NumThreads = 1;
+  }
 #endif
-          IP->printInst(&Inst, outs(), "");
+
+  if (NumThreads <= 1 && !UseCache) {
 #ifdef NDEBUG
-          if (++NumProcessed % 10000 == 0) {
-            outs() << ".";
-          }
+    uint64_t NumProcessed = 0;
+    outs() << "Binary translation in progress...";
 #endif
+    for (const TranslationItem &Item : Items) {
 #ifndef NDEBUG
-          outs() << "\n";
+      outs() << '\n' << Item.Name << ":\n";
+#endif
+#ifdef NDEBUG
+      TranslateFunction(*IP, *DisAsm, Item, &NumProcessed);
+#else
+      TranslateFunction(*IP, *DisAsm, Item, nullptr);
 #endif
-        } else {
-          errs() << ToolName << ": warning: invalid instruction encoding\n";
-          DumpBytes(StringRef(BytesStr.data() + Index, Size));
-          exit(1);
-          if (Size == 0)
-            Size = 1; // skip illegible bytes
-        }
-      }
-      IP->FinishFunction();
     }
+    IP->FinishModule();
+#ifdef NDEBUG
+    outs() << "\n";
+#endif
+    OptimizeAndWriteBitcode(&*IP, false);
+    return;
   }
-  IP->FinishModule();
+
 #ifdef NDEBUG
-  outs() << "\n";
+  outs() << "Binary translation in progress on " << NumThreads
+         << " threads...\n";
 #endif
-  OptimizeAndWriteBitcode(&*IP);
+  // Every item is translated into a module of its own context, written out
+  // as bitcode and then linked back in item order, so the output does not
+  // depend on which thread got which item. Items found in the cache are
+  // not translated at all.
+  // Each thread also runs the per-function pipeline over the modules it
+  // built, except under -time-passes: pass timers are shared by all threads.
+  bool OptimizeInWorkers =
+      (Optimize || OptLevel > 0) && !TimePassesIsEnabled;
+  if (OptimizeInWorkers)
+    outs() << "Running verification and basic optimization pipeline on "
+           << "each function...\n";
+  IP->CollectCodePointers();
+  std::vector<uint64_t> FunctionAddrs;
+  for (const TranslationItem &Item : Items)
+    FunctionAddrs.push_back(Item.Start + Item.Offset);
+  std::sort(FunctionAddrs.begin(), FunctionAddrs.end());
+
+  std::unique_ptr<OiTranslationCache> Cache;
+  // Code pointers by the function they point into, for the cache keys
+  std::vector<std::vector<std::pair<uint64_t, uint64_t>>> OwnedPtrs;
+  if (UseCache) {
+    Cache.reset(new OiTranslationCache(CacheDir));
+    OwnedPtrs.resize(FunctionAddrs.size());
+    for (const auto &Ptr : IP->GetCodePtrRelocs()) {
+      auto F = std::upper_bound(FunctionAddrs.begin(), FunctionAddrs.end(),
+                                Ptr.second);
+      if (F != FunctionAddrs.begin())
+        OwnedPtrs[F - FunctionAddrs.begin() - 1].push_back(Ptr);
+    }
+  }
+
+  std::vector<TranslationResult> Results(Items.size());
+  std::atomic<unsigned> NextItem(0);
+  auto Worker = [&]() {
+    // MCContext is not thread-safe, so each thread disassembles on its own
+    MCContext WorkerCtx(AsmInfo.get(), MRI.get(), MOFI.get());
+    std::unique_ptr<const MCDisassembler> WorkerDisAsm(
+        TheTarget->createMCDisassembler(*STI, WorkerCtx));
+    for (unsigned I = NextItem++; I < Items.size(); I = NextItem++) {
+      TranslationResult &R = Results[I];
+      std::string Key;
+      if (Cache) {
+        uint64_t Addr = Items[I].Start + Items[I].Offset;
+        auto F = std::lower_bound(FunctionAddrs.begin(), FunctionAddrs.end(),
+                                  Addr);
+        uint64_t Next = F + 1 == FunctionAddrs.end() ? ~0ULL : *(F + 1);
+        Key = TranslationKey(*IP, Items[I], Next,
+                             OwnedPtrs[F - FunctionAddrs.begin()],
+                             OptimizeInWorkers);
+        if (Cache->lookup(Key, IP->GetShadowImage(), R))
+          continue;
+      }
+
+      LLVMContext Ctx;
+      OiInstTranslate WIP(*AsmInfo, *MII, *MRI, *IP, Ctx, FunctionAddrs);
+      TranslateFunction(WIP, *WorkerDisAsm, Items[I], nullptr);
+      WIP.FinishModule();
+      WIP.GetIndirectJumpStats(R.NumJumpsOK, R.NumJumpsWarning,
+                               R.NumIndirectCalls);
+      R.ImageReads = WIP.GetImageReads();
+      std::unique_ptr<Module> M(WIP.takeModule());
+      if (OptimizeInWorkers)
+        OptimizeFunctions(M.get());
+      raw_string_ostream OS(R.Bitcode);
+      WriteBitcodeToFile(M.get(), OS);
+      OS.flush();
+      if (Cache)
+        Cache->store(Key, R);
+    }
+  };
+  std::vector<std::thread> Threads;
+  for (unsigned I = 0; I < NumThreads; ++I)
+    Threads.emplace_back(Worker);
+  for (std::thread &T : Threads)
+    T.join();
+  if (Cache)
+    printf("INFO: Translation cache: %u hits, %u misses.\n",
+           Cache->getHits(), Cache->getMisses());
+
+  Linker L(IP->getModule());
+  uint32_t NumJumpsOK = 0, NumJumpsWarning = 0, NumIndirectCalls = 0;
+  for (unsigned I = 0, E = Items.size(); I != E; ++I) {
+    TranslationResult &R = Results[I];
+    ErrorOr<Module *> M = parseBitcodeFile(
+        MemoryBufferRef(R.Bitcode, Items[I].Name),
+        IP->getModule()->getContext());
+    if (std::error_code EC = M.getError())
+      report_fatal_error("Cannot read back the translation of " +
+                         Items[I].Name + ": " + EC.message());
+    std::unique_ptr<Module> Owner(M.get());
+    if (L.linkInModule(Owner.get()))
+      report_fatal_error("Cannot link the translation of " + Items[I].Name);
+    std::string().swap(R.Bitcode);
+    NumJumpsOK += R.NumJumpsOK;
+    NumJumpsWarning += R.NumJumpsWarning;
+    NumIndirectCalls += R.NumIndirectCalls;
+  }
+  IP->FinishLinkedModule(NumJumpsOK, NumJumpsWarning, NumIndirectCalls);
+  OptimizeAndWriteBitcode(&*IP, OptimizeInWorkers);
 }
 
 static void DumpObject(const ObjectFile *o) {
@@ -488,6 +950,11 @@ int main(int argc, char **argv) {
 
   cl::ParseCommandLineOptions(argc, argv,
                               "Open-ISA Static Binary Translator\n");
+  if (OptLevel > 3) {
+    errs() << argv[0] << ": invalid optimization level -O" << OptLevel
+           << "\n";
+    return 1;
+  }
   TripleName = Triple::normalize(TripleName);
 
   ToolName = argv[0];